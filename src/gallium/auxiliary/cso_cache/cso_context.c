@@ -68,6 +68,7 @@ struct cso_context {
    struct u_vbuf *vbuf;
    struct u_vbuf *vbuf_current;
    bool always_use_vbuf;
+   bool always_bind;
 
    boolean has_geometry_shader;
    boolean has_tessellation;
@@ -127,6 +128,24 @@ struct pipe_context *cso_get_pipe_context(struct cso_context *cso)
    return cso->pipe;
 }
 
+/**
+ * Bind states even if they are already bound.
+ *
+ * This is needed around calls recorded with threaded_context_begin_recording
+ * and replayed with threaded_context_replay, because replays change the
+ * bound states behind the back of the cso context. Return false if that
+ * can't work because of u_vbuf, which also skips redundant states.
+ */
+bool
+cso_set_always_bind(struct cso_context *cso, bool enable)
+{
+   if (cso->vbuf)
+      return false;
+
+   cso->always_bind = enable;
+   return true;
+}
+
 static inline boolean delete_cso(struct cso_context *ctx,
                                  void *state, enum cso_cache_type type)
 {
@@ -460,7 +479,7 @@ enum pipe_error cso_set_blend(struct cso_context *ctx,
       handle = ((struct cso_blend *)cso_hash_iter_data(iter))->data;
    }
 
-   if (ctx->blend != handle) {
+   if (ctx->blend != handle || ctx->always_bind) {
       ctx->blend = handle;
       ctx->pipe->bind_blend_state(ctx->pipe, handle);
    }
@@ -477,7 +496,7 @@ cso_save_blend(struct cso_context *ctx)
 static void
 cso_restore_blend(struct cso_context *ctx)
 {
-   if (ctx->blend != ctx->blend_saved) {
+   if (ctx->blend != ctx->blend_saved || ctx->always_bind) {
       ctx->blend = ctx->blend_saved;
       ctx->pipe->bind_blend_state(ctx->pipe, ctx->blend_saved);
    }
@@ -522,7 +541,7 @@ cso_set_depth_stencil_alpha(struct cso_context *ctx,
                 cso_hash_iter_data(iter))->data;
    }
 
-   if (ctx->depth_stencil != handle) {
+   if (ctx->depth_stencil != handle || ctx->always_bind) {
       ctx->depth_stencil = handle;
       ctx->pipe->bind_depth_stencil_alpha_state(ctx->pipe, handle);
    }
@@ -539,7 +558,7 @@ cso_save_depth_stencil_alpha(struct cso_context *ctx)
 static void
 cso_restore_depth_stencil_alpha(struct cso_context *ctx)
 {
-   if (ctx->depth_stencil != ctx->depth_stencil_saved) {
+   if (ctx->depth_stencil != ctx->depth_stencil_saved || ctx->always_bind) {
       ctx->depth_stencil = ctx->depth_stencil_saved;
       ctx->pipe->bind_depth_stencil_alpha_state(ctx->pipe,
                                                 ctx->depth_stencil_saved);
@@ -585,7 +604,7 @@ enum pipe_error cso_set_rasterizer(struct cso_context *ctx,
       handle = ((struct cso_rasterizer *)cso_hash_iter_data(iter))->data;
    }
 
-   if (ctx->rasterizer != handle) {
+   if (ctx->rasterizer != handle || ctx->always_bind) {
       ctx->rasterizer = handle;
       ctx->flatshade_first = templ->flatshade_first;
       if (ctx->vbuf)
@@ -606,7 +625,7 @@ cso_save_rasterizer(struct cso_context *ctx)
 static void
 cso_restore_rasterizer(struct cso_context *ctx)
 {
-   if (ctx->rasterizer != ctx->rasterizer_saved) {
+   if (ctx->rasterizer != ctx->rasterizer_saved || ctx->always_bind) {
       ctx->rasterizer = ctx->rasterizer_saved;
       ctx->flatshade_first = ctx->flatshade_first_saved;
       if (ctx->vbuf)
@@ -619,7 +638,7 @@ cso_restore_rasterizer(struct cso_context *ctx)
 
 void cso_set_fragment_shader_handle(struct cso_context *ctx, void *handle )
 {
-   if (ctx->fragment_shader != handle) {
+   if (ctx->fragment_shader != handle || ctx->always_bind) {
       ctx->fragment_shader = handle;
       ctx->pipe->bind_fs_state(ctx->pipe, handle);
    }
@@ -635,7 +654,7 @@ cso_save_fragment_shader(struct cso_context *ctx)
 static void
 cso_restore_fragment_shader(struct cso_context *ctx)
 {
-   if (ctx->fragment_shader_saved != ctx->fragment_shader) {
+   if (ctx->fragment_shader_saved != ctx->fragment_shader || ctx->always_bind) {
       ctx->pipe->bind_fs_state(ctx->pipe, ctx->fragment_shader_saved);
       ctx->fragment_shader = ctx->fragment_shader_saved;
    }
@@ -645,7 +664,7 @@ cso_restore_fragment_shader(struct cso_context *ctx)
 
 void cso_set_vertex_shader_handle(struct cso_context *ctx, void *handle)
 {
-   if (ctx->vertex_shader != handle) {
+   if (ctx->vertex_shader != handle || ctx->always_bind) {
       ctx->vertex_shader = handle;
       ctx->pipe->bind_vs_state(ctx->pipe, handle);
    }
@@ -661,7 +680,7 @@ cso_save_vertex_shader(struct cso_context *ctx)
 static void
 cso_restore_vertex_shader(struct cso_context *ctx)
 {
-   if (ctx->vertex_shader_saved != ctx->vertex_shader) {
+   if (ctx->vertex_shader_saved != ctx->vertex_shader || ctx->always_bind) {
       ctx->pipe->bind_vs_state(ctx->pipe, ctx->vertex_shader_saved);
       ctx->vertex_shader = ctx->vertex_shader_saved;
    }
@@ -672,7 +691,7 @@ cso_restore_vertex_shader(struct cso_context *ctx)
 void cso_set_framebuffer(struct cso_context *ctx,
                          const struct pipe_framebuffer_state *fb)
 {
-   if (memcmp(&ctx->fb, fb, sizeof(*fb)) != 0) {
+   if (memcmp(&ctx->fb, fb, sizeof(*fb)) != 0 || ctx->always_bind) {
       util_copy_framebuffer_state(&ctx->fb, fb);
       ctx->pipe->set_framebuffer_state(ctx->pipe, fb);
    }
@@ -687,7 +706,8 @@ cso_save_framebuffer(struct cso_context *ctx)
 static void
 cso_restore_framebuffer(struct cso_context *ctx)
 {
-   if (memcmp(&ctx->fb, &ctx->fb_saved, sizeof(ctx->fb))) {
+   if (memcmp(&ctx->fb, &ctx->fb_saved, sizeof(ctx->fb)) ||
+       ctx->always_bind) {
       util_copy_framebuffer_state(&ctx->fb, &ctx->fb_saved);
       ctx->pipe->set_framebuffer_state(ctx->pipe, &ctx->fb);
       util_unreference_framebuffer_state(&ctx->fb_saved);
@@ -698,7 +718,7 @@ cso_restore_framebuffer(struct cso_context *ctx)
 void cso_set_viewport(struct cso_context *ctx,
                       const struct pipe_viewport_state *vp)
 {
-   if (memcmp(&ctx->vp, vp, sizeof(*vp))) {
+   if (memcmp(&ctx->vp, vp, sizeof(*vp)) || ctx->always_bind) {
       ctx->vp = *vp;
       ctx->pipe->set_viewport_states(ctx->pipe, 0, 1, vp);
    }
@@ -736,7 +756,7 @@ cso_save_viewport(struct cso_context *ctx)
 static void
 cso_restore_viewport(struct cso_context *ctx)
 {
-   if (memcmp(&ctx->vp, &ctx->vp_saved, sizeof(ctx->vp))) {
+   if (memcmp(&ctx->vp, &ctx->vp_saved, sizeof(ctx->vp)) || ctx->always_bind) {
       ctx->vp = ctx->vp_saved;
       ctx->pipe->set_viewport_states(ctx->pipe, 0, 1, &ctx->vp);
    }
@@ -744,7 +764,7 @@ cso_restore_viewport(struct cso_context *ctx)
 
 void cso_set_sample_mask(struct cso_context *ctx, unsigned sample_mask)
 {
-   if (ctx->sample_mask != sample_mask) {
+   if (ctx->sample_mask != sample_mask || ctx->always_bind) {
       ctx->sample_mask = sample_mask;
       ctx->pipe->set_sample_mask(ctx->pipe, sample_mask);
    }
@@ -764,7 +784,8 @@ cso_restore_sample_mask(struct cso_context *ctx)
 
 void cso_set_min_samples(struct cso_context *ctx, unsigned min_samples)
 {
-   if (ctx->min_samples != min_samples && ctx->pipe->set_min_samples) {
+   if ((ctx->min_samples != min_samples || ctx->always_bind) &&
+       ctx->pipe->set_min_samples) {
       ctx->min_samples = min_samples;
       ctx->pipe->set_min_samples(ctx->pipe, min_samples);
    }
@@ -785,7 +806,8 @@ cso_restore_min_samples(struct cso_context *ctx)
 void cso_set_stencil_ref(struct cso_context *ctx,
                          const struct pipe_stencil_ref sr)
 {
-   if (memcmp(&ctx->stencil_ref, &sr, sizeof(ctx->stencil_ref))) {
+   if (memcmp(&ctx->stencil_ref, &sr, sizeof(ctx->stencil_ref)) ||
+       ctx->always_bind) {
       ctx->stencil_ref = sr;
       ctx->pipe->set_stencil_ref(ctx->pipe, sr);
    }
@@ -802,7 +824,7 @@ static void
 cso_restore_stencil_ref(struct cso_context *ctx)
 {
    if (memcmp(&ctx->stencil_ref, &ctx->stencil_ref_saved,
-              sizeof(ctx->stencil_ref))) {
+              sizeof(ctx->stencil_ref)) || ctx->always_bind) {
       ctx->stencil_ref = ctx->stencil_ref_saved;
       ctx->pipe->set_stencil_ref(ctx->pipe, ctx->stencil_ref);
    }
@@ -817,7 +839,7 @@ void cso_set_render_condition(struct cso_context *ctx,
 
    if (ctx->render_condition != query ||
        ctx->render_condition_mode != mode ||
-       ctx->render_condition_cond != condition) {
+       ctx->render_condition_cond != condition || ctx->always_bind) {
       pipe->render_condition(pipe, query, condition, mode);
       ctx->render_condition = query;
       ctx->render_condition_cond = condition;
@@ -845,7 +867,8 @@ void cso_set_geometry_shader_handle(struct cso_context *ctx, void *handle)
 {
    assert(ctx->has_geometry_shader || !handle);
 
-   if (ctx->has_geometry_shader && ctx->geometry_shader != handle) {
+   if (ctx->has_geometry_shader &&
+       (ctx->geometry_shader != handle || ctx->always_bind)) {
       ctx->geometry_shader = handle;
       ctx->pipe->bind_gs_state(ctx->pipe, handle);
    }
@@ -869,7 +892,7 @@ cso_restore_geometry_shader(struct cso_context *ctx)
       return;
    }
 
-   if (ctx->geometry_shader_saved != ctx->geometry_shader) {
+   if (ctx->geometry_shader_saved != ctx->geometry_shader || ctx->always_bind) {
       ctx->pipe->bind_gs_state(ctx->pipe, ctx->geometry_shader_saved);
       ctx->geometry_shader = ctx->geometry_shader_saved;
    }
@@ -880,7 +903,8 @@ void cso_set_tessctrl_shader_handle(struct cso_context *ctx, void *handle)
 {
    assert(ctx->has_tessellation || !handle);
 
-   if (ctx->has_tessellation && ctx->tessctrl_shader != handle) {
+   if (ctx->has_tessellation &&
+       (ctx->tessctrl_shader != handle || ctx->always_bind)) {
       ctx->tessctrl_shader = handle;
       ctx->pipe->bind_tcs_state(ctx->pipe, handle);
    }
@@ -904,7 +928,7 @@ cso_restore_tessctrl_shader(struct cso_context *ctx)
       return;
    }
 
-   if (ctx->tessctrl_shader_saved != ctx->tessctrl_shader) {
+   if (ctx->tessctrl_shader_saved != ctx->tessctrl_shader || ctx->always_bind) {
       ctx->pipe->bind_tcs_state(ctx->pipe, ctx->tessctrl_shader_saved);
       ctx->tessctrl_shader = ctx->tessctrl_shader_saved;
    }
@@ -915,7 +939,8 @@ void cso_set_tesseval_shader_handle(struct cso_context *ctx, void *handle)
 {
    assert(ctx->has_tessellation || !handle);
 
-   if (ctx->has_tessellation && ctx->tesseval_shader != handle) {
+   if (ctx->has_tessellation &&
+       (ctx->tesseval_shader != handle || ctx->always_bind)) {
       ctx->tesseval_shader = handle;
       ctx->pipe->bind_tes_state(ctx->pipe, handle);
    }
@@ -939,7 +964,7 @@ cso_restore_tesseval_shader(struct cso_context *ctx)
       return;
    }
 
-   if (ctx->tesseval_shader_saved != ctx->tesseval_shader) {
+   if (ctx->tesseval_shader_saved != ctx->tesseval_shader || ctx->always_bind) {
       ctx->pipe->bind_tes_state(ctx->pipe, ctx->tesseval_shader_saved);
       ctx->tesseval_shader = ctx->tesseval_shader_saved;
    }
@@ -950,7 +975,8 @@ void cso_set_compute_shader_handle(struct cso_context *ctx, void *handle)
 {
    assert(ctx->has_compute_shader || !handle);
 
-   if (ctx->has_compute_shader && ctx->compute_shader != handle) {
+   if (ctx->has_compute_shader &&
+       (ctx->compute_shader != handle || ctx->always_bind)) {
       ctx->compute_shader = handle;
       ctx->pipe->bind_compute_state(ctx->pipe, handle);
    }
@@ -974,7 +1000,7 @@ cso_restore_compute_shader(struct cso_context *ctx)
       return;
    }
 
-   if (ctx->compute_shader_saved != ctx->compute_shader) {
+   if (ctx->compute_shader_saved != ctx->compute_shader || ctx->always_bind) {
       ctx->pipe->bind_compute_state(ctx->pipe, ctx->compute_shader_saved);
       ctx->compute_shader = ctx->compute_shader_saved;
    }
@@ -1062,7 +1088,7 @@ cso_set_vertex_elements_direct(struct cso_context *ctx,
       handle = ((struct cso_velements *)cso_hash_iter_data(iter))->data;
    }
 
-   if (ctx->velements != handle) {
+   if (ctx->velements != handle || ctx->always_bind) {
       ctx->velements = handle;
       ctx->pipe->bind_vertex_elements_state(ctx->pipe, handle);
    }
@@ -1107,7 +1133,7 @@ cso_restore_vertex_elements(struct cso_context *ctx)
       return;
    }
 
-   if (ctx->velements != ctx->velements_saved) {
+   if (ctx->velements != ctx->velements_saved || ctx->always_bind) {
       ctx->velements = ctx->velements_saved;
       ctx->pipe->bind_vertex_elements_state(ctx->pipe, ctx->velements_saved);
    }
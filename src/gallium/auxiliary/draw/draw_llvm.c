@@ -54,6 +54,7 @@
 #include "gallivm/lp_bld_misc.h"
 #include "tgsi/tgsi_exec.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
 
 #include "util/u_math.h"
 #include "util/u_pointer.h"
@@ -836,29 +837,45 @@ draw_llvm_destroy(struct draw_llvm *llvm)
    FREE(llvm);
 }
 
-static void
-draw_get_ir_cache_key(struct nir_shader *nir,
+/**
+ * Compute the disk cache key of a shader variant from the shader IR (NIR
+ * or TGSI tokens) and the variant key.
+ * \return false if the shader has no IR the key could be derived from.
+ */
+static bool
+draw_get_ir_cache_key(const struct pipe_shader_state *state,
                       const void *key, size_t key_size,
                       uint32_t val_32bit,
                       unsigned char ir_sha1_cache_key[20])
 {
    struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
+   struct mesa_sha1 ctx;
 
-   blob_init(&blob);
-   nir_serialize(&blob, nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
+   if (state->type == PIPE_SHADER_IR_TGSI) {
+      if (!state->tokens)
+         return false;
+   } else if (!state->ir.nir) {
+      return false;
+   }
 
-   struct mesa_sha1 ctx;
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, key, key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
+
+   if (state->type == PIPE_SHADER_IR_TGSI) {
+      _mesa_sha1_update(&ctx, state->tokens,
+                        tgsi_num_tokens(state->tokens) *
+                        sizeof(struct tgsi_token));
+   } else {
+      blob_init(&blob);
+      nir_serialize(&blob, state->ir.nir, true);
+      _mesa_sha1_update(&ctx, blob.data, blob.size);
+      blob_finish(&blob);
+   }
+
    _mesa_sha1_update(&ctx, &val_32bit, 4);
    _mesa_sha1_final(&ctx, ir_sha1_cache_key);
 
-   blob_finish(&blob);
+   return true;
 }
 
 /**
@@ -890,13 +907,12 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    snprintf(module_name, sizeof(module_name), "draw_llvm_vs_variant%u",
             variant->shader->variants_cached);
 
-   if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
-                            key,
-                            shader->variant_key_size,
-                            num_inputs,
-                            ir_sha1_cache_key);
-
+   if (llvm->draw->disk_cache_cookie &&
+       draw_get_ir_cache_key(&shader->base.state,
+                             key,
+                             shader->variant_key_size,
+                             num_inputs,
+                             ir_sha1_cache_key)) {
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
                                          ir_sha1_cache_key);
@@ -2953,13 +2969,12 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
-   if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
-                            key,
-                            shader->variant_key_size,
-                            num_outputs,
-                            ir_sha1_cache_key);
-
+   if (llvm->draw->disk_cache_cookie &&
+       draw_get_ir_cache_key(&shader->base.state,
+                             key,
+                             shader->variant_key_size,
+                             num_outputs,
+                             ir_sha1_cache_key)) {
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
                                          ir_sha1_cache_key);
@@ -3615,13 +3630,12 @@ draw_tcs_llvm_create_variant(struct draw_llvm *llvm,
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
-   if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
-                            key,
-                            shader->variant_key_size,
-                            num_outputs,
-                            ir_sha1_cache_key);
-
+   if (llvm->draw->disk_cache_cookie &&
+       draw_get_ir_cache_key(&shader->base.state,
+                             key,
+                             shader->variant_key_size,
+                             num_outputs,
+                             ir_sha1_cache_key)) {
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
                                          ir_sha1_cache_key);
@@ -4141,13 +4155,12 @@ draw_tes_llvm_create_variant(struct draw_llvm *llvm,
             variant->shader->variants_cached);
 
    memcpy(&variant->key, key, shader->variant_key_size);
-   if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
-                            key,
-                            shader->variant_key_size,
-                            num_outputs,
-                            ir_sha1_cache_key);
-
+   if (llvm->draw->disk_cache_cookie &&
+       draw_get_ir_cache_key(&shader->base.state,
+                             key,
+                             shader->variant_key_size,
+                             num_outputs,
+                             ir_sha1_cache_key)) {
       llvm->draw->disk_cache_find_shader(llvm->draw->disk_cache_cookie,
                                          &cached,
                                          ir_sha1_cache_key);
@@ -60,6 +60,9 @@ static const struct debug_named_value lp_bld_perf_flags[] = {
    { "no_quad_lod", GALLIVM_PERF_NO_QUAD_LOD, "disable quad_lod optimization" },
    { "no_aos_sampling", GALLIVM_PERF_NO_AOS_SAMPLING, "disable aos sampling optimization" },
    { "nopt",   GALLIVM_PERF_NO_OPT, "disable optimization passes to speed up shader compilation" },
+#ifdef GALLIVM_USE_ORCJIT
+   { "mcjit", GALLIVM_PERF_MCJIT, "use MCJIT instead of the ORC JIT" },
+#endif
    DEBUG_NAMED_VALUE_END
 };
 
@@ -102,6 +105,56 @@ enum LLVM_CodeGenOpt_Level {
 };
 
 
+/**
+ * Add the optimization passes, or only the ones needed for correct code
+ * when not optimizing.
+ */
+static void
+add_optimization_passes(LLVMPassManagerRef passmgr, boolean optimize)
+{
+   if (optimize) {
+      /*
+       * TODO: Evaluate passes some more - keeping in mind
+       * both quality of generated code and compile times.
+       */
+      /*
+       * NOTE: if you change this, don't forget to change the output
+       * with GALLIVM_DEBUG_DUMP_BC in gallivm_compile_module.
+       */
+      LLVMAddScalarReplAggregatesPass(passmgr);
+      LLVMAddEarlyCSEPass(passmgr);
+      LLVMAddCFGSimplificationPass(passmgr);
+      /*
+       * FIXME: LICM is potentially quite useful. However, for some
+       * rather crazy shaders the compile time can reach _hours_ per shader,
+       * due to licm implying lcssa (since llvm 3.5), which can take forever.
+       * Even for sane shaders, the cost of licm is rather high (and not just
+       * due to lcssa, licm itself too), though mostly only in cases when it
+       * can actually move things, so having to disable it is a pity.
+       * LLVMAddLICMPass(passmgr);
+       */
+      LLVMAddReassociatePass(passmgr);
+      LLVMAddPromoteMemoryToRegisterPass(passmgr);
+#if LLVM_VERSION_MAJOR <= 11
+      LLVMAddConstantPropagationPass(passmgr);
+#else
+      LLVMAddInstructionSimplifyPass(passmgr);
+#endif
+      LLVMAddInstructionCombiningPass(passmgr);
+      LLVMAddGVNPass(passmgr);
+   }
+   else {
+      /* We need at least this pass to prevent the backends to fail in
+       * unexpected ways.
+       */
+      LLVMAddPromoteMemoryToRegisterPass(passmgr);
+   }
+#if GALLIVM_HAVE_CORO
+   LLVMAddCoroCleanupPass(passmgr);
+#endif
+}
+
+
 /**
  * Create the LLVM (optimization) pass manager and install
  * relevant optimization passes.
@@ -144,46 +197,8 @@ create_pass_manager(struct gallivm_state *gallivm)
    LLVMAddCoroElidePass(gallivm->cgpassmgr);
 #endif
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
-      /*
-       * TODO: Evaluate passes some more - keeping in mind
-       * both quality of generated code and compile times.
-       */
-      /*
-       * NOTE: if you change this, don't forget to change the output
-       * with GALLIVM_DEBUG_DUMP_BC in gallivm_compile_module.
-       */
-      LLVMAddScalarReplAggregatesPass(gallivm->passmgr);
-      LLVMAddEarlyCSEPass(gallivm->passmgr);
-      LLVMAddCFGSimplificationPass(gallivm->passmgr);
-      /*
-       * FIXME: LICM is potentially quite useful. However, for some
-       * rather crazy shaders the compile time can reach _hours_ per shader,
-       * due to licm implying lcssa (since llvm 3.5), which can take forever.
-       * Even for sane shaders, the cost of licm is rather high (and not just
-       * due to lcssa, licm itself too), though mostly only in cases when it
-       * can actually move things, so having to disable it is a pity.
-       * LLVMAddLICMPass(gallivm->passmgr);
-       */
-      LLVMAddReassociatePass(gallivm->passmgr);
-      LLVMAddPromoteMemoryToRegisterPass(gallivm->passmgr);
-#if LLVM_VERSION_MAJOR <= 11
-      LLVMAddConstantPropagationPass(gallivm->passmgr);
-#else
-      LLVMAddInstructionSimplifyPass(gallivm->passmgr);
-#endif
-      LLVMAddInstructionCombiningPass(gallivm->passmgr);
-      LLVMAddGVNPass(gallivm->passmgr);
-   }
-   else {
-      /* We need at least this pass to prevent the backends to fail in
-       * unexpected ways.
-       */
-      LLVMAddPromoteMemoryToRegisterPass(gallivm->passmgr);
-   }
-#if GALLIVM_HAVE_CORO
-   LLVMAddCoroCleanupPass(gallivm->passmgr);
-#endif
+   add_optimization_passes(gallivm->passmgr,
+                           (gallivm_perf & GALLIVM_PERF_NO_OPT) == 0);
 
    return TRUE;
 }
@@ -209,7 +224,7 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    if (gallivm->engine) {
       /* This will already destroy any associated module */
       LLVMDisposeExecutionEngine(gallivm->engine);
-   } else if (gallivm->module) {
+   } else if (gallivm->module && !gallivm->compiled) {
       LLVMDisposeModule(gallivm->module);
    }
 
@@ -226,6 +241,14 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    if (gallivm->builder)
       LLVMDisposeBuilder(gallivm->builder);
 
+#ifdef GALLIVM_USE_ORCJIT
+   /* This frees the module and the context it owns, so it must come after
+    * everything else created in them.
+    */
+   if (gallivm->orc)
+      lp_orc_free_ir(gallivm->orc);
+#endif
+
    /* The LLVMContext should be owned by the parent of gallivm. */
 
    gallivm->engine = NULL;
@@ -248,6 +271,10 @@ gallivm_free_code(struct gallivm_state *gallivm)
 {
    assert(!gallivm->module);
    assert(!gallivm->engine);
+#ifdef GALLIVM_USE_ORCJIT
+   lp_orc_destroy(gallivm->orc);
+   gallivm->orc = NULL;
+#endif
    lp_free_generated_code(gallivm->code);
    gallivm->code = NULL;
    lp_free_memory_manager(gallivm->memorymgr);
@@ -326,6 +353,19 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
    if (!lp_build_init())
       return FALSE;
 
+#ifdef GALLIVM_USE_ORCJIT
+   /*
+    * The ORC JIT may compile the module on any thread, so the module gets a
+    * context of its own instead of the caller's.  If the JIT can't be set up
+    * fall back to MCJIT.
+    */
+   if (!(gallivm_perf & GALLIVM_PERF_MCJIT)) {
+      LLVMContextRef orc_context = lp_orc_create(&gallivm->orc, name, cache);
+      if (orc_context)
+         context = orc_context;
+   }
+#endif
+
    gallivm->context = context;
    gallivm->cache = cache;
    if (!gallivm->context)
@@ -353,9 +393,11 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
    if (!gallivm->builder)
       goto fail;
 
-   gallivm->memorymgr = lp_get_default_memory_manager();
-   if (!gallivm->memorymgr)
-      goto fail;
+   if (!gallivm->orc) {
+      gallivm->memorymgr = lp_get_default_memory_manager();
+      if (!gallivm->memorymgr)
+         goto fail;
+   }
 
    /* FIXME: MC-JIT only allows compiling one module at a time, and it must be
     * complete when MC-JIT is created. So defer the MC-JIT engine creation for
@@ -564,6 +606,27 @@ gallivm_verify_function(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Compile the module without optimizations, which trades code quality for
+ * compile time.  Only the passes needed for correct code are run.  With
+ * MCJIT the code generator keeps the level chosen for the engine.
+ */
+void
+gallivm_disable_optimizations(struct gallivm_state *gallivm)
+{
+   assert(!gallivm->compiled);
+
+   LLVMDisposePassManager(gallivm->passmgr);
+   gallivm->passmgr = LLVMCreateFunctionPassManagerForModule(gallivm->module);
+   add_optimization_passes(gallivm->passmgr, FALSE);
+
+#ifdef GALLIVM_USE_ORCJIT
+   if (gallivm->orc)
+      lp_set_module_unoptimized(gallivm->module);
+#endif
+}
+
+
 /**
  * Compile a module.
  * This does IR optimization on all functions in the module.
@@ -654,6 +717,31 @@ gallivm_compile_module(struct gallivm_state *gallivm)
     */
  skip_cached:
    LLVMSetDataLayout(gallivm->module, "");
+
+#ifdef GALLIVM_USE_ORCJIT
+   if (gallivm->orc) {
+      char *error = NULL;
+
+      /*
+       * The JIT owns the module from now on.  It stays valid for inspection
+       * until the first gallivm_jit_function() call generates the code.
+       */
+      if (lp_orc_add_module(gallivm->orc, gallivm->module, &error)) {
+         _debug_printf("%s\n", error);
+         free(error);
+         gallivm->module = NULL;
+         assert(0);
+      }
+
+      ++gallivm->compiled;
+
+      if (gallivm->debug_printf_hook)
+         gallivm_add_global_mapping(gallivm, gallivm->debug_printf_hook,
+                                    debug_printf);
+      return;
+   }
+#endif
+
    assert(!gallivm->engine);
    if (!init_gallivm_engine(gallivm)) {
       assert(0);
@@ -663,7 +751,8 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    ++gallivm->compiled;
 
    if (gallivm->debug_printf_hook)
-      LLVMAddGlobalMapping(gallivm->engine, gallivm->debug_printf_hook, debug_printf);
+      gallivm_add_global_mapping(gallivm, gallivm->debug_printf_hook,
+                                 debug_printf);
 
    if (gallivm_debug & GALLIVM_DEBUG_ASM) {
       LLVMValueRef llvm_func = LLVMGetFirstFunction(gallivm->module);
@@ -706,14 +795,29 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    void *code;
    func_pointer jit_func;
    int64_t time_begin = 0;
+   const char *func_name = "";
 
    assert(gallivm->compiled);
-   assert(gallivm->engine);
+   assert(gallivm->engine || gallivm->orc);
 
-   if (gallivm_debug & GALLIVM_DEBUG_PERF)
+   if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+#ifdef GALLIVM_USE_ORCJIT
+      /* The IR is gone once the first function has been generated */
+      if (gallivm->orc)
+         func_name = lp_orc_get_function_name(gallivm->orc, func);
+      else
+#endif
+         func_name = LLVMGetValueName(func);
       time_begin = os_time_get();
+   }
 
-   code = LLVMGetPointerToGlobal(gallivm->engine, func);
+#ifdef GALLIVM_USE_ORCJIT
+   if (gallivm->orc) {
+      code = lp_orc_get_function(gallivm->orc, func);
+      gallivm->module = NULL;
+   } else
+#endif
+      code = LLVMGetPointerToGlobal(gallivm->engine, func);
    assert(code);
    jit_func = pointer_to_func(code);
 
@@ -721,12 +825,34 @@ gallivm_jit_function(struct gallivm_state *gallivm,
       int64_t time_end = os_time_get();
       int time_msec = (int)(time_end - time_begin) / 1000;
       debug_printf("   jitting func %s took %d msec\n",
-                   LLVMGetValueName(func), time_msec);
+                   func_name, time_msec);
    }
 
    return jit_func;
 }
 
+
+/**
+ * Resolve a global declared in the module to the given address.
+ * Must be called after gallivm_compile_module().
+ */
+void
+gallivm_add_global_mapping(struct gallivm_state *gallivm,
+                           LLVMValueRef global, void *addr)
+{
+   assert(gallivm->compiled);
+
+#ifdef GALLIVM_USE_ORCJIT
+   if (gallivm->orc) {
+      lp_orc_add_global_mapping(gallivm->orc, global, addr);
+      return;
+   }
+#endif
+
+   assert(gallivm->engine);
+   LLVMAddGlobalMapping(gallivm->engine, global, addr);
+}
+
 unsigned gallivm_get_perf_flags(void)
 {
    return gallivm_perf;
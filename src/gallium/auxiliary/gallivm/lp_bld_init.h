@@ -53,6 +53,7 @@ struct gallivm_state
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
    struct lp_cached_code *cache;
+   struct lp_orc_state *orc;
    unsigned compiled;
    LLVMValueRef coro_malloc_hook;
    LLVMValueRef coro_free_hook;
@@ -78,6 +79,9 @@ void
 gallivm_verify_function(struct gallivm_state *gallivm,
                         LLVMValueRef func);
 
+void
+gallivm_disable_optimizations(struct gallivm_state *gallivm);
+
 void
 gallivm_compile_module(struct gallivm_state *gallivm);
 
@@ -85,6 +89,10 @@ func_pointer
 gallivm_jit_function(struct gallivm_state *gallivm,
                      LLVMValueRef func);
 
+void
+gallivm_add_global_mapping(struct gallivm_state *gallivm,
+                           LLVMValueRef global, void *addr);
+
 unsigned gallivm_get_perf_flags(void);
 
 #ifdef __cplusplus
@@ -64,6 +64,15 @@
 #include <llvm/Support/PrettyStackTrace.h>
 #include <llvm/ExecutionEngine/ObjectCache.h>
 #include <llvm/Support/TargetSelect.h>
+#ifdef GALLIVM_USE_ORCJIT
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#endif
 
 #if LLVM_VERSION_MAJOR < 11
 #include <llvm/IR/CallSite.h>
@@ -321,61 +330,15 @@ public:
 };
 
 /**
- * Same as LLVMCreateJITCompilerForModule, but:
- * - allows using MCJIT and enabling AVX feature where available.
- * - set target options
- *
- * See also:
- * - llvm/lib/ExecutionEngine/ExecutionEngineBindings.cpp
- * - llvm/tools/lli/lli.cpp
- * - http://markmail.org/message/ttkuhvgj4cxxy2on#query:+page:1+mid:aju2dggerju3ivd3+state:results
+ * Work out the -mattr and -mcpu options matching the host, as used by both
+ * the MCJIT and the ORC JIT backends.
  */
-extern "C"
-LLVMBool
-lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
-                                        lp_generated_code **OutCode,
-                                        struct lp_cached_code *cache_out,
-                                        LLVMModuleRef M,
-                                        LLVMMCJITMemoryManagerRef CMM,
-                                        unsigned OptLevel,
-                                        char **OutError)
+static void
+lp_get_host_target_options(llvm::SmallVectorImpl<std::string> &MAttrs,
+                           std::string &MCPU)
 {
    using namespace llvm;
 
-   std::string Error;
-   EngineBuilder builder(std::unique_ptr<Module>(unwrap(M)));
-
-   /**
-    * LLVM 3.1+ haven't more "extern unsigned llvm::StackAlignmentOverride" and
-    * friends for configuring code generation options, like stack alignment.
-    */
-   TargetOptions options;
-#if defined(PIPE_ARCH_X86) && LLVM_VERSION_MAJOR < 13
-   options.StackAlignmentOverride = 4;
-#endif
-
-   builder.setEngineKind(EngineKind::JIT)
-          .setErrorStr(&Error)
-          .setTargetOptions(options)
-          .setOptLevel((CodeGenOpt::Level)OptLevel);
-
-#ifdef _WIN32
-    /*
-     * MCJIT works on Windows, but currently only through ELF object format.
-     *
-     * XXX: We could use `LLVM_HOST_TRIPLE "-elf"` but LLVM_HOST_TRIPLE has
-     * different strings for MinGW/MSVC, so better play it safe and be
-     * explicit.
-     */
-#  ifdef _WIN64
-    LLVMSetTarget(M, "x86_64-pc-win32-elf");
-#  else
-    LLVMSetTarget(M, "i686-pc-win32-elf");
-#  endif
-#endif
-
-   llvm::SmallVector<std::string, 16> MAttrs;
-
 #if LLVM_VERSION_MAJOR >= 4 && (defined(PIPE_ARCH_X86) || defined(PIPE_ARCH_X86_64) || defined(PIPE_ARCH_ARM))
    /* llvm-3.3+ implements sys::getHostCPUFeatures for Arm
     * and llvm-3.7+ for x86, which allows us to enable/disable
@@ -470,8 +433,6 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
    MAttrs.push_back("+fp64");
 #endif
 
-   builder.setMAttrs(MAttrs);
-
    if (gallivm_debug & (GALLIVM_DEBUG_IR | GALLIVM_DEBUG_ASM | GALLIVM_DEBUG_DUMP_BC)) {
       int n = MAttrs.size();
       if (n > 0) {
@@ -482,7 +443,7 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
       }
    }
 
-   StringRef MCPU = llvm::sys::getHostCPUName();
+   StringRef CPU = llvm::sys::getHostCPUName();
    /*
     * The cpu bits are no longer set automatically, so need to set mcpu manually.
     * Note that the MAttrs set above will be sort of ignored (since we should
@@ -497,17 +458,6 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
     */
 
 #ifdef PIPE_ARCH_PPC_64
-   /*
-    * Large programs, e.g. gnome-shell and firefox, may tax the addressability
-    * of the Medium code model once dynamically generated JIT-compiled shader
-    * programs are linked in and relocated.  Yet the default code model as of
-    * LLVM 8 is Medium or even Small.
-    * The cost of changing from Medium to Large is negligible:
-    * - an additional 8-byte pointer stored immediately before the shader entrypoint;
-    * - change an add-immediate (addis) instruction to a load (ld).
-    */
-   builder.setCodeModel(CodeModel::Large);
-
 #if UTIL_ARCH_LITTLE_ENDIAN
    /*
     * Versions of LLVM prior to 4.0 lacked a table entry for "POWER8NVL",
@@ -518,8 +468,8 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
     * Piglit tests, e.g.
     * .../arb_gpu_shader_fp64/execution/conversion/frag-conversion-explicit-double-uint
     */
-   if (MCPU == "generic")
-      MCPU = "pwr8";
+   if (CPU == "generic")
+      CPU = "pwr8";
 #endif
 #endif
 
@@ -531,14 +481,90 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
        * mips CPU currently. So we override the MCPU to mips64r5 if MSA is
        * implemented, feedback to mips64r2 for all other ordinary mips64 cpu.
        */
-   if (MCPU == "generic")
-      MCPU = util_get_cpu_caps()->has_msa ? "mips64r5" : "mips64r2";
+   if (CPU == "generic")
+      CPU = util_get_cpu_caps()->has_msa ? "mips64r5" : "mips64r2";
 #endif
 
-   builder.setMCPU(MCPU);
+   MCPU = CPU.str();
    if (gallivm_debug & (GALLIVM_DEBUG_IR | GALLIVM_DEBUG_ASM | GALLIVM_DEBUG_DUMP_BC)) {
-      debug_printf("llc -mcpu option: %s\n", MCPU.str().c_str());
+      debug_printf("llc -mcpu option: %s\n", MCPU.c_str());
    }
+}
+
+/**
+ * Same as LLVMCreateJITCompilerForModule, but:
+ * - allows using MCJIT and enabling AVX feature where available.
+ * - set target options
+ *
+ * See also:
+ * - llvm/lib/ExecutionEngine/ExecutionEngineBindings.cpp
+ * - llvm/tools/lli/lli.cpp
+ * - http://markmail.org/message/ttkuhvgj4cxxy2on#query:+page:1+mid:aju2dggerju3ivd3+state:results
+ */
+extern "C"
+LLVMBool
+lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
+                                        lp_generated_code **OutCode,
+                                        struct lp_cached_code *cache_out,
+                                        LLVMModuleRef M,
+                                        LLVMMCJITMemoryManagerRef CMM,
+                                        unsigned OptLevel,
+                                        char **OutError)
+{
+   using namespace llvm;
+
+   std::string Error;
+   EngineBuilder builder(std::unique_ptr<Module>(unwrap(M)));
+
+   /**
+    * LLVM 3.1+ haven't more "extern unsigned llvm::StackAlignmentOverride" and
+    * friends for configuring code generation options, like stack alignment.
+    */
+   TargetOptions options;
+#if defined(PIPE_ARCH_X86) && LLVM_VERSION_MAJOR < 13
+   options.StackAlignmentOverride = 4;
+#endif
+
+   builder.setEngineKind(EngineKind::JIT)
+          .setErrorStr(&Error)
+          .setTargetOptions(options)
+          .setOptLevel((CodeGenOpt::Level)OptLevel);
+
+#ifdef _WIN32
+    /*
+     * MCJIT works on Windows, but currently only through ELF object format.
+     *
+     * XXX: We could use `LLVM_HOST_TRIPLE "-elf"` but LLVM_HOST_TRIPLE has
+     * different strings for MinGW/MSVC, so better play it safe and be
+     * explicit.
+     */
+#  ifdef _WIN64
+    LLVMSetTarget(M, "x86_64-pc-win32-elf");
+#  else
+    LLVMSetTarget(M, "i686-pc-win32-elf");
+#  endif
+#endif
+
+   llvm::SmallVector<std::string, 16> MAttrs;
+   std::string MCPU;
+
+   lp_get_host_target_options(MAttrs, MCPU);
+
+   builder.setMAttrs(MAttrs);
+   builder.setMCPU(MCPU);
+
+#ifdef PIPE_ARCH_PPC_64
+   /*
+    * Large programs, e.g. gnome-shell and firefox, may tax the addressability
+    * of the Medium code model once dynamically generated JIT-compiled shader
+    * programs are linked in and relocated.  Yet the default code model as of
+    * LLVM 8 is Medium or even Small.
+    * The cost of changing from Medium to Large is negligible:
+    * - an additional 8-byte pointer stored immediately before the shader entrypoint;
+    * - change an add-immediate (addis) instruction to a load (ld).
+    */
+   builder.setCodeModel(CodeModel::Large);
+#endif
 
    ShaderMemoryManager *MM = NULL;
    BaseMemoryManager* JMM = reinterpret_cast<BaseMemoryManager*>(CMM);
@@ -604,6 +630,379 @@ lp_free_objcache(void *objcache_ptr)
    delete objcache;
 }
 
+#ifdef GALLIVM_USE_ORCJIT
+
+/*
+ * ORC JIT backend.
+ *
+ * MCJIT needs a complete ExecutionEngine (target machine, memory manager,
+ * ...) for every module.  Here a single LLJIT instance is shared by the
+ * whole process instead.  Each gallivm_state gets its own LLVMContext,
+ * wrapped in a ThreadSafeContext so its module may be compiled on any
+ * thread, and its own JITDylib holding the generated code, which is what
+ * lp_orc_destroy() releases again.
+ *
+ * Adding a module does not compile anything yet; code generation happens on
+ * the first symbol lookup, on the looking up thread.  Lookups from different
+ * threads compile concurrently.
+ */
+
+namespace {
+
+/*
+ * Object cache shared by all modules of the JIT.  Objects are routed to and
+ * from the lp_cached_code of the gallivm_state owning the module, the same
+ * way LPObjectCache does for MCJIT.
+ */
+class LPOrcObjectCache : public llvm::ObjectCache {
+private:
+   std::mutex lock;
+   std::unordered_map<std::string, struct lp_cached_code *> caches;
+
+   struct lp_cached_code *find(const llvm::Module *M) {
+      auto it = caches.find(M->getModuleIdentifier());
+      return it == caches.end() ? NULL : it->second;
+   }
+
+public:
+   void setCache(const std::string &name, struct lp_cached_code *cache) {
+      std::lock_guard<std::mutex> guard(lock);
+      if (cache)
+         caches[name] = cache;
+      else
+         caches.erase(name);
+   }
+
+   void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) {
+      std::lock_guard<std::mutex> guard(lock);
+      struct lp_cached_code *cache = find(M);
+      if (!cache || cache->data_size)
+         return;
+      cache->data = malloc(Obj.getBufferSize());
+      if (cache->data) {
+         cache->data_size = Obj.getBufferSize();
+         memcpy(cache->data, Obj.getBufferStart(), cache->data_size);
+      }
+   }
+
+   virtual std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) {
+      std::lock_guard<std::mutex> guard(lock);
+      struct lp_cached_code *cache = find(M);
+      if (!cache || !cache->data_size)
+         return NULL;
+      return llvm::MemoryBuffer::getMemBufferCopy(
+         llvm::StringRef((const char *)cache->data, cache->data_size));
+   }
+};
+
+/*
+ * Modules marked by lp_set_module_unoptimized() are compiled without
+ * code generator optimizations, all others with the JIT's level.
+ */
+class LPOrcCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+private:
+   llvm::orc::ConcurrentIRCompiler optimized;
+   llvm::orc::ConcurrentIRCompiler unoptimized;
+
+   static llvm::orc::JITTargetMachineBuilder
+   withoutOptimization(llvm::orc::JITTargetMachineBuilder JTMB) {
+      JTMB.setCodeGenOptLevel(llvm::CodeGenOpt::None);
+      return JTMB;
+   }
+
+public:
+   LPOrcCompiler(llvm::orc::JITTargetMachineBuilder JTMB,
+                 llvm::ObjectCache *objcache)
+      : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(
+                      JTMB.getOptions())),
+        optimized(JTMB, objcache),
+        unoptimized(withoutOptimization(JTMB), objcache) {}
+
+   llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+   operator()(llvm::Module &M) override {
+      if (M.getModuleFlag("lp.unoptimized"))
+         return unoptimized(M);
+      return optimized(M);
+   }
+};
+
+struct LPOrcJIT {
+   std::unique_ptr<llvm::orc::LLJIT> lljit;
+   LPOrcObjectCache objcache;
+   std::atomic<unsigned> num_dylibs;
+};
+
+static LPOrcJIT *lp_orc_jit = NULL;
+static once_flag lp_orc_jit_once_flag = ONCE_FLAG_INIT;
+
+static void
+lp_orc_jit_init(void)
+{
+   using namespace llvm;
+   using namespace llvm::orc;
+
+   auto JTMB = JITTargetMachineBuilder::detectHost();
+   if (!JTMB) {
+      _debug_printf("gallivm: %s\n", toString(JTMB.takeError()).c_str());
+      return;
+   }
+
+   SmallVector<std::string, 16> MAttrs;
+   std::string MCPU;
+   lp_get_host_target_options(MAttrs, MCPU);
+
+   JTMB->setCPU(MCPU);
+   JTMB->addFeatures(std::vector<std::string>(MAttrs.begin(), MAttrs.end()));
+   JTMB->setCodeGenOptLevel(gallivm_perf & GALLIVM_PERF_NO_OPT ?
+                            CodeGenOpt::None : CodeGenOpt::Default);
+#ifdef PIPE_ARCH_PPC_64
+   /* See lp_build_create_jit_compiler_for_module() */
+   JTMB->setCodeModel(CodeModel::Large);
+#endif
+
+   LPOrcJIT *jit = new LPOrcJIT();
+   jit->num_dylibs = 0;
+
+   /*
+    * A target machine may only be used by one thread at a time, so use
+    * compilers that create one per module rather than the default one.
+    */
+   auto J = LLJITBuilder()
+      .setJITTargetMachineBuilder(std::move(*JTMB))
+      .setCompileFunctionCreator(
+         [jit](JITTargetMachineBuilder JTMB)
+            -> Expected<std::unique_ptr<IRCompileLayer::IRCompiler>> {
+            return std::make_unique<LPOrcCompiler>(std::move(JTMB),
+                                                   &jit->objcache);
+         })
+      .create();
+   if (!J) {
+      _debug_printf("gallivm: %s\n", toString(J.takeError()).c_str());
+      delete jit;
+      return;
+   }
+   jit->lljit = std::move(*J);
+
+   /* Resolve libc/libm calls emitted by LLVM against the process. */
+   auto Gen = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      jit->lljit->getDataLayout().getGlobalPrefix());
+   if (!Gen) {
+      _debug_printf("gallivm: %s\n", toString(Gen.takeError()).c_str());
+      delete jit;
+      return;
+   }
+   jit->lljit->getMainJITDylib().addGenerator(std::move(*Gen));
+
+   lp_orc_jit = jit;
+}
+
+} /* anonymous namespace */
+
+
+struct lp_orc_state {
+   llvm::orc::ThreadSafeContext context;
+   llvm::orc::JITDylib *dylib;
+   std::string name;
+   struct lp_cached_code *cache;
+
+   /* Module holding just the declarations when the code came from cache */
+   std::unique_ptr<llvm::Module> module;
+
+   /*
+    * Names of the module's functions.  Once the module has been handed over
+    * to the JIT the IR must not be touched anymore, since it may be getting
+    * compiled on another thread.
+    */
+   std::unordered_map<LLVMValueRef, std::string> functions;
+};
+
+
+/**
+ * Create the per-gallivm_state JIT state and return the LLVMContext the
+ * module must be built in.  Returns NULL if the ORC JIT is not usable.
+ */
+extern "C" LLVMContextRef
+lp_orc_create(struct lp_orc_state **out, const char *name,
+              struct lp_cached_code *cache)
+{
+   using namespace llvm;
+
+   call_once(&lp_orc_jit_once_flag, lp_orc_jit_init);
+   if (!lp_orc_jit)
+      return NULL;
+
+   lp_orc_state *orc = new lp_orc_state();
+
+   /* JITDylib names must be unique, module names are not */
+   orc->name = std::string(name ? name : "gallivm") + "." +
+               std::to_string(lp_orc_jit->num_dylibs++);
+
+   auto JD = lp_orc_jit->lljit->createJITDylib(orc->name);
+   if (!JD) {
+      _debug_printf("gallivm: %s\n", toString(JD.takeError()).c_str());
+      delete orc;
+      return NULL;
+   }
+   orc->dylib = &*JD;
+   orc->dylib->addToLinkOrder(lp_orc_jit->lljit->getMainJITDylib());
+
+   orc->context = orc::ThreadSafeContext(std::make_unique<LLVMContext>());
+
+   orc->cache = cache;
+   if (cache)
+      lp_orc_jit->objcache.setCache(orc->name, cache);
+
+   *out = orc;
+   return wrap(orc->context.getContext());
+}
+
+
+/**
+ * Hand the module over to the JIT.  Nothing is compiled until the first
+ * lp_orc_get_function() call.
+ */
+extern "C" LLVMBool
+lp_orc_add_module(struct lp_orc_state *orc, LLVMModuleRef M,
+                  char **OutError)
+{
+   using namespace llvm;
+
+   Module *module = unwrap(M);
+
+   for (Function &F : *module)
+      orc->functions[wrap(&F)] = F.getName().str();
+
+   /*
+    * Unnamed globals can't be referred to from outside the module anyway,
+    * but the JIT would try to export them as symbols.
+    */
+   for (GlobalValue &G : module->global_values()) {
+      if (!G.hasName() && !G.hasLocalLinkage())
+         G.setLinkage(GlobalValue::InternalLinkage);
+   }
+
+   Error err = Error::success();
+   if (orc->cache && orc->cache->data_size) {
+      /*
+       * The module only declares the functions, their code comes from the
+       * cached object.
+       */
+      orc->module.reset(module);
+      err = lp_orc_jit->lljit->addObjectFile(
+         *orc->dylib,
+         MemoryBuffer::getMemBufferCopy(
+            StringRef((const char *)orc->cache->data, orc->cache->data_size),
+            orc->name));
+   } else {
+      /* The object cache finds the lp_cached_code by module identifier */
+      module->setModuleIdentifier(orc->name);
+
+      err = lp_orc_jit->lljit->addIRModule(
+         *orc->dylib,
+         orc::ThreadSafeModule(std::unique_ptr<Module>(module), orc->context));
+   }
+   if (err) {
+      *OutError = strdup(toString(std::move(err)).c_str());
+      return 1;
+   }
+   return 0;
+}
+
+
+extern "C" void
+lp_orc_add_global_mapping(struct lp_orc_state *orc, LLVMValueRef global,
+                          void *addr)
+{
+   using namespace llvm;
+
+   auto it = orc->functions.find(global);
+   assert(it != orc->functions.end());
+   if (it == orc->functions.end())
+      return;
+
+   orc::SymbolMap symbols;
+   symbols[lp_orc_jit->lljit->mangleAndIntern(it->second)] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(addr),
+                         JITSymbolFlags::Exported | JITSymbolFlags::Callable);
+
+   Error err = orc->dylib->define(orc::absoluteSymbols(std::move(symbols)));
+   if (err)
+      _debug_printf("gallivm: %s\n", toString(std::move(err)).c_str());
+}
+
+
+extern "C" void *
+lp_orc_get_function(struct lp_orc_state *orc, LLVMValueRef func)
+{
+   using namespace llvm;
+
+   auto it = orc->functions.find(func);
+   if (it == orc->functions.end())
+      return NULL;
+
+   auto sym = lp_orc_jit->lljit->lookup(*orc->dylib, it->second);
+   if (!sym) {
+      _debug_printf("gallivm: %s\n", toString(sym.takeError()).c_str());
+      return NULL;
+   }
+#if LLVM_VERSION_MAJOR >= 15
+   return sym->toPtr<void *>();
+#else
+   return jitTargetAddressToPointer<void *>(sym->getAddress());
+#endif
+}
+
+
+/**
+ * Name of a function of the module, which unlike LLVMGetValueName() stays
+ * valid after LLJIT has compiled and freed the module.
+ */
+extern "C" const char *
+lp_orc_get_function_name(struct lp_orc_state *orc, LLVMValueRef func)
+{
+   auto it = orc->functions.find(func);
+   if (it == orc->functions.end())
+      return "";
+
+   return it->second.c_str();
+}
+
+
+/**
+ * Drop everything related to the IR, keeping the generated code.
+ */
+extern "C" void
+lp_orc_free_ir(struct lp_orc_state *orc)
+{
+   lp_orc_jit->objcache.setCache(orc->name, NULL);
+   orc->cache = NULL;
+   orc->functions.clear();
+   orc->module.reset();
+   orc->context = llvm::orc::ThreadSafeContext();
+}
+
+
+/**
+ * Free the generated code and the JIT state.
+ */
+extern "C" void
+lp_orc_destroy(struct lp_orc_state *orc)
+{
+   if (!orc)
+      return;
+
+   lp_orc_free_ir(orc);
+
+   llvm::Error err =
+      lp_orc_jit->lljit->getExecutionSession().removeJITDylib(*orc->dylib);
+   if (err)
+      _debug_printf("gallivm: %s\n", llvm::toString(std::move(err)).c_str());
+
+   delete orc;
+}
+
+#endif /* GALLIVM_USE_ORCJIT */
+
 extern "C" LLVMValueRef
 lp_get_called_value(LLVMValueRef call)
 {
@@ -616,6 +1015,17 @@ lp_is_function(LLVMValueRef v)
 	return LLVMGetValueKind(v) == LLVMFunctionValueKind;
 }
 
+/**
+ * Have the code generator skip its optimizations for the module.  Only
+ * supported with ORC, MCJIT picks the level when creating the engine.
+ */
+extern "C" void
+lp_set_module_unoptimized(LLVMModuleRef MRef)
+{
+   llvm::Module *M = llvm::unwrap(MRef);
+   M->addModuleFlag(llvm::Module::Override, "lp.unoptimized", 1);
+}
+
 extern "C" void
 lp_set_module_stack_alignment_override(LLVMModuleRef MRef, unsigned align)
 {
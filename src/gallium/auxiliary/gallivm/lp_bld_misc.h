@@ -92,8 +92,39 @@ lp_is_function(LLVMValueRef v);
 void
 lp_free_objcache(void *objcache);
 
+void
+lp_set_module_unoptimized(LLVMModuleRef M);
+
 void
 lp_set_module_stack_alignment_override(LLVMModuleRef M, unsigned align);
+
+#ifdef GALLIVM_USE_ORCJIT
+struct lp_orc_state;
+
+extern LLVMContextRef
+lp_orc_create(struct lp_orc_state **out, const char *name,
+              struct lp_cached_code *cache);
+
+extern LLVMBool
+lp_orc_add_module(struct lp_orc_state *orc, LLVMModuleRef M,
+                  char **OutError);
+
+extern void
+lp_orc_add_global_mapping(struct lp_orc_state *orc, LLVMValueRef global,
+                          void *addr);
+
+extern void *
+lp_orc_get_function(struct lp_orc_state *orc, LLVMValueRef func);
+
+extern const char *
+lp_orc_get_function_name(struct lp_orc_state *orc, LLVMValueRef func);
+
+extern void
+lp_orc_free_ir(struct lp_orc_state *orc);
+
+extern void
+lp_orc_destroy(struct lp_orc_state *orc);
+#endif
 #ifdef __cplusplus
 }
 #endif
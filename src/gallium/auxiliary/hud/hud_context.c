@@ -1272,6 +1272,33 @@ hud_parse_env_var(struct hud_context *hud, struct pipe_screen *screen,
       else if (strcmp(name, "main-thread-busy") == 0) {
          hud_thread_busy_install(pane, name, true);
       }
+      else if (strcmp(name, "tc-num-flush-syncs") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_FLUSH_SYNCS);
+      }
+      else if (strcmp(name, "tc-num-query-syncs") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_QUERY_SYNCS);
+      }
+      else if (strcmp(name, "tc-num-transfer-syncs") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_TRANSFER_SYNCS);
+      }
+      else if (strcmp(name, "tc-num-batches") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_BATCHES);
+      }
+      else if (strcmp(name, "tc-batch-fill") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_BATCH_FILL);
+         pane->type = PIPE_DRIVER_QUERY_TYPE_PERCENTAGE;
+      }
+      else if (strcmp(name, "tc-num-stalls") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_STALLS);
+      }
+      else if (strcmp(name, "tc-stall-time") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_STALL_TIME);
+         pane->type = PIPE_DRIVER_QUERY_TYPE_MICROSECONDS;
+      }
+      else if (strcmp(name, "tc-driver-idle-time") == 0) {
+         hud_tc_counter_install(pane, name, HUD_TC_COUNTER_DRIVER_IDLE_TIME);
+         pane->type = PIPE_DRIVER_QUERY_TYPE_MICROSECONDS;
+      }
 #ifdef HAVE_GALLIUM_EXTRA_HUD
       else if (sscanf(name, "nic-rx-%s", arg_name) == 1) {
          hud_nic_graph_install(pane, arg_name, NIC_DIRECTION_RX);
@@ -1568,6 +1595,16 @@ print_help(struct pipe_screen *screen)
    for (i = 0; i < num_cpus; i++)
       printf("    cpu%i\n", i);
 
+   /* Threaded context counters, zero if the driver doesn't use it. */
+   puts("    tc-num-flush-syncs");
+   puts("    tc-num-query-syncs");
+   puts("    tc-num-transfer-syncs");
+   puts("    tc-num-batches");
+   puts("    tc-batch-fill");
+   puts("    tc-num-stalls");
+   puts("    tc-stall-time");
+   puts("    tc-driver-idle-time");
+
    if (has_occlusion_query(screen))
       puts("    samples-passed");
    if (has_streamout(screen))
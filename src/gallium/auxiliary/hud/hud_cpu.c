@@ -33,6 +33,7 @@
 #include "os/os_thread.h"
 #include "util/u_memory.h"
 #include "util/u_queue.h"
+#include "util/u_threaded_context.h"
 #include <stdio.h>
 #include <inttypes.h>
 #ifdef PIPE_OS_WINDOWS
@@ -466,3 +467,98 @@ void hud_thread_counter_install(struct hud_pane *pane, const char *name,
    hud_pane_add_graph(pane, gr);
    hud_pane_set_max_value(pane, 100);
 }
+
+struct tc_counter_info {
+   enum hud_tc_counter counter;
+   uint64_t last_value;
+   uint64_t last_slot_limit_total;
+   int64_t last_time;
+};
+
+static uint64_t
+get_tc_counter(const struct tc_stats *stats, enum hud_tc_counter counter)
+{
+   switch (counter) {
+   case HUD_TC_COUNTER_FLUSH_SYNCS:
+      return stats->num_syncs_by_reason[TC_SYNC_FLUSH];
+   case HUD_TC_COUNTER_QUERY_SYNCS:
+      return stats->num_syncs_by_reason[TC_SYNC_QUERY];
+   case HUD_TC_COUNTER_TRANSFER_SYNCS:
+      return stats->num_syncs_by_reason[TC_SYNC_TRANSFER];
+   case HUD_TC_COUNTER_BATCHES:
+      return stats->num_batches;
+   case HUD_TC_COUNTER_BATCH_FILL:
+      return stats->num_offloaded_slots;
+   case HUD_TC_COUNTER_STALLS:
+      return stats->num_stalls;
+   case HUD_TC_COUNTER_STALL_TIME:
+      return stats->stall_time_ns / 1000;
+   case HUD_TC_COUNTER_DRIVER_IDLE_TIME:
+      return stats->driver_idle_time_ns / 1000;
+   default:
+      assert(0);
+      return 0;
+   }
+}
+
+static void
+query_tc_counter(struct hud_graph *gr, struct pipe_context *pipe)
+{
+   struct tc_counter_info *info = gr->query_data;
+   int64_t now = os_time_get_nano();
+   struct tc_stats stats;
+
+   /* Drivers without a threaded context show zeros. */
+   if (!threaded_context_get_stats(pipe, &stats))
+      memset(&stats, 0, sizeof(stats));
+
+   uint64_t current_value = get_tc_counter(&stats, info->counter);
+
+   if (info->last_time) {
+      if (info->last_time + gr->pane->period*1000 <= now) {
+         uint64_t value = current_value - info->last_value;
+
+         /* The percentage of the adaptive batch size limit that flushed
+          * batches used.
+          */
+         if (info->counter == HUD_TC_COUNTER_BATCH_FILL) {
+            uint64_t limit = stats.batch_slot_limit_total -
+                             info->last_slot_limit_total;
+            value = limit ? value * 100 / limit : 0;
+         }
+
+         hud_graph_add_value(gr, value);
+         info->last_value = current_value;
+         info->last_slot_limit_total = stats.batch_slot_limit_total;
+         info->last_time = now;
+      }
+   } else {
+      /* initialize */
+      info->last_value = current_value;
+      info->last_slot_limit_total = stats.batch_slot_limit_total;
+      info->last_time = now;
+   }
+}
+
+void hud_tc_counter_install(struct hud_pane *pane, const char *name,
+                            enum hud_tc_counter counter)
+{
+   struct hud_graph *gr = CALLOC_STRUCT(hud_graph);
+   if (!gr)
+      return;
+
+   strcpy(gr->name, name);
+
+   gr->query_data = CALLOC_STRUCT(tc_counter_info);
+   if (!gr->query_data) {
+      FREE(gr);
+      return;
+   }
+
+   ((struct tc_counter_info*)gr->query_data)->counter = counter;
+   gr->query_new_value = query_tc_counter;
+   gr->free_query_data = free_query_data;
+
+   hud_pane_add_graph(pane, gr);
+   hud_pane_set_max_value(pane, 100);
+}
@@ -40,6 +40,18 @@ enum hud_counter {
    HUD_COUNTER_SYNCS,
 };
 
+/* Counters of the threaded context, see tc_stats. */
+enum hud_tc_counter {
+   HUD_TC_COUNTER_FLUSH_SYNCS,
+   HUD_TC_COUNTER_QUERY_SYNCS,
+   HUD_TC_COUNTER_TRANSFER_SYNCS,
+   HUD_TC_COUNTER_BATCHES,
+   HUD_TC_COUNTER_BATCH_FILL,
+   HUD_TC_COUNTER_STALLS,
+   HUD_TC_COUNTER_STALL_TIME,
+   HUD_TC_COUNTER_DRIVER_IDLE_TIME,
+};
+
 struct hud_context {
    int refcount;
    bool simple;
@@ -164,6 +176,8 @@ void hud_cpu_graph_install(struct hud_pane *pane, unsigned cpu_index);
 void hud_thread_busy_install(struct hud_pane *pane, const char *name, bool main);
 void hud_thread_counter_install(struct hud_pane *pane, const char *name,
                                 enum hud_counter counter);
+void hud_tc_counter_install(struct hud_pane *pane, const char *name,
+                            enum hud_tc_counter counter);
 void hud_pipe_query_install(struct hud_batch_query_context **pbq,
                             struct hud_pane *pane,
                             const char *name,
@@ -144,6 +144,9 @@ pp_free_fbos(struct pp_queue_t *ppq)
 
    unsigned int i;
 
+   /* The recording uses the temp buffers. */
+   pp_free_recording(ppq);
+
    if (!ppq->fbos_init)
       return;
 
@@ -87,11 +87,20 @@ struct pp_queue_t
    struct pp_program *p;
 
    bool fbos_init;
+
+   /* The filter passes recorded with the threaded context for these
+    * buffers, replayed by the following frames that use the same ones.
+    */
+   struct tc_recording *recording;
+   struct pipe_resource *recorded_in, *recorded_out, *recorded_depth;
+   bool unrecordable;           /* A filter can't be recorded. */
 };
 
 
 void pp_free_fbos(struct pp_queue_t *);
 
+void pp_free_recording(struct pp_queue_t *);
+
 void pp_debug(const char *, ...);
 
 struct pp_program *pp_init_prog(struct pp_queue_t *, struct pipe_context *pipe,
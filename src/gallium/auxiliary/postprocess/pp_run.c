@@ -31,6 +31,7 @@
 
 #include "frontend/api.h"
 #include "util/u_inlines.h"
+#include "util/u_threaded_context.h"
 #include "util/u_sampler.h"
 
 #include "tgsi/tgsi_parse.h"
@@ -75,19 +76,77 @@ pp_blit(struct pipe_context *pipe,
    pipe->blit(pipe, &blit);
 }
 
+/** Free the filter passes recorded by pp_run. */
+void
+pp_free_recording(struct pp_queue_t *ppq)
+{
+   tc_recording_destroy(ppq->recording);
+   ppq->recording = NULL;
+   pipe_resource_reference(&ppq->recorded_in, NULL);
+   pipe_resource_reference(&ppq->recorded_out, NULL);
+   pipe_resource_reference(&ppq->recorded_depth, NULL);
+}
+
+/** Run the filters in order, shuffling the temp buffers in between. */
+static void
+pp_run_filters(struct pp_queue_t *ppq, struct pipe_resource *in,
+               struct pipe_resource *out)
+{
+   unsigned int i;
+
+   switch (ppq->n_filters) {
+   case 0:
+      /* Failsafe, but never reached. */
+      break;
+   case 1:                     /* No temp buf */
+      ppq->pp_queue[0] (ppq, in, out, 0);
+      break;
+   case 2:                     /* One temp buf */
+
+      ppq->pp_queue[0] (ppq, in, ppq->tmp[0], 0);
+      ppq->pp_queue[1] (ppq, ppq->tmp[0], out, 1);
+
+      break;
+   default:                    /* Two temp bufs */
+      assert(ppq->tmp[1]);
+      ppq->pp_queue[0] (ppq, in, ppq->tmp[0], 0);
+
+      for (i = 1; i < (ppq->n_filters - 1); i++) {
+         if (i % 2 == 0)
+            ppq->pp_queue[i] (ppq, ppq->tmp[1], ppq->tmp[0], i);
+
+         else
+            ppq->pp_queue[i] (ppq, ppq->tmp[0], ppq->tmp[1], i);
+      }
+
+      if (i % 2 == 0)
+         ppq->pp_queue[i] (ppq, ppq->tmp[1], out, i);
+
+      else
+         ppq->pp_queue[i] (ppq, ppq->tmp[0], out, i);
+
+      break;
+   }
+}
+
 /**
 *	Main run function of the PP queue. Called on swapbuffers/flush.
 *
 *	Runs all requested filters in order and handles shuffling the temp
 *	buffers in between.
+*
+*	With a threaded context, the filter passes are recorded the first
+*	time and replayed by the following frames with the same buffers.
 */
 void
 pp_run(struct pp_queue_t *ppq, struct pipe_resource *in,
        struct pipe_resource *out, struct pipe_resource *indepth)
 {
    struct pipe_resource *refin = NULL, *refout = NULL;
-   unsigned int i;
+   struct pipe_resource *origin = in;
+   struct pipe_context *pipe = ppq->p->pipe;
    struct cso_context *cso = ppq->p->cso;
+   bool always_bind = false;
 
    if (ppq->n_filters == 0)
       return;
@@ -149,38 +208,40 @@ pp_run(struct pp_queue_t *ppq, struct pipe_resource *in,
    pipe_resource_reference(&refin, in);
    pipe_resource_reference(&refout, out);
 
-   switch (ppq->n_filters) {
-   case 0:
-      /* Failsafe, but never reached. */
-      break;
-   case 1:                     /* No temp buf */
-      ppq->pp_queue[0] (ppq, in, out, 0);
-      break;
-   case 2:                     /* One temp buf */
-
-      ppq->pp_queue[0] (ppq, in, ppq->tmp[0], 0);
-      ppq->pp_queue[1] (ppq, ppq->tmp[0], out, 1);
-
-      break;
-   default:                    /* Two temp bufs */
-      assert(ppq->tmp[1]);
-      ppq->pp_queue[0] (ppq, in, ppq->tmp[0], 0);
-
-      for (i = 1; i < (ppq->n_filters - 1); i++) {
-         if (i % 2 == 0)
-            ppq->pp_queue[i] (ppq, ppq->tmp[1], ppq->tmp[0], i);
-
-         else
-            ppq->pp_queue[i] (ppq, ppq->tmp[0], ppq->tmp[1], i);
+   if (ppq->recording &&
+       (ppq->recorded_in != origin || ppq->recorded_out != out ||
+        ppq->recorded_depth != indepth))
+      pp_free_recording(ppq);
+
+   /* The replay and the recorded passes change the bound states without
+    * cso knowing, so they must be bound regardless of what cso tracks.
+    */
+   if ((ppq->recording || !ppq->unrecordable) &&
+       cso_set_always_bind(cso, true))
+      always_bind = true;
+
+   if (!ppq->recording || !always_bind ||
+       !threaded_context_replay(pipe, ppq->recording, NULL)) {
+      /* Nothing to replay, or a CSO used by the filters was deleted. */
+      pp_free_recording(ppq);
+
+      if (always_bind && threaded_context_begin_recording(pipe)) {
+         pp_run_filters(ppq, in, out);
+
+         ppq->recording = threaded_context_end_recording(pipe);
+         if (ppq->recording) {
+            pipe_resource_reference(&ppq->recorded_in, origin);
+            pipe_resource_reference(&ppq->recorded_out, out);
+            pipe_resource_reference(&ppq->recorded_depth, indepth);
+         } else {
+            pp_debug("The filters can't be recorded.\n");
+            ppq->unrecordable = true;
+         }
+      } else {
+         /* Not a threaded context, or u_vbuf is used. */
+         ppq->unrecordable = true;
+         pp_run_filters(ppq, in, out);
       }
-
-      if (i % 2 == 0)
-         ppq->pp_queue[i] (ppq, ppq->tmp[1], out, i);
-
-      else
-         ppq->pp_queue[i] (ppq, ppq->tmp[0], out, i);
-
-      break;
    }
 
    /* restore state we changed */
@@ -199,6 +260,9 @@ pp_run(struct pp_queue_t *ppq, struct pipe_resource *in,
                                    ST_INVALIDATE_VERTEX_BUFFERS);
    }
 
+   if (always_bind)
+      cso_set_always_bind(cso, false);
+
    pipe_resource_reference(&ppq->depth, NULL);
    pipe_resource_reference(&refin, NULL);
    pipe_resource_reference(&refout, NULL);
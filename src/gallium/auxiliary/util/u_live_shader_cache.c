@@ -34,15 +34,64 @@
 #include "util/hash_table.h"
 #include "util/mesa-sha1.h"
 
+#define XXH_INLINE_ALL
+#include "util/xxhash.h"
+
+struct key_ctx {
+   bool xxhash;
+   struct mesa_sha1 sha1;
+   XXH64_state_t xxh64[2];
+};
+
+static void
+key_init(struct key_ctx *ctx, bool xxhash)
+{
+   ctx->xxhash = xxhash;
+
+   if (xxhash) {
+      XXH64_reset(&ctx->xxh64[0], 0);
+      XXH64_reset(&ctx->xxh64[1], 0x9e3779b97f4a7c15ull);
+   } else {
+      _mesa_sha1_init(&ctx->sha1);
+   }
+}
+
+static void
+key_update(struct key_ctx *ctx, const void *data, size_t size)
+{
+   if (ctx->xxhash) {
+      XXH64_update(&ctx->xxh64[0], data, size);
+      XXH64_update(&ctx->xxh64[1], data, size);
+   } else {
+      _mesa_sha1_update(&ctx->sha1, data, size);
+   }
+}
+
+static void
+key_final(struct key_ctx *ctx, unsigned char key[20])
+{
+   if (ctx->xxhash) {
+      uint64_t hash[2] = {
+         XXH64_digest(&ctx->xxh64[0]),
+         XXH64_digest(&ctx->xxh64[1]),
+      };
+
+      memcpy(key, hash, sizeof(hash));
+      memset(key + sizeof(hash), 0, 20 - sizeof(hash));
+   } else {
+      _mesa_sha1_final(&ctx->sha1, key);
+   }
+}
+
 static uint32_t key_hash(const void *key)
 {
-   /* Take the first dword of SHA1. */
+   /* Take the first dword of the key. */
    return *(uint32_t*)key;
 }
 
 static bool key_equals(const void *a, const void *b)
 {
-   /* Compare SHA1s. */
+   /* Compare keys. */
    return memcmp(a, b, 20) == 0;
 }
 
@@ -56,6 +105,7 @@ util_live_shader_cache_init(struct util_live_shader_cache *cache,
    cache->hashtable = _mesa_hash_table_create(NULL, key_hash, key_equals);
    cache->create_shader = create_shader;
    cache->destroy_shader = destroy_shader;
+   cache->xxhash_keys = false;
 }
 
 void
@@ -96,19 +146,19 @@ util_live_shader_cache_get(struct pipe_context *ctx,
       return NULL;
    }
 
-   /* Compute SHA1 of pipe_shader_state. */
-   struct mesa_sha1 sha1_ctx;
+   /* Compute the key of pipe_shader_state. */
+   struct key_ctx key_ctx;
    unsigned char sha1[20];
-   _mesa_sha1_init(&sha1_ctx);
-   _mesa_sha1_update(&sha1_ctx, ir_binary, ir_size);
+   key_init(&key_ctx, cache->xxhash_keys);
+   key_update(&key_ctx, ir_binary, ir_size);
    if ((stage == PIPE_SHADER_VERTEX ||
         stage == PIPE_SHADER_TESS_EVAL ||
         stage == PIPE_SHADER_GEOMETRY) &&
        state->stream_output.num_outputs) {
-      _mesa_sha1_update(&sha1_ctx, &state->stream_output,
-                        sizeof(state->stream_output));
+      key_update(&key_ctx, &state->stream_output,
+                 sizeof(state->stream_output));
    }
-   _mesa_sha1_final(&sha1_ctx, sha1);
+   key_final(&key_ctx, sha1);
 
    if (ir_binary == blob.data)
       blob_finish(&blob);
@@ -65,10 +65,17 @@ struct util_live_shader_cache {
    void (*destroy_shader)(struct pipe_context *, void *);
 
    unsigned hits, misses;
+
+   /* Identify shaders by a pair of 64-bit xxhashes rather than by a SHA-1,
+    * which is much faster to compute.  Only for drivers which don't use
+    * util_live_shader::sha1 as a key outside of the process.
+    */
+   bool xxhash_keys;
 };
 
 struct util_live_shader {
    struct pipe_reference reference;
+   /* SHA-1 or xxhash key, see util_live_shader_cache::xxhash_keys. */
    unsigned char sha1[20];
 };
 
@@ -30,6 +30,8 @@
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
 #include "util/u_upload_mgr.h"
+#include "util/u_dynarray.h"
+#include "util/os_time.h"
 #include "driver_trace/tr_context.h"
 #include "util/log.h"
 #include "compiler/shader_info.h"
@@ -77,6 +79,24 @@ tc_buffer_subdata(struct pipe_context *_pipe,
                   unsigned usage, unsigned offset,
                   unsigned size, const void *data);
 
+struct tc_recording {
+   struct threaded_context *tc;
+   struct list_head list; /* in threaded_context::recordings once ended */
+   struct util_dynarray slots; /* uint64_t, in the same format as batches */
+   struct util_dynarray csos; /* void *, the CSOs bound by the calls */
+   unsigned num_constant_buffers;
+   bool valid;
+};
+
+static void
+tc_record_batch(struct threaded_context *tc, struct tc_batch *batch);
+
+static void
+tc_forget_recorded_cso(struct threaded_context *tc, void *cso);
+
+static void
+tc_destroy(struct pipe_context *_pipe);
+
 static void
 tc_batch_check(UNUSED struct tc_batch *batch)
 {
@@ -239,6 +259,18 @@ tc_batch_execute(void *job, UNUSED void *gdata, int thread_index)
    batch->num_total_slots = 0;
 }
 
+/* Execute a batch in the driver thread. Syncs execute batches directly in
+ * the application thread, which doesn't end the driver thread's idle time.
+ */
+static void
+tc_batch_execute_queued(void *job, void *gdata, int thread_index)
+{
+   struct threaded_context *tc = ((struct tc_batch *)job)->tc;
+
+   tc_batch_execute(job, gdata, thread_index);
+   p_atomic_set(&tc->driver_idle_since, os_time_get_nano());
+}
+
 static void
 tc_begin_next_buffer_list(struct threaded_context *tc)
 {
@@ -256,6 +288,50 @@ tc_begin_next_buffer_list(struct threaded_context *tc)
    tc->add_all_compute_bindings_to_buffer_list = true;
 }
 
+/* Return how long the driver thread has been idle if it is, and add that to
+ * the counter.
+ */
+static int64_t
+tc_driver_idle_time(struct threaded_context *tc, int64_t now)
+{
+   int64_t idle = now - MAX2(p_atomic_read(&tc->driver_idle_since),
+                             tc->driver_idle_counted);
+
+   if (!util_queue_fence_is_signalled(&tc->batch_slots[tc->last].fence) ||
+       idle <= 0)
+      return 0;
+
+   p_atomic_add(&tc->driver_idle_time_ns, idle);
+   tc->driver_idle_counted = now;
+   return now - p_atomic_read(&tc->driver_idle_since);
+}
+
+/* Wait until the batch after "next" is free, which is when the queue has
+ * room for "next". If that happens, the driver thread is saturated and
+ * bigger batches lower its overhead.
+ */
+static void
+tc_wait_for_free_batch(struct threaded_context *tc)
+{
+   struct tc_batch *following =
+      &tc->batch_slots[(tc->next + 1) % TC_MAX_BATCHES];
+   int64_t now = os_time_get_nano();
+
+   if (!util_queue_fence_is_signalled(&following->fence)) {
+      util_queue_fence_wait(&following->fence);
+
+      p_atomic_inc(&tc->num_stalls);
+      p_atomic_add(&tc->stall_time_ns, os_time_get_nano() - now);
+      tc->batch_slot_limit *= 2;
+   } else {
+      tc_driver_idle_time(tc, now);
+      tc->batch_slot_limit += TC_MIN_SLOTS_PER_BATCH / 4;
+   }
+
+   if (!tc->adaptive_batches || tc->batch_slot_limit > TC_SLOTS_PER_BATCH)
+      tc->batch_slot_limit = TC_SLOTS_PER_BATCH;
+}
+
 static void
 tc_batch_flush(struct threaded_context *tc)
 {
@@ -266,13 +342,20 @@ tc_batch_flush(struct threaded_context *tc)
    tc_debug_check(tc);
    tc->bytes_mapped_estimate = 0;
    p_atomic_add(&tc->num_offloaded_slots, next->num_total_slots);
+   p_atomic_inc(&tc->num_batches);
+   p_atomic_add(&tc->batch_slot_limit_total, tc->batch_slot_limit);
 
    if (next->token) {
       next->token->tc = NULL;
       tc_unflushed_batch_token_reference(&next->token, NULL);
    }
 
-   util_queue_add_job(&tc->queue, next, &next->fence, tc_batch_execute,
+   if (unlikely(tc->recording))
+      tc_record_batch(tc, next);
+
+   tc_wait_for_free_batch(tc);
+
+   util_queue_add_job(&tc->queue, next, &next->fence, tc_batch_execute_queued,
                       NULL, 0);
    tc->last = tc->next;
    tc->next = (tc->next + 1) % TC_MAX_BATCHES;
@@ -291,7 +374,9 @@ tc_add_sized_call(struct threaded_context *tc, enum tc_call_id id,
    assert(num_slots <= TC_SLOTS_PER_BATCH);
    tc_debug_check(tc);
 
-   if (unlikely(next->num_total_slots + num_slots > TC_SLOTS_PER_BATCH)) {
+   /* A call larger than the limit still fits in an empty batch. */
+   if (unlikely(next->num_total_slots + num_slots > tc->batch_slot_limit &&
+                next->num_total_slots)) {
       tc_batch_flush(tc);
       next = &tc->batch_slots[tc->next];
       tc_assert(next->num_total_slots == 0);
@@ -334,11 +419,13 @@ tc_is_sync(struct threaded_context *tc)
 }
 
 static void
-_tc_sync(struct threaded_context *tc, UNUSED const char *info, UNUSED const char *func)
+_tc_sync(struct threaded_context *tc, enum tc_sync_reason reason,
+         UNUSED const char *info, const char *func)
 {
    struct tc_batch *last = &tc->batch_slots[tc->last];
    struct tc_batch *next = &tc->batch_slots[tc->next];
    bool synced = false;
+   int64_t idle = 0;
 
    tc_debug_check(tc);
 
@@ -355,17 +442,42 @@ _tc_sync(struct threaded_context *tc, UNUSED const char *info, UNUSED const char
       tc_unflushed_batch_token_reference(&next->token, NULL);
    }
 
+   /* Whatever needed the sync talks to the driver directly, which can't be
+    * replayed.
+    */
+   if (unlikely(tc->recording) && tc->recording->valid) {
+      mesa_logw("threaded context: %s can't be recorded", func);
+      tc->recording->valid = false;
+   }
+
    /* .. and execute unflushed calls directly. */
    if (next->num_total_slots) {
+      int64_t begin = os_time_get_nano();
+
+      if (!synced)
+         idle = tc_driver_idle_time(tc, begin);
+
       p_atomic_add(&tc->num_direct_slots, next->num_total_slots);
       tc->bytes_mapped_estimate = 0;
       tc_batch_execute(next, NULL, 0);
       tc_begin_next_buffer_list(tc);
       synced = true;
+
+      /* If the driver thread sat idle for a good part of the time it takes
+       * to execute these calls, it should have been given them earlier.
+       */
+      int64_t direct = os_time_get_nano() - begin;
+
+      if (tc->adaptive_batches && direct > TC_MIN_ADAPTIVE_SYNC_NS &&
+          idle > direct / 2) {
+         tc->batch_slot_limit = MAX2(tc->batch_slot_limit / 2,
+                                     TC_MIN_SLOTS_PER_BATCH);
+      }
    }
 
    if (synced) {
       p_atomic_inc(&tc->num_syncs);
+      p_atomic_inc(&tc->num_syncs_by_reason[reason]);
 
       if (tc_strcmp(func, "tc_destroy") != 0) {
          tc_printf("sync %s %s", func, info);
@@ -375,8 +487,8 @@ _tc_sync(struct threaded_context *tc, UNUSED const char *info, UNUSED const char
    tc_debug_check(tc);
 }
 
-#define tc_sync(tc) _tc_sync(tc, "", __func__)
-#define tc_sync_msg(tc, info) _tc_sync(tc, info, __func__)
+#define tc_sync(tc) _tc_sync(tc, TC_SYNC_OTHER, "", __func__)
+#define tc_sync_msg(tc, reason, info) _tc_sync(tc, reason, info, __func__)
 
 /**
  * Call this from fence_finish for same-context fence waits of deferred fences
@@ -402,7 +514,7 @@ threaded_context_flush(struct pipe_context *_pipe,
       if (prefer_async || !util_queue_fence_is_signalled(&last->fence))
          tc_batch_flush(tc);
       else
-         tc_sync(token->tc);
+         tc_sync_msg(token->tc, TC_SYNC_FLUSH, "fence");
    }
 }
 
@@ -873,7 +985,7 @@ tc_get_query_result(struct pipe_context *_pipe,
    bool flushed = tq->flushed;
 
    if (!flushed) {
-      tc_sync_msg(tc, wait ? "wait" : "nowait");
+      tc_sync_msg(tc, TC_SYNC_QUERY, wait ? "wait" : "nowait");
       tc_set_driver_thread(tc);
    }
 
@@ -980,7 +1092,8 @@ tc_render_condition(struct pipe_context *_pipe,
    }
 
 #define TC_CSO_BIND(name, ...) TC_FUNC1(bind_##name##_state, , void *, , , ##__VA_ARGS__)
-#define TC_CSO_DELETE(name) TC_FUNC1(delete_##name##_state, , void *, , )
+#define TC_CSO_DELETE(name) TC_FUNC1(delete_##name##_state, , void *, , , \
+                                     tc_forget_recorded_cso(tc, param))
 
 #define TC_CSO(name, sname, ...) \
    TC_CSO_CREATE(name, sname) \
@@ -2243,7 +2356,8 @@ tc_buffer_map(struct pipe_context *_pipe,
 
    /* Unsychronized buffer mappings don't have to synchronize the thread. */
    if (!(usage & TC_TRANSFER_MAP_THREADED_UNSYNC)) {
-      tc_sync_msg(tc, usage & PIPE_MAP_DISCARD_RANGE ? "  discard_range" :
+      tc_sync_msg(tc, TC_SYNC_TRANSFER,
+                  usage & PIPE_MAP_DISCARD_RANGE ? "  discard_range" :
                       usage & PIPE_MAP_READ ? "  read" : "  staging conflict");
       tc_set_driver_thread(tc);
    }
@@ -2271,7 +2385,7 @@ tc_texture_map(struct pipe_context *_pipe,
    struct threaded_resource *tres = threaded_resource(resource);
    struct pipe_context *pipe = tc->pipe;
 
-   tc_sync_msg(tc, "texture");
+   tc_sync_msg(tc, TC_SYNC_TRANSFER, "texture");
    tc_set_driver_thread(tc);
 
    tc->bytes_mapped_estimate += box->width;
@@ -2651,7 +2765,7 @@ tc_texture_subdata(struct pipe_context *_pipe,
    } else {
       struct pipe_context *pipe = tc->pipe;
 
-      tc_sync(tc);
+      tc_sync_msg(tc, TC_SYNC_TRANSFER, "texture_subdata");
       tc_set_driver_thread(tc);
       pipe->texture_subdata(pipe, resource, level, usage, box, data,
                             stride, layer_stride);
@@ -2995,7 +3109,8 @@ tc_flush(struct pipe_context *_pipe, struct pipe_fence_handle **fence,
    }
 
 out_of_memory:
-   tc_sync_msg(tc, flags & PIPE_FLUSH_END_OF_FRAME ? "end of frame" :
+   tc_sync_msg(tc, TC_SYNC_FLUSH,
+               flags & PIPE_FLUSH_END_OF_FRAME ? "end of frame" :
                    flags & PIPE_FLUSH_DEFERRED ? "deferred fence" : "normal");
 
    if (!(flags & PIPE_FLUSH_DEFERRED))
@@ -3346,10 +3461,10 @@ tc_draw_vbo(struct pipe_context *_pipe, const struct pipe_draw_info *info,
       while (num_draws) {
          struct tc_batch *next = &tc->batch_slots[tc->next];
 
-         int nb_slots_left = TC_SLOTS_PER_BATCH - next->num_total_slots;
+         int nb_slots_left = (int)tc->batch_slot_limit - next->num_total_slots;
          /* If there isn't enough place for one draw, try to fill the next one */
          if (nb_slots_left < slots_for_one_draw)
-            nb_slots_left = TC_SLOTS_PER_BATCH;
+            nb_slots_left = tc->batch_slot_limit;
          const int size_left_bytes = nb_slots_left * sizeof(struct tc_call_base);
 
          /* How many draws can we fit in the current batch */
@@ -3392,10 +3507,10 @@ tc_draw_vbo(struct pipe_context *_pipe, const struct pipe_draw_info *info,
       while (num_draws) {
          struct tc_batch *next = &tc->batch_slots[tc->next];
 
-         int nb_slots_left = TC_SLOTS_PER_BATCH - next->num_total_slots;
+         int nb_slots_left = (int)tc->batch_slot_limit - next->num_total_slots;
          /* If there isn't enough place for one draw, try to fill the next one */
          if (nb_slots_left < slots_for_one_draw)
-            nb_slots_left = TC_SLOTS_PER_BATCH;
+            nb_slots_left = tc->batch_slot_limit;
          const int size_left_bytes = nb_slots_left * sizeof(struct tc_call_base);
 
          /* How many draws can we fit in the current batch */
@@ -3553,10 +3668,10 @@ tc_draw_vertex_state(struct pipe_context *_pipe,
    while (num_draws) {
       struct tc_batch *next = &tc->batch_slots[tc->next];
 
-      int nb_slots_left = TC_SLOTS_PER_BATCH - next->num_total_slots;
+      int nb_slots_left = (int)tc->batch_slot_limit - next->num_total_slots;
       /* If there isn't enough place for one draw, try to fill the next one */
       if (nb_slots_left < slots_for_one_draw)
-         nb_slots_left = TC_SLOTS_PER_BATCH;
+         nb_slots_left = tc->batch_slot_limit;
       const int size_left_bytes = nb_slots_left * sizeof(struct tc_call_base);
 
       /* How many draws can we fit in the current batch */
@@ -4204,6 +4319,485 @@ tc_callback(struct pipe_context *_pipe, void (*fn)(void *), void *data,
 }
 
 
+/********************************************************************
+ * recording and replay
+ */
+
+static bool
+tc_is_recorded_draw(enum tc_call_id id)
+{
+   return id == TC_CALL_draw_single || id == TC_CALL_draw_single_drawid ||
+          id == TC_CALL_draw_multi;
+}
+
+static struct pipe_resource *
+tc_recorded_draw_index_buffer(struct tc_call_base *call)
+{
+   struct pipe_draw_info *info =
+      call->call_id == TC_CALL_draw_multi ?
+         &((struct tc_draw_multi *)call)->info :
+         &((struct tc_draw_single *)call)->info;
+
+   return info->index_size ? info->index.resource : NULL;
+}
+
+/* Add a reference to everything a copy of the call uses. Return false if
+ * the call can't be replayed.
+ */
+static bool
+tc_reference_recorded_call(struct tc_call_base *call)
+{
+   switch (call->call_id) {
+   case TC_CALL_set_framebuffer_state: {
+      struct pipe_framebuffer_state *fb =
+         &((struct tc_framebuffer *)call)->state;
+
+      for (unsigned i = 0; i < fb->nr_cbufs; i++) {
+         if (fb->cbufs[i])
+            pipe_reference(NULL, &fb->cbufs[i]->reference);
+      }
+      if (fb->zsbuf)
+         pipe_reference(NULL, &fb->zsbuf->reference);
+      return true;
+   }
+   case TC_CALL_set_constant_buffer: {
+      struct tc_constant_buffer *p = (struct tc_constant_buffer *)call;
+
+      if (!p->base.is_null && p->cb.buffer)
+         pipe_reference(NULL, &p->cb.buffer->reference);
+      return true;
+   }
+   case TC_CALL_set_vertex_buffers: {
+      struct tc_vertex_buffers *p = (struct tc_vertex_buffers *)call;
+
+      for (unsigned i = 0; i < p->count; i++) {
+         if (p->slot[i].buffer.resource)
+            pipe_reference(NULL, &p->slot[i].buffer.resource->reference);
+      }
+      return true;
+   }
+   case TC_CALL_set_sampler_views: {
+      struct tc_sampler_views *p = (struct tc_sampler_views *)call;
+
+      for (unsigned i = 0; i < p->count; i++) {
+         if (p->slot[i])
+            pipe_reference(NULL, &p->slot[i]->reference);
+      }
+      return true;
+   }
+   case TC_CALL_draw_single:
+   case TC_CALL_draw_single_drawid:
+   case TC_CALL_draw_multi: {
+      struct pipe_resource *index_buffer = tc_recorded_draw_index_buffer(call);
+
+      if (index_buffer)
+         pipe_reference(NULL, &index_buffer->reference);
+      return true;
+   }
+   /* These don't reference anything. */
+   case TC_CALL_bind_sampler_states:
+   case TC_CALL_set_tess_state:
+   case TC_CALL_set_patch_vertices:
+   case TC_CALL_set_inlinable_constants:
+   case TC_CALL_set_sample_locations:
+   case TC_CALL_set_scissor_states:
+   case TC_CALL_set_viewport_states:
+   case TC_CALL_set_window_rectangles:
+   case TC_CALL_set_blend_color:
+   case TC_CALL_set_stencil_ref:
+   case TC_CALL_set_clip_state:
+   case TC_CALL_set_sample_mask:
+   case TC_CALL_set_min_samples:
+   case TC_CALL_set_polygon_stipple:
+   case TC_CALL_texture_barrier:
+   case TC_CALL_memory_barrier:
+   case TC_CALL_clear:
+   case TC_CALL_bind_blend_state:
+   case TC_CALL_bind_rasterizer_state:
+   case TC_CALL_bind_depth_stencil_alpha_state:
+   case TC_CALL_bind_fs_state:
+   case TC_CALL_bind_vs_state:
+   case TC_CALL_bind_gs_state:
+   case TC_CALL_bind_tcs_state:
+   case TC_CALL_bind_tes_state:
+   case TC_CALL_bind_vertex_elements_state:
+      return true;
+   default:
+      return false;
+   }
+}
+
+/* Drop the references taken by tc_reference_recorded_call. */
+static void
+tc_release_recorded_call(struct tc_call_base *call)
+{
+   switch (call->call_id) {
+   case TC_CALL_set_framebuffer_state: {
+      struct pipe_framebuffer_state *fb =
+         &((struct tc_framebuffer *)call)->state;
+
+      for (unsigned i = 0; i < fb->nr_cbufs; i++)
+         pipe_surface_reference(&fb->cbufs[i], NULL);
+      pipe_surface_reference(&fb->zsbuf, NULL);
+      break;
+   }
+   case TC_CALL_set_constant_buffer: {
+      struct tc_constant_buffer *p = (struct tc_constant_buffer *)call;
+
+      if (!p->base.is_null)
+         pipe_resource_reference(&p->cb.buffer, NULL);
+      break;
+   }
+   case TC_CALL_set_vertex_buffers: {
+      struct tc_vertex_buffers *p = (struct tc_vertex_buffers *)call;
+
+      for (unsigned i = 0; i < p->count; i++)
+         pipe_resource_reference(&p->slot[i].buffer.resource, NULL);
+      break;
+   }
+   case TC_CALL_set_sampler_views: {
+      struct tc_sampler_views *p = (struct tc_sampler_views *)call;
+
+      for (unsigned i = 0; i < p->count; i++)
+         pipe_sampler_view_reference(&p->slot[i], NULL);
+      break;
+   }
+   case TC_CALL_draw_single:
+   case TC_CALL_draw_single_drawid:
+   case TC_CALL_draw_multi: {
+      struct pipe_resource *index_buffer = tc_recorded_draw_index_buffer(call);
+
+      if (index_buffer)
+         tc_drop_resource_reference(index_buffer);
+      break;
+   }
+   default:
+      break;
+   }
+}
+
+/* Update the buffer bindings and lists like the tc_* function that added
+ * the call would have done.
+ */
+static void
+tc_replay_bindings(struct threaded_context *tc, struct tc_call_base *call)
+{
+   struct tc_buffer_list *next = &tc->buffer_lists[tc->next_buf_list];
+
+   switch (call->call_id) {
+   case TC_CALL_set_constant_buffer: {
+      struct tc_constant_buffer *p = (struct tc_constant_buffer *)call;
+      uint32_t *binding = &tc->const_buffers[p->base.shader][p->base.index];
+
+      if (!p->base.is_null && p->cb.buffer)
+         tc_bind_buffer(binding, next, p->cb.buffer);
+      else
+         tc_unbind_buffer(binding);
+      break;
+   }
+   case TC_CALL_set_vertex_buffers: {
+      struct tc_vertex_buffers *p = (struct tc_vertex_buffers *)call;
+
+      for (unsigned i = 0; i < p->count; i++) {
+         struct pipe_resource *buf = p->slot[i].buffer.resource;
+
+         if (buf)
+            tc_bind_buffer(&tc->vertex_buffers[p->start + i], next, buf);
+         else
+            tc_unbind_buffer(&tc->vertex_buffers[p->start + i]);
+      }
+      tc_unbind_buffers(&tc->vertex_buffers[p->start + p->count],
+                        p->unbind_num_trailing_slots);
+      break;
+   }
+   case TC_CALL_set_sampler_views: {
+      struct tc_sampler_views *p = (struct tc_sampler_views *)call;
+      uint32_t *bindings = tc->sampler_buffers[p->shader];
+
+      for (unsigned i = 0; i < p->count; i++) {
+         if (p->slot[i] && p->slot[i]->target == PIPE_BUFFER)
+            tc_bind_buffer(&bindings[p->start + i], next, p->slot[i]->texture);
+         else
+            tc_unbind_buffer(&bindings[p->start + i]);
+      }
+      tc_unbind_buffers(&bindings[p->start + p->count],
+                        p->unbind_num_trailing_slots);
+      tc->seen_sampler_buffers[p->shader] = true;
+      break;
+   }
+   case TC_CALL_draw_single:
+   case TC_CALL_draw_single_drawid:
+   case TC_CALL_draw_multi: {
+      struct pipe_resource *index_buffer = tc_recorded_draw_index_buffer(call);
+
+      if (index_buffer)
+         tc_add_to_buffer_list(next, index_buffer);
+      break;
+   }
+   case TC_CALL_bind_gs_state:
+      tc->seen_gs = true;
+      break;
+   case TC_CALL_bind_tcs_state:
+      tc->seen_tcs = true;
+      break;
+   case TC_CALL_bind_tes_state:
+      tc->seen_tes = true;
+      break;
+   default:
+      break;
+   }
+}
+
+/* Remember the CSOs bound by the call, so that deleting one of them
+ * invalidates the recording.
+ */
+static void
+tc_record_csos(struct tc_recording *rec, struct tc_call_base *call)
+{
+   switch (call->call_id) {
+   case TC_CALL_bind_sampler_states: {
+      struct tc_sampler_states *p = (struct tc_sampler_states *)call;
+
+      for (unsigned i = 0; i < p->count; i++) {
+         if (p->slot[i])
+            util_dynarray_append(&rec->csos, void *, p->slot[i]);
+      }
+      break;
+   }
+   case TC_CALL_bind_blend_state:
+   case TC_CALL_bind_rasterizer_state:
+   case TC_CALL_bind_depth_stencil_alpha_state:
+   case TC_CALL_bind_fs_state:
+   case TC_CALL_bind_vs_state:
+   case TC_CALL_bind_gs_state:
+   case TC_CALL_bind_tcs_state:
+   case TC_CALL_bind_tes_state:
+   case TC_CALL_bind_vertex_elements_state: {
+      /* All of them are declared by TC_FUNC1 with a "void *" state. */
+      void *cso = to_call(call, tc_call_bind_blend_state)->state;
+
+      if (cso)
+         util_dynarray_append(&rec->csos, void *, cso);
+      break;
+   }
+   default:
+      break;
+   }
+}
+
+/* Invalidate the recordings that bind a CSO that is being deleted. */
+static void
+tc_forget_recorded_cso(struct threaded_context *tc, void *cso)
+{
+   if (likely(list_is_empty(&tc->recordings)))
+      return;
+
+   list_for_each_entry(struct tc_recording, rec, &tc->recordings, list) {
+      util_dynarray_foreach(&rec->csos, void *, recorded) {
+         if (*recorded == cso) {
+            rec->valid = false;
+            break;
+         }
+      }
+   }
+}
+
+/* Append the calls of the batch recorded so far to the recording. This is
+ * called before the batch is executed, which drops the references the
+ * calls hold.
+ */
+static void
+tc_record_batch(struct threaded_context *tc, struct tc_batch *batch)
+{
+   struct tc_recording *rec = tc->recording;
+   uint64_t *iter = &batch->slots[tc->recording_start];
+   uint64_t *last = &batch->slots[batch->num_total_slots];
+
+   tc->recording_start = 0;
+
+   while (rec->valid && iter != last) {
+      struct tc_call_base *call = (struct tc_call_base *)iter;
+      unsigned size = call->num_slots * sizeof(uint64_t);
+
+      if (!tc_reference_recorded_call(call)) {
+         mesa_logw("threaded context: call %u can't be recorded",
+                   call->call_id);
+         rec->valid = false;
+         break;
+      }
+
+      memcpy(util_dynarray_grow_bytes(&rec->slots, 1, size), call, size);
+      tc_record_csos(rec, call);
+
+      if (call->call_id == TC_CALL_set_constant_buffer &&
+          !((struct tc_constant_buffer_base *)call)->is_null)
+         rec->num_constant_buffers++;
+
+      iter += call->num_slots;
+   }
+}
+
+/**
+ * Start recording the calls made to the context, which are also executed
+ * normally. Return false if the context isn't a threaded context.
+ */
+bool
+threaded_context_begin_recording(struct pipe_context *_pipe)
+{
+   if (_pipe->destroy != tc_destroy)
+      return false;
+
+   struct threaded_context *tc = threaded_context(_pipe);
+
+   assert(!tc->recording);
+   tc->recording = CALLOC_STRUCT(tc_recording);
+   if (!tc->recording)
+      return false;
+
+   tc->recording->tc = tc;
+   list_inithead(&tc->recording->list);
+   util_dynarray_init(&tc->recording->slots, NULL);
+   util_dynarray_init(&tc->recording->csos, NULL);
+   tc->recording->valid = true;
+   tc->recording_start = tc->batch_slots[tc->next].num_total_slots;
+   return true;
+}
+
+/**
+ * Stop recording and return the recorded calls, or NULL if some can't be
+ * replayed.
+ */
+struct tc_recording *
+threaded_context_end_recording(struct pipe_context *_pipe)
+{
+   struct threaded_context *tc = threaded_context(_pipe);
+   struct tc_recording *rec = tc->recording;
+
+   if (!rec)
+      return NULL;
+
+   tc_record_batch(tc, &tc->batch_slots[tc->next]);
+   tc->recording = NULL;
+
+   if (!rec->valid) {
+      tc_recording_destroy(rec);
+      return NULL;
+   }
+
+   list_addtail(&rec->list, &tc->recordings);
+   return rec;
+}
+
+/**
+ * Return the number of set_constant_buffer calls in the recording that bind
+ * a buffer, which is the size of the "constants" array of
+ * threaded_context_replay.
+ */
+unsigned
+tc_recording_num_constant_buffers(const struct tc_recording *rec)
+{
+   return rec->num_constant_buffers;
+}
+
+/**
+ * Enqueue the recorded calls again.
+ *
+ * If "constants" isn't NULL, its entries replace the constant buffers bound
+ * by the recording, in order. Entries with neither a buffer nor a user
+ * buffer keep the recorded one. User buffers are uploaded.
+ *
+ * Return false without enqueuing anything if a CSO bound by the recording
+ * has been deleted since, in which case the recording should be destroyed
+ * and the calls made again.
+ */
+bool
+threaded_context_replay(struct pipe_context *_pipe,
+                        const struct tc_recording *rec,
+                        const struct pipe_constant_buffer *constants)
+{
+   struct threaded_context *tc = threaded_context(_pipe);
+   uint64_t *iter = rec->slots.data;
+   uint64_t *end = iter + rec->slots.size / sizeof(uint64_t);
+   unsigned cb_index = 0;
+
+   assert(rec->tc == tc);
+   if (!rec->valid)
+      return false;
+
+   while (iter != end) {
+      struct tc_call_base *call = (struct tc_call_base *)iter;
+      const struct pipe_constant_buffer *cb = NULL;
+      struct pipe_resource *buffer = NULL;
+      unsigned offset = 0;
+
+      if (call->call_id == TC_CALL_set_constant_buffer &&
+          !((struct tc_constant_buffer_base *)call)->is_null) {
+         if (constants &&
+             (constants[cb_index].buffer || constants[cb_index].user_buffer))
+            cb = &constants[cb_index];
+         cb_index++;
+      }
+
+      /* This must be done before adding the call, like in
+       * tc_set_constant_buffer.
+       */
+      if (cb && cb->user_buffer) {
+         u_upload_data(tc->base.const_uploader, 0, cb->buffer_size,
+                       tc->ubo_alignment, cb->user_buffer, &offset, &buffer);
+         u_upload_unmap(tc->base.const_uploader);
+      } else if (cb) {
+         pipe_resource_reference(&buffer, cb->buffer);
+         offset = cb->buffer_offset;
+      }
+
+      if (tc_is_recorded_draw(call->call_id) &&
+          unlikely(tc->add_all_gfx_bindings_to_buffer_list))
+         tc_add_all_gfx_bindings_to_buffer_list(tc);
+
+      struct tc_call_base *copy =
+         tc_add_sized_call(tc, call->call_id, call->num_slots);
+      memcpy(copy, call, call->num_slots * sizeof(uint64_t));
+
+      if (cb) {
+         struct tc_constant_buffer *p = (struct tc_constant_buffer *)copy;
+
+         p->cb.buffer = buffer;
+         p->cb.buffer_offset = offset;
+         p->cb.buffer_size = cb->buffer_size;
+      } else {
+         tc_reference_recorded_call(copy);
+      }
+
+      tc_replay_bindings(tc, copy);
+      iter += call->num_slots;
+   }
+
+   return true;
+}
+
+void
+tc_recording_destroy(struct tc_recording *rec)
+{
+   if (!rec)
+      return;
+
+   uint64_t *iter = rec->slots.data;
+   uint64_t *end = iter + rec->slots.size / sizeof(uint64_t);
+
+   while (iter != end) {
+      struct tc_call_base *call = (struct tc_call_base *)iter;
+
+      iter += call->num_slots;
+      tc_release_recorded_call(call);
+   }
+
+   list_del(&rec->list);
+   util_dynarray_fini(&rec->slots);
+   util_dynarray_fini(&rec->csos);
+   FREE(rec);
+}
+
+
 /********************************************************************
  * create & destroy
  */
@@ -4223,6 +4817,16 @@ tc_destroy(struct pipe_context *_pipe)
 
    tc_sync(tc);
 
+   /* A recording that was never ended holds references to resources. */
+   tc_recording_destroy(tc->recording);
+   tc->recording = NULL;
+
+   /* Recordings that outlive the context can't be replayed anymore. */
+   list_for_each_entry_safe(struct tc_recording, rec, &tc->recordings, list) {
+      rec->valid = false;
+      list_delinit(&rec->list);
+   }
+
    if (util_queue_is_initialized(&tc->queue)) {
       util_queue_destroy(&tc->queue);
 
@@ -4331,6 +4935,10 @@ threaded_context_create(struct pipe_context *pipe,
       goto fail;
 
    tc->use_forced_staging_uploads = true;
+   tc->adaptive_batches = debug_get_bool_option("GALLIUM_THREAD_ADAPTIVE", true);
+   tc->batch_slot_limit = TC_SLOTS_PER_BATCH;
+   tc->driver_idle_since = os_time_get_nano();
+   tc->driver_idle_counted = tc->driver_idle_since;
 
    /* The queue size is the number of batches "waiting". Batches are removed
     * from the queue before being executed, so keep one tc_batch slot for that
@@ -4350,6 +4958,7 @@ threaded_context_create(struct pipe_context *pipe,
       util_queue_fence_init(&tc->buffer_lists[i].driver_flushed_fence);
 
    list_inithead(&tc->unflushed_queries);
+   list_inithead(&tc->recordings);
 
    slab_create_child(&tc->pool_transfers, parent_transfer_pool);
 
@@ -4522,3 +5131,29 @@ threaded_context_init_bytes_mapped_limit(struct threaded_context *tc, unsigned d
          tc->bytes_mapped_limit = MIN2(tc->bytes_mapped_limit, 512*1024*1024UL);
    }
 }
+
+/**
+ * Read the counters of a threaded context, for the HUD and for drivers
+ * that expose them as queries. Returns false if \p pipe isn't a threaded
+ * context.
+ */
+bool
+threaded_context_get_stats(struct pipe_context *pipe, struct tc_stats *stats)
+{
+   if (pipe->destroy != tc_destroy)
+      return false;
+
+   struct threaded_context *tc = threaded_context(pipe);
+
+   stats->num_offloaded_slots = p_atomic_read(&tc->num_offloaded_slots);
+   stats->num_direct_slots = p_atomic_read(&tc->num_direct_slots);
+   stats->num_syncs = p_atomic_read(&tc->num_syncs);
+   for (unsigned i = 0; i < TC_NUM_SYNC_REASONS; i++)
+      stats->num_syncs_by_reason[i] = p_atomic_read(&tc->num_syncs_by_reason[i]);
+   stats->num_batches = p_atomic_read(&tc->num_batches);
+   stats->batch_slot_limit_total = p_atomic_read(&tc->batch_slot_limit_total);
+   stats->num_stalls = p_atomic_read(&tc->num_stalls);
+   stats->stall_time_ns = p_atomic_read(&tc->stall_time_ns);
+   stats->driver_idle_time_ns = p_atomic_read(&tc->driver_idle_time_ns);
+   return true;
+}
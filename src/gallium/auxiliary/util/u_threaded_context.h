@@ -179,6 +179,32 @@
  * util_idalloc_mt_init_tc.
  *
  *
+ * Recording and replaying command streams
+ * ---------------------------------------
+ *
+ * Frontends that submit the same state changes and draws every frame can
+ * record them once and replay them without going through the pipe_context
+ * entry points again:
+ *
+ *    threaded_context_begin_recording(pipe);
+ *    ... set states, bind buffers and views, draw, clear ...
+ *    struct tc_recording *rec = threaded_context_end_recording(pipe);
+ *
+ *    threaded_context_replay(pipe, rec, constants);  (every frame)
+ *
+ * threaded_context_begin_recording returns false if the context isn't
+ * a threaded context. The recorded calls are still executed normally while
+ * recording. threaded_context_end_recording returns NULL if any of them
+ * can't be replayed, e.g. flushes, queries, transfers, blits and compute.
+ *
+ * A recording keeps references to the resources, surfaces and sampler views
+ * it uses, so buffer contents can be updated between replays as usual. CSOs
+ * aren't referenced: deleting a CSO that a recording binds invalidates the
+ * recording, and threaded_context_replay then returns false, so that the
+ * caller can destroy it and record the calls again. Constant buffers can be
+ * replaced at replay time, see threaded_context_replay.
+ *
+ *
  * How it works (queue architecture)
  * ---------------------------------
  *
@@ -210,6 +236,7 @@ extern "C" {
 #endif
 
 struct threaded_context;
+struct tc_recording;
 struct tc_unflushed_batch_token;
 
 /* 0 = disabled, 1 = assertions, 2 = printfs, 3 = logging */
@@ -248,6 +275,19 @@ struct tc_unflushed_batch_token;
  */
 #define TC_SLOTS_PER_BATCH    1536
 
+/* Batches are flushed once they contain threaded_context::batch_slot_limit
+ * slots, which varies between TC_MIN_SLOTS_PER_BATCH and TC_SLOTS_PER_BATCH.
+ *
+ * Waking up the driver thread has a cost, so batches are only made smaller
+ * when a sync had to execute the unflushed calls in the application thread
+ * for more than TC_MIN_ADAPTIVE_SYNC_NS while the driver thread was idle.
+ * Then the limit is halved. It grows back a little with every flush and is
+ * doubled when all batches are in use and the application thread waits.
+ * GALLIUM_THREAD_ADAPTIVE=0 always fills batches.
+ */
+#define TC_MIN_SLOTS_PER_BATCH  256
+#define TC_MIN_ADAPTIVE_SYNC_NS 50000
+
 /* The buffer list queue is much deeper than the batch queue because buffer
  * lists need to stay around until the driver internally flushes its command
  * buffer.
@@ -271,6 +311,33 @@ struct tc_unflushed_batch_token;
  */
 #define TC_MAX_SUBDATA_BYTES        320
 
+/* Why the application thread had to wait for the driver thread. */
+enum tc_sync_reason {
+   TC_SYNC_FLUSH,    /* pipe->flush and fences */
+   TC_SYNC_QUERY,    /* waiting for query results */
+   TC_SYNC_TRANSFER, /* buffer and texture mappings and uploads */
+   TC_SYNC_OTHER,
+   TC_NUM_SYNC_REASONS,
+};
+
+/* Snapshot of the counters of a threaded context, which only ever grow.
+ * See threaded_context_get_stats().
+ */
+struct tc_stats {
+   unsigned num_offloaded_slots;
+   unsigned num_direct_slots;
+   unsigned num_syncs;
+   unsigned num_syncs_by_reason[TC_NUM_SYNC_REASONS];
+   unsigned num_batches;
+   /* Slots the batches could have used before being flushed, which with
+    * adaptive batches is less than TC_SLOTS_PER_BATCH.
+    */
+   uint64_t batch_slot_limit_total;
+   unsigned num_stalls;
+   uint64_t stall_time_ns;
+   uint64_t driver_idle_time_ns;
+};
+
 enum tc_binding_type {
    TC_BINDING_VERTEX_BUFFER,
    TC_BINDING_STREAMOUT_BUFFER,
@@ -458,6 +525,26 @@ struct threaded_context {
    unsigned num_offloaded_slots;
    unsigned num_direct_slots;
    unsigned num_syncs;
+   unsigned num_syncs_by_reason[TC_NUM_SYNC_REASONS];
+   unsigned num_batches;         /* batches sent to the driver thread */
+   uint64_t batch_slot_limit_total; /* sum of their batch_slot_limit */
+   unsigned num_stalls;          /* flushes that waited for a free batch */
+   uint64_t stall_time_ns;       /* time spent in those waits */
+   uint64_t driver_idle_time_ns; /* driver thread idle time between batches */
+
+   /* The recording in progress and the first slot of the current batch
+    * that belongs to it.
+    */
+   struct tc_recording *recording;
+   unsigned recording_start;
+   struct list_head recordings; /* ended recordings, for CSO deletion */
+
+   /* Adaptive batch sizing. */
+   bool adaptive_batches;
+   unsigned batch_slot_limit;
+   /* Set by the driver thread when it finishes a batch. */
+   int64_t driver_idle_since;
+   int64_t driver_idle_counted;
 
    bool use_forced_staging_uploads;
    bool add_all_gfx_bindings_to_buffer_list;
@@ -537,11 +624,31 @@ threaded_context_create(struct pipe_context *pipe,
 void
 threaded_context_init_bytes_mapped_limit(struct threaded_context *tc, unsigned divisor);
 
+bool
+threaded_context_get_stats(struct pipe_context *pipe, struct tc_stats *stats);
+
 void
 threaded_context_flush(struct pipe_context *_pipe,
                        struct tc_unflushed_batch_token *token,
                        bool prefer_async);
 
+bool
+threaded_context_begin_recording(struct pipe_context *_pipe);
+
+struct tc_recording *
+threaded_context_end_recording(struct pipe_context *_pipe);
+
+unsigned
+tc_recording_num_constant_buffers(const struct tc_recording *rec);
+
+bool
+threaded_context_replay(struct pipe_context *_pipe,
+                        const struct tc_recording *rec,
+                        const struct pipe_constant_buffer *constants);
+
+void
+tc_recording_destroy(struct tc_recording *rec);
+
 void
 tc_draw_vbo(struct pipe_context *_pipe, const struct pipe_draw_info *info,
             unsigned drawid_offset,
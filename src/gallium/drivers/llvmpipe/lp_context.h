@@ -158,6 +158,9 @@ struct llvmpipe_context {
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
 
+   /** Optimized version of the bound fs variant still being compiled */
+   struct lp_fragment_shader_variant *fs_variant_optimized;
+
    boolean permit_linear_rasterizer;
    boolean single_vp;
 
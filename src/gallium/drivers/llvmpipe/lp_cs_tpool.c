@@ -30,55 +30,142 @@
 
 #include "util/u_thread.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
+#include "util/u_math.h"
 #include "lp_cs_tpool.h"
 
-static int
-lp_cs_tpool_worker(void *data)
+/* Number of iterations to claim from the front of a range: large batches
+ * while there's plenty left keep locking rare, small ones near the end leave
+ * something for other threads to steal.
+ */
+static inline unsigned
+batch_size(const struct lp_cs_tpool_range *range)
 {
-   struct lp_cs_tpool *pool = data;
-   struct lp_cs_local_mem lmem;
+   return DIV_ROUND_UP(range->end - range->start, 4);
+}
 
-   memset(&lmem, 0, sizeof(lmem));
-   mtx_lock(&pool->m);
+static void
+run_iterations(struct lp_cs_tpool *pool, struct lp_cs_tpool_task *task,
+               unsigned start, unsigned count, struct lp_cs_local_mem *lmem)
+{
+   /* the task may be gone as soon as our iterations are accounted for */
+   unsigned iter_total = task->iter_total;
 
-   while (!pool->shutdown) {
-      struct lp_cs_tpool_task *task;
-      unsigned iter_per_thread;
+   for (unsigned i = 0; i < count; i++)
+      task->work(task->data, start + i, lmem);
 
-      while (list_is_empty(&pool->workqueue) && !pool->shutdown)
-         cnd_wait(&pool->new_work, &pool->m);
+   if (p_atomic_add_return(&task->iter_finished, count) == iter_total) {
+      /* the waiter frees the task once done is set, signal under the lock */
+      mtx_lock(&pool->m);
+      task->done = true;
+      cnd_broadcast(&task->finish);
+      mtx_unlock(&pool->m);
+   }
+}
 
-      if (pool->shutdown)
-         break;
+/* Claim a batch from the first range on the thread's own list. */
+static bool
+claim_own(struct lp_cs_tpool_thread *thread, struct lp_cs_tpool_task **task,
+          unsigned *start, unsigned *count)
+{
+   mtx_lock(&thread->m);
+   if (list_is_empty(&thread->ranges)) {
+      mtx_unlock(&thread->m);
+      return false;
+   }
 
-      task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
-                              list);
+   struct lp_cs_tpool_range *range =
+      list_first_entry(&thread->ranges, struct lp_cs_tpool_range, list);
+   *task = range->task;
+   *start = range->start;
+   *count = batch_size(range);
+   range->start += *count;
+   if (range->start == range->end)
+      list_del(&range->list);
+   mtx_unlock(&thread->m);
+   return true;
+}
 
-      unsigned this_iter = task->iter_start;
+/* Move the back half of another thread's range onto our own list.  Stolen
+ * iterations go into the thread's one stolen range, which is free whenever
+ * our list is empty: ranges leave the list as soon as they run out.  Only
+ * one thread lock is held at a time.
+ */
+static bool
+steal(struct lp_cs_tpool_thread *thread)
+{
+   struct lp_cs_tpool *pool = thread->pool;
+   struct lp_cs_tpool_range *own = &thread->stolen;
+   bool found = false;
+
+   mtx_lock(&thread->m);
+   /* work may have been queued for us since we last looked */
+   bool busy = !list_is_empty(&thread->ranges);
+   mtx_unlock(&thread->m);
+   if (busy)
+      return true;
+
+   for (unsigned i = 1; i < pool->num_threads && !found; i++) {
+      struct lp_cs_tpool_thread *victim =
+         &pool->thread_data[(thread->index + i) % pool->num_threads];
+
+      mtx_lock(&victim->m);
+      if (!list_is_empty(&victim->ranges)) {
+         struct lp_cs_tpool_range *range =
+            list_first_entry(&victim->ranges, struct lp_cs_tpool_range, list);
+         unsigned count = DIV_ROUND_UP(range->end - range->start, 2);
+
+         own->task = range->task;
+         own->start = range->end - count;
+         own->end = range->end;
+         range->end = own->start;
+         if (range->start == range->end)
+            list_del(&range->list);
+         found = true;
+      }
+      mtx_unlock(&victim->m);
+   }
 
-      iter_per_thread = task->iter_per_thread;
+   if (!found)
+      return false;
 
-      if (task->iter_remainder &&
-          task->iter_start + task->iter_remainder == task->iter_total) {
-         task->iter_remainder--;
-         iter_per_thread = 1;
-      }
+   mtx_lock(&thread->m);
+   list_addtail(&own->list, &thread->ranges);
+   mtx_unlock(&thread->m);
+   return true;
+}
 
-      task->iter_start += iter_per_thread;
+static int
+lp_cs_tpool_worker(void *data)
+{
+   struct lp_cs_tpool_thread *thread = data;
+   struct lp_cs_tpool *pool = thread->pool;
+   struct lp_cs_local_mem lmem;
 
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
+   memset(&lmem, 0, sizeof(lmem));
 
+   while (true) {
+      mtx_lock(&pool->m);
+      unsigned generation = pool->generation;
+      bool shutdown = pool->shutdown;
       mtx_unlock(&pool->m);
-      for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
+
+      if (shutdown)
+         break;
+
+      do {
+         struct lp_cs_tpool_task *task;
+         unsigned start, count;
+
+         while (claim_own(thread, &task, &start, &count))
+            run_iterations(pool, task, start, count, &lmem);
+      } while (steal(thread));
 
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
-         cnd_broadcast(&task->finish);
+      while (pool->generation == generation && !pool->shutdown)
+         cnd_wait(&pool->new_work, &pool->m);
+      mtx_unlock(&pool->m);
    }
-   mtx_unlock(&pool->m);
    FREE(lmem.local_mem_ptr);
    return 0;
 }
@@ -94,11 +181,30 @@ lp_cs_tpool_create(unsigned num_threads)
    (void) mtx_init(&pool->m, mtx_plain);
    cnd_init(&pool->new_work);
 
-   list_inithead(&pool->workqueue);
    assert (num_threads <= LP_MAX_THREADS);
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof(*pool->threads));
+      pool->thread_data = CALLOC(num_threads, sizeof(*pool->thread_data));
+      if (!pool->threads || !pool->thread_data) {
+         FREE(pool->threads);
+         FREE(pool->thread_data);
+         cnd_destroy(&pool->new_work);
+         mtx_destroy(&pool->m);
+         FREE(pool);
+         return NULL;
+      }
+   }
    pool->num_threads = num_threads;
+   for (unsigned i = 0; i < num_threads; i++) {
+      struct lp_cs_tpool_thread *thread = &pool->thread_data[i];
+
+      thread->pool = pool;
+      thread->index = i;
+      (void) mtx_init(&thread->m, mtx_plain);
+      list_inithead(&thread->ranges);
+   }
    for (unsigned i = 0; i < num_threads; i++)
-      pool->threads[i] = u_thread_create(lp_cs_tpool_worker, pool);
+      pool->threads[i] = u_thread_create(lp_cs_tpool_worker, &pool->thread_data[i]);
    return pool;
 }
 
@@ -116,9 +222,13 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
    for (unsigned i = 0; i < pool->num_threads; i++) {
       thrd_join(pool->threads[i], NULL);
    }
+   for (unsigned i = 0; i < pool->num_threads; i++)
+      mtx_destroy(&pool->thread_data[i].m);
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
+   FREE(pool->thread_data);
    FREE(pool);
 }
 
@@ -138,7 +248,7 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
       FREE(lmem.local_mem_ptr);
       return NULL;
    }
-   task = CALLOC_STRUCT(lp_cs_tpool_task);
+   task = CALLOC(1, sizeof(*task) + pool->num_threads * sizeof(task->ranges[0]));
    if (!task) {
       return NULL;
    }
@@ -147,15 +257,28 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    task->data = data;
    task->iter_total = num_iters;
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
-
    cnd_init(&task->finish);
 
-   mtx_lock(&pool->m);
+   /* all ranges must be set up before any of them becomes visible */
+   for (unsigned i = 0; i < pool->num_threads; i++) {
+      task->ranges[i].task = task;
+      task->ranges[i].start = (uint64_t)num_iters * i / pool->num_threads;
+      task->ranges[i].end = (uint64_t)num_iters * (i + 1) / pool->num_threads;
+   }
+
+   for (unsigned i = 0; i < pool->num_threads; i++) {
+      struct lp_cs_tpool_thread *thread = &pool->thread_data[i];
 
-   list_addtail(&task->list, &pool->workqueue);
+      if (task->ranges[i].start == task->ranges[i].end)
+         continue;
 
+      mtx_lock(&thread->m);
+      list_addtail(&task->ranges[i].list, &thread->ranges);
+      mtx_unlock(&thread->m);
+   }
+
+   mtx_lock(&pool->m);
+   pool->generation++;
    cnd_broadcast(&pool->new_work);
    mtx_unlock(&pool->m);
    return task;
@@ -166,12 +289,44 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
                           struct lp_cs_tpool_task **task_handle)
 {
    struct lp_cs_tpool_task *task = *task_handle;
+   struct lp_cs_local_mem lmem;
 
    if (!pool || !task)
       return;
 
+   /* rather than sleeping, help out by taking batches off the back of the
+    * task's ranges
+    */
+   memset(&lmem, 0, sizeof(lmem));
+   for (unsigned i = 0; i < pool->num_threads; i++) {
+      struct lp_cs_tpool_thread *thread = &pool->thread_data[i];
+
+      while (true) {
+         unsigned start = 0, count = 0;
+
+         mtx_lock(&thread->m);
+         list_for_each_entry(struct lp_cs_tpool_range, range, &thread->ranges, list) {
+            if (range->task != task)
+               continue;
+
+            count = batch_size(range);
+            range->end -= count;
+            start = range->end;
+            if (range->start == range->end)
+               list_del(&range->list);
+            break;
+         }
+         mtx_unlock(&thread->m);
+
+         if (!count)
+            break;
+         run_iterations(pool, task, start, count, &lmem);
+      }
+   }
+   FREE(lmem.local_mem_ptr);
+
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
+   while (!task->done)
       cnd_wait(&task->finish, &pool->m);
    mtx_unlock(&pool->m);
 
@@ -30,6 +30,13 @@
  * structs with just unique indexes in them.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
+ *
+ * The iterations of a task are split into one range per thread up front.
+ * Each thread works through the ranges on its own list in batches and,
+ * once that runs dry, steals the back half of a range from another
+ * thread, so the threads only contend when they run out of work.
+ * Several tasks may be in flight at once, and the thread waiting for a
+ * task helps executing it.
  */
 #ifndef LP_CS_QUEUE
 #define LP_CS_QUEUE
@@ -41,13 +48,36 @@
 
 #include "lp_limits.h"
 
+struct lp_cs_tpool_task;
+
+/* iterations [start, end) of a task, on one thread's list */
+struct lp_cs_tpool_range {
+   struct lp_cs_tpool_task *task;
+   struct list_head list;
+   unsigned start;
+   unsigned end;
+};
+
+struct lp_cs_tpool_thread {
+   struct lp_cs_tpool *pool;
+   unsigned index;
+
+   /* protects ranges and the bounds of every range on it */
+   mtx_t m;
+   struct list_head ranges;
+   /* iterations taken from other threads */
+   struct lp_cs_tpool_range stolen;
+};
+
 struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
+   /* bumped whenever work is queued, so idle threads don't miss it */
+   unsigned generation;
 
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
+   struct lp_cs_tpool_thread *thread_data;
    unsigned num_threads;
-   struct list_head workqueue;
    bool shutdown;
 };
 
@@ -61,13 +91,12 @@ typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_loc
 struct lp_cs_tpool_task {
    lp_cs_tpool_task_func work;
    void *data;
-   struct list_head list;
    cnd_t finish;
+   bool done;
    unsigned iter_total;
-   unsigned iter_start;
    unsigned iter_finished;
-   unsigned iter_per_thread;
-   unsigned iter_remainder;
+   /* one per pool thread, indexed by thread */
+   struct lp_cs_tpool_range ranges[0];
 };
 
 struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
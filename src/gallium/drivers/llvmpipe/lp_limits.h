@@ -66,7 +66,12 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 16
+/**
+ * Upper bound for the number of rasterizer / compute threads.  Per-thread
+ * storage is allocated for the number of threads actually created, so this
+ * is merely a sanity limit.
+ */
+#define LP_MAX_THREADS 256
 
 
 /**
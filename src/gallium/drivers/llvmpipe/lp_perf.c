@@ -118,6 +118,16 @@ lp_print_counters(void)
       debug_printf("llvmpipe: nr_color_tile_load:           %9u\n", lp_count.nr_color_tile_load);
       debug_printf("llvmpipe: nr_color_tile_store:          %9u\n", lp_count.nr_color_tile_store);
 
+      debug_printf("llvmpipe: nr_scenes:                    %9u\n", lp_count.nr_scenes);
+      debug_printf("llvmpipe:   nr_setup_scene_stalls:      %9u (%.3f sec)\n",
+                   lp_count.nr_setup_scene_stalls,
+                   lp_count.setup_scene_stall_time / 1000000.0);
+      debug_printf("llvmpipe:   nr_rast_scene_waits:        %9u (%.3f sec)\n",
+                   lp_count.nr_rast_scene_waits,
+                   lp_count.rast_scene_wait_time / 1000000.0);
+      debug_printf("llvmpipe:   rast_idle_time:             %9.3f sec\n",
+                   lp_count.rast_idle_time / 1000000.0);
+
       debug_printf("llvmpipe: nr_llvm_compiles:             %u\n", lp_count.nr_llvm_compiles);
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
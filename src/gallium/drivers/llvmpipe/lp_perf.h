@@ -65,6 +65,13 @@ struct lp_counters
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
 
+   unsigned nr_scenes;
+   unsigned nr_setup_scene_stalls;  /**< setup blocked on a busy scene */
+   int64_t setup_scene_stall_time;  /**< total, in microseconds */
+   unsigned nr_rast_scene_waits;    /**< rasterizer waited for binning */
+   int64_t rast_scene_wait_time;    /**< total, in microseconds */
+   int64_t rast_idle_time;          /**< including between frames */
+
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
    unsigned nr_color_tile_store;
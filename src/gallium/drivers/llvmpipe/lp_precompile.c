@@ -0,0 +1,374 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Recording and replay of shader lists, see lp_precompile.h.
+ *
+ * A shader list is a sequence of records, each holding the IR of a shader as
+ * it is hashed for the disk cache followed by a variant key. Records are
+ * appended with a single write so that any number of processes can record
+ * to the same list.
+ */
+
+#include <stdio.h>
+
+#include "util/blob.h"
+#include "util/disk_cache.h"
+#include "util/hash_table.h"
+#include "util/mesa-sha1.h"
+#include "util/os_file.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "util/u_queue.h"
+#include "tgsi/tgsi_parse.h"
+#include "nir.h"
+#include "nir_serialize.h"
+
+#include "lp_context.h"
+#include "lp_precompile.h"
+#include "lp_screen.h"
+#include "lp_state_cs.h"
+#include "lp_state_fs.h"
+
+#define LP_SHADER_LIST_MAGIC 0x4c53504c /* "LPSL" */
+
+struct lp_shader_list_record
+{
+   uint32_t magic;
+   /* Variant keys are only meaningful to the build that recorded them. */
+   uint8_t build_id[20];
+   uint32_t stage;
+   uint32_t ir_type;
+   /* pipe_compute_state::req_local_mem, 0 for fragment shaders */
+   uint32_t req_local_mem;
+   uint32_t ir_size;
+   uint32_t key_size;
+   /* followed by ir_size bytes of IR and key_size bytes of key */
+};
+
+struct lp_precompile_job
+{
+   enum pipe_shader_type stage;
+   enum pipe_shader_ir ir_type;
+   unsigned req_local_mem;
+   const void *ir;
+   size_t ir_size;
+   const void *key;
+   size_t key_size;
+};
+
+/* The replay of the list named by LP_PRECOMPILE, in the background. */
+struct lp_precompile
+{
+   struct llvmpipe_screen *screen;
+   struct util_queue queue;
+   struct util_queue_fence load_fence;
+   /* created by each queue thread on its first job */
+   struct llvmpipe_context **contexts;
+   unsigned num_threads;
+   struct lp_precompile_job *jobs;
+   char *list;
+};
+
+
+static bool
+get_build_id(uint8_t build_id[20])
+{
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   if (!disk_cache_get_function_identifier(lp_shader_list_record, &ctx))
+      return false;
+   _mesa_sha1_final(&ctx, build_id);
+
+   return true;
+}
+
+
+void
+lp_shader_list_init(struct llvmpipe_screen *screen)
+{
+   const char *filename = debug_get_option("LP_SHADER_LIST", NULL);
+
+   if (!filename || !get_build_id(screen->shader_list_build_id))
+      return;
+
+   screen->shader_list = fopen(filename, "ab");
+   if (!screen->shader_list) {
+      debug_printf("llvmpipe: failed to open shader list %s\n", filename);
+      return;
+   }
+
+   /* Each record must go out in a single write(). */
+   setvbuf(screen->shader_list, NULL, _IONBF, 0);
+
+   (void) mtx_init(&screen->shader_list_mutex, mtx_plain);
+   screen->shader_list_keys = _mesa_hash_table_u64_create(NULL);
+}
+
+
+void
+lp_shader_list_fini(struct llvmpipe_screen *screen)
+{
+   if (!screen->shader_list)
+      return;
+
+   _mesa_hash_table_u64_destroy(screen->shader_list_keys);
+   mtx_destroy(&screen->shader_list_mutex);
+   fclose(screen->shader_list);
+}
+
+
+/**
+ * Append a shader variant to the shader list, unless it was recorded
+ * already.  Called with the IR of the shader in the state it is hashed in
+ * for the disk cache, so that replaying the record computes the same key.
+ */
+void
+lp_shader_list_record(struct llvmpipe_screen *screen,
+                      enum pipe_shader_type stage,
+                      const struct pipe_shader_state *base,
+                      unsigned req_local_mem,
+                      const void *key, size_t key_size,
+                      const unsigned char ir_sha1_cache_key[20])
+{
+   struct lp_shader_list_record record;
+   struct blob blob;
+   uint64_t hash;
+
+   if (!screen->shader_list)
+      return;
+
+   memcpy(&hash, ir_sha1_cache_key, sizeof(hash));
+
+   mtx_lock(&screen->shader_list_mutex);
+   bool recorded = _mesa_hash_table_u64_search(screen->shader_list_keys, hash);
+   if (!recorded)
+      _mesa_hash_table_u64_insert(screen->shader_list_keys, hash, (void *)1);
+   mtx_unlock(&screen->shader_list_mutex);
+
+   if (recorded)
+      return;
+
+   memset(&record, 0, sizeof(record));
+   record.magic = LP_SHADER_LIST_MAGIC;
+   memcpy(record.build_id, screen->shader_list_build_id,
+          sizeof(record.build_id));
+   record.stage = stage;
+   record.ir_type = base->type;
+   record.req_local_mem = req_local_mem;
+   record.key_size = key_size;
+
+   blob_init(&blob);
+   blob_write_bytes(&blob, &record, sizeof(record));
+
+   if (base->type == PIPE_SHADER_IR_TGSI) {
+      blob_write_bytes(&blob, base->tokens,
+                       tgsi_num_tokens(base->tokens) *
+                       sizeof(struct tgsi_token));
+   } else {
+      nir_serialize(&blob, base->ir.nir, true);
+   }
+
+   record.ir_size = blob.size - sizeof(record);
+   blob_overwrite_bytes(&blob, 0, &record, sizeof(record));
+   blob_write_bytes(&blob, key, key_size);
+
+   if (!blob.out_of_memory)
+      fwrite(blob.data, 1, blob.size, screen->shader_list);
+
+   blob_finish(&blob);
+}
+
+
+static void
+precompile_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_precompile_job *job = (struct lp_precompile_job *)data;
+   struct lp_precompile *pre = (struct lp_precompile *)gdata;
+   struct llvmpipe_context *lp = pre->contexts[thread_index];
+   struct pipe_screen *screen = &pre->screen->base;
+   struct pipe_shader_state state;
+   void *key;
+
+   if (!lp) {
+      struct pipe_context *pipe = screen->context_create(screen, NULL, 0);
+      if (!pipe)
+         return;
+      lp = pre->contexts[thread_index] = llvmpipe_context(pipe);
+   }
+
+   memset(&state, 0, sizeof(state));
+   state.type = job->ir_type;
+
+   if (job->ir_type == PIPE_SHADER_IR_TGSI) {
+      state.tokens = job->ir;
+   } else {
+      struct blob_reader reader;
+      const nir_shader_compiler_options *options =
+         screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR, job->stage);
+
+      blob_reader_init(&reader, job->ir, job->ir_size);
+      state.ir.nir = nir_deserialize(NULL, options, &reader);
+      if (!state.ir.nir)
+         return;
+   }
+
+   /* The key is read in place, so it needs to be aligned. */
+   key = MALLOC(job->key_size);
+   if (key) {
+      memcpy(key, job->key, job->key_size);
+
+      if (job->stage == PIPE_SHADER_FRAGMENT)
+         llvmpipe_precompile_fs_variant(lp, &state, key, job->key_size);
+      else
+         llvmpipe_precompile_cs_variant(lp, &state, job->req_local_mem,
+                                        key, job->key_size);
+
+      FREE(key);
+   } else if (state.ir.nir) {
+      ralloc_free(state.ir.nir);
+   }
+}
+
+
+/**
+ * Read the shader list and queue a compile job for each of its records
+ * made by this build.
+ */
+static void
+precompile_load(void *data, void *gdata, int thread_index)
+{
+   struct lp_precompile *pre = (struct lp_precompile *)data;
+   const char *filename = debug_get_option("LP_PRECOMPILE", NULL);
+   uint8_t build_id[20];
+   unsigned num_jobs = 0;
+   size_t size;
+
+   if (!get_build_id(build_id))
+      return;
+
+   pre->list = os_read_file(filename, &size);
+   if (!pre->list) {
+      debug_printf("llvmpipe: failed to read shader list %s\n", filename);
+      return;
+   }
+
+   /* Records are variable sized, so count them first. */
+   for (unsigned pass = 0; pass < 2; pass++) {
+      size_t offset = 0;
+
+      num_jobs = 0;
+      while (size - offset >= sizeof(struct lp_shader_list_record)) {
+         struct lp_shader_list_record record;
+         memcpy(&record, pre->list + offset, sizeof(record));
+         offset += sizeof(record);
+
+         if (record.magic != LP_SHADER_LIST_MAGIC ||
+             record.ir_size > size - offset ||
+             record.key_size > size - offset - record.ir_size)
+            break;
+
+         if (!memcmp(record.build_id, build_id, sizeof(build_id)) &&
+             (record.stage == PIPE_SHADER_FRAGMENT ||
+              record.stage == PIPE_SHADER_COMPUTE) &&
+             (record.ir_type == PIPE_SHADER_IR_TGSI ||
+              record.ir_type == PIPE_SHADER_IR_NIR)) {
+            if (pre->jobs) {
+               struct lp_precompile_job *job = &pre->jobs[num_jobs];
+               job->stage = record.stage;
+               job->ir_type = record.ir_type;
+               job->req_local_mem = record.req_local_mem;
+               job->ir = pre->list + offset;
+               job->ir_size = record.ir_size;
+               job->key = pre->list + offset + record.ir_size;
+               job->key_size = record.key_size;
+            }
+            num_jobs++;
+         }
+
+         offset += record.ir_size + record.key_size;
+      }
+
+      if (!num_jobs || pre->jobs)
+         break;
+
+      pre->jobs = CALLOC(num_jobs, sizeof(*pre->jobs));
+      if (!pre->jobs)
+         return;
+   }
+
+   for (unsigned i = 0; i < num_jobs; i++)
+      util_queue_add_job(&pre->queue, &pre->jobs[i], NULL,
+                         precompile_execute, NULL, 0);
+}
+
+
+/**
+ * Start compiling every shader variant of the list named by LP_PRECOMPILE,
+ * which stores them in the disk cache.  This doesn't wait for the compiles,
+ * which run on the minimum priority worker pool with a context each, up to
+ * one per CPU; lp_precompile_finish() does.
+ */
+void
+lp_precompile_shader_list(struct llvmpipe_screen *screen)
+{
+   struct lp_precompile *pre;
+
+   if (!debug_get_option("LP_PRECOMPILE", NULL))
+      return;
+
+   pre = CALLOC_STRUCT(lp_precompile);
+   if (!pre)
+      return;
+
+   pre->screen = screen;
+   pre->num_threads = MAX2(util_get_cpu_caps()->nr_cpus, 1);
+   pre->contexts = CALLOC(pre->num_threads, sizeof(*pre->contexts));
+   if (!pre->contexts ||
+       !util_queue_init(&pre->queue, "lppre", 64, pre->num_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                        UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY |
+                        UTIL_QUEUE_INIT_SHARED_THREADS, pre)) {
+      FREE(pre->contexts);
+      FREE(pre);
+      return;
+   }
+
+   util_queue_fence_init(&pre->load_fence);
+   util_queue_add_job(&pre->queue, pre, &pre->load_fence,
+                      precompile_load, NULL, 0);
+   screen->precompile = pre;
+}
+
+
+/**
+ * Wait for the shader list replay to finish, so that a program which just
+ * creates and destroys a screen precompiles the whole list.
+ */
+void
+lp_precompile_finish(struct llvmpipe_screen *screen)
+{
+   struct lp_precompile *pre = screen->precompile;
+
+   if (!pre)
+      return;
+
+   /* The compile jobs are only queued once the list is loaded. */
+   util_queue_fence_wait(&pre->load_fence);
+   util_queue_finish(&pre->queue);
+   util_queue_destroy(&pre->queue);
+   util_queue_fence_destroy(&pre->load_fence);
+
+   for (unsigned i = 0; i < pre->num_threads; i++) {
+      if (pre->contexts[i])
+         pre->contexts[i]->pipe.destroy(&pre->contexts[i]->pipe);
+   }
+   FREE(pre->contexts);
+   FREE(pre->jobs);
+   free(pre->list);
+   FREE(pre);
+   screen->precompile = NULL;
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Shader lists: every fragment and compute shader variant llvmpipe compiles
+ * can be recorded, with its variant key, to the file named by LP_SHADER_LIST.
+ * Setting LP_PRECOMPILE to such a file makes the next screen compile all of
+ * them in the background, on low priority threads, which fills the disk
+ * shader cache ahead of time.  Destroying the screen waits for them.
+ *
+ * The disk cache of llvmpipe is specific to the binary it is linked into, so
+ * the replay is done by the driver itself rather than a separate program:
+ * any program which creates a screen with the driver that should use the
+ * cache can be used to precompile, e.g. vulkaninfo for lavapipe.
+ */
+
+#ifndef LP_PRECOMPILE_H
+#define LP_PRECOMPILE_H
+
+#include "pipe/p_defines.h"
+#include "pipe/p_state.h"
+
+struct llvmpipe_screen;
+
+void
+lp_shader_list_init(struct llvmpipe_screen *screen);
+
+void
+lp_shader_list_fini(struct llvmpipe_screen *screen);
+
+void
+lp_shader_list_record(struct llvmpipe_screen *screen,
+                      enum pipe_shader_type stage,
+                      const struct pipe_shader_state *base,
+                      unsigned req_local_mem,
+                      const void *key, size_t key_size,
+                      const unsigned char ir_sha1_cache_key[20]);
+
+void
+lp_precompile_shader_list(struct llvmpipe_screen *screen);
+
+void
+lp_precompile_finish(struct llvmpipe_screen *screen);
+
+#endif /* LP_PRECOMPILE_H */
@@ -32,6 +32,7 @@
 #include "util/u_surface.h"
 #include "util/u_pack_color.h"
 #include "util/u_string.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_thread.h"
 #include "util/u_memset.h"
 #include "util/os_time.h"
@@ -1180,6 +1181,53 @@ lp_rast_finish( struct lp_rasterizer *rast )
 }
 
 
+DEBUG_GET_ONCE_BOOL_OPTION(no_affinity, "LP_NO_AFFINITY", FALSE)
+
+/**
+ * On machines with several L3 caches (typically one per CCX or NUMA node),
+ * spread the rasterizer threads across them and re-allocate the thread's
+ * private data from the thread itself.  With the usual first-touch policy
+ * that puts it into memory local to the node running the thread.
+ *
+ * Threads are left alone when the process may not run on the whole L3
+ * domain, e.g. in a restricted cpuset or when the application manages
+ * affinity itself, and with LP_NO_AFFINITY.
+ */
+static void
+bind_rast_thread(struct lp_rasterizer_task *task)
+{
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   struct lp_build_format_cache *cache;
+   util_affinity_mask old_mask;
+   const uint32_t *mask;
+   unsigned i;
+
+   if (caps->num_L3_caches <= 1 || task->rast->num_threads <= 1 ||
+       debug_get_option_no_affinity())
+      return;
+
+   mask = caps->L3_affinity_mask[task->thread_index % caps->num_L3_caches];
+   if (!util_set_current_thread_affinity(mask, old_mask,
+                                         caps->num_cpu_mask_bits))
+      return;
+
+   for (i = 0; i < caps->num_cpu_mask_bits / 32; i++) {
+      if (mask[i] & ~old_mask[i]) {
+         util_set_current_thread_affinity(old_mask, NULL,
+                                          caps->num_cpu_mask_bits);
+         return;
+      }
+   }
+
+   cache = align_malloc(sizeof *cache, 16);
+   if (cache) {
+      memset(cache, 0, sizeof *cache);
+      align_free(task->thread_data.cache);
+      task->thread_data.cache = cache;
+   }
+}
+
+
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
@@ -1205,22 +1253,44 @@ thread_function(void *init_data)
    fpstate = util_fpstate_get();
    util_fpstate_set_denorms_to_zero(fpstate);
 
+   bind_rast_thread(task);
+
    while (1) {
+      int64_t idle_start = 0;
+
       /* wait for work */
       if (debug)
          debug_printf("thread %d waiting for work\n", task->thread_index);
+      if (LP_DEBUG & DEBUG_COUNTERS)
+         idle_start = os_time_get();
       pipe_semaphore_wait(&task->work_ready);
 
       if (rast->exit_flag)
          break;
 
       if (task->thread_index == 0) {
+         struct lp_scene *scene = lp_scene_dequeue( rast->full_scenes, TRUE );
+
+         /* Track how long the rasterizer sat idle, and which part of that
+          * it was waiting for setup to finish binning the scene rather
+          * than for the application to start the next one.
+          */
+         if (LP_DEBUG & DEBUG_COUNTERS) {
+            int64_t now = os_time_get();
+            int64_t starved = now - MAX2(idle_start, scene->binning_start);
+
+            LP_COUNT_ADD(rast_idle_time, now - idle_start);
+            if (starved > 0) {
+               LP_COUNT(nr_rast_scene_waits);
+               LP_COUNT_ADD(rast_scene_wait_time, starved);
+            }
+         }
+
          /* thread[0]:
           *  - get next scene to rasterize
           *  - map the framebuffer surfaces
           */
-         lp_rast_begin( rast, 
-                        lp_scene_dequeue( rast->full_scenes, TRUE ) );
+         lp_rast_begin( rast, scene );
       }
 
       /* Wait for all threads to get here so that threads[1+] don't
@@ -1303,6 +1373,18 @@ lp_rast_create( unsigned num_threads )
       goto no_full_scenes;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof *rast->tasks);
+   if (!rast->tasks) {
+      goto no_tasks;
+   }
+
+   if (num_threads) {
+      rast->threads = CALLOC(num_threads, sizeof *rast->threads);
+      if (!rast->threads) {
+         goto no_thread_data_cache;
+      }
+   }
+
    for (i = 0; i < MAX2(1, num_threads); i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
@@ -1330,12 +1412,15 @@ lp_rast_create( unsigned num_threads )
    return rast;
 
 no_thread_data_cache:
-   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
    }
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
+no_tasks:
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
    FREE(rast);
@@ -1391,6 +1476,8 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
@@ -26,9 +26,11 @@
  **************************************************************************/
 
 #include "util/u_framebuffer.h"
+#include "util/u_atomic.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_inlines.h"
+#include "util/os_time.h"
 #include "util/simple_list.h"
 #include "util/format/u_format.h"
 #include "lp_scene.h"
@@ -73,8 +75,6 @@ lp_scene_create( struct lp_setup_context *setup )
    scene->setup = setup;
    scene->data.head = &scene->data.first;
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
-
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
    {
@@ -101,8 +101,8 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_scene_end_rasterization(scene);
-   mtx_destroy(&scene->mutex);
    assert(scene->data.head == &scene->data.first);
+   FREE(scene->bin_order);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
 
@@ -547,61 +547,103 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/**
+ * Estimate the cost of rasterizing a bin from the number of commands
+ * binned into it.
+ */
+static unsigned
+bin_cost(const struct cmd_bin *bin)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
-   }
-   return TRUE;
+   const struct cmd_block *block;
+   unsigned cost = 0;
+
+   for (block = bin->head; block; block = block->next)
+      cost += block->count;
+
+   return cost;
 }
 
 
+static int
+compare_bin_cost(const void *a, const void *b)
+{
+   const struct bin_order_entry *ea = a;
+   const struct bin_order_entry *eb = b;
+
+   if (ea->cost != eb->cost)
+      return ea->cost > eb->cost ? -1 : 1;
+
+   /* keep raster order between bins of equal cost */
+   if (ea->y != eb->y)
+      return ea->y < eb->y ? -1 : 1;
+   return ea->x < eb->x ? -1 : (ea->x > eb->x);
+}
+
+
+/**
+ * Prepare the bin iterator.  Called by a single thread before any
+ * rasterizer thread calls lp_scene_bin_iter_next().
+ *
+ * Empty bins are left out and the rest are sorted so that the most
+ * expensive tiles are started first, which shortens the tail of the
+ * scene when there are more bins than threads.
+ */
 void
 lp_scene_bin_iter_begin( struct lp_scene *scene )
 {
-   scene->curr_x = scene->curr_y = -1;
+   unsigned x, y, n = 0;
+
+   scene->curr_bin = 0;
+
+   if (!scene->bin_order) {
+      scene->num_ordered_bins = scene->tiles_x * scene->tiles_y;
+      return;
+   }
+
+   for (y = 0; y < scene->tiles_y; y++) {
+      for (x = 0; x < scene->tiles_x; x++) {
+         const struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+
+         if (bin->head) {
+            scene->bin_order[n].x = x;
+            scene->bin_order[n].y = y;
+            scene->bin_order[n].cost = bin_cost(bin);
+            n++;
+         }
+      }
+   }
+
+   if (n > 1)
+      qsort(scene->bin_order, n, sizeof(scene->bin_order[0]),
+            compare_bin_cost);
+
+   scene->num_ordered_bins = n;
 }
 
 
 /**
  * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  Bins are claimed with an atomic
+ * increment of lp_scene::curr_bin, so no lock is needed.
  */
 struct cmd_bin *
 lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
 {
-   struct cmd_bin *bin = NULL;
+   unsigned i = p_atomic_inc_return(&scene->curr_bin) - 1;
 
-   mtx_lock(&scene->mutex);
+   if (i >= scene->num_ordered_bins)
+      return NULL;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
+   if (scene->bin_order) {
+      *x = scene->bin_order[i].x;
+      *y = scene->bin_order[i].y;
+   } else {
+      *x = i % scene->tiles_x;
+      *y = i / scene->tiles_x;
    }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
-
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   return lp_scene_get_bin(scene, *x, *y);
 }
 
 
@@ -620,6 +662,18 @@ void lp_scene_begin_binning(struct lp_scene *scene,
    assert(scene->tiles_x <= TILES_X);
    assert(scene->tiles_y <= TILES_Y);
 
+   if (LP_DEBUG & DEBUG_COUNTERS)
+      scene->binning_start = os_time_get();
+
+   if (scene->bin_order_size < scene->tiles_x * scene->tiles_y) {
+      FREE(scene->bin_order);
+      scene->bin_order_size = scene->tiles_x * scene->tiles_y;
+      scene->bin_order = MALLOC(scene->bin_order_size *
+                                sizeof(scene->bin_order[0]));
+      if (!scene->bin_order)
+         scene->bin_order_size = 0;
+   }
+
    /*
     * Determine how many layers the fb has (used for clamping layer value).
     * OpenGL (but not d3d10) permits different amount of layers per rt, however
@@ -188,14 +188,29 @@ struct lp_scene {
    boolean alloc_failed;
    boolean permit_linear_rasterizer;
 
+   /** When setup started binning the scene, with LP_DEBUG=counters */
+   int64_t binning_start;
+
    /**
     * Number of active tiles in each dimension.
     * This basically the framebuffer size divided by tile size
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /**
+    * Non-empty bins in the order rasterizer threads should pick them up,
+    * most expensive first.  Filled by lp_scene_bin_iter_begin() and
+    * handed out by lp_scene_bin_iter_next() through an atomic counter.
+    * Allocated by lp_scene_begin_binning() for the framebuffer size; if
+    * that fails all bins are handed out in raster order.
+    */
+   struct bin_order_entry {
+      uint16_t x, y;
+      unsigned cost;
+   } *bin_order;
+   unsigned bin_order_size;
+   unsigned num_ordered_bins;
+   unsigned curr_bin;  /**< for iterating over bins */
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
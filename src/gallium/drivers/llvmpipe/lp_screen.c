@@ -51,6 +51,7 @@
 #include "lp_limits.h"
 #include "lp_rast.h"
 #include "lp_cs_tpool.h"
+#include "lp_precompile.h"
 
 #include "frontend/sw_winsys.h"
 
@@ -842,9 +843,14 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
    struct sw_winsys *winsys = screen->winsys;
 
+   lp_precompile_finish(screen);
+
    if (screen->cs_tpool)
       lp_cs_tpool_destroy(screen->cs_tpool);
 
+   if (util_queue_is_initialized(&screen->fs_compile_queue))
+      util_queue_destroy(&screen->fs_compile_queue);
+
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
@@ -854,6 +860,7 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
       printf("disk shader cache:   hits = %u, misses = %u\n", screen->num_disk_shader_cache_hits,
              screen->num_disk_shader_cache_misses);
    disk_cache_destroy(screen->disk_shader_cache);
+   lp_shader_list_fini(screen);
    if(winsys->destroy)
       winsys->destroy(winsys);
 
@@ -916,10 +923,10 @@ static void update_cache_sha1_cpu(struct mesa_sha1 *ctx)
    const struct util_cpu_caps_t *cpu_caps = util_get_cpu_caps();
    /*
     * Don't need the cpu cache affinity stuff. The rest
-    * is contained in first 5 dwords.
+    * is contained in first 6 dwords.
     */
-   STATIC_ASSERT(offsetof(struct util_cpu_caps_t, num_L3_caches) == 5 * sizeof(uint32_t));
-   _mesa_sha1_update(ctx, cpu_caps, 5 * sizeof(uint32_t));
+   STATIC_ASSERT(offsetof(struct util_cpu_caps_t, num_L3_caches) == 6 * sizeof(uint32_t));
+   _mesa_sha1_update(ctx, cpu_caps, 6 * sizeof(uint32_t));
 }
 
 static void lp_disk_cache_create(struct llvmpipe_screen *screen)
@@ -1005,6 +1012,15 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
       goto out;
    }
 
+   if (screen->num_fs_compile_threads &&
+       !util_queue_init(&screen->fs_compile_queue, "lpfs", 64,
+                        screen->num_fs_compile_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                        UTIL_QUEUE_INIT_SHARED_THREADS, NULL)) {
+      /* Keep compiling optimized variants on the calling thread */
+      screen->num_fs_compile_threads = 0;
+   }
+
    lp_disk_cache_create(screen);
    screen->late_init_done = true;
 out:
@@ -1077,6 +1093,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 #endif
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS", screen->num_threads);
    screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
+   screen->num_fs_compile_threads = debug_get_num_option("LP_FS_COMPILE_THREADS", 0);
 
    lp_build_init(); /* get lp_native_vector_width initialised */
 
@@ -1087,5 +1104,8 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 
    (void) mtx_init(&screen->late_mutex, mtx_plain);
 
+   lp_shader_list_init(screen);
+   lp_precompile_shader_list(screen);
+
    return &screen->base;
 }
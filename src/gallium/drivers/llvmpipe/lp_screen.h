@@ -39,6 +39,7 @@
 #include "os/os_thread.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
+#include "util/u_queue.h"
 
 struct sw_winsys;
 struct lp_cs_tpool;
@@ -61,6 +62,12 @@ struct llvmpipe_screen
    struct lp_cs_tpool *cs_tpool;
    mtx_t cs_mutex;
 
+   /* Optimized fragment shader variants are compiled here with
+    * LP_FS_COMPILE_THREADS, see generate_variant()
+    */
+   struct util_queue fs_compile_queue;
+   unsigned num_fs_compile_threads;
+
    bool use_tgsi;
    bool allow_cl;
 
@@ -72,6 +79,14 @@ struct llvmpipe_screen
    struct disk_cache *disk_shader_cache;
    unsigned num_disk_shader_cache_hits;
    unsigned num_disk_shader_cache_misses;
+
+   /* Shader list recorded to with LP_SHADER_LIST, see lp_precompile.h */
+   FILE *shader_list;
+   mtx_t shader_list_mutex;
+   struct hash_table_u64 *shader_list_keys;
+   uint8_t shader_list_build_id[20];
+   /* Replay of LP_PRECOMPILE, see lp_precompile.h */
+   struct lp_precompile *precompile;
 };
 
 void lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
@@ -49,6 +49,7 @@
 #include "lp_texture.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
+#include "lp_perf.h"
 #include "lp_query.h"
 #include "lp_rast.h"
 #include "lp_setup_context.h"
@@ -65,17 +66,42 @@ static boolean set_scene_state( struct lp_setup_context *, enum setup_state,
                              const char *reason);
 static boolean try_update_scene_state( struct lp_setup_context *setup );
 
+/**
+ * Block until the oldest scene handed to the rasterizer is done and
+ * return its index.  Waiting on the oldest fence rather than on an
+ * arbitrary scene keeps the remaining scenes in flight.
+ */
 static unsigned
 lp_setup_wait_empty_scene(struct lp_setup_context *setup)
 {
-   /* just use the first scene if we run out */
-   if (setup->scenes[0]->fence) {
-      debug_printf("%s: wait for scene %d\n",
-                   __FUNCTION__, setup->scenes[0]->fence->id);
-      lp_fence_wait(setup->scenes[0]->fence);
-      lp_scene_end_rasterization(setup->scenes[0]);
+   struct lp_scene *scene;
+   unsigned i, oldest = 0;
+   int64_t start = 0;
+
+   for (i = 0; i < setup->num_active_scenes; i++) {
+      struct lp_fence *fence = setup->scenes[i]->fence;
+      if (fence && (!setup->scenes[oldest]->fence ||
+                    (int)(fence->id - setup->scenes[oldest]->fence->id) < 0))
+         oldest = i;
    }
-   return 0;
+
+   scene = setup->scenes[oldest];
+   if (scene->fence) {
+      LP_DBG(DEBUG_SETUP, "%s: wait for scene %d\n",
+             __FUNCTION__, scene->fence->id);
+
+      if (LP_DEBUG & DEBUG_COUNTERS)
+         start = os_time_get();
+
+      lp_fence_wait(scene->fence);
+
+      LP_COUNT(nr_setup_scene_stalls);
+      if (LP_DEBUG & DEBUG_COUNTERS)
+         LP_COUNT_ADD(setup_scene_stall_time, os_time_get() - start);
+
+      lp_scene_end_rasterization(scene);
+   }
+   return oldest;
 }
 
 static void
@@ -95,11 +121,13 @@ lp_setup_get_empty_scene(struct lp_setup_context *setup)
          break;
    }
 
-   if (setup->num_active_scenes + 1 > MAX_SCENES)
-      i = lp_setup_wait_empty_scene(setup);
-   else if (i == setup->num_active_scenes) {
-      /* allocate a new scene */
-      struct lp_scene *scene = lp_scene_create(setup);
+   if (i == setup->num_active_scenes) {
+      struct lp_scene *scene = NULL;
+
+      /* allocate a new scene, unless the pipeline is already full */
+      if (setup->num_active_scenes < setup->max_scenes)
+         scene = lp_scene_create(setup);
+
       if (!scene) {
          /* block and reuse scenes */
          i = lp_setup_wait_empty_scene(setup);
@@ -111,6 +139,8 @@ lp_setup_get_empty_scene(struct lp_setup_context *setup)
       }
    }
 
+   LP_COUNT(nr_scenes);
+
    setup->scene = setup->scenes[i];
    setup->scene->permit_linear_rasterizer = setup->permit_linear_rasterizer;
    lp_scene_begin_binning(setup->scene, &setup->fb);
@@ -1618,6 +1648,8 @@ lp_setup_create( struct pipe_context *pipe,
 
 
    setup->num_threads = screen->num_threads;
+   setup->max_scenes = CLAMP(debug_get_num_option("LP_MAX_SCENES", MAX_SCENES),
+                             1, MAX_SCENES);
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
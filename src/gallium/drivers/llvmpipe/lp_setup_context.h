@@ -93,6 +93,7 @@ struct lp_setup_context
 
    struct slab_mempool scene_slab;
    int num_active_scenes;
+   int max_scenes;     /**< scenes in flight before binning blocks */
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
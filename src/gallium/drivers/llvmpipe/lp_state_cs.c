@@ -45,6 +45,7 @@
 #include "lp_memory.h"
 #include "lp_query.h"
 #include "lp_cs_tpool.h"
+#include "lp_precompile.h"
 #include "frontend/sw_winsys.h"
 #include "nir/nir_to_tgsi_info.h"
 #include "util/mesa-sha1.h"
@@ -716,22 +717,26 @@ static void
 lp_cs_get_ir_cache_key(struct lp_compute_shader_variant *variant,
                        unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
+   const struct pipe_shader_state *base = &variant->shader->base;
    struct mesa_sha1 ctx;
+
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, &variant->key, variant->shader->variant_key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
-   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
 
-   blob_finish(&blob);
+   if (base->type == PIPE_SHADER_IR_TGSI) {
+      _mesa_sha1_update(&ctx, base->tokens,
+                        tgsi_num_tokens(base->tokens) *
+                        sizeof(struct tgsi_token));
+   } else {
+      struct blob blob = { 0 };
+
+      blob_init(&blob);
+      nir_serialize(&blob, base->ir.nir, true);
+      _mesa_sha1_update(&ctx, blob.data, blob.size);
+      blob_finish(&blob);
+   }
+
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
 }
 
 static struct lp_compute_shader_variant *
@@ -756,8 +761,12 @@ generate_variant(struct llvmpipe_context *lp,
    variant->shader = shader;
    memcpy(&variant->key, key, shader->variant_key_size);
 
-   if (shader->base.ir.nir) {
+   if (shader->base.ir.nir || shader->base.type == PIPE_SHADER_IR_TGSI) {
       lp_cs_get_ir_cache_key(variant, ir_sha1_cache_key);
+      lp_shader_list_record(screen, PIPE_SHADER_COMPUTE, &shader->base,
+                            shader->req_local_mem,
+                            key, shader->variant_key_size,
+                            ir_sha1_cache_key);
 
       lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
       if (!cached.data_size)
@@ -797,6 +806,49 @@ generate_variant(struct llvmpipe_context *lp,
    return variant;
 }
 
+/**
+ * Create a shader from a shader list record and compile the variant for
+ * the given key, which puts it into the disk cache.
+ */
+bool
+llvmpipe_precompile_cs_variant(struct llvmpipe_context *lp,
+                               const struct pipe_shader_state *templ,
+                               unsigned req_local_mem,
+                               const void *key, size_t key_size)
+{
+   struct pipe_compute_state cs_templ;
+   struct lp_compute_shader *shader;
+   struct lp_compute_shader_variant *variant = NULL;
+
+   memset(&cs_templ, 0, sizeof(cs_templ));
+   cs_templ.ir_type = templ->type;
+   cs_templ.prog = templ->type == PIPE_SHADER_IR_TGSI ?
+      (const void *)templ->tokens : templ->ir.nir;
+
+   shader = llvmpipe_create_compute_state(&lp->pipe, &cs_templ);
+   if (!shader) {
+      if (templ->type == PIPE_SHADER_IR_NIR)
+         ralloc_free(templ->ir.nir);
+      return false;
+   }
+
+   /* The recorded size already includes the shared memory of the NIR. */
+   shader->req_local_mem = req_local_mem;
+
+   if (shader->variant_key_size == key_size)
+      variant = generate_variant(lp, shader, key);
+
+   /* The variant was never added to the variant lists. */
+   if (variant) {
+      gallivm_destroy(variant->gallivm);
+      FREE(variant);
+   }
+
+   llvmpipe_delete_compute_state(&lp->pipe, shader);
+
+   return variant != NULL;
+}
+
 static void
 lp_cs_ctx_set_cs_variant( struct lp_cs_context *csctx,
                           struct lp_compute_shader_variant *variant)
@@ -155,4 +155,12 @@ struct lp_cs_context {
 struct lp_cs_context *lp_csctx_create(struct pipe_context *pipe);
 void lp_csctx_destroy(struct lp_cs_context *csctx);
 
+struct llvmpipe_context;
+
+bool
+llvmpipe_precompile_cs_variant(struct llvmpipe_context *lp,
+                               const struct pipe_shader_state *templ,
+                               unsigned req_local_mem,
+                               const void *key, size_t key_size);
+
 #endif
@@ -259,6 +259,12 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
       llvmpipe->dirty |= LP_NEW_SAMPLER_VIEW;
    }
 
+   /* Switch to the optimized fs variant once it has been compiled.
+    */
+   if (llvmpipe->fs_variant_optimized &&
+       util_queue_fence_is_signalled(&llvmpipe->fs_variant_optimized->compiled))
+      llvmpipe->dirty |= LP_NEW_FS;
+
    /* This needs LP_NEW_RASTERIZER because of draw_prepare_shader_outputs(). */
    if (llvmpipe->dirty & (LP_NEW_RASTERIZER |
                           LP_NEW_FS |
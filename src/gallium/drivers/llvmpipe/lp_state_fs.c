@@ -108,6 +108,7 @@
 #include "nir/nir_to_tgsi_info.h"
 
 #include "lp_screen.h"
+#include "lp_precompile.h"
 #include "compiler/nir/nir_serialize.h"
 #include "util/mesa-sha1.h"
 /** Fragment shader number (for debugging) */
@@ -549,6 +550,7 @@ static void fs_fb_fetch(const struct lp_build_fs_iface *iface,
 static void
 generate_fs_loop(struct gallivm_state *gallivm,
                  struct lp_fragment_shader *shader,
+                 struct nir_shader *nir,
                  const struct lp_fragment_shader_variant_key *key,
                  LLVMBuilderRef builder,
                  struct lp_type type,
@@ -972,7 +974,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
       lp_build_tgsi_soa(gallivm, tokens, &params,
                         outputs);
    else
-      lp_build_nir_soa(gallivm, shader->base.ir.nir, &params,
+      lp_build_nir_soa(gallivm, nir, &params,
                        outputs);
 
    /* Alpha test */
@@ -2966,6 +2968,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
 static void
 generate_fragment(struct llvmpipe_context *lp,
                   struct lp_fragment_shader *shader,
+                  struct nir_shader *nir,
                   struct lp_fragment_shader_variant *variant,
                   unsigned partial_mask)
 {
@@ -3251,7 +3254,7 @@ generate_fragment(struct llvmpipe_context *lp,
       }
 
       generate_fs_loop(gallivm,
-                       shader, key,
+                       shader, nir, key,
                        builder,
                        fs_type,
                        context_ptr,
@@ -3519,46 +3522,65 @@ lp_debug_fs_variant(struct lp_fragment_shader_variant *variant)
 }
 
 static void
-lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
-                            unsigned char ir_sha1_cache_key[20])
+lp_fs_get_ir_cache_key(struct lp_fragment_shader *shader,
+                       const struct lp_fragment_shader_variant_key *key,
+                       unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
+   const struct pipe_shader_state *base = &shader->base;
    struct mesa_sha1 ctx;
+
    _mesa_sha1_init(&ctx);
-   _mesa_sha1_update(&ctx, &variant->key, variant->shader->variant_key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
-   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+   _mesa_sha1_update(&ctx, key, shader->variant_key_size);
 
-   blob_finish(&blob);
+   if (base->type == PIPE_SHADER_IR_TGSI) {
+      _mesa_sha1_update(&ctx, base->tokens,
+                        tgsi_num_tokens(base->tokens) *
+                        sizeof(struct tgsi_token));
+   } else {
+      struct blob blob = { 0 };
+
+      blob_init(&blob);
+      nir_serialize(&blob, base->ir.nir, true);
+      _mesa_sha1_update(&ctx, blob.data, blob.size);
+      blob_finish(&blob);
+   }
+
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
 }
 
 /**
- * Generate a new fragment shader variant from the shader code and
- * other state indicated by the key.
+ * State needed to generate the code of a variant, which may happen on the
+ * fs compile queue.
+ */
+struct lp_fs_compile_job
+{
+   struct llvmpipe_context *lp;
+   struct lp_fragment_shader_variant *variant;
+   struct nir_shader *nir;
+   struct lp_cached_code cached;
+   unsigned char ir_sha1_cache_key[20];
+   bool needs_caching;
+   boolean fullcolormask;
+   boolean linear;
+};
+
+
+/**
+ * Create a variant from the shader and the key, and derive everything
+ * setup needs to bin primitives, without generating any code yet.
  */
 static struct lp_fragment_shader_variant *
-generate_variant(struct llvmpipe_context *lp,
-                 struct lp_fragment_shader *shader,
-                 const struct lp_fragment_shader_variant_key *key)
+create_variant(struct llvmpipe_context *lp,
+               struct lp_fragment_shader *shader,
+               const struct lp_fragment_shader_variant_key *key,
+               LLVMContextRef context, struct lp_cached_code *cache,
+               struct lp_fs_compile_job *job)
 {
-   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_fragment_shader_variant *variant;
    const struct util_format_description *cbuf0_format_desc = NULL;
    boolean fullcolormask;
    boolean no_kill;
-   boolean linear;
    char module_name[64];
-   unsigned char ir_sha1_cache_key[20];
-   struct lp_cached_code cached = { 0 };
-   bool needs_caching = false;
    variant = MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
       return NULL;
@@ -3567,23 +3589,18 @@ generate_variant(struct llvmpipe_context *lp,
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
             shader->no, shader->variants_created);
 
+   variant->gallivm = gallivm_create(module_name, context, cache);
+   if (!variant->gallivm) {
+      FREE(variant);
+      return NULL;
+   }
+
    pipe_reference_init(&variant->reference, 1);
    lp_fs_reference(lp, &variant->shader, shader);
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
-   if (shader->base.ir.nir) {
-      lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
-
-      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
-      if (!cached.data_size)
-         needs_caching = true;
-   }
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
-   if (!variant->gallivm) {
-      FREE(variant);
-      return NULL;
-   }
+   util_queue_fence_init(&variant->compiled);
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
@@ -3672,7 +3689,7 @@ generate_variant(struct llvmpipe_context *lp,
 
 
    /* Whether this is a candidate for the linear path */
-   linear =
+   job->linear =
          !key->stencil[0].enabled &&
          !key->depth.enabled &&
          !shader->info.base.uses_kill &&
@@ -3680,7 +3697,29 @@ generate_variant(struct llvmpipe_context *lp,
          (key->cbuf_format[0] == PIPE_FORMAT_B8G8R8A8_UNORM ||
           key->cbuf_format[0] == PIPE_FORMAT_B8G8R8X8_UNORM);
 
-   memcpy(&variant->key, key, sizeof *key);
+   job->lp = lp;
+   job->variant = variant;
+   job->nir = shader->base.ir.nir;
+   job->fullcolormask = fullcolormask;
+
+   return variant;
+}
+
+
+/**
+ * Generate the code of a variant and compile it.  This is a util_queue
+ * job function, as optimized variants are compiled on the fs compile
+ * queue with LP_FS_COMPILE_THREADS.
+ */
+static void
+compile_variant(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_compile_job *job = (struct lp_fs_compile_job *)data;
+   struct llvmpipe_context *lp = job->lp;
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader_variant *variant = job->variant;
+   struct lp_fragment_shader *shader = variant->shader;
+   const struct lp_fragment_shader_variant_key *key = &variant->key;
 
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       lp_debug_fs_variant(variant);
@@ -3689,25 +3728,25 @@ generate_variant(struct llvmpipe_context *lp,
    llvmpipe_fs_variant_fastpath(variant);
 
    lp_jit_init_types(variant);
-   
+
    if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+      generate_fragment(lp, shader, job->nir, variant, RAST_EDGE_TEST);
 
    if (variant->jit_function[RAST_WHOLE] == NULL) {
       if (variant->opaque) {
          /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
+         generate_fragment(lp, shader, job->nir, variant, RAST_WHOLE);
       }
    }
 
-   if (linear) {
+   if (job->linear) {
       /* Currently keeping both the old fastpaths and new linear path
        * active.  The older code is still somewhat faster for the cases
        * it covers.
        *
        * XXX: consider restricting this to aero-mode only.
        */
-      if (fullcolormask &&
+      if (job->fullcolormask &&
           !key->alpha.enabled &&
           !key->blend.alpha_to_coverage) {
          llvmpipe_fs_variant_linear_fastpath(variant);
@@ -3752,7 +3791,7 @@ generate_variant(struct llvmpipe_context *lp,
       variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
    }
 
-   if (linear) {
+   if (job->linear) {
       if (variant->linear_function) {
          variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
                gallivm_jit_function(variant->gallivm, variant->linear_function);
@@ -3765,11 +3804,142 @@ generate_variant(struct llvmpipe_context *lp,
       lp_linear_check_variant(variant);
    }
 
-   if (needs_caching) {
-      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+   if (job->needs_caching) {
+      lp_disk_cache_insert_shader(screen, &job->cached, job->ir_sha1_cache_key);
    }
 
    gallivm_free_ir(variant->gallivm);
+}
+
+
+/**
+ * Free a job of the fs compile queue.  This runs after the fence of the
+ * variant is signalled, when the variant may already be destroyed, so only
+ * the job and its NIR clone can be touched.
+ *
+ * The exception is a job dropped by llvmpipe_destroy_shader_variant()
+ * before it ran (thread_index is -1), which happens while the variant is
+ * still referenced.  Its IR refers to job->cached and is freed here.
+ */
+static void
+compile_variant_cleanup(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_compile_job *job = (struct lp_fs_compile_job *)data;
+
+   if (thread_index < 0)
+      gallivm_free_ir(job->variant->gallivm);
+
+   ralloc_free(job->nir);
+   FREE(job);
+}
+
+
+/**
+ * Start compiling the optimized version of an unoptimized variant on the
+ * fs compile queue.  llvmpipe_update_fs() switches to it once it's done.
+ */
+static void
+queue_optimized_variant(struct llvmpipe_context *lp,
+                        struct lp_fragment_shader_variant *unoptimized,
+                        const unsigned char ir_sha1_cache_key[20])
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader *shader = unoptimized->shader;
+   struct lp_fragment_shader_variant *variant;
+   struct lp_fs_compile_job *job;
+   LLVMContextRef context;
+
+   job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job)
+      return;
+
+   /* MCJIT builds the module in the given context, which may only be used
+    * by one thread at a time.
+    */
+   context = LLVMContextCreate();
+   if (!context) {
+      FREE(job);
+      return;
+   }
+
+   variant = create_variant(lp, shader, &unoptimized->key, context,
+                            &job->cached, job);
+   if (!variant) {
+      LLVMContextDispose(context);
+      FREE(job);
+      return;
+   }
+   variant->context = context;
+
+   /* NIR is lowered in place when generating code, which may happen for
+    * other variants of the shader on this thread meanwhile.
+    */
+   if (job->nir) {
+      job->nir = nir_shader_clone(NULL, job->nir);
+      if (!job->nir) {
+         llvmpipe_destroy_shader_variant(lp, variant);
+         FREE(job);
+         return;
+      }
+   }
+
+   memcpy(job->ir_sha1_cache_key, ir_sha1_cache_key, 20);
+   job->needs_caching = true;
+
+   unoptimized->optimized = variant;
+   util_queue_add_job(&screen->fs_compile_queue, job, &variant->compiled,
+                      compile_variant, compile_variant_cleanup, sizeof *job);
+}
+
+
+/**
+ * Generate a new fragment shader variant from the shader code and
+ * other state indicated by the key.
+ *
+ * With LP_FS_COMPILE_THREADS and if async is set, a variant which isn't in
+ * the disk cache is compiled without optimizations first, which takes a
+ * fraction of the time, and the optimized one is compiled in the
+ * background.
+ */
+static struct lp_fragment_shader_variant *
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_fragment_shader *shader,
+                 const struct lp_fragment_shader_variant_key *key,
+                 bool async)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fragment_shader_variant *variant;
+   struct lp_fs_compile_job job = { 0 };
+
+   if (shader->base.ir.nir || shader->base.type == PIPE_SHADER_IR_TGSI) {
+      lp_fs_get_ir_cache_key(shader, key, job.ir_sha1_cache_key);
+      lp_shader_list_record(screen, PIPE_SHADER_FRAGMENT, &shader->base, 0,
+                            key, shader->variant_key_size,
+                            job.ir_sha1_cache_key);
+
+      lp_disk_cache_find_shader(screen, &job.cached, job.ir_sha1_cache_key);
+      if (!job.cached.data_size)
+         job.needs_caching = true;
+   }
+
+   async = async && job.needs_caching && screen->num_fs_compile_threads;
+
+   variant = create_variant(lp, shader, key, lp->context, &job.cached, &job);
+   if (!variant) {
+      free(job.cached.data);
+      return NULL;
+   }
+
+   if (async) {
+      /* Unoptimized code isn't worth caching */
+      job.needs_caching = false;
+      gallivm_disable_optimizations(variant->gallivm);
+   }
+
+   compile_variant(&job, NULL, 0);
+
+   if (async)
+      queue_optimized_variant(lp, variant, job.ir_sha1_cache_key);
 
    return variant;
 }
@@ -3899,6 +4069,7 @@ llvmpipe_bind_fs_state(struct pipe_context *pipe, void *fs)
 
    /* invalidate the setup link, NEW_FS will make it update */
    lp_setup_set_fs_variant(llvmpipe->setup, NULL);
+   llvmpipe->fs_variant_optimized = NULL;
    llvmpipe->dirty |= LP_NEW_FS;
 }
 
@@ -3929,14 +4100,29 @@ void llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
    remove_from_list(&variant->list_item_global);
    lp->nr_fs_variants--;
    lp->nr_fs_instrs -= variant->nr_instrs;
+
+   if (variant->optimized && variant->optimized == lp->fs_variant_optimized)
+      lp->fs_variant_optimized = NULL;
 }
 
 void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                struct lp_fragment_shader_variant *variant)
 {
+   if (variant->optimized) {
+      struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+      util_queue_drop_job(&screen->fs_compile_queue,
+                          &variant->optimized->compiled);
+      lp_fs_variant_reference(lp, &variant->optimized, NULL);
+   }
+   util_queue_fence_destroy(&variant->compiled);
+
    gallivm_destroy(variant->gallivm);
 
+   if (variant->context)
+      LLVMContextDispose(variant->context);
+
    lp_fs_reference(lp, &variant->shader, NULL);
 
    FREE(variant);
@@ -3977,6 +4163,38 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    lp_fs_reference(llvmpipe, &shader, NULL);
 }
 
+/**
+ * Create a shader from a shader list record and compile the variant for
+ * the given key, which puts it into the disk cache.
+ */
+bool
+llvmpipe_precompile_fs_variant(struct llvmpipe_context *lp,
+                               const struct pipe_shader_state *templ,
+                               const void *key, size_t key_size)
+{
+   struct lp_fragment_shader *shader;
+   struct lp_fragment_shader_variant *variant = NULL;
+
+   shader = llvmpipe_create_fs_state(&lp->pipe, templ);
+   if (!shader) {
+      if (templ->type == PIPE_SHADER_IR_NIR)
+         ralloc_free(templ->ir.nir);
+      return false;
+   }
+
+   if (shader->variant_key_size == key_size)
+      variant = generate_variant(lp, shader, key, false);
+
+   bool ret = variant != NULL;
+
+   if (variant)
+      lp_fs_variant_reference(lp, &variant, NULL);
+
+   llvmpipe_delete_fs_state(&lp->pipe, shader);
+
+   return ret;
+}
+
 static void
 llvmpipe_set_constant_buffer(struct pipe_context *pipe,
                              enum pipe_shader_type shader, uint index,
@@ -4382,7 +4600,27 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       li = next_elem(li);
    }
 
-   if (variant) {
+   if (variant && variant->optimized &&
+       util_queue_fence_is_signalled(&variant->optimized->compiled)) {
+      /* The optimized variant compiled in the background is ready, so it
+       * replaces the unoptimized one.  Scenes still using that one hold
+       * references.
+       */
+      struct lp_fragment_shader_variant *unoptimized = variant;
+
+      variant = unoptimized->optimized;
+      unoptimized->optimized = NULL;
+
+      insert_at_head(&shader->variants, &variant->list_item_local);
+      insert_at_head(&lp->fs_variants_list, &variant->list_item_global);
+      lp->nr_fs_variants++;
+      lp->nr_fs_instrs += variant->nr_instrs;
+      shader->variants_cached++;
+
+      llvmpipe_remove_shader_variant(lp, unoptimized);
+      lp_fs_variant_reference(lp, &unoptimized, NULL);
+   }
+   else if (variant) {
       /* Move this variant to the head of the list to implement LRU
        * deletion of shader's when we have too many.
        */
@@ -4440,7 +4678,7 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
        * Generate the new variant.
        */
       t0 = os_time_get();
-      variant = generate_variant(lp, shader, key);
+      variant = generate_variant(lp, shader, key, true);
       t1 = os_time_get();
       dt = t1 - t0;
       LP_COUNT_ADD(llvm_compile_time, dt);
@@ -4458,6 +4696,7 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
 
    /* Bind this variant */
    lp_setup_set_fs_variant(lp->setup, variant);
+   lp->fs_variant_optimized = variant ? variant->optimized : NULL;
 }
 
 
@@ -37,6 +37,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct tgsi_token;
@@ -170,6 +171,17 @@ struct lp_fragment_shader_variant
 
    struct gallivm_state *gallivm;
 
+   /* Private LLVM context of variants compiled in the background */
+   LLVMContextRef context;
+
+   /* Signalled once a variant compiled in the background is ready */
+   struct util_queue_fence compiled;
+
+   /* Optimized variant being compiled in the background to replace this
+    * unoptimized one, see generate_variant()
+    */
+   struct lp_fragment_shader_variant *optimized;
+
    LLVMTypeRef jit_context_ptr_type;
    LLVMTypeRef jit_thread_data_ptr_type;
    LLVMTypeRef jit_linear_context_ptr_type;
@@ -278,6 +290,11 @@ void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant);
 
+bool
+llvmpipe_precompile_fs_variant(struct llvmpipe_context *lp,
+                               const struct pipe_shader_state *templ,
+                               const void *key, size_t key_size);
+
 static inline void
 lp_fs_variant_reference(struct llvmpipe_context *llvmpipe,
                         struct lp_fragment_shader_variant **ptr,
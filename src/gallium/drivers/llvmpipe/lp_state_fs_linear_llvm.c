@@ -305,8 +305,10 @@ llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
     * lp_jit.h's lp_jit_frag_func function pointer type, and vice-versa.
     */
 
-   snprintf(func_name, sizeof(func_name), "fs%u_variant%u_linear",
-            shader->no, variant->no);
+   /* Keep the name independent of the shader/variant numbers so that
+    * object code from the disk cache can be linked by symbol name.
+    */
+   snprintf(func_name, sizeof(func_name), "fs_variant_linear");
 
    ret_type = pint8t;
    arg_types[0] = variant->jit_linear_context_ptr_type; /* context */
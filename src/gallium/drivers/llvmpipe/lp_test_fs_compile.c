@@ -0,0 +1,339 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Test the background compilation of optimized fragment shader variants
+ * with LP_FS_COMPILE_THREADS: draws must render the same with the
+ * unoptimized variant and with the optimized one that replaces it.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "cso_cache/cso_context.h"
+#include "util/u_box.h"
+#include "util/u_draw_quad.h"
+#include "util/u_inlines.h"
+#include "util/simple_list.h"
+#include "util/u_simple_shaders.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_context.h"
+#include "lp_public.h"
+#include "lp_test.h"
+
+
+#define WIDTH 64
+#define HEIGHT 64
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "threads\n");
+
+   fflush(fp);
+}
+
+
+struct fs_compile_test
+{
+   struct pipe_screen *screen;
+   struct pipe_context *pipe;
+   struct cso_context *cso;
+   struct pipe_resource *vbuf;
+   struct pipe_resource *target;
+   struct pipe_surface *cbuf;
+   void *vs;
+   void *fs;
+};
+
+
+static boolean
+init_test(struct fs_compile_test *t)
+{
+   static const float vertices[3][2][4] = {
+      { {  0.0f, -0.9f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+      { { -0.9f,  0.9f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+      { {  0.9f,  0.9f, 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f, 0.5f } },
+   };
+   static const enum tgsi_semantic semantic_names[] =
+      { TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+   static const uint semantic_indexes[] = { 0, 0 };
+   struct pipe_resource tmpl;
+   struct pipe_surface surf_tmpl;
+   struct pipe_framebuffer_state fb;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_rasterizer_state rast;
+   struct pipe_viewport_state vp;
+   struct cso_velems_state velem;
+
+   t->screen = llvmpipe_create_screen(null_sw_create());
+   if (!t->screen)
+      return FALSE;
+
+   t->pipe = t->screen->context_create(t->screen, NULL, 0);
+   if (!t->pipe)
+      return FALSE;
+   t->cso = cso_create_context(t->pipe, 0);
+
+   t->vbuf = pipe_buffer_create(t->screen, PIPE_BIND_VERTEX_BUFFER,
+                                PIPE_USAGE_DEFAULT, sizeof vertices);
+   pipe_buffer_write(t->pipe, t->vbuf, 0, sizeof vertices, vertices);
+
+   memset(&tmpl, 0, sizeof tmpl);
+   tmpl.target = PIPE_TEXTURE_2D;
+   tmpl.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   tmpl.width0 = WIDTH;
+   tmpl.height0 = HEIGHT;
+   tmpl.depth0 = 1;
+   tmpl.array_size = 1;
+   tmpl.bind = PIPE_BIND_RENDER_TARGET;
+   t->target = t->screen->resource_create(t->screen, &tmpl);
+
+   memset(&surf_tmpl, 0, sizeof surf_tmpl);
+   surf_tmpl.format = tmpl.format;
+   t->cbuf = t->pipe->create_surface(t->pipe, t->target, &surf_tmpl);
+
+   memset(&fb, 0, sizeof fb);
+   fb.width = WIDTH;
+   fb.height = HEIGHT;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = t->cbuf;
+   cso_set_framebuffer(t->cso, &fb);
+
+   memset(&dsa, 0, sizeof dsa);
+   cso_set_depth_stencil_alpha(t->cso, &dsa);
+
+   memset(&rast, 0, sizeof rast);
+   rast.cull_face = PIPE_FACE_NONE;
+   rast.half_pixel_center = 1;
+   rast.bottom_edge_rule = 1;
+   rast.depth_clip_near = 1;
+   rast.depth_clip_far = 1;
+   cso_set_rasterizer(t->cso, &rast);
+
+   memset(&vp, 0, sizeof vp);
+   vp.scale[0] = WIDTH / 2.0f;
+   vp.scale[1] = HEIGHT / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = WIDTH / 2.0f;
+   vp.translate[1] = HEIGHT / 2.0f;
+   vp.translate[2] = 0.5f;
+   vp.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+   vp.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+   vp.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+   vp.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+   cso_set_viewport(t->cso, &vp);
+
+   memset(&velem, 0, sizeof velem);
+   velem.count = 2;
+   velem.velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   velem.velems[1].src_offset = 4 * sizeof(float);
+   velem.velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   cso_set_vertex_elements(t->cso, &velem);
+
+   t->vs = util_make_vertex_passthrough_shader(t->pipe, 2, semantic_names,
+                                               semantic_indexes, FALSE);
+   t->fs = util_make_fragment_passthrough_shader(t->pipe, TGSI_SEMANTIC_COLOR,
+                                                 TGSI_INTERPOLATE_PERSPECTIVE,
+                                                 TRUE);
+   cso_set_vertex_shader_handle(t->cso, t->vs);
+   cso_set_fragment_shader_handle(t->cso, t->fs);
+
+   return TRUE;
+}
+
+
+static void
+fini_test(struct fs_compile_test *t)
+{
+   if (t->cso)
+      cso_destroy_context(t->cso);
+   if (t->pipe) {
+      t->pipe->delete_vs_state(t->pipe, t->vs);
+      t->pipe->delete_fs_state(t->pipe, t->fs);
+      pipe_surface_reference(&t->cbuf, NULL);
+      pipe_resource_reference(&t->target, NULL);
+      pipe_resource_reference(&t->vbuf, NULL);
+      t->pipe->destroy(t->pipe);
+   }
+   if (t->screen)
+      t->screen->destroy(t->screen);
+}
+
+
+/**
+ * Clear, draw the triangle blended with the given colormask and read the
+ * result back.
+ */
+static void
+draw(struct fs_compile_test *t, unsigned colormask, uint32_t *pixels)
+{
+   static const union pipe_color_union clear_color = {
+      .f = { 0.3f, 0.1f, 0.3f, 1.0f }
+   };
+   struct pipe_blend_state blend;
+   struct pipe_transfer *transfer;
+   struct pipe_box box;
+   const uint8_t *map;
+
+   memset(&blend, 0, sizeof blend);
+   blend.rt[0].colormask = colormask;
+   blend.rt[0].blend_enable = 1;
+   blend.rt[0].rgb_func = PIPE_BLEND_ADD;
+   blend.rt[0].rgb_src_factor = PIPE_BLENDFACTOR_SRC_ALPHA;
+   blend.rt[0].rgb_dst_factor = PIPE_BLENDFACTOR_INV_SRC_ALPHA;
+   blend.rt[0].alpha_func = PIPE_BLEND_ADD;
+   blend.rt[0].alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+   blend.rt[0].alpha_dst_factor = PIPE_BLENDFACTOR_ZERO;
+   cso_set_blend(t->cso, &blend);
+
+   t->pipe->clear(t->pipe, PIPE_CLEAR_COLOR, NULL, &clear_color, 0, 0);
+   util_draw_vertex_buffer(t->pipe, t->cso, t->vbuf, 0, 0,
+                           PIPE_PRIM_TRIANGLES, 3, 2);
+
+   u_box_2d(0, 0, WIDTH, HEIGHT, &box);
+   map = t->pipe->texture_map(t->pipe, t->target, 0, PIPE_MAP_READ,
+                              &box, &transfer);
+   for (unsigned y = 0; y < HEIGHT; y++)
+      memcpy(pixels + y * WIDTH, map + y * transfer->stride, WIDTH * 4);
+   t->pipe->texture_unmap(t->pipe, transfer);
+}
+
+
+/**
+ * Create the variants of unblended draws without waiting for their
+ * optimized versions, so that destroying the context drops pending jobs.
+ */
+static void
+queue_variants(struct fs_compile_test *t)
+{
+   struct pipe_blend_state blend;
+
+   memset(&blend, 0, sizeof blend);
+   for (unsigned colormask = 0; colormask < 16; colormask++) {
+      blend.rt[0].colormask = colormask;
+      cso_set_blend(t->cso, &blend);
+      util_draw_vertex_buffer(t->pipe, t->cso, t->vbuf, 0, 0,
+                              PIPE_PRIM_TRIANGLES, 3, 2);
+   }
+   t->pipe->flush(t->pipe, NULL, 0);
+}
+
+
+/**
+ * Render every colormask, switching to the optimized variants compiled
+ * in the background with LP_FS_COMPILE_THREADS, and compare the results
+ * to the reference.
+ */
+static boolean
+test_fs_compile(unsigned verbose, FILE *fp, unsigned threads,
+                uint32_t (*ref)[WIDTH * HEIGHT])
+{
+   struct fs_compile_test t;
+   uint32_t pixels[WIDTH * HEIGHT];
+   char value[16];
+   boolean success = TRUE;
+
+   snprintf(value, sizeof value, "%u", threads);
+   setenv("LP_FS_COMPILE_THREADS", value, 1);
+
+   memset(&t, 0, sizeof t);
+   if (!init_test(&t)) {
+      fini_test(&t);
+      return FALSE;
+   }
+
+   for (unsigned colormask = 0; colormask < 16; colormask++) {
+      struct llvmpipe_context *lp = llvmpipe_context(t.pipe);
+      struct lp_fragment_shader_variant *optimized;
+
+      draw(&t, colormask, pixels);
+
+      if (!threads) {
+         memcpy(ref[colormask], pixels, sizeof pixels);
+         continue;
+      }
+
+      if (memcmp(ref[colormask], pixels, sizeof pixels) != 0) {
+         if (verbose)
+            printf("colormask %x: unoptimized variant mismatch\n", colormask);
+         success = FALSE;
+      }
+
+      optimized = lp->fs_variant_optimized;
+      if (!optimized) {
+         if (verbose)
+            printf("colormask %x: no background compile\n", colormask);
+         success = FALSE;
+         continue;
+      }
+
+      util_queue_fence_wait(&optimized->compiled);
+      draw(&t, colormask, pixels);
+
+      if (lp->fs_variant_optimized ||
+          first_elem(&lp->fs->variants)->base != optimized) {
+         if (verbose)
+            printf("colormask %x: optimized variant not used\n", colormask);
+         success = FALSE;
+      }
+
+      if (memcmp(ref[colormask], pixels, sizeof pixels) != 0) {
+         if (verbose)
+            printf("colormask %x: optimized variant mismatch\n", colormask);
+         success = FALSE;
+      }
+   }
+
+   if (threads)
+      queue_variants(&t);
+
+   fini_test(&t);
+
+   if (fp)
+      fprintf(fp, "%s\t%u\n", success ? "pass" : "fail", threads);
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   static uint32_t ref[16][WIDTH * HEIGHT];
+   boolean success = TRUE;
+
+   /* Only fresh variants are compiled in the background */
+   setenv("MESA_GLSL_CACHE_DISABLE", "true", 1);
+
+   success = test_fs_compile(verbose, fp, 0, ref);
+   if (success)
+      success = test_fs_compile(verbose, fp, 2, ref);
+
+   return success;
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   printf("no test_single()");
+   return TRUE;
+}
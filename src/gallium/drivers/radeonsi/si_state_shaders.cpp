@@ -4267,6 +4267,8 @@ void si_init_screen_live_shader_cache(struct si_screen *sscreen)
 {
    util_live_shader_cache_init(&sscreen->live_shader_cache, si_create_shader_selector,
                                si_destroy_shader_selector);
+   /* The keys are only used to find live shaders. */
+   sscreen->live_shader_cache.xxhash_keys = true;
 }
 
 void si_init_shader_functions(struct si_context *sctx)
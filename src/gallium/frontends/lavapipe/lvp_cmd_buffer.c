@@ -47,8 +47,7 @@ static VkResult lvp_create_cmd_buffer(
    cmd_buffer->device = device;
    cmd_buffer->pool = pool;
 
-   cmd_buffer->queue.alloc = &pool->vk.alloc;
-   list_inithead(&cmd_buffer->queue.cmds);
+   vk_cmd_queue_init(&cmd_buffer->queue, &pool->vk.alloc);
 
    cmd_buffer->status = LVP_CMD_BUFFER_STATUS_INITIAL;
    if (pool) {
@@ -64,12 +63,16 @@ static VkResult lvp_create_cmd_buffer(
    return VK_SUCCESS;
 }
 
-static VkResult lvp_reset_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer)
+static VkResult lvp_reset_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer,
+                                     bool release_resources)
 {
    vk_command_buffer_reset(&cmd_buffer->vk);
 
-   vk_free_queue(&cmd_buffer->queue);
-   list_inithead(&cmd_buffer->queue.cmds);
+   /* Keep the command memory around for re-recording unless asked not to */
+   if (release_resources)
+      vk_free_queue(&cmd_buffer->queue);
+   else
+      vk_cmd_queue_reset(&cmd_buffer->queue);
    cmd_buffer->status = LVP_CMD_BUFFER_STATUS_INITIAL;
    return VK_SUCCESS;
 }
@@ -93,7 +96,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_AllocateCommandBuffers(
          list_del(&cmd_buffer->pool_link);
          list_addtail(&cmd_buffer->pool_link, &pool->cmd_buffers);
 
-         result = lvp_reset_cmd_buffer(cmd_buffer);
+         result = lvp_reset_cmd_buffer(cmd_buffer, false);
          vk_command_buffer_finish(&cmd_buffer->vk);
          VkResult init_result =
             vk_command_buffer_init(&cmd_buffer->vk, &pool->vk,
@@ -154,7 +157,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_ResetCommandBuffer(
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
-   return lvp_reset_cmd_buffer(cmd_buffer);
+   return lvp_reset_cmd_buffer(cmd_buffer,
+                               flags & VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL lvp_BeginCommandBuffer(
@@ -164,7 +168,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_BeginCommandBuffer(
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
    VkResult result;
    if (cmd_buffer->status != LVP_CMD_BUFFER_STATUS_INITIAL) {
-      result = lvp_reset_cmd_buffer(cmd_buffer);
+      result = lvp_reset_cmd_buffer(cmd_buffer, false);
       if (result != VK_SUCCESS)
          return result;
    }
@@ -172,10 +176,62 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_BeginCommandBuffer(
    return VK_SUCCESS;
 }
 
+/* Whether the command buffer contains anything that synchronizes with work
+ * earlier or later in submission order.  Submissions without such commands
+ * may be executed concurrently with their neighbours.
+ */
+static bool
+cmd_buffer_is_ordered(struct lvp_cmd_buffer *cmd_buffer)
+{
+   list_for_each_entry(struct vk_cmd_queue_entry, cmd, &cmd_buffer->queue.cmds, cmd_link) {
+      switch (cmd->type) {
+      case VK_CMD_PIPELINE_BARRIER:
+      case VK_CMD_PIPELINE_BARRIER2:
+      case VK_CMD_SET_EVENT:
+      case VK_CMD_SET_EVENT2:
+      case VK_CMD_RESET_EVENT:
+      case VK_CMD_RESET_EVENT2:
+      case VK_CMD_WAIT_EVENTS:
+      case VK_CMD_WAIT_EVENTS2:
+      case VK_CMD_BEGIN_QUERY:
+      case VK_CMD_BEGIN_QUERY_INDEXED_EXT:
+      case VK_CMD_END_QUERY:
+      case VK_CMD_END_QUERY_INDEXED_EXT:
+      case VK_CMD_RESET_QUERY_POOL:
+      case VK_CMD_WRITE_TIMESTAMP:
+      case VK_CMD_COPY_QUERY_POOL_RESULTS:
+         return true;
+      case VK_CMD_BEGIN_RENDER_PASS: {
+         LVP_FROM_HANDLE(lvp_render_pass, pass, cmd->u.begin_render_pass.render_pass_begin->renderPass);
+         if (pass->has_external_dependency)
+            return true;
+         break;
+      }
+      case VK_CMD_BEGIN_RENDER_PASS2: {
+         LVP_FROM_HANDLE(lvp_render_pass, pass, cmd->u.begin_render_pass2.render_pass_begin->renderPass);
+         if (pass->has_external_dependency)
+            return true;
+         break;
+      }
+      case VK_CMD_EXECUTE_COMMANDS:
+         for (unsigned i = 0; i < cmd->u.execute_commands.command_buffer_count; i++) {
+            LVP_FROM_HANDLE(lvp_cmd_buffer, secondary, cmd->u.execute_commands.command_buffers[i]);
+            if (secondary->ordered)
+               return true;
+         }
+         break;
+      default:
+         break;
+      }
+   }
+   return false;
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL lvp_EndCommandBuffer(
    VkCommandBuffer                             commandBuffer)
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
+   cmd_buffer->ordered = cmd_buffer_is_ordered(cmd_buffer);
    cmd_buffer->status = LVP_CMD_BUFFER_STATUS_EXECUTABLE;
    return VK_SUCCESS;
 }
@@ -244,7 +300,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_ResetCommandPool(
 
    list_for_each_entry(struct lvp_cmd_buffer, cmd_buffer,
                        &pool->cmd_buffers, pool_link) {
-      result = lvp_reset_cmd_buffer(cmd_buffer);
+      result = lvp_reset_cmd_buffer(cmd_buffer,
+                                    flags & VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
       if (result != VK_SUCCESS)
          return result;
    }
@@ -277,9 +334,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdDrawMultiEXT(
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(cmd_buffer->queue.alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -289,10 +344,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdDrawMultiEXT(
    cmd->u.draw_multi_ext.draw_count = drawCount;
    if (pVertexInfo) {
       unsigned i = 0;
-      cmd->u.draw_multi_ext.vertex_info = vk_zalloc(cmd_buffer->queue.alloc,
-                                                    sizeof(*cmd->u.draw_multi_ext.vertex_info) * drawCount,
-                                                    8,
-                                                    VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      cmd->u.draw_multi_ext.vertex_info = vk_cmd_queue_zalloc(&cmd_buffer->queue,
+                                                              sizeof(*cmd->u.draw_multi_ext.vertex_info) * drawCount);
       vk_foreach_multi_draw(draw, i, pVertexInfo, drawCount, stride)
          memcpy(&cmd->u.draw_multi_ext.vertex_info[i], draw, sizeof(*cmd->u.draw_multi_ext.vertex_info));
    }
@@ -312,9 +365,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdDrawMultiIndexedEXT(
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(cmd_buffer->queue.alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -325,10 +376,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdDrawMultiIndexedEXT(
 
    if (pIndexInfo) {
       unsigned i = 0;
-      cmd->u.draw_multi_indexed_ext.index_info = vk_zalloc(cmd_buffer->queue.alloc,
-                                                           sizeof(*cmd->u.draw_multi_indexed_ext.index_info) * drawCount,
-                                                           8,
-                                                           VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      cmd->u.draw_multi_indexed_ext.index_info = vk_cmd_queue_zalloc(&cmd_buffer->queue,
+                                                                     sizeof(*cmd->u.draw_multi_indexed_ext.index_info) * drawCount);
       vk_foreach_multi_draw_indexed(draw, i, pIndexInfo, drawCount, stride) {
          cmd->u.draw_multi_indexed_ext.index_info[i].firstIndex = draw->firstIndex;
          cmd->u.draw_multi_indexed_ext.index_info[i].indexCount = draw->indexCount;
@@ -342,7 +391,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdDrawMultiIndexedEXT(
    cmd->u.draw_multi_indexed_ext.stride = stride;
 
    if (pVertexOffset) {
-      cmd->u.draw_multi_indexed_ext.vertex_offset = vk_zalloc(cmd_buffer->queue.alloc, sizeof(*cmd->u.draw_multi_indexed_ext.vertex_offset), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      cmd->u.draw_multi_indexed_ext.vertex_offset = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd->u.draw_multi_indexed_ext.vertex_offset));
       memcpy(cmd->u.draw_multi_indexed_ext.vertex_offset, pVertexOffset, sizeof(*cmd->u.draw_multi_indexed_ext.vertex_offset));
    }
 }
@@ -358,9 +407,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdPushDescriptorSetKHR(
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
    struct vk_cmd_push_descriptor_set_khr *pds;
 
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(cmd_buffer->queue.alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -375,10 +422,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdPushDescriptorSetKHR(
    pds->descriptor_write_count = descriptorWriteCount;
 
    if (pDescriptorWrites) {
-      pds->descriptor_writes = vk_zalloc(cmd_buffer->queue.alloc,
-                                         sizeof(*pds->descriptor_writes) * descriptorWriteCount,
-                                         8,
-                                         VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      pds->descriptor_writes = vk_cmd_queue_zalloc(&cmd_buffer->queue,
+                                                   sizeof(*pds->descriptor_writes) * descriptorWriteCount);
       memcpy(pds->descriptor_writes,
              pDescriptorWrites,
              sizeof(*pds->descriptor_writes) * descriptorWriteCount);
@@ -390,20 +435,16 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdPushDescriptorSetKHR(
          case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
          case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
          case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
-            pds->descriptor_writes[i].pImageInfo = vk_zalloc(cmd_buffer->queue.alloc,
-                                         sizeof(VkDescriptorImageInfo) * pds->descriptor_writes[i].descriptorCount,
-                                         8,
-                                         VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+            pds->descriptor_writes[i].pImageInfo = vk_cmd_queue_zalloc(&cmd_buffer->queue,
+                                                                       sizeof(VkDescriptorImageInfo) * pds->descriptor_writes[i].descriptorCount);
             memcpy((VkDescriptorImageInfo *)pds->descriptor_writes[i].pImageInfo,
                    pDescriptorWrites[i].pImageInfo,
                    sizeof(VkDescriptorImageInfo) * pds->descriptor_writes[i].descriptorCount);
             break;
          case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
          case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
-            pds->descriptor_writes[i].pTexelBufferView = vk_zalloc(cmd_buffer->queue.alloc,
-                                         sizeof(VkBufferView) * pds->descriptor_writes[i].descriptorCount,
-                                         8,
-                                         VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+            pds->descriptor_writes[i].pTexelBufferView = vk_cmd_queue_zalloc(&cmd_buffer->queue,
+                                                                             sizeof(VkBufferView) * pds->descriptor_writes[i].descriptorCount);
             memcpy((VkBufferView *)pds->descriptor_writes[i].pTexelBufferView,
                    pDescriptorWrites[i].pTexelBufferView,
                    sizeof(VkBufferView) * pds->descriptor_writes[i].descriptorCount);
@@ -413,10 +454,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdPushDescriptorSetKHR(
          case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
          case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
          default:
-            pds->descriptor_writes[i].pBufferInfo = vk_zalloc(cmd_buffer->queue.alloc,
-                                         sizeof(VkDescriptorBufferInfo) * pds->descriptor_writes[i].descriptorCount,
-                                         8,
-                                         VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+            pds->descriptor_writes[i].pBufferInfo = vk_cmd_queue_zalloc(&cmd_buffer->queue,
+                                                                        sizeof(VkDescriptorBufferInfo) * pds->descriptor_writes[i].descriptorCount);
             memcpy((VkDescriptorBufferInfo *)pds->descriptor_writes[i].pBufferInfo,
                    pDescriptorWrites[i].pBufferInfo,
                    sizeof(VkDescriptorBufferInfo) * pds->descriptor_writes[i].descriptorCount);
@@ -436,9 +475,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdPushDescriptorSetWithTemplateKHR(
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
    LVP_FROM_HANDLE(lvp_descriptor_update_template, templ, descriptorUpdateTemplate);
    size_t info_size = 0;
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(cmd_buffer->queue.alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -475,7 +512,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdPushDescriptorSetWithTemplateKHR(
       }
    }
 
-   cmd->u.push_descriptor_set_with_template_khr.data = vk_zalloc(cmd_buffer->queue.alloc, info_size, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   cmd->u.push_descriptor_set_with_template_khr.data = vk_cmd_queue_zalloc(&cmd_buffer->queue, info_size);
 
    uint64_t offset = 0;
    for (unsigned i = 0; i < templ->entry_count; i++) {
@@ -521,9 +558,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBindDescriptorSets(
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
    LVP_FROM_HANDLE(lvp_pipeline_layout, layout, _layout);
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(cmd_buffer->queue.alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -531,7 +566,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBindDescriptorSets(
    list_addtail(&cmd->cmd_link, &cmd_buffer->queue.cmds);
 
    /* _layout could have been destroyed by when this command executes */
-   struct lvp_descriptor_set_layout **set_layout = vk_zalloc(cmd_buffer->queue.alloc, sizeof(*set_layout) * layout->num_sets, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct lvp_descriptor_set_layout **set_layout = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*set_layout) * layout->num_sets);
    cmd->driver_data = set_layout;
    for (unsigned i = 0; i < layout->num_sets; i++)
       set_layout[i] = layout->set[i].layout;
@@ -540,12 +575,12 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBindDescriptorSets(
    cmd->u.bind_descriptor_sets.first_set = firstSet;
    cmd->u.bind_descriptor_sets.descriptor_set_count = descriptorSetCount;
    if (pDescriptorSets) {
-      cmd->u.bind_descriptor_sets.descriptor_sets = vk_zalloc(cmd_buffer->queue.alloc, sizeof(*cmd->u.bind_descriptor_sets.descriptor_sets) * descriptorSetCount, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      cmd->u.bind_descriptor_sets.descriptor_sets = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd->u.bind_descriptor_sets.descriptor_sets) * descriptorSetCount);
       memcpy(( VkDescriptorSet* )cmd->u.bind_descriptor_sets.descriptor_sets, pDescriptorSets, sizeof(*cmd->u.bind_descriptor_sets.descriptor_sets) * descriptorSetCount);
    }
    cmd->u.bind_descriptor_sets.dynamic_offset_count = dynamicOffsetCount;
    if (pDynamicOffsets) {
-      cmd->u.bind_descriptor_sets.dynamic_offsets = vk_zalloc(cmd_buffer->queue.alloc, sizeof(*cmd->u.bind_descriptor_sets.dynamic_offsets) * dynamicOffsetCount, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      cmd->u.bind_descriptor_sets.dynamic_offsets = vk_cmd_queue_zalloc(&cmd_buffer->queue, sizeof(*cmd->u.bind_descriptor_sets.dynamic_offsets) * dynamicOffsetCount);
       memcpy(( uint32_t* )cmd->u.bind_descriptor_sets.dynamic_offsets, pDynamicOffsets, sizeof(*cmd->u.bind_descriptor_sets.dynamic_offsets) * dynamicOffsetCount);
    }
 }
@@ -557,9 +592,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
    struct vk_cmd_queue *queue = &cmd_buffer->queue;
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(queue->alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -567,7 +600,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
    list_addtail(&cmd->cmd_link, &queue->cmds);
 
    if (pRenderingInfo) {
-      cmd->u.begin_rendering.rendering_info = vk_zalloc(queue->alloc, sizeof(VkRenderingInfoKHR), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      cmd->u.begin_rendering.rendering_info = vk_cmd_queue_zalloc(queue, sizeof(VkRenderingInfoKHR));
       memcpy((void*)cmd->u.begin_rendering.rendering_info, pRenderingInfo, sizeof(VkRenderingInfoKHR));
    VkRenderingInfoKHR *tmp_dst1 = (void *) cmd->u.begin_rendering.rendering_info; (void) tmp_dst1;
    VkRenderingInfoKHR *tmp_src1 = (void *) pRenderingInfo; (void) tmp_src1;   
@@ -578,11 +611,11 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
          
       case VK_STRUCTURE_TYPE_DEVICE_GROUP_RENDER_PASS_BEGIN_INFO:
          if (pnext) {
-      tmp_dst1->pNext = vk_zalloc(queue->alloc, sizeof(VkDeviceGroupRenderPassBeginInfo), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      tmp_dst1->pNext = vk_cmd_queue_zalloc(queue, sizeof(VkDeviceGroupRenderPassBeginInfo));
       memcpy((void*)tmp_dst1->pNext, pnext, sizeof(VkDeviceGroupRenderPassBeginInfo));
    VkDeviceGroupRenderPassBeginInfo *tmp_dst2 = (void *) tmp_dst1->pNext; (void) tmp_dst2;
    VkDeviceGroupRenderPassBeginInfo *tmp_src2 = (void *) pnext; (void) tmp_src2;   
-   tmp_dst2->pDeviceRenderAreas = vk_zalloc(queue->alloc, sizeof(*tmp_dst2->pDeviceRenderAreas) * tmp_dst2->deviceRenderAreaCount, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   tmp_dst2->pDeviceRenderAreas = vk_cmd_queue_zalloc(queue, sizeof(*tmp_dst2->pDeviceRenderAreas) * tmp_dst2->deviceRenderAreaCount);
    memcpy(( VkRect2D*  )tmp_dst2->pDeviceRenderAreas, tmp_src2->pDeviceRenderAreas, sizeof(*tmp_dst2->pDeviceRenderAreas) * tmp_dst2->deviceRenderAreaCount);
    } else {
       tmp_dst1->pNext = NULL;
@@ -591,7 +624,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
       
       case VK_STRUCTURE_TYPE_RENDERING_FRAGMENT_SHADING_RATE_ATTACHMENT_INFO_KHR:
          if (pnext) {
-      tmp_dst1->pNext = vk_zalloc(queue->alloc, sizeof(VkRenderingFragmentShadingRateAttachmentInfoKHR), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      tmp_dst1->pNext = vk_cmd_queue_zalloc(queue, sizeof(VkRenderingFragmentShadingRateAttachmentInfoKHR));
       memcpy((void*)tmp_dst1->pNext, pnext, sizeof(VkRenderingFragmentShadingRateAttachmentInfoKHR));
    VkRenderingFragmentShadingRateAttachmentInfoKHR *tmp_dst2 = (void *) tmp_dst1->pNext; (void) tmp_dst2;
    VkRenderingFragmentShadingRateAttachmentInfoKHR *tmp_src2 = (void *) pnext; (void) tmp_src2;   
@@ -602,7 +635,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
       
       case VK_STRUCTURE_TYPE_RENDERING_FRAGMENT_DENSITY_MAP_ATTACHMENT_INFO_EXT:
          if (pnext) {
-      tmp_dst1->pNext = vk_zalloc(queue->alloc, sizeof(VkRenderingFragmentDensityMapAttachmentInfoEXT), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      tmp_dst1->pNext = vk_cmd_queue_zalloc(queue, sizeof(VkRenderingFragmentDensityMapAttachmentInfoEXT));
       memcpy((void*)tmp_dst1->pNext, pnext, sizeof(VkRenderingFragmentDensityMapAttachmentInfoEXT));
    VkRenderingFragmentDensityMapAttachmentInfoEXT *tmp_dst2 = (void *) tmp_dst1->pNext; (void) tmp_dst2;
    VkRenderingFragmentDensityMapAttachmentInfoEXT *tmp_src2 = (void *) pnext; (void) tmp_src2;   
@@ -613,7 +646,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
       
       case VK_STRUCTURE_TYPE_MULTIVIEW_PER_VIEW_ATTRIBUTES_INFO_NVX:
          if (pnext) {
-      tmp_dst1->pNext = vk_zalloc(queue->alloc, sizeof(VkMultiviewPerViewAttributesInfoNVX), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      tmp_dst1->pNext = vk_cmd_queue_zalloc(queue, sizeof(VkMultiviewPerViewAttributesInfoNVX));
       memcpy((void*)tmp_dst1->pNext, pnext, sizeof(VkMultiviewPerViewAttributesInfoNVX));
    VkMultiviewPerViewAttributesInfoNVX *tmp_dst2 = (void *) tmp_dst1->pNext; (void) tmp_dst2;
    VkMultiviewPerViewAttributesInfoNVX *tmp_src2 = (void *) pnext; (void) tmp_src2;   
@@ -624,14 +657,14 @@ VKAPI_ATTR void VKAPI_CALL lvp_CmdBeginRendering(VkCommandBuffer
       
          }
       }
-      tmp_dst1->pColorAttachments = vk_zalloc(queue->alloc, sizeof(*tmp_dst1->pColorAttachments) * tmp_dst1->colorAttachmentCount, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+      tmp_dst1->pColorAttachments = vk_cmd_queue_zalloc(queue, sizeof(*tmp_dst1->pColorAttachments) * tmp_dst1->colorAttachmentCount);
    memcpy(( VkRenderingAttachmentInfoKHR*             )tmp_dst1->pColorAttachments, tmp_src1->pColorAttachments, sizeof(*tmp_dst1->pColorAttachments) * tmp_dst1->colorAttachmentCount);
       if (tmp_src1->pDepthAttachment) {
-         tmp_dst1->pDepthAttachment = vk_zalloc(queue->alloc, sizeof(VkRenderingAttachmentInfoKHR), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+         tmp_dst1->pDepthAttachment = vk_cmd_queue_zalloc(queue, sizeof(VkRenderingAttachmentInfoKHR));
          memcpy((void*)tmp_dst1->pDepthAttachment, tmp_src1->pDepthAttachment, sizeof(VkRenderingAttachmentInfoKHR));
       }
       if (tmp_src1->pStencilAttachment) {
-         tmp_dst1->pStencilAttachment = vk_zalloc(queue->alloc, sizeof(VkRenderingAttachmentInfoKHR), 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+         tmp_dst1->pStencilAttachment = vk_cmd_queue_zalloc(queue, sizeof(VkRenderingAttachmentInfoKHR));
          memcpy((void*)tmp_dst1->pStencilAttachment, tmp_src1->pStencilAttachment, sizeof(VkRenderingAttachmentInfoKHR));
       }
    } else {
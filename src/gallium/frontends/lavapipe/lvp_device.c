@@ -1179,13 +1179,36 @@ set_last_fence(struct lvp_device *device, struct pipe_fence_handle *handle, uint
    simple_mtx_unlock(&device->queue.last_lock);
 }
 
+/* wait until all jobs up to and including seq have retired */
 static void
-thread_flush(struct lvp_device *device, struct lvp_fence *fence, uint64_t timeline,
+wait_retired(struct lvp_queue *queue, uint64_t seq)
+{
+   mtx_lock(&queue->retire_lock);
+   while (queue->retired < seq)
+      cnd_wait(&queue->retire_cond, &queue->retire_lock);
+   mtx_unlock(&queue->retire_lock);
+}
+
+static void
+thread_flush(struct lvp_device *device, unsigned ctx_index,
+             const struct lvp_queue_order *order,
+             struct lvp_fence *fence, uint64_t timeline,
              unsigned num_signal_semaphores, struct lvp_semaphore **semaphores,
              unsigned num_timelines, struct lvp_semaphore_timeline **timelines)
 {
+   struct lvp_queue *queue = &device->queue;
+   struct pipe_context *ctx = queue->ctxs[ctx_index];
    struct pipe_fence_handle *handle = NULL;
-   device->queue.ctx->flush(device->queue.ctx, &handle, 0);
+   ctx->flush(ctx, &handle, 0);
+
+   /* signal operations cover everything submitted before them, so retire
+    * in submission order; with several contexts the fence only covers this
+    * job's context, so also wait for it before letting later jobs through
+    */
+   wait_retired(queue, order->seq - 1);
+   if (queue->num_contexts > 1 && handle)
+      device->pscreen->fence_finish(device->pscreen, NULL, handle, PIPE_TIMEOUT_INFINITE);
+
    if (fence)
       device->pscreen->fence_reference(device->pscreen, &fence->handle, handle);
    for (unsigned i = 0; i < num_signal_semaphores; i++) {
@@ -1202,6 +1225,11 @@ thread_flush(struct lvp_device *device, struct lvp_fence *fence, uint64_t timeli
       device->pscreen->fence_reference(device->pscreen, &timelines[i]->fence, handle);
 
    device->pscreen->fence_reference(device->pscreen, &handle, NULL);
+
+   mtx_lock(&queue->retire_lock);
+   queue->retired = order->seq;
+   cnd_broadcast(&queue->retire_cond);
+   mtx_unlock(&queue->retire_lock);
 }
 
 /* get a new timeline link for creating a new signal event
@@ -1372,7 +1400,8 @@ queue_thread_noop(void *data, void *gdata, int thread_index)
    struct lvp_fence *fence = noop->fence;
    struct lvp_semaphore *semaphore = noop->sema;
 
-   thread_flush(device, fence, fence ? fence->timeline : 0, semaphore ? 1 : 0, &semaphore, 0, NULL);
+   thread_flush(device, thread_index, &noop->order, fence, fence ? fence->timeline : 0,
+                semaphore ? 1 : 0, &semaphore, 0, NULL);
    free(noop);
 }
 
@@ -1394,15 +1423,40 @@ queue_thread(void *data, void *gdata, int thread_index)
       wait_semaphores(device, &wait, UINT64_MAX);
    }
 
+   /* barriers and the like order this job after earlier ones, and
+    * earlier ones after the previous such job
+    */
+   wait_retired(queue, task->order.wait);
+
    //execute
    for (unsigned i = 0; i < task->cmd_buffer_count; i++) {
-      lvp_execute_cmds(queue->device, queue, task->cmd_buffers[i]);
+      lvp_execute_cmds(queue->device, queue, thread_index, task->cmd_buffers[i]);
    }
 
-   thread_flush(device, task->fence, task->timeline, task->signal_count, task->signals, task->timeline_count, task->timelines);
+   thread_flush(device, thread_index, &task->order, task->fence, task->timeline,
+                task->signal_count, task->signals, task->timeline_count, task->timelines);
    free(task);
 }
 
+void
+lvp_queue_add_job(struct lvp_queue *queue, void *job,
+                  struct lvp_queue_order *order, bool ordered,
+                  struct util_queue_fence *fence,
+                  util_queue_execute_func execute)
+{
+   /* jobs must be added to the util_queue in the same order their sequence
+    * numbers are handed out: a job only ever waits on earlier ones, which are
+    * then guaranteed to have been picked up by another queue thread
+    */
+   simple_mtx_lock(&queue->submit_lock);
+   order->seq = ++queue->submitted;
+   order->wait = ordered ? order->seq - 1 : queue->last_ordered;
+   if (ordered)
+      queue->last_ordered = order->seq;
+   util_queue_add_job(&queue->queue, job, fence, execute, NULL, 0);
+   simple_mtx_unlock(&queue->submit_lock);
+}
+
 static VkResult
 lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
                const VkDeviceQueueCreateInfo *create_info,
@@ -1416,10 +1470,27 @@ lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
    queue->device = device;
 
    simple_mtx_init(&queue->last_lock, mtx_plain);
+   simple_mtx_init(&queue->submit_lock, mtx_plain);
+   mtx_init(&queue->retire_lock, mtx_plain);
+   cnd_init(&queue->retire_cond);
    queue->timeline = 0;
-   queue->ctx = device->pscreen->context_create(device->pscreen, NULL, PIPE_CONTEXT_ROBUST_BUFFER_ACCESS);
-   queue->cso = cso_create_context(queue->ctx, CSO_NO_VBUF);
-   util_queue_init(&queue->queue, "lavapipe", 8, 1, UTIL_QUEUE_INIT_RESIZE_IF_FULL, device);
+   queue->submitted = 0;
+   queue->last_ordered = 0;
+   queue->retired = 0;
+
+   /* independent submissions can run concurrently on their own contexts,
+    * but those share the llvmpipe rasterizer threads and the concurrent
+    * path hasn't been through CTS yet, so this is opt-in
+    */
+   unsigned num_contexts = debug_get_num_option("LVP_QUEUE_THREADS", 1);
+   queue->num_contexts = CLAMP(num_contexts, 1, LVP_MAX_QUEUE_CONTEXTS);
+   for (unsigned i = 0; i < queue->num_contexts; i++) {
+      queue->ctxs[i] = device->pscreen->context_create(device->pscreen, NULL, PIPE_CONTEXT_ROBUST_BUFFER_ACCESS);
+      queue->csos[i] = cso_create_context(queue->ctxs[i], CSO_NO_VBUF);
+   }
+   queue->ctx = queue->ctxs[0];
+   queue->cso = queue->csos[0];
+   util_queue_init(&queue->queue, "lavapipe", 8, queue->num_contexts, UTIL_QUEUE_INIT_RESIZE_IF_FULL, device);
    p_atomic_set(&queue->count, 0);
 
    return VK_SUCCESS;
@@ -1431,8 +1502,13 @@ lvp_queue_finish(struct lvp_queue *queue)
    util_queue_finish(&queue->queue);
    util_queue_destroy(&queue->queue);
 
-   cso_destroy_context(queue->cso);
-   queue->ctx->destroy(queue->ctx);
+   for (unsigned i = 0; i < queue->num_contexts; i++) {
+      cso_destroy_context(queue->csos[i]);
+      queue->ctxs[i]->destroy(queue->ctxs[i]);
+   }
+   cnd_destroy(&queue->retire_cond);
+   mtx_destroy(&queue->retire_lock);
+   simple_mtx_destroy(&queue->submit_lock);
    simple_mtx_destroy(&queue->last_lock);
 
    vk_queue_finish(&queue->vk);
@@ -1568,9 +1644,12 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_QueueSubmit(
       task->waits = (VkSemaphore*)((uint8_t*)task->signals + pSubmits[i].signalSemaphoreCount * sizeof(struct lvp_semaphore *));
       task->wait_vals = (uint64_t*)((uint8_t*)task->waits + pSubmits[i].waitSemaphoreCount * sizeof(VkSemaphore));
 
+      bool ordered = false;
       unsigned c = 0;
       for (uint32_t j = 0; j < pSubmits[i].commandBufferCount; j++) {
-         task->cmd_buffers[c++] = lvp_cmd_buffer_from_handle(pSubmits[i].pCommandBuffers[j]);
+         task->cmd_buffers[c] = lvp_cmd_buffer_from_handle(pSubmits[i].pCommandBuffers[j]);
+         ordered |= task->cmd_buffers[c]->ordered;
+         c++;
       }
       const VkTimelineSemaphoreSubmitInfo *info = vk_find_struct_const(pSubmits[i].pNext, TIMELINE_SEMAPHORE_SUBMIT_INFO);
       unsigned s = 0;
@@ -1627,9 +1706,9 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_QueueSubmit(
           * the vk fence represents
           */
          fence->timeline = timeline;
-         util_queue_add_job(&queue->queue, task, &fence->fence, queue_thread, NULL, 0);
+         lvp_queue_add_job(queue, task, &task->order, ordered, &fence->fence, queue_thread);
       } else
-         util_queue_add_job(&queue->queue, task, NULL, queue_thread, NULL, 0);
+         lvp_queue_add_job(queue, task, &task->order, ordered, NULL, queue_thread);
    }
    if (!submitCount && fence) {
       /* special case where a fence is created to use as a synchronization point */
@@ -1639,7 +1718,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_QueueSubmit(
          return VK_ERROR_OUT_OF_HOST_MEMORY;
       noop->fence = fence;
       noop->sema = NULL;
-      util_queue_add_job(&queue->queue, noop, &fence->fence, queue_thread_noop, NULL, 0);
+      lvp_queue_add_job(queue, noop, &noop->order, false, &fence->fence, queue_thread_noop);
    }
    return VK_SUCCESS;
 }
@@ -59,6 +59,7 @@ enum gs_output {
 struct rendering_state {
    struct pipe_context *pctx;
    struct cso_context *cso;
+   unsigned ctx_index;
 
    bool blend_dirty;
    bool rs_dirty;
@@ -380,7 +381,7 @@ static void handle_compute_pipeline(struct vk_cmd_queue_entry *cmd,
    state->dispatch_info.block[0] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[0];
    state->dispatch_info.block[1] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[1];
    state->dispatch_info.block[2] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[2];
-   state->pctx->bind_compute_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_COMPUTE]);
+   state->pctx->bind_compute_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_COMPUTE));
 }
 
 static void
@@ -500,24 +501,24 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
          const VkPipelineShaderStageCreateInfo *sh = &pipeline->graphics_create_info.pStages[i];
          switch (sh->stage) {
          case VK_SHADER_STAGE_FRAGMENT_BIT:
-            state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+            state->pctx->bind_fs_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_FRAGMENT));
             has_stage[PIPE_SHADER_FRAGMENT] = true;
             break;
          case VK_SHADER_STAGE_VERTEX_BIT:
-            state->pctx->bind_vs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
+            state->pctx->bind_vs_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_VERTEX));
             has_stage[PIPE_SHADER_VERTEX] = true;
             break;
          case VK_SHADER_STAGE_GEOMETRY_BIT:
-            state->pctx->bind_gs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
+            state->pctx->bind_gs_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_GEOMETRY));
             state->gs_output_lines = pipeline->gs_output_lines ? GS_OUTPUT_LINES : GS_OUTPUT_NOT_LINES;
             has_stage[PIPE_SHADER_GEOMETRY] = true;
             break;
          case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-            state->pctx->bind_tcs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
+            state->pctx->bind_tcs_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_TESS_CTRL));
             has_stage[PIPE_SHADER_TESS_CTRL] = true;
             break;
          case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-            state->pctx->bind_tes_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
+            state->pctx->bind_tes_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_TESS_EVAL));
             has_stage[PIPE_SHADER_TESS_EVAL] = true;
             break;
          default:
@@ -529,7 +530,7 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
 
    /* there should always be a dummy fs. */
    if (!has_stage[PIPE_SHADER_FRAGMENT])
-      state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+      state->pctx->bind_fs_state(state->pctx, lvp_pipeline_shader_cso(pipeline, state->ctx_index, MESA_SHADER_FRAGMENT));
    if (state->pctx->bind_gs_state && !has_stage[PIPE_SHADER_GEOMETRY])
       state->pctx->bind_gs_state(state->pctx, NULL);
    if (state->pctx->bind_tcs_state && !has_stage[PIPE_SHADER_TESS_CTRL])
@@ -2850,6 +2851,11 @@ static void handle_push_constants(struct vk_cmd_queue_entry *cmd,
 static void lvp_execute_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer,
                                    struct rendering_state *state);
 
+/* Secondaries run in order on the primary's context.  They inherit its
+ * render pass, attachments and dynamic state, and their draws must land
+ * in the framebuffer in recording order, so running them on other queue
+ * contexts would need those to be copied and the results merged back.
+ */
 static void handle_execute_commands(struct vk_cmd_queue_entry *cmd,
                                     struct rendering_state *state)
 {
@@ -2912,6 +2918,7 @@ static void handle_begin_query(struct vk_cmd_queue_entry *cmd,
       enum pipe_query_type qtype = pool->base_type;
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              qtype, 0);
+      pool->query_ctxs[qcmd->query] = state->pctx;
    }
 
    state->pctx->begin_query(state->pctx, pool->queries[qcmd->query]);
@@ -2944,6 +2951,7 @@ static void handle_begin_query_indexed_ext(struct vk_cmd_queue_entry *cmd,
       enum pipe_query_type qtype = pool->base_type;
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              qtype, qcmd->index);
+      pool->query_ctxs[qcmd->query] = state->pctx;
    }
 
    state->pctx->begin_query(state->pctx, pool->queries[qcmd->query]);
@@ -2966,7 +2974,7 @@ static void handle_reset_query_pool(struct vk_cmd_queue_entry *cmd,
    LVP_FROM_HANDLE(lvp_query_pool, pool, qcmd->query_pool);
    for (unsigned i = qcmd->first_query; i < qcmd->first_query + qcmd->query_count; i++) {
       if (pool->queries[i]) {
-         state->pctx->destroy_query(state->pctx, pool->queries[i]);
+         pool->query_ctxs[i]->destroy_query(pool->query_ctxs[i], pool->queries[i]);
          pool->queries[i] = NULL;
       }
    }
@@ -2980,6 +2988,7 @@ static void handle_write_timestamp(struct vk_cmd_queue_entry *cmd,
    if (!pool->queries[qcmd->query]) {
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              PIPE_QUERY_TIMESTAMP, 0);
+      pool->query_ctxs[qcmd->query] = state->pctx;
    }
 
    if (!(qcmd->pipeline_stage == VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT))
@@ -4104,12 +4113,14 @@ static void lvp_execute_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer,
 
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
+                          unsigned ctx_index,
                           struct lvp_cmd_buffer *cmd_buffer)
 {
    struct rendering_state state;
    memset(&state, 0, sizeof(state));
-   state.pctx = queue->ctx;
-   state.cso = queue->cso;
+   state.pctx = queue->ctxs[ctx_index];
+   state.cso = queue->csos[ctx_index];
+   state.ctx_index = ctx_index;
    state.blend_dirty = true;
    state.dsa_dirty = true;
    state.rs_dirty = true;
@@ -4123,7 +4134,7 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
 
    state.start_vb = -1;
    state.num_vb = 0;
-   cso_unbind_context(queue->cso);
+   cso_unbind_context(state.cso);
    for (unsigned i = 0; i < PIPE_MAX_SO_BUFFERS; i++) {
       if (state.so_targets[i]) {
          state.pctx->stream_output_target_destroy(state.pctx, state.so_targets[i]);
@@ -91,6 +91,13 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateRenderPass2(
       pass->has_color_attachment |= !is_zs;
    }
 
+   /* external dependencies order the render pass against other submissions */
+   for (uint32_t i = 0; i < pCreateInfo->dependencyCount; i++) {
+      if (pCreateInfo->pDependencies[i].srcSubpass == VK_SUBPASS_EXTERNAL ||
+          pCreateInfo->pDependencies[i].dstSubpass == VK_SUBPASS_EXTERNAL)
+         pass->has_external_dependency = true;
+   }
+
    uint32_t subpass_attachment_idx = 0;
 #define ATTACHMENT_OFFSET (struct lvp_render_pass_attachment**)(((uint8_t*)pass) + subpass_attachment_offset + (subpass_attachment_idx * sizeof(void*)))
 #define CHECK_UNUSED_ATTACHMENT(SRC, DST, IDX) do { \
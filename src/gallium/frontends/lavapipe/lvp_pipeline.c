@@ -30,6 +30,8 @@
 #include "pipe/p_state.h"
 #include "pipe/p_context.h"
 #include "nir/nir_xfb_info.h"
+#include "tgsi/tgsi_from_mesa.h"
+#include "util/mesa-sha1.h"
 
 #define SPIR_V_MAGIC_NUMBER 0x07230203
 
@@ -51,18 +53,23 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipeline(
    if (!_pipeline)
       return;
 
-   if (pipeline->shader_cso[PIPE_SHADER_VERTEX])
-      device->queue.ctx->delete_vs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
-   if (pipeline->shader_cso[PIPE_SHADER_FRAGMENT])
-      device->queue.ctx->delete_fs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
-   if (pipeline->shader_cso[PIPE_SHADER_GEOMETRY])
-      device->queue.ctx->delete_gs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
-   if (pipeline->shader_cso[PIPE_SHADER_TESS_CTRL])
-      device->queue.ctx->delete_tcs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
-   if (pipeline->shader_cso[PIPE_SHADER_TESS_EVAL])
-      device->queue.ctx->delete_tes_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
-   if (pipeline->shader_cso[PIPE_SHADER_COMPUTE])
-      device->queue.ctx->delete_compute_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_COMPUTE]);
+   for (unsigned i = 0; i < device->queue.num_contexts; i++) {
+      struct pipe_context *ctx = device->queue.ctxs[i];
+      void **shader_cso = pipeline->shader_cso[i];
+
+      if (shader_cso[PIPE_SHADER_VERTEX])
+         ctx->delete_vs_state(ctx, shader_cso[PIPE_SHADER_VERTEX]);
+      if (shader_cso[PIPE_SHADER_FRAGMENT])
+         ctx->delete_fs_state(ctx, shader_cso[PIPE_SHADER_FRAGMENT]);
+      if (shader_cso[PIPE_SHADER_GEOMETRY])
+         ctx->delete_gs_state(ctx, shader_cso[PIPE_SHADER_GEOMETRY]);
+      if (shader_cso[PIPE_SHADER_TESS_CTRL])
+         ctx->delete_tcs_state(ctx, shader_cso[PIPE_SHADER_TESS_CTRL]);
+      if (shader_cso[PIPE_SHADER_TESS_EVAL])
+         ctx->delete_tes_state(ctx, shader_cso[PIPE_SHADER_TESS_EVAL]);
+      if (shader_cso[PIPE_SHADER_COMPUTE])
+         ctx->delete_compute_state(ctx, shader_cso[PIPE_SHADER_COMPUTE]);
+   }
 
    ralloc_free(pipeline->mem_ctx);
    vk_object_base_finish(&pipeline->base);
@@ -460,8 +467,53 @@ shared_var_info(const struct glsl_type *type, unsigned *size, unsigned *align)
       *align = comp_size;
 }
 
+/**
+ * Hash everything lvp_shader_compile_to_ir() depends on: the SPIR-V,
+ * entrypoint, specialization constants and the descriptor layout the
+ * resources get lowered to.
+ */
+static void
+lvp_shader_compute_cache_key(const struct lvp_pipeline *pipeline,
+                             const struct vk_shader_module *module,
+                             const char *entrypoint_name,
+                             gl_shader_stage stage,
+                             const VkSpecializationInfo *spec_info,
+                             unsigned char sha1[20])
+{
+   const struct lvp_pipeline_layout *layout = pipeline->layout;
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, module->sha1, sizeof(module->sha1));
+   _mesa_sha1_update(&ctx, entrypoint_name, strlen(entrypoint_name));
+   _mesa_sha1_update(&ctx, &stage, sizeof(stage));
+   if (spec_info) {
+      _mesa_sha1_update(&ctx, spec_info->pMapEntries,
+                        spec_info->mapEntryCount * sizeof(*spec_info->pMapEntries));
+      _mesa_sha1_update(&ctx, spec_info->pData, spec_info->dataSize);
+   }
+
+   _mesa_sha1_update(&ctx, &layout->num_sets, sizeof(layout->num_sets));
+   for (unsigned s = 0; s < layout->num_sets; s++) {
+      const struct lvp_descriptor_set_layout *set_layout = layout->set[s].layout;
+
+      _mesa_sha1_update(&ctx, set_layout->stage, sizeof(set_layout->stage));
+      _mesa_sha1_update(&ctx, &set_layout->binding_count,
+                        sizeof(set_layout->binding_count));
+      for (unsigned b = 0; b < set_layout->binding_count; b++) {
+         const struct lvp_descriptor_set_binding_layout *binding =
+            &set_layout->binding[b];
+         _mesa_sha1_update(&ctx, &binding->type, sizeof(binding->type));
+         _mesa_sha1_update(&ctx, binding->stage, sizeof(binding->stage));
+      }
+   }
+
+   _mesa_sha1_final(&ctx, sha1);
+}
+
 static void
 lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
+                         struct lvp_pipeline_cache *cache,
                          struct vk_shader_module *module,
                          const char *entrypoint_name,
                          gl_shader_stage stage,
@@ -471,9 +523,20 @@ lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
    const nir_shader_compiler_options *drv_options = pipeline->device->pscreen->get_compiler_options(pipeline->device->pscreen, PIPE_SHADER_IR_NIR, st_shader_stage_to_ptarget(stage));
    bool progress;
    uint32_t *spirv = (uint32_t *) module->data;
+   unsigned char sha1[20];
    assert(spirv[0] == SPIR_V_MAGIC_NUMBER);
    assert(module->size % 4 == 0);
 
+   if (cache) {
+      lvp_shader_compute_cache_key(pipeline, module, entrypoint_name, stage,
+                                   spec_info, sha1);
+      nir = lvp_pipeline_cache_search_nir(cache, sha1, drv_options);
+      if (nir) {
+         pipeline->pipeline_nir[stage] = nir;
+         return;
+      }
+   }
+
    uint32_t num_spec_entries = 0;
    struct nir_spirv_specialization *spec_entries =
       vk_spec_info_to_nir_spirv(spec_info, &num_spec_entries);
@@ -655,12 +718,9 @@ lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
    nir_assign_io_var_locations(nir, nir_var_shader_out, &nir->num_outputs,
                                nir->info.stage);
    pipeline->pipeline_nir[stage] = nir;
-}
 
-static void fill_shader_prog(struct pipe_shader_state *state, gl_shader_stage stage, struct lvp_pipeline *pipeline)
-{
-   state->type = PIPE_SHADER_IR_NIR;
-   state->ir.nir = pipeline->pipeline_nir[stage];
+   if (cache)
+      lvp_pipeline_cache_upload_nir(cache, sha1, nir);
 }
 
 static void
@@ -724,77 +784,116 @@ lvp_shader_stage(VkShaderStageFlagBits stage)
    }
 }
 
-static VkResult
-lvp_pipeline_compile(struct lvp_pipeline *pipeline,
-                     gl_shader_stage stage)
+/* Create the shader CSO for a stage on one of the queue contexts, which
+ * takes ownership of the NIR.
+ */
+static void *
+lvp_pipeline_create_cso(struct pipe_context *ctx, nir_shader *nir)
 {
-   struct lvp_device *device = pipeline->device;
-   device->physical_device->pscreen->finalize_nir(device->physical_device->pscreen, pipeline->pipeline_nir[stage]);
+   gl_shader_stage stage = nir->info.stage;
+
    if (stage == MESA_SHADER_COMPUTE) {
       struct pipe_compute_state shstate = {0};
-      shstate.prog = (void *)pipeline->pipeline_nir[MESA_SHADER_COMPUTE];
+      shstate.prog = (void *)nir;
       shstate.ir_type = PIPE_SHADER_IR_NIR;
-      shstate.req_local_mem = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.shared_size;
-      pipeline->shader_cso[PIPE_SHADER_COMPUTE] = device->queue.ctx->create_compute_state(device->queue.ctx, &shstate);
-   } else {
-      struct pipe_shader_state shstate = {0};
-      fill_shader_prog(&shstate, stage, pipeline);
-
-      if (stage == MESA_SHADER_VERTEX ||
-          stage == MESA_SHADER_GEOMETRY ||
-          stage == MESA_SHADER_TESS_EVAL) {
-         nir_xfb_info *xfb_info = nir_gather_xfb_info(pipeline->pipeline_nir[stage], NULL);
-         if (xfb_info) {
-            uint8_t output_mapping[VARYING_SLOT_TESS_MAX];
-            memset(output_mapping, 0, sizeof(output_mapping));
-
-            nir_foreach_shader_out_variable(var, pipeline->pipeline_nir[stage]) {
-               unsigned slots = var->data.compact ? DIV_ROUND_UP(glsl_get_length(var->type), 4)
-                                                  : glsl_count_attribute_slots(var->type, false);
-               for (unsigned i = 0; i < slots; i++)
-                  output_mapping[var->data.location + i] = var->data.driver_location + i;
-            }
+      shstate.req_local_mem = nir->info.shared_size;
+      return ctx->create_compute_state(ctx, &shstate);
+   }
 
-            shstate.stream_output.num_outputs = xfb_info->output_count;
-            for (unsigned i = 0; i < PIPE_MAX_SO_BUFFERS; i++) {
-               if (xfb_info->buffers_written & (1 << i)) {
-                  shstate.stream_output.stride[i] = xfb_info->buffers[i].stride / 4;
-               }
-            }
-            for (unsigned i = 0; i < xfb_info->output_count; i++) {
-               shstate.stream_output.output[i].output_buffer = xfb_info->outputs[i].buffer;
-               shstate.stream_output.output[i].dst_offset = xfb_info->outputs[i].offset / 4;
-               shstate.stream_output.output[i].register_index = output_mapping[xfb_info->outputs[i].location];
-               shstate.stream_output.output[i].num_components = util_bitcount(xfb_info->outputs[i].component_mask);
-               shstate.stream_output.output[i].start_component = ffs(xfb_info->outputs[i].component_mask) - 1;
-               shstate.stream_output.output[i].stream = xfb_info->buffer_to_stream[xfb_info->outputs[i].buffer];
-            }
+   struct pipe_shader_state shstate = {0};
+   shstate.type = PIPE_SHADER_IR_NIR;
+   shstate.ir.nir = nir;
+
+   if (stage == MESA_SHADER_VERTEX ||
+       stage == MESA_SHADER_GEOMETRY ||
+       stage == MESA_SHADER_TESS_EVAL) {
+      nir_xfb_info *xfb_info = nir_gather_xfb_info(nir, NULL);
+      if (xfb_info) {
+         uint8_t output_mapping[VARYING_SLOT_TESS_MAX];
+         memset(output_mapping, 0, sizeof(output_mapping));
+
+         nir_foreach_shader_out_variable(var, nir) {
+            unsigned slots = var->data.compact ? DIV_ROUND_UP(glsl_get_length(var->type), 4)
+                                               : glsl_count_attribute_slots(var->type, false);
+            for (unsigned i = 0; i < slots; i++)
+               output_mapping[var->data.location + i] = var->data.driver_location + i;
+         }
 
-            ralloc_free(xfb_info);
+         shstate.stream_output.num_outputs = xfb_info->output_count;
+         for (unsigned i = 0; i < PIPE_MAX_SO_BUFFERS; i++) {
+            if (xfb_info->buffers_written & (1 << i)) {
+               shstate.stream_output.stride[i] = xfb_info->buffers[i].stride / 4;
+            }
+         }
+         for (unsigned i = 0; i < xfb_info->output_count; i++) {
+            shstate.stream_output.output[i].output_buffer = xfb_info->outputs[i].buffer;
+            shstate.stream_output.output[i].dst_offset = xfb_info->outputs[i].offset / 4;
+            shstate.stream_output.output[i].register_index = output_mapping[xfb_info->outputs[i].location];
+            shstate.stream_output.output[i].num_components = util_bitcount(xfb_info->outputs[i].component_mask);
+            shstate.stream_output.output[i].start_component = ffs(xfb_info->outputs[i].component_mask) - 1;
+            shstate.stream_output.output[i].stream = xfb_info->buffer_to_stream[xfb_info->outputs[i].buffer];
          }
-      }
 
-      switch (stage) {
-      case MESA_SHADER_FRAGMENT:
-         pipeline->shader_cso[PIPE_SHADER_FRAGMENT] = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_VERTEX:
-         pipeline->shader_cso[PIPE_SHADER_VERTEX] = device->queue.ctx->create_vs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_GEOMETRY:
-         pipeline->shader_cso[PIPE_SHADER_GEOMETRY] = device->queue.ctx->create_gs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_TESS_CTRL:
-         pipeline->shader_cso[PIPE_SHADER_TESS_CTRL] = device->queue.ctx->create_tcs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_TESS_EVAL:
-         pipeline->shader_cso[PIPE_SHADER_TESS_EVAL] = device->queue.ctx->create_tes_state(device->queue.ctx, &shstate);
-         break;
-      default:
-         unreachable("illegal shader");
-         break;
+         ralloc_free(xfb_info);
       }
    }
+
+   switch (stage) {
+   case MESA_SHADER_FRAGMENT:
+      return ctx->create_fs_state(ctx, &shstate);
+   case MESA_SHADER_VERTEX:
+      return ctx->create_vs_state(ctx, &shstate);
+   case MESA_SHADER_GEOMETRY:
+      return ctx->create_gs_state(ctx, &shstate);
+   case MESA_SHADER_TESS_CTRL:
+      return ctx->create_tcs_state(ctx, &shstate);
+   case MESA_SHADER_TESS_EVAL:
+      return ctx->create_tes_state(ctx, &shstate);
+   default:
+      unreachable("illegal shader");
+      return NULL;
+   }
+}
+
+/* Create the CSO for the first queue context.  The other contexts create
+ * theirs when they first bind the pipeline, from a copy of the NIR taken
+ * before the first context lowers it.
+ */
+static void
+lvp_pipeline_create_shader(struct lvp_pipeline *pipeline,
+                           gl_shader_stage stage)
+{
+   struct lvp_device *device = pipeline->device;
+   nir_shader *nir = pipeline->pipeline_nir[stage];
+
+   if (device->queue.num_contexts > 1)
+      pipeline->shader_nir[stage] = nir_shader_clone(pipeline->mem_ctx, nir);
+
+   pipeline->shader_cso[0][pipe_shader_type_from_mesa(stage)] =
+      lvp_pipeline_create_cso(device->queue.ctxs[0], nir);
+}
+
+void *
+lvp_pipeline_shader_cso(struct lvp_pipeline *pipeline, unsigned ctx_index,
+                        gl_shader_stage stage)
+{
+   void **cso = &pipeline->shader_cso[ctx_index][pipe_shader_type_from_mesa(stage)];
+
+   /* Only the queue thread owning the context gets here for it. */
+   if (!*cso && pipeline->shader_nir[stage]) {
+      *cso = lvp_pipeline_create_cso(pipeline->device->queue.ctxs[ctx_index],
+                                     nir_shader_clone(NULL, pipeline->shader_nir[stage]));
+   }
+   return *cso;
+}
+
+static VkResult
+lvp_pipeline_compile(struct lvp_pipeline *pipeline,
+                     gl_shader_stage stage)
+{
+   struct lvp_device *device = pipeline->device;
+   device->physical_device->pscreen->finalize_nir(device->physical_device->pscreen, pipeline->pipeline_nir[stage]);
+   lvp_pipeline_create_shader(pipeline, stage);
    return VK_SUCCESS;
 }
 
@@ -864,7 +963,7 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
       VK_FROM_HANDLE(vk_shader_module, module,
                       pCreateInfo->pStages[i].module);
       gl_shader_stage stage = lvp_shader_stage(pCreateInfo->pStages[i].stage);
-      lvp_shader_compile_to_ir(pipeline, module,
+      lvp_shader_compile_to_ir(pipeline, cache, module,
                                pCreateInfo->pStages[i].pName,
                                stage,
                                pCreateInfo->pStages[i].pSpecializationInfo);
@@ -906,10 +1005,7 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
                                                      "dummy_frag");
 
       pipeline->pipeline_nir[MESA_SHADER_FRAGMENT] = b.shader;
-      struct pipe_shader_state shstate = {0};
-      shstate.type = PIPE_SHADER_IR_NIR;
-      shstate.ir.nir = pipeline->pipeline_nir[MESA_SHADER_FRAGMENT];
-      pipeline->shader_cso[PIPE_SHADER_FRAGMENT] = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
+      lvp_pipeline_create_shader(pipeline, MESA_SHADER_FRAGMENT);
    }
    return VK_SUCCESS;
 }
@@ -994,7 +1090,7 @@ lvp_compute_pipeline_init(struct lvp_pipeline *pipeline,
                                  &pipeline->compute_create_info, pCreateInfo);
    pipeline->is_compute_pipeline = true;
 
-   lvp_shader_compile_to_ir(pipeline, module,
+   lvp_shader_compile_to_ir(pipeline, cache, module,
                             pCreateInfo->stage.pName,
                             MESA_SHADER_COMPUTE,
                             pCreateInfo->stage.pSpecializationInfo);
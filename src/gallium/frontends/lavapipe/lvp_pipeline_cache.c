@@ -22,6 +22,90 @@
  */
 
 #include "lvp_private.h"
+#include "nir_serialize.h"
+#include "util/blob.h"
+#include "util/hash_table.h"
+#include "util/ralloc.h"
+
+struct serialized_nir {
+   unsigned char sha1_key[20];
+   size_t size;
+   char data[0];
+};
+
+static uint32_t
+sha1_hash_func(const void *sha1)
+{
+   return _mesa_hash_data(sha1, 20);
+}
+
+static bool
+sha1_compare_func(const void *sha1_a, const void *sha1_b)
+{
+   return memcmp(sha1_a, sha1_b, 20) == 0;
+}
+
+/* Must be called with the cache lock held */
+static void
+lvp_pipeline_cache_add_nir_locked(struct lvp_pipeline_cache *cache,
+                                  const unsigned char *sha1_key,
+                                  const void *data, size_t size)
+{
+   if (_mesa_hash_table_search(cache->nir_cache, sha1_key))
+      return;
+
+   struct serialized_nir *snir =
+      ralloc_size(cache->nir_cache, sizeof(*snir) + size);
+   if (!snir)
+      return;
+   memcpy(snir->sha1_key, sha1_key, 20);
+   snir->size = size;
+   memcpy(snir->data, data, size);
+
+   _mesa_hash_table_insert(cache->nir_cache, snir->sha1_key, snir);
+}
+
+static void
+lvp_pipeline_cache_load(struct lvp_pipeline_cache *cache,
+                        const void *data, size_t size)
+{
+   struct blob_reader blob;
+   blob_reader_init(&blob, data, size);
+
+   struct vk_pipeline_cache_header header;
+   uint8_t uuid[VK_UUID_SIZE];
+   blob_copy_bytes(&blob, &header, sizeof(header));
+   if (blob.overrun)
+      return;
+
+   lvp_device_get_cache_uuid(uuid);
+   if (header.header_size < sizeof(header) || header.header_size > size)
+      return;
+   if (header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+      return;
+   if (header.vendor_id != VK_VENDOR_ID_MESA)
+      return;
+   if (header.device_id != 0)
+      return;
+   if (memcmp(header.uuid, uuid, VK_UUID_SIZE) != 0)
+      return;
+
+   /* The entries start after the header, which may be larger than ours. */
+   blob_skip_bytes(&blob, header.header_size - sizeof(header));
+   uint32_t count = blob_read_uint32(&blob);
+   if (blob.overrun)
+      return;
+
+   for (uint32_t i = 0; i < count; i++) {
+      const unsigned char *sha1_key = blob_read_bytes(&blob, 20);
+      uint32_t nir_size = blob_read_uint32(&blob);
+      const void *nir_data = blob_read_bytes(&blob, nir_size);
+      if (blob.overrun)
+         break;
+
+      lvp_pipeline_cache_add_nir_locked(cache, sha1_key, nir_data, nir_size);
+   }
+}
 
 VKAPI_ATTR VkResult VKAPI_CALL lvp_CreatePipelineCache(
     VkDevice                                    _device,
@@ -41,6 +125,13 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreatePipelineCache(
    if (cache == NULL)
       return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
 
+   cache->nir_cache = _mesa_hash_table_create(NULL, sha1_hash_func,
+                                              sha1_compare_func);
+   if (cache->nir_cache == NULL) {
+      vk_free2(&device->vk.alloc, pAllocator, cache);
+      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+   }
+
    vk_object_base_init(&device->vk, &cache->base,
                        VK_OBJECT_TYPE_PIPELINE_CACHE);
    if (pAllocator)
@@ -49,6 +140,13 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreatePipelineCache(
      cache->alloc = device->vk.alloc;
 
    cache->device = device;
+   simple_mtx_init(&cache->lock, mtx_plain);
+
+   if (pCreateInfo->initialDataSize > 0)
+      lvp_pipeline_cache_load(cache,
+                              pCreateInfo->pInitialData,
+                              pCreateInfo->initialDataSize);
+
    *pPipelineCache = lvp_pipeline_cache_to_handle(cache);
 
    return VK_SUCCESS;
@@ -64,7 +162,10 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipelineCache(
 
    if (!_cache)
       return;
-//   lvp_pipeline_cache_finish(cache);
+
+   /* The serialized shaders are ralloc'ed off the table */
+   _mesa_hash_table_destroy(cache->nir_cache, NULL);
+   simple_mtx_destroy(&cache->lock);
    vk_object_base_finish(&cache->base);
    vk_free2(&device->vk.alloc, pAllocator, cache);
 }
@@ -75,21 +176,57 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_GetPipelineCacheData(
         size_t*                                     pDataSize,
         void*                                       pData)
 {
+   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
    VkResult result = VK_SUCCESS;
-   if (pData) {
-      if (*pDataSize < 32) {
-         *pDataSize = 0;
+
+   struct blob blob;
+   if (pData)
+      blob_init_fixed(&blob, pData, *pDataSize);
+   else
+      blob_init_fixed(&blob, NULL, SIZE_MAX);
+
+   struct vk_pipeline_cache_header header = {
+      .header_size = sizeof(struct vk_pipeline_cache_header),
+      .header_version = VK_PIPELINE_CACHE_HEADER_VERSION_ONE,
+      .vendor_id = VK_VENDOR_ID_MESA,
+      .device_id = 0,
+   };
+   lvp_device_get_cache_uuid(header.uuid);
+   blob_write_bytes(&blob, &header, sizeof(header));
+
+   uint32_t count = 0;
+   intptr_t count_offset = blob_reserve_uint32(&blob);
+   if (count_offset < 0) {
+      *pDataSize = 0;
+      blob_finish(&blob);
+      return VK_INCOMPLETE;
+   }
+
+   simple_mtx_lock(&cache->lock);
+   hash_table_foreach(cache->nir_cache, entry) {
+      const struct serialized_nir *snir = entry->data;
+
+      size_t save_size = blob.size;
+      blob_write_bytes(&blob, snir->sha1_key, 20);
+      blob_write_uint32(&blob, snir->size);
+      blob_write_bytes(&blob, snir->data, snir->size);
+      if (blob.out_of_memory) {
+         /* If it fails reset to the previous size and bail */
+         blob.size = save_size;
          result = VK_INCOMPLETE;
-      } else {
-         uint32_t *hdr = (uint32_t *)pData;
-         hdr[0] = 32;
-         hdr[1] = 1;
-         hdr[2] = VK_VENDOR_ID_MESA;
-         hdr[3] = 0;
-         lvp_device_get_cache_uuid(&hdr[4]);
+         break;
       }
-   } else
-      *pDataSize = 32;
+
+      count++;
+   }
+   simple_mtx_unlock(&cache->lock);
+
+   blob_overwrite_uint32(&blob, count_offset, count);
+
+   *pDataSize = blob.size;
+
+   blob_finish(&blob);
+
    return result;
 }
 
@@ -99,5 +236,82 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_MergePipelineCaches(
         uint32_t                                    srcCacheCount,
         const VkPipelineCache*                      pSrcCaches)
 {
+   LVP_FROM_HANDLE(lvp_pipeline_cache, dst, destCache);
+
+   simple_mtx_lock(&dst->lock);
+   for (uint32_t i = 0; i < srcCacheCount; i++) {
+      LVP_FROM_HANDLE(lvp_pipeline_cache, src, pSrcCaches[i]);
+
+      simple_mtx_lock(&src->lock);
+      hash_table_foreach(src->nir_cache, entry) {
+         const struct serialized_nir *snir = entry->data;
+         lvp_pipeline_cache_add_nir_locked(dst, snir->sha1_key,
+                                           snir->data, snir->size);
+      }
+      simple_mtx_unlock(&src->lock);
+   }
+   simple_mtx_unlock(&dst->lock);
+
    return VK_SUCCESS;
 }
+
+/**
+ * Look up the NIR lvp_shader_compile_to_ir() produced for the given key.
+ * Returns NULL on a miss.
+ */
+nir_shader *
+lvp_pipeline_cache_search_nir(struct lvp_pipeline_cache *cache,
+                              const unsigned char *sha1_key,
+                              const nir_shader_compiler_options *nir_options)
+{
+   nir_shader *nir = NULL;
+
+   if (!cache)
+      return NULL;
+
+   simple_mtx_lock(&cache->lock);
+   struct hash_entry *entry =
+      _mesa_hash_table_search(cache->nir_cache, sha1_key);
+   if (entry) {
+      const struct serialized_nir *snir = entry->data;
+      struct blob_reader blob;
+      blob_reader_init(&blob, snir->data, snir->size);
+
+      nir = nir_deserialize(NULL, nir_options, &blob);
+      if (blob.overrun) {
+         ralloc_free(nir);
+         nir = NULL;
+      }
+   }
+   simple_mtx_unlock(&cache->lock);
+
+   return nir;
+}
+
+void
+lvp_pipeline_cache_upload_nir(struct lvp_pipeline_cache *cache,
+                              const unsigned char *sha1_key,
+                              const nir_shader *nir)
+{
+   if (!cache)
+      return;
+
+   simple_mtx_lock(&cache->lock);
+   struct hash_entry *entry =
+      _mesa_hash_table_search(cache->nir_cache, sha1_key);
+   simple_mtx_unlock(&cache->lock);
+   if (entry)
+      return;
+
+   struct blob blob;
+   blob_init(&blob);
+
+   nir_serialize(&blob, nir, true);
+   if (!blob.out_of_memory) {
+      simple_mtx_lock(&cache->lock);
+      lvp_pipeline_cache_add_nir_locked(cache, sha1_key, blob.data, blob.size);
+      simple_mtx_unlock(&cache->lock);
+   }
+
+   blob_finish(&blob);
+}
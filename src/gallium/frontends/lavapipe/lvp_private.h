@@ -156,11 +156,17 @@ void lvp_finish_wsi(struct lvp_physical_device *physical_device);
 bool lvp_physical_device_extension_supported(struct lvp_physical_device *dev,
                                               const char *name);
 
+#define LVP_MAX_QUEUE_CONTEXTS 8
+
 struct lvp_queue {
    struct vk_queue vk;
    struct lvp_device *                         device;
    struct pipe_context *ctx;
    struct cso_context *cso;
+   /* one context per queue thread; ctxs[0] and csos[0] are ctx and cso */
+   unsigned num_contexts;
+   struct pipe_context *ctxs[LVP_MAX_QUEUE_CONTEXTS];
+   struct cso_context *csos[LVP_MAX_QUEUE_CONTEXTS];
    bool shutdown;
    uint64_t timeline;
    struct util_queue queue;
@@ -169,6 +175,23 @@ struct lvp_queue {
    uint64_t last_fence_timeline;
    struct pipe_fence_handle *last_fence;
    volatile int count;
+
+   /* jobs may execute concurrently on the queue threads, but they are
+    * retired (flushed and signalled) in submission order
+    */
+   simple_mtx_t submit_lock;
+   uint64_t submitted;
+   uint64_t last_ordered;
+   mtx_t retire_lock;
+   cnd_t retire_cond;
+   uint64_t retired;
+};
+
+/* position of a queue job in submission order */
+struct lvp_queue_order {
+   uint64_t seq;
+   /* jobs up to and including this one must retire before execution starts */
+   uint64_t wait;
 };
 
 struct lvp_semaphore_wait {
@@ -178,6 +201,7 @@ struct lvp_semaphore_wait {
 
 struct lvp_queue_work {
    struct list_head list;
+   struct lvp_queue_order order;
    uint32_t cmd_buffer_count;
    uint32_t timeline_count;
    uint32_t wait_count;
@@ -195,8 +219,22 @@ struct lvp_pipeline_cache {
    struct vk_object_base                        base;
    struct lvp_device *                          device;
    VkAllocationCallbacks                        alloc;
+
+   simple_mtx_t                                 lock;
+   /* sha1 of the shader stage and layout -> serialized NIR */
+   struct hash_table *                          nir_cache;
 };
 
+nir_shader *
+lvp_pipeline_cache_search_nir(struct lvp_pipeline_cache *cache,
+                              const unsigned char *sha1_key,
+                              const nir_shader_compiler_options *nir_options);
+
+void
+lvp_pipeline_cache_upload_nir(struct lvp_pipeline_cache *cache,
+                              const unsigned char *sha1_key,
+                              const nir_shader *nir);
+
 struct lvp_device {
    struct vk_device vk;
 
@@ -295,6 +333,7 @@ struct lvp_render_pass {
    struct lvp_render_pass_attachment *          attachments;
    bool has_color_attachment;
    bool has_zs_attachment;
+   bool has_external_dependency;
    struct lvp_subpass                           subpasses[0];
 };
 
@@ -463,7 +502,10 @@ struct lvp_pipeline {
    bool is_compute_pipeline;
    bool force_min_sample;
    nir_shader *pipeline_nir[MESA_SHADER_STAGES];
-   void *shader_cso[PIPE_SHADER_TYPES];
+   /* indexed by queue context, see lvp_pipeline_shader_cso() */
+   void *shader_cso[LVP_MAX_QUEUE_CONTEXTS][PIPE_SHADER_TYPES];
+   /* unlowered copies the other queue contexts create their CSOs from */
+   nir_shader *shader_nir[MESA_SHADER_STAGES];
    VkGraphicsPipelineCreateInfo graphics_create_info;
    VkComputePipelineCreateInfo compute_create_info;
    uint32_t line_stipple_factor;
@@ -476,6 +518,10 @@ struct lvp_pipeline {
    bool provoking_vertex_last;
 };
 
+void *
+lvp_pipeline_shader_cso(struct lvp_pipeline *pipeline, unsigned ctx_index,
+                        gl_shader_stage stage);
+
 struct lvp_event {
    struct vk_object_base base;
    volatile uint64_t event_storage;
@@ -511,6 +557,7 @@ struct lvp_semaphore {
 };
 
 struct lvp_queue_noop {
+   struct lvp_queue_order order;
    struct lvp_fence *fence;
    struct lvp_semaphore *sema;
 };
@@ -543,6 +590,8 @@ struct lvp_query_pool {
    uint32_t count;
    VkQueryPipelineStatisticFlags pipeline_stats;
    enum pipe_query_type base_type;
+   /* the queue context each query was created on */
+   struct pipe_context **query_ctxs;
    struct pipe_query *queries[0];
 };
 
@@ -571,6 +620,8 @@ struct lvp_cmd_buffer {
    struct list_head                             pool_link;
 
    struct vk_cmd_queue                          queue;
+   /* contains commands that must be ordered against other submissions */
+   bool                                         ordered;
 
    uint8_t push_constants[MAX_PUSH_CONSTANTS_SIZE];
 };
@@ -648,6 +699,7 @@ struct lvp_cmd_push_descriptor_set {
 
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
+                          unsigned ctx_index,
                           struct lvp_cmd_buffer *cmd_buffer);
 
 struct lvp_image *lvp_swapchain_get_image(VkSwapchainKHR swapchain,
@@ -687,6 +739,11 @@ lvp_vk_format_to_pipe_format(VkFormat format)
 
 void
 queue_thread_noop(void *data, void *gdata, int thread_index);
+void
+lvp_queue_add_job(struct lvp_queue *queue, void *job,
+                  struct lvp_queue_order *order, bool ordered,
+                  struct util_queue_fence *fence,
+                  util_queue_execute_func execute);
 #ifdef __cplusplus
 }
 #endif
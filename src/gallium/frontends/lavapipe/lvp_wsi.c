@@ -80,7 +80,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_AcquireNextImage2KHR(
       noop->sema = semaphore;
       if (fence)
          fence->timeline = p_atomic_inc_return(&device->queue.timeline);
-      util_queue_add_job(&device->queue.queue, noop, fence ? &fence->fence : NULL, queue_thread_noop, NULL, 0);
+      lvp_queue_add_job(&device->queue, noop, &noop->order, false,
+                        fence ? &fence->fence : NULL, queue_thread_noop);
    }
    return result;
 }
@@ -0,0 +1,237 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Test recording and replaying calls with the threaded context, on top of
+ * a fake driver context that logs the calls it executes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "util/u_memory.h"
+#include "util/u_threaded_context.h"
+#include "util/u_upload_mgr.h"
+
+enum call {
+   CALL_BIND_BLEND,
+   CALL_DRAW,
+   CALL_CLEAR,
+};
+
+static struct {
+   enum call call;
+   void *state;
+} calls[64];
+static unsigned num_calls;
+
+static void
+log_call(enum call call, void *state)
+{
+   assert(num_calls < ARRAY_SIZE(calls));
+   calls[num_calls].call = call;
+   calls[num_calls].state = state;
+   num_calls++;
+}
+
+static int
+fake_get_param(struct pipe_screen *screen, enum pipe_cap param)
+{
+   return param == PIPE_CAP_MAX_VERTEX_BUFFERS ? 16 : 0;
+}
+
+static int
+fake_get_shader_param(struct pipe_screen *screen,
+                      enum pipe_shader_type shader,
+                      enum pipe_shader_cap param)
+{
+   return 16;
+}
+
+static void *
+fake_create_blend_state(struct pipe_context *pipe,
+                        const struct pipe_blend_state *state)
+{
+   return CALLOC_STRUCT(pipe_blend_state);
+}
+
+static void
+fake_bind_blend_state(struct pipe_context *pipe, void *state)
+{
+   log_call(CALL_BIND_BLEND, state);
+}
+
+static void
+fake_delete_blend_state(struct pipe_context *pipe, void *state)
+{
+   FREE(state);
+}
+
+static void
+fake_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
+              unsigned drawid_offset,
+              const struct pipe_draw_indirect_info *indirect,
+              const struct pipe_draw_start_count_bias *draws,
+              unsigned num_draws)
+{
+   log_call(CALL_DRAW, NULL);
+}
+
+static void
+fake_clear(struct pipe_context *pipe, unsigned buffers,
+           const struct pipe_scissor_state *scissor_state,
+           const union pipe_color_union *color, double depth,
+           unsigned stencil)
+{
+   log_call(CALL_CLEAR, NULL);
+}
+
+static void
+fake_flush(struct pipe_context *pipe, struct pipe_fence_handle **fence,
+           unsigned flags)
+{
+}
+
+static void
+fake_destroy(struct pipe_context *pipe)
+{
+   u_upload_destroy(pipe->stream_uploader);
+   FREE(pipe);
+}
+
+static struct pipe_context *
+fake_context_create(struct pipe_screen *screen)
+{
+   struct pipe_context *pipe = CALLOC_STRUCT(pipe_context);
+
+   pipe->screen = screen;
+   pipe->create_blend_state = fake_create_blend_state;
+   pipe->bind_blend_state = fake_bind_blend_state;
+   pipe->delete_blend_state = fake_delete_blend_state;
+   pipe->draw_vbo = fake_draw_vbo;
+   pipe->clear = fake_clear;
+   pipe->flush = fake_flush;
+   pipe->destroy = fake_destroy;
+   pipe->stream_uploader = u_upload_create_default(pipe);
+   pipe->const_uploader = pipe->stream_uploader;
+   return pipe;
+}
+
+static void
+draw(struct pipe_context *pipe)
+{
+   struct pipe_draw_info info;
+   struct pipe_draw_start_count_bias draw = { .start = 0, .count = 3 };
+   union pipe_color_union color = { .f = { 0.0f } };
+
+   memset(&info, 0, sizeof info);
+   info.mode = PIPE_PRIM_TRIANGLES;
+   info.instance_count = 1;
+   pipe->draw_vbo(pipe, &info, 0, NULL, &draw, 1);
+   pipe->clear(pipe, PIPE_CLEAR_COLOR, NULL, &color, 0, 0);
+}
+
+/* Execute the enqueued calls and check that the driver got the expected
+ * ones.
+ */
+static bool
+check_calls(struct pipe_context *pipe, const char *name,
+            void *blend0, void *blend1)
+{
+   pipe->flush(pipe, NULL, 0);
+
+   bool ok = (blend0 ? num_calls == 4 : num_calls == 3);
+   unsigned i = 0;
+
+   if (ok && blend0)
+      ok = calls[i].call == CALL_BIND_BLEND && calls[i++].state == blend0;
+   ok = ok && calls[i].call == CALL_BIND_BLEND && calls[i++].state == blend1;
+   ok = ok && calls[i++].call == CALL_DRAW;
+   ok = ok && calls[i++].call == CALL_CLEAR;
+
+   if (!ok)
+      printf("%s: unexpected calls (%u)\n", name, num_calls);
+   num_calls = 0;
+   return ok;
+}
+
+int
+main(int argc, char **argv)
+{
+   struct pipe_blend_state templ;
+   struct pipe_screen screen;
+   struct slab_parent_pool pool;
+   struct tc_recording *rec;
+   bool ok = true;
+
+   memset(&screen, 0, sizeof screen);
+   screen.get_param = fake_get_param;
+   screen.get_shader_param = fake_get_shader_param;
+
+   setenv("GALLIUM_THREAD", "true", 1);
+   slab_create_parent(&pool, sizeof(struct threaded_transfer), 16);
+
+   struct pipe_context *fake = fake_context_create(&screen);
+   if (threaded_context_begin_recording(fake)) {
+      printf("recording started without a threaded context\n");
+      ok = false;
+   }
+
+   struct pipe_context *pipe =
+      threaded_context_create(fake, &pool, NULL, NULL, NULL);
+   if (pipe == fake) {
+      printf("no threaded context\n");
+      return 1;
+   }
+
+   memset(&templ, 0, sizeof templ);
+   void *blend0 = pipe->create_blend_state(pipe, &templ);
+   void *blend1 = pipe->create_blend_state(pipe, &templ);
+
+   /* The recorded calls are executed normally. */
+   threaded_context_begin_recording(pipe);
+   pipe->bind_blend_state(pipe, blend1);
+   draw(pipe);
+   rec = threaded_context_end_recording(pipe);
+   if (!rec) {
+      printf("recording failed\n");
+      return 1;
+   }
+   ok &= check_calls(pipe, "record", NULL, blend1);
+
+   /* Replays restore the recorded state. */
+   pipe->bind_blend_state(pipe, blend0);
+   if (!threaded_context_replay(pipe, rec, NULL)) {
+      printf("replay failed\n");
+      ok = false;
+   }
+   ok &= check_calls(pipe, "replay", blend0, blend1);
+
+   /* Deleting a CSO that is used by the recording invalidates it. */
+   pipe->delete_blend_state(pipe, blend1);
+   if (threaded_context_replay(pipe, rec, NULL)) {
+      printf("replay with a deleted CSO\n");
+      ok = false;
+   }
+   tc_recording_destroy(rec);
+
+   /* Flushes can't be recorded. */
+   threaded_context_begin_recording(pipe);
+   pipe->flush(pipe, NULL, 0);
+   rec = threaded_context_end_recording(pipe);
+   if (rec) {
+      printf("flush recorded\n");
+      tc_recording_destroy(rec);
+      ok = false;
+   }
+
+   pipe->delete_blend_state(pipe, blend0);
+   pipe->destroy(pipe);
+   slab_destroy_parent(&pool);
+
+   return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "main/formats.h"
+#include "main/macros.h"
+#include "main/texcompress.h"
+#include "main/texcompress_astc.h"
+#include "util/u_queue.h"
+
+/* Not a multiple of any block size, so that every decoder writes partial
+ * blocks at the right and bottom edges.
+ */
+#define WIDTH 61
+#define HEIGHT 53
+
+static uint32_t
+rand_next(uint32_t *state)
+{
+   *state = *state * 1664525 + 1013904223;
+   return *state >> 8;
+}
+
+static bool
+is_astc_error_block(const uint8_t *rgba, unsigned num_texels)
+{
+   for (unsigned i = 0; i < num_texels; i++) {
+      if (rgba[i * 4 + 0] != 0xff || rgba[i * 4 + 1] != 0 ||
+          rgba[i * 4 + 2] != 0xff || rgba[i * 4 + 3] != 0xff)
+         return false;
+   }
+   return true;
+}
+
+/**
+ * Returns an image of random blocks.  Most random ASTC blocks are illegal
+ * encodings, so these are redrawn until they decode to something other than
+ * the error colour.
+ */
+static std::vector<uint8_t>
+random_blocks(mesa_format format, unsigned width, unsigned height,
+              unsigned *stride, uint32_t seed)
+{
+   unsigned size = _mesa_format_image_size(format, width, height, 1);
+   unsigned block_size = _mesa_get_format_bytes(format);
+   std::vector<uint8_t> data(size);
+   unsigned blk_w, blk_h;
+
+   _mesa_get_format_block_size(format, &blk_w, &blk_h);
+
+   for (unsigned b = 0; b < size; b += block_size) {
+      for (;;) {
+         uint8_t rgba[12 * 12 * 4];
+
+         for (unsigned i = 0; i < block_size; i++)
+            data[b + i] = rand_next(&seed);
+
+         if (!_mesa_is_format_astc_2d(format))
+            break;
+
+         _mesa_unpack_astc_2d_ldr(rgba, blk_w * 4, &data[b], block_size,
+                                  blk_w, blk_h, format);
+         if (!is_astc_error_block(rgba, blk_w * blk_h))
+            break;
+      }
+   }
+
+   *stride = _mesa_format_row_stride(format, width);
+   return data;
+}
+
+static uint32_t
+hash_rgba8(const std::vector<uint8_t> &data)
+{
+   uint32_t hash = 2166136261u;
+   for (uint8_t byte : data)
+      hash = (hash ^ byte) * 16777619u;
+   return hash;
+}
+
+/* FNV-1a hashes of the images decoded from random_blocks(). */
+static const struct {
+   mesa_format format;
+   uint32_t hash;
+} astc_golden[] = {
+   { MESA_FORMAT_RGBA_ASTC_4x4, 0xa953c214 },
+   { MESA_FORMAT_RGBA_ASTC_5x4, 0xae1ca908 },
+   { MESA_FORMAT_RGBA_ASTC_5x5, 0x2605ed79 },
+   { MESA_FORMAT_RGBA_ASTC_6x5, 0xc7d2b1c4 },
+   { MESA_FORMAT_RGBA_ASTC_6x6, 0x4d4e56b1 },
+   { MESA_FORMAT_RGBA_ASTC_8x5, 0x654561f1 },
+   { MESA_FORMAT_RGBA_ASTC_8x6, 0x70529662 },
+   { MESA_FORMAT_RGBA_ASTC_8x8, 0xa3dab58f },
+   { MESA_FORMAT_RGBA_ASTC_10x5, 0x3884d269 },
+   { MESA_FORMAT_RGBA_ASTC_10x6, 0xf74e95cc },
+   { MESA_FORMAT_RGBA_ASTC_10x8, 0x2a39a1ed },
+   { MESA_FORMAT_RGBA_ASTC_10x10, 0x8b1c1b97 },
+   { MESA_FORMAT_RGBA_ASTC_12x10, 0x580bb90f },
+   { MESA_FORMAT_RGBA_ASTC_12x12, 0xa114ec2e },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_4x4, 0x32d3a49a },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_5x4, 0xd2571367 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_5x5, 0xfb6cbf55 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_6x5, 0xede2b323 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_6x6, 0x4761fd10 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_8x5, 0x978528df },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_8x6, 0xfe6bfc58 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_8x8, 0x6e099dd2 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_10x5, 0xed76048d },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_10x6, 0xb5ff37da },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_10x8, 0x2ce5db95 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_10x10, 0x539460f3 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_12x10, 0xd3ef2086 },
+   { MESA_FORMAT_SRGB8_ALPHA8_ASTC_12x12, 0x2fd60952 },
+};
+
+TEST(texcompress, astc_golden)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(astc_golden); i++) {
+      mesa_format format = astc_golden[i].format;
+      unsigned stride;
+      std::vector<uint8_t> blocks =
+         random_blocks(format, WIDTH, HEIGHT, &stride, format);
+      std::vector<uint8_t> rgba(WIDTH * HEIGHT * 4);
+
+      _mesa_unpack_astc_2d_ldr(rgba.data(), WIDTH * 4, blocks.data(), stride,
+                               WIDTH, HEIGHT, format);
+      EXPECT_EQ(hash_rgba8(rgba), astc_golden[i].hash)
+         << _mesa_get_format_name(format);
+   }
+}
+
+/* Splitting an image into strips decoded by a queue must not change the
+ * result, including the partial blocks at the strip and image edges.
+ */
+TEST(texcompress, unpack_parallel)
+{
+   static const mesa_format formats[] = {
+      MESA_FORMAT_ETC1_RGB8,
+      MESA_FORMAT_ETC2_RGB8,
+      MESA_FORMAT_ETC2_SRGB8_ALPHA8_EAC,
+      MESA_FORMAT_ETC2_RGB8_PUNCHTHROUGH_ALPHA1,
+      MESA_FORMAT_RGBA_ASTC_4x4,
+      MESA_FORMAT_RGBA_ASTC_6x5,
+      MESA_FORMAT_SRGB8_ALPHA8_ASTC_12x12,
+   };
+   const unsigned width = 8 * WIDTH, height = 8 * HEIGHT;
+   struct util_queue queue;
+
+   ASSERT_TRUE(util_queue_init(&queue, "texcomp", 8, 3,
+                               UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL));
+
+   for (unsigned i = 0; i < ARRAY_SIZE(formats); i++) {
+      mesa_format format = formats[i];
+      unsigned stride;
+      std::vector<uint8_t> blocks =
+         random_blocks(format, width, height, &stride, format);
+      std::vector<uint8_t> serial(width * height * 4);
+      std::vector<uint8_t> parallel(width * height * 4);
+
+      _mesa_unpack_compressed_image(NULL, format, false, serial.data(),
+                                    width * 4, blocks.data(), stride,
+                                    width, height);
+      _mesa_unpack_compressed_image(&queue, format, false, parallel.data(),
+                                    width * 4, blocks.data(), stride,
+                                    width, height);
+      EXPECT_TRUE(serial == parallel) << _mesa_get_format_name(format);
+   }
+
+   util_queue_destroy(&queue);
+}
@@ -0,0 +1,242 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Benchmark of the decompression done on upload of ETC and ASTC textures
+ * when the driver doesn't support them, and of the S3TC, RGTC and BPTC
+ * encoders used to transcode them.  Prints megapixels per second of a
+ * 1024x1024 image processed on the calling thread and split across a queue
+ * with one thread per additional CPU, and the PSNR of the encoders.
+ *
+ * Usage: texcompress_bench [scale]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "main/formats.h"
+#include "main/macros.h"
+#include "main/texcompress.h"
+#include "main/texcompress_astc.h"
+#include "util/format/u_format.h"
+#include "util/format/u_format_bc_encode.h"
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+
+#define WIDTH 1024
+#define HEIGHT 1024
+
+static const mesa_format formats[] = {
+   MESA_FORMAT_ETC1_RGB8,
+   MESA_FORMAT_ETC2_SRGB8_ALPHA8_EAC,
+   MESA_FORMAT_RGBA_ASTC_4x4,
+   MESA_FORMAT_SRGB8_ALPHA8_ASTC_6x6,
+   MESA_FORMAT_RGBA_ASTC_8x8,
+   MESA_FORMAT_RGBA_ASTC_12x12,
+};
+
+static const mesa_format encode_formats[] = {
+   MESA_FORMAT_RGB_DXT1,
+   MESA_FORMAT_RGBA_DXT5,
+   MESA_FORMAT_RG_RGTC2_UNORM,
+   MESA_FORMAT_BPTC_RGBA_UNORM,
+};
+
+static const char *quality_names[] = { "fast", "normal", "best" };
+
+static uint32_t
+rand_next(uint32_t *state)
+{
+   *state = *state * 1664525 + 1013904223;
+   return *state >> 8;
+}
+
+/* Random blocks, redrawing the ASTC ones that are illegal encodings since
+ * the decoder returns early for those.
+ */
+static std::vector<uint8_t>
+random_blocks(mesa_format format)
+{
+   unsigned size = _mesa_format_image_size(format, WIDTH, HEIGHT, 1);
+   unsigned block_size = _mesa_get_format_bytes(format);
+   std::vector<uint8_t> data(size);
+   uint32_t seed = format;
+   unsigned blk_w, blk_h;
+
+   _mesa_get_format_block_size(format, &blk_w, &blk_h);
+
+   for (unsigned b = 0; b < size; b += block_size) {
+      for (;;) {
+         uint8_t rgba[12 * 12 * 4];
+         bool error = true;
+
+         for (unsigned i = 0; i < block_size; i++)
+            data[b + i] = rand_next(&seed);
+
+         if (!_mesa_is_format_astc_2d(format))
+            break;
+
+         _mesa_unpack_astc_2d_ldr(rgba, blk_w * 4, &data[b], block_size,
+                                  blk_w, blk_h, format);
+         for (unsigned i = 0; i < blk_w * blk_h; i++) {
+            if (rgba[i * 4 + 0] != 0xff || rgba[i * 4 + 1] != 0 ||
+                rgba[i * 4 + 2] != 0xff || rgba[i * 4 + 3] != 0xff)
+               error = false;
+         }
+         if (!error)
+            break;
+      }
+   }
+
+   return data;
+}
+
+static double
+bench(struct util_queue *queue, mesa_format format,
+      const std::vector<uint8_t> &blocks, std::vector<uint8_t> &rgba,
+      unsigned scale)
+{
+   unsigned stride = _mesa_format_row_stride(format, WIDTH);
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < scale; i++) {
+      _mesa_unpack_compressed_image(queue, format, false, rgba.data(),
+                                    WIDTH * 4, blocks.data(), stride,
+                                    WIDTH, HEIGHT);
+   }
+
+   return (double)WIDTH * HEIGHT * scale /
+          ((os_time_get_nano() - start) / 1000.0);
+}
+
+/* Something like a photo: smooth gradients with noise and some edges. */
+static std::vector<uint8_t>
+test_image(void)
+{
+   std::vector<uint8_t> rgba(WIDTH * HEIGHT * 4);
+   uint32_t seed = 1;
+
+   for (unsigned y = 0; y < HEIGHT; y++) {
+      for (unsigned x = 0; x < WIDTH; x++) {
+         uint8_t *p = &rgba[(y * WIDTH + x) * 4];
+         int noise = rand_next(&seed) % 9 - 4;
+         int edge = ((x / 37 + y / 23) % 3) ? 0 : 60;
+
+         p[0] = CLAMP((int)(x / 4) + noise, 0, 255);
+         p[1] = CLAMP((int)(y / 4) - noise + edge, 0, 255);
+         p[2] = CLAMP(255 - (int)((x + y) / 8) + noise, 0, 255);
+         p[3] = CLAMP(255 - (int)(x / 8) + edge, 0, 255);
+      }
+   }
+
+   return rgba;
+}
+
+static double
+bench_encode(struct util_queue *queue, mesa_format format,
+             const std::vector<uint8_t> &rgba, std::vector<uint8_t> &blocks,
+             unsigned scale)
+{
+   unsigned stride = _mesa_format_row_stride(format, WIDTH);
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < scale; i++) {
+      _mesa_compress_rgba8_image(queue, format, blocks.data(), stride,
+                                 rgba.data(), WIDTH * 4, WIDTH, HEIGHT);
+   }
+
+   return (double)WIDTH * HEIGHT * scale /
+          ((os_time_get_nano() - start) / 1000.0);
+}
+
+static double
+psnr(mesa_format format, const std::vector<uint8_t> &rgba,
+     const std::vector<uint8_t> &blocks)
+{
+   const struct util_format_description *desc =
+      util_format_description(format);
+   std::vector<uint8_t> decoded(WIDTH * HEIGHT * 4);
+   unsigned nr_channels = 0;
+   double error = 0.0;
+
+   util_format_unpack_rgba_8unorm_rect(format, decoded.data(), WIDTH * 4,
+                                       blocks.data(),
+                                       _mesa_format_row_stride(format, WIDTH),
+                                       WIDTH, HEIGHT);
+
+   for (unsigned i = 0; i < WIDTH * HEIGHT; i++) {
+      for (unsigned c = 0; c < 4; c++) {
+         if (desc->swizzle[c] > PIPE_SWIZZLE_W)
+            continue;
+         nr_channels++;
+         int d = rgba[i * 4 + c] - decoded[i * 4 + c];
+         error += d * d;
+      }
+   }
+
+   error /= nr_channels;
+   return 10.0 * log10(255.0 * 255.0 / error);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned scale = argc > 1 ? atoi(argv[1]) : 4;
+   struct util_queue queue;
+
+   util_cpu_detect();
+   unsigned num_threads = MAX2(util_get_cpu_caps()->nr_cpus, 2) - 1;
+
+   if (!util_queue_init(&queue, "texcomp", 64, num_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                        UTIL_QUEUE_INIT_SHARED_THREADS, NULL)) {
+      fprintf(stderr, "failed to create the queue\n");
+      return 1;
+   }
+
+   printf("%-36s %12s %12s (%u+1 threads)\n", "format (Mpix/s)",
+          "serial", "parallel", num_threads);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(formats); i++) {
+      std::vector<uint8_t> blocks = random_blocks(formats[i]);
+      std::vector<uint8_t> rgba(WIDTH * HEIGHT * 4);
+
+      double serial = bench(NULL, formats[i], blocks, rgba, scale);
+      double parallel = bench(&queue, formats[i], blocks, rgba, scale);
+
+      printf("%-36s %12.1f %12.1f\n", _mesa_get_format_name(formats[i]),
+             serial, parallel);
+   }
+
+   std::vector<uint8_t> image = test_image();
+
+   printf("\n%-36s %12s %12s %9s\n", "encode (Mpix/s)",
+          "serial", "parallel", "PSNR");
+
+   for (unsigned i = 0; i < ARRAY_SIZE(encode_formats); i++) {
+      std::vector<uint8_t> blocks(_mesa_format_image_size(encode_formats[i],
+                                                          WIDTH, HEIGHT, 1));
+
+      for (unsigned q = 0; q < ARRAY_SIZE(quality_names); q++) {
+         util_format_set_compress_quality((enum util_format_compress_quality)q);
+
+         double serial = bench_encode(NULL, encode_formats[i], image, blocks,
+                                      scale);
+         double parallel = bench_encode(&queue, encode_formats[i], image,
+                                        blocks, scale);
+         char name[64];
+
+         snprintf(name, sizeof(name), "%s %s",
+                  _mesa_get_format_name(encode_formats[i]), quality_names[q]);
+         printf("%-36s %12.1f %12.1f %9.2f\n", name, serial, parallel,
+                psnr(encode_formats[i], image, blocks));
+      }
+   }
+
+   util_queue_destroy(&queue);
+   return 0;
+}
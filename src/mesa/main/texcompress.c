@@ -42,6 +42,9 @@
 #include "texcompress_s3tc.h"
 #include "texcompress_etc.h"
 #include "texcompress_bptc.h"
+#include "texcompress_astc.h"
+#include "util/format/u_format.h"
+#include "util/u_queue.h"
 
 
 /**
@@ -929,3 +932,174 @@ _mesa_decompress_image(mesa_format format, GLuint width, GLuint height,
       }
    }
 }
+
+
+/**
+ * Minimum number of texels decoded or encoded by one job of
+ * process_compressed_image(), so that small images and mipmap levels
+ * don't pay for the thread hand-off.
+ */
+#define UNPACK_MIN_STRIP_TEXELS (64 * 1024)
+#define UNPACK_MAX_STRIPS 64
+
+struct texcompress_strip {
+   struct util_queue_fence fence;
+   mesa_format format;
+   bool compress;
+   bool bgra;
+   uint8_t *dst;
+   unsigned dst_stride;
+   const uint8_t *src;
+   unsigned src_stride;
+   unsigned width, height;
+};
+
+static void
+process_strip(const struct texcompress_strip *strip)
+{
+   if (strip->compress) {
+      /* The RGBA8 values are stored as is, sRGB formats included. */
+      const struct util_format_pack_description *pack =
+         util_format_pack_description(util_format_linear(strip->format));
+
+      pack->pack_rgba_8unorm(strip->dst, strip->dst_stride,
+                             strip->src, strip->src_stride,
+                             strip->width, strip->height);
+   } else if (strip->format == MESA_FORMAT_ETC1_RGB8) {
+      _mesa_etc1_unpack_rgba8888(strip->dst, strip->dst_stride,
+                                 strip->src, strip->src_stride,
+                                 strip->width, strip->height);
+   } else if (_mesa_is_format_etc2(strip->format)) {
+      _mesa_unpack_etc2_format(strip->dst, strip->dst_stride,
+                               strip->src, strip->src_stride,
+                               strip->width, strip->height,
+                               strip->format, strip->bgra);
+   } else if (_mesa_is_format_astc_2d(strip->format)) {
+      _mesa_unpack_astc_2d_ldr(strip->dst, strip->dst_stride,
+                               strip->src, strip->src_stride,
+                               strip->width, strip->height,
+                               strip->format);
+   } else {
+      unreachable("unexpected format for a compressed format fallback");
+   }
+}
+
+static void
+process_strip_execute(void *data, void *gdata, int thread_index)
+{
+   process_strip(data);
+}
+
+/**
+ * Split the image described by \p image into strips of block rows, which
+ * are processed by the queue threads and the calling thread in parallel.
+ */
+static void
+process_compressed_image(struct util_queue *queue,
+                         const struct texcompress_strip *image)
+{
+   struct texcompress_strip strips[UNPACK_MAX_STRIPS];
+   unsigned bw, bh;
+
+   _mesa_get_format_block_size(image->format, &bw, &bh);
+
+   unsigned block_rows = DIV_ROUND_UP(image->height, bh);
+   unsigned rows_per_strip =
+      MAX2(DIV_ROUND_UP(UNPACK_MIN_STRIP_TEXELS,
+                        MAX2(image->width, 1) * bh), 1);
+   rows_per_strip = MAX2(rows_per_strip,
+                         DIV_ROUND_UP(block_rows, UNPACK_MAX_STRIPS));
+   unsigned num_strips = DIV_ROUND_UP(block_rows, rows_per_strip);
+
+   if (!queue || num_strips <= 1) {
+      process_strip(image);
+      return;
+   }
+
+   for (unsigned i = 0; i < num_strips; i++) {
+      /* Offsets of the strip in texel rows and in rows of blocks. */
+      size_t y = (size_t)i * rows_per_strip * bh;
+      size_t block_y = (size_t)i * rows_per_strip;
+
+      strips[i] = *image;
+      strips[i].height = MIN2(rows_per_strip * bh, image->height - y);
+      if (image->compress) {
+         strips[i].dst += block_y * image->dst_stride;
+         strips[i].src += y * image->src_stride;
+      } else {
+         strips[i].dst += y * image->dst_stride;
+         strips[i].src += block_y * image->src_stride;
+      }
+   }
+
+   /* Queue all strips but the first, which this thread processes itself. */
+   for (unsigned i = 1; i < num_strips; i++) {
+      util_queue_fence_init(&strips[i].fence);
+      util_queue_add_job(queue, &strips[i], &strips[i].fence,
+                         process_strip_execute, NULL, 0);
+   }
+
+   process_strip(&strips[0]);
+
+   for (unsigned i = 1; i < num_strips; i++) {
+      util_queue_fence_wait(&strips[i].fence);
+      util_queue_fence_destroy(&strips[i].fence);
+   }
+}
+
+/**
+ * Decompress an ETC1, ETC2 or 2D ASTC image into the uncompressed format
+ * the driver uses instead, as done on upload when the compressed format
+ * isn't supported.  \p bgra selects BGRA output for the sRGB ETC2 formats.
+ *
+ * If \p queue is not NULL, large images are split into strips of block rows
+ * which are decoded by the queue threads and the calling thread in parallel.
+ */
+void
+_mesa_unpack_compressed_image(struct util_queue *queue,
+                              mesa_format format, bool bgra,
+                              uint8_t *dst, unsigned dst_stride,
+                              const uint8_t *src, unsigned src_stride,
+                              unsigned width, unsigned height)
+{
+   const struct texcompress_strip image = {
+      .format = format,
+      .bgra = bgra,
+      .dst = dst,
+      .dst_stride = dst_stride,
+      .src = src,
+      .src_stride = src_stride,
+      .width = width,
+      .height = height,
+   };
+
+   process_compressed_image(queue, &image);
+}
+
+/**
+ * Compress an RGBA8 image into an S3TC, RGTC or BPTC format, as done when
+ * transcoding a compressed format the driver doesn't support.  The values
+ * are stored without sRGB conversion.
+ *
+ * Like _mesa_unpack_compressed_image(), large images are encoded in
+ * parallel strips if \p queue is not NULL.
+ */
+void
+_mesa_compress_rgba8_image(struct util_queue *queue, mesa_format format,
+                           uint8_t *dst, unsigned dst_stride,
+                           const uint8_t *src, unsigned src_stride,
+                           unsigned width, unsigned height)
+{
+   const struct texcompress_strip image = {
+      .format = format,
+      .compress = true,
+      .dst = dst,
+      .dst_stride = dst_stride,
+      .src = src,
+      .src_stride = src_stride,
+      .width = width,
+      .height = height,
+   };
+
+   process_compressed_image(queue, &image);
+}
@@ -28,7 +28,12 @@
 #include "formats.h"
 #include "glheader.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct gl_context;
+struct util_queue;
 
 extern GLenum
 _mesa_gl_compressed_format_base_format(GLenum format);
@@ -63,4 +68,21 @@ _mesa_decompress_image(mesa_format format, GLuint width, GLuint height,
                        const GLubyte *src, GLint srcRowStride,
                        GLfloat *dest);
 
+extern void
+_mesa_unpack_compressed_image(struct util_queue *queue,
+                              mesa_format format, bool bgra,
+                              uint8_t *dst, unsigned dst_stride,
+                              const uint8_t *src, unsigned src_stride,
+                              unsigned width, unsigned height);
+
+extern void
+_mesa_compress_rgba8_image(struct util_queue *queue, mesa_format format,
+                           uint8_t *dst, unsigned dst_stride,
+                           const uint8_t *src, unsigned src_stride,
+                           unsigned width, unsigned height);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* TEXCOMPRESS_H */
@@ -36,6 +36,7 @@
 #include "texcompress_astc.h"
 #include "macros.h"
 #include "util/half_float.h"
+#include "c11/threads.h"
 #include <stdio.h>
 #include <cstdlib>  // for abort() on windows
 
@@ -48,6 +49,19 @@ uint16_div_64k_to_half_to_unorm8(uint16_t v)
    return _mesa_half_to_unorm8(_mesa_uint16_div_64k_to_half(v));
 }
 
+/* uint16_div_64k_to_half_to_unorm8() of every UNORM16 value, so that the
+ * per-texel conversion is a single load instead of two float conversions.
+ */
+static uint8_t unorm16_to_unorm8_table[65536];
+static once_flag unorm16_to_unorm8_table_once = ONCE_FLAG_INIT;
+
+static void
+unorm16_to_unorm8_table_init(void)
+{
+   for (unsigned v = 0; v < ARRAY_SIZE(unorm16_to_unorm8_table); ++v)
+      unorm16_to_unorm8_table[v] = uint16_div_64k_to_half_to_unorm8(v);
+}
+
 class decode_error
 {
 public:
@@ -276,14 +290,22 @@ static uint32_t hash52(uint32_t p)
    return p;
 }
 
-static int select_partition(int seed, int x, int y, int z, int partitioncount,
-                            int small_block)
+/**
+ * The part of the partition selection that only depends on the partition
+ * index and count of a block, computed once per block.
+ */
+struct partition_seeds
+{
+   /* Multipliers of x, y and z and offsets of the four partition values. */
+   uint8_t sx[4], sy[4], sz[4];
+   uint32_t offset[4];
+   int partitioncount;
+   int small_block;
+};
+
+static void init_partition_seeds(partition_seeds *seeds, int seed,
+                                 int partitioncount, int small_block)
 {
-   if (small_block) {
-      x <<= 1;
-      y <<= 1;
-      z <<= 1;
-   }
    seed += (partitioncount - 1) * 1024;
    uint32_t rnum = hash52(seed);
    uint8_t seed1 = rnum & 0xF;
@@ -335,20 +357,36 @@ static int select_partition(int seed, int x, int y, int z, int partitioncount,
    seed11 >>= sh3;
    seed12 >>= sh3;
 
-   int a = seed1 * x + seed2 * y + seed11 * z + (rnum >> 14);
-   int b = seed3 * x + seed4 * y + seed12 * z + (rnum >> 10);
-   int c = seed5 * x + seed6 * y + seed9 * z + (rnum >> 6);
-   int d = seed7 * x + seed8 * y + seed10 * z + (rnum >> 2);
+   const uint8_t sx[4] = { seed1, seed3, seed5, seed7 };
+   const uint8_t sy[4] = { seed2, seed4, seed6, seed8 };
+   const uint8_t sz[4] = { seed11, seed12, seed9, seed10 };
+   const uint32_t offset[4] = { rnum >> 14, rnum >> 10, rnum >> 6, rnum >> 2 };
+
+   memcpy(seeds->sx, sx, sizeof(sx));
+   memcpy(seeds->sy, sy, sizeof(sy));
+   memcpy(seeds->sz, sz, sizeof(sz));
+   memcpy(seeds->offset, offset, sizeof(offset));
+   seeds->partitioncount = partitioncount;
+   seeds->small_block = small_block;
+}
+
+static inline int select_partition(const partition_seeds &seeds,
+                                   int x, int y, int z)
+{
+   if (seeds.small_block) {
+      x <<= 1;
+      y <<= 1;
+      z <<= 1;
+   }
 
-   a &= 0x3F;
-   b &= 0x3F;
-   c &= 0x3F;
-   d &= 0x3F;
+   int v[4];
+   for (int i = 0; i < 4; ++i)
+      v[i] = (seeds.sx[i] * x + seeds.sy[i] * y + seeds.sz[i] * z +
+              seeds.offset[i]) & 0x3F;
 
-   if (partitioncount < 4)
-      d = 0;
-   if (partitioncount < 3)
-      c = 0;
+   int a = v[0], b = v[1];
+   int c = seeds.partitioncount < 3 ? 0 : v[2];
+   int d = seeds.partitioncount < 4 ? 0 : v[3];
 
    if (a >= b && a >= c && a >= d)
       return 0;
@@ -544,7 +582,11 @@ class Decoder
 public:
    Decoder(int block_w, int block_h, int block_d, bool srgb, bool output_unorm8)
       : block_w(block_w), block_h(block_h), block_d(block_d), srgb(srgb),
-        output_unorm8(output_unorm8) {}
+        output_unorm8(output_unorm8)
+   {
+      if (output_unorm8)
+         call_once(&unorm16_to_unorm8_table_once, unorm16_to_unorm8_table_init);
+   }
 
    decode_error::type decode(const uint8_t *in, uint16_t *output) const;
 
@@ -1265,37 +1307,49 @@ void Block::compute_infill_weights(int block_w, int block_h, int block_d)
    int Ds = block_w <= 1 ? 0 : (1024 + block_w / 2) / (block_w - 1);
    int Dt = block_h <= 1 ? 0 : (1024 + block_h / 2) / (block_h - 1);
    int Dr = block_d <= 1 ? 0 : (1024 + block_d / 2) / (block_d - 1);
+
+   /* The grid position and fraction only depend on one coordinate each, so
+    * compute them once per column and row instead of once per texel.
+    */
+   int js[12], fs[12];
+   assert(block_w <= (int)ARRAY_SIZE(js));
+   for (int s = 0; s < block_w; ++s) {
+      int cs = Ds * s;
+      int gs = (cs * (wt_w - 1) + 32) >> 6;
+      assert(gs >= 0 && gs <= 176);
+      js[s] = gs >> 4;
+      fs[s] = gs & 0xf;
+   }
+
    for (int r = 0; r < block_d; ++r) {
+      int cr = Dr * r;
+      int gr = (cr * (wt_d - 1) + 32) >> 6;
+      assert(gr >= 0 && gr <= 176);
+      int jr = gr >> 4;
+      int fr = gr & 0xf;
+
+      /* TODO: 3D */
+      (void)jr;
+      (void)fr;
+
       for (int t = 0; t < block_h; ++t) {
+         int ct = Dt * t;
+         int gt = (ct * (wt_h - 1) + 32) >> 6;
+         assert(gt >= 0 && gt <= 176);
+         int jt = gt >> 4;
+         int ft = gt & 0xf;
+         uint8_t *out0 = &infill_weights[0][t*block_w + r*block_w*block_h];
+         uint8_t *out1 = &infill_weights[1][t*block_w + r*block_w*block_h];
+
          for (int s = 0; s < block_w; ++s) {
-            int cs = Ds * s;
-            int ct = Dt * t;
-            int cr = Dr * r;
-            int gs = (cs * (wt_w - 1) + 32) >> 6;
-            int gt = (ct * (wt_h - 1) + 32) >> 6;
-            int gr = (cr * (wt_d - 1) + 32) >> 6;
-            assert(gs >= 0 && gs <= 176);
-            assert(gt >= 0 && gt <= 176);
-            assert(gr >= 0 && gr <= 176);
-            int js = gs >> 4;
-            int fs = gs & 0xf;
-            int jt = gt >> 4;
-            int ft = gt & 0xf;
-            int jr = gr >> 4;
-            int fr = gr & 0xf;
-
-            /* TODO: 3D */
-            (void)jr;
-            (void)fr;
-
-            int w11 = (fs * ft + 8) >> 4;
+            int w11 = (fs[s] * ft + 8) >> 4;
             int w10 = ft - w11;
-            int w01 = fs - w11;
-            int w00 = 16 - fs - ft + w11;
+            int w01 = fs[s] - w11;
+            int w00 = 16 - fs[s] - ft + w11;
 
             if (dual_plane) {
                int p00, p01, p10, p11, i0, i1;
-               int v0 = js + jt * wt_w;
+               int v0 = js[s] + jt * wt_w;
                p00 = weights[(v0) * 2];
                p01 = weights[(v0 + 1) * 2];
                p10 = weights[(v0 + wt_w) * 2];
@@ -1308,11 +1362,11 @@ void Block::compute_infill_weights(int block_w, int block_h, int block_d)
                assert((v0 + wt_w + 1) * 2 + 1 < (int)ARRAY_SIZE(weights));
                i1 = (p00*w00 + p01*w01 + p10*w10 + p11*w11 + 8) >> 4;
                assert(0 <= i0 && i0 <= 64);
-               infill_weights[0][s + t*block_w + r*block_w*block_h] = i0;
-               infill_weights[1][s + t*block_w + r*block_w*block_h] = i1;
+               out0[s] = i0;
+               out1[s] = i1;
             } else {
                int p00, p01, p10, p11, i;
-               int v0 = js + jt * wt_w;
+               int v0 = js[s] + jt * wt_w;
                p00 = weights[v0];
                p01 = weights[v0 + 1];
                p10 = weights[v0 + wt_w];
@@ -1320,7 +1374,7 @@ void Block::compute_infill_weights(int block_w, int block_h, int block_d)
                assert(v0 + wt_w + 1 < (int)ARRAY_SIZE(weights));
                i = (p00*w00 + p01*w01 + p10*w10 + p11*w11 + 8) >> 4;
                assert(0 <= i && i <= 64);
-               infill_weights[0][s + t*block_w + r*block_w*block_h] = i;
+               out0[s] = i;
             }
          }
       }
@@ -1619,11 +1673,11 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
                output[idx*4+1] = void_extent_colour_g >> 8;
                output[idx*4+2] = void_extent_colour_b >> 8;
             } else {
-               output[idx*4+0] = uint16_div_64k_to_half_to_unorm8(void_extent_colour_r);
-               output[idx*4+1] = uint16_div_64k_to_half_to_unorm8(void_extent_colour_g);
-               output[idx*4+2] = uint16_div_64k_to_half_to_unorm8(void_extent_colour_b);
+               output[idx*4+0] = unorm16_to_unorm8_table[void_extent_colour_r];
+               output[idx*4+1] = unorm16_to_unorm8_table[void_extent_colour_g];
+               output[idx*4+2] = unorm16_to_unorm8_table[void_extent_colour_b];
             }
-            output[idx*4+3] = uint16_div_64k_to_half_to_unorm8(void_extent_colour_a);
+            output[idx*4+3] = unorm16_to_unorm8_table[void_extent_colour_a];
          } else {
             /* Store the color as FP16. */
             output[idx*4+0] = _mesa_uint16_div_64k_to_half(void_extent_colour_r);
@@ -1636,6 +1690,26 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
    }
 
    int small_block = (decoder.block_w * decoder.block_h * decoder.block_d) < 31;
+   partition_seeds seeds = {};
+   if (num_parts > 1)
+      init_partition_seeds(&seeds, partition_index, num_parts, small_block);
+
+   /* Expand the endpoints of each partition to 16 bits once per block. */
+   uint16_t c0[4][4], c1[4][4];
+   for (int p = 0; p < num_parts; ++p) {
+      uint8x4_t e0 = endpoints_decoded[0][p];
+      uint8x4_t e1 = endpoints_decoded[1][p];
+
+      for (int i = 0; i < 4; ++i) {
+         if (decoder.srgb) {
+            c0[p][i] = (uint16_t)((e0.v[i] << 8) | 0x80);
+            c1[p][i] = (uint16_t)((e1.v[i] << 8) | 0x80);
+         } else {
+            c0[p][i] = (uint16_t)((e0.v[i] << 8) | e0.v[i]);
+            c1[p][i] = (uint16_t)((e1.v[i] << 8) | e1.v[i]);
+         }
+      }
+   }
 
    int idx = 0;
    for (int z = 0; z < decoder.block_d; ++z) {
@@ -1644,7 +1718,7 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
 
             int partition;
             if (num_parts > 1) {
-               partition = select_partition(partition_index, x, y, z, num_parts, small_block);
+               partition = select_partition(seeds, x, y, z);
                assert(partition < num_parts);
             } else {
                partition = 0;
@@ -1652,33 +1726,6 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
 
             /* TODO: HDR */
 
-            uint8x4_t e0 = endpoints_decoded[0][partition];
-            uint8x4_t e1 = endpoints_decoded[1][partition];
-            uint16_t c0[4], c1[4];
-
-            /* Expand to 16 bits. */
-            if (decoder.srgb) {
-               c0[0] = (uint16_t)((e0.v[0] << 8) | 0x80);
-               c0[1] = (uint16_t)((e0.v[1] << 8) | 0x80);
-               c0[2] = (uint16_t)((e0.v[2] << 8) | 0x80);
-               c0[3] = (uint16_t)((e0.v[3] << 8) | 0x80);
-
-               c1[0] = (uint16_t)((e1.v[0] << 8) | 0x80);
-               c1[1] = (uint16_t)((e1.v[1] << 8) | 0x80);
-               c1[2] = (uint16_t)((e1.v[2] << 8) | 0x80);
-               c1[3] = (uint16_t)((e1.v[3] << 8) | 0x80);
-            } else {
-               c0[0] = (uint16_t)((e0.v[0] << 8) | e0.v[0]);
-               c0[1] = (uint16_t)((e0.v[1] << 8) | e0.v[1]);
-               c0[2] = (uint16_t)((e0.v[2] << 8) | e0.v[2]);
-               c0[3] = (uint16_t)((e0.v[3] << 8) | e0.v[3]);
-
-               c1[0] = (uint16_t)((e1.v[0] << 8) | e1.v[0]);
-               c1[1] = (uint16_t)((e1.v[1] << 8) | e1.v[1]);
-               c1[2] = (uint16_t)((e1.v[2] << 8) | e1.v[2]);
-               c1[3] = (uint16_t)((e1.v[3] << 8) | e1.v[3]);
-            }
-
             int w[4];
             if (dual_plane) {
                int w0 = infill_weights[0][idx];
@@ -1691,12 +1738,11 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
             }
 
             /* Interpolate to produce UNORM16, applying weights. */
-            uint16_t c[4] = {
-               (uint16_t)((c0[0] * (64 - w[0]) + c1[0] * w[0] + 32) >> 6),
-               (uint16_t)((c0[1] * (64 - w[1]) + c1[1] * w[1] + 32) >> 6),
-               (uint16_t)((c0[2] * (64 - w[2]) + c1[2] * w[2] + 32) >> 6),
-               (uint16_t)((c0[3] * (64 - w[3]) + c1[3] * w[3] + 32) >> 6),
-            };
+            uint16_t c[4];
+            for (int i = 0; i < 4; ++i) {
+               c[i] = (uint16_t)((c0[partition][i] * (64 - w[i]) +
+                                  c1[partition][i] * w[i] + 32) >> 6);
+            }
 
             if (decoder.output_unorm8) {
                if (decoder.srgb) {
@@ -1704,11 +1750,11 @@ void Block::write_decoded(const Decoder &decoder, uint16_t *output)
                   output[idx*4+1] = c[1] >> 8;
                   output[idx*4+2] = c[2] >> 8;
                } else {
-                  output[idx*4+0] = c[0] == 65535 ? 0xff : uint16_div_64k_to_half_to_unorm8(c[0]);
-                  output[idx*4+1] = c[1] == 65535 ? 0xff : uint16_div_64k_to_half_to_unorm8(c[1]);
-                  output[idx*4+2] = c[2] == 65535 ? 0xff : uint16_div_64k_to_half_to_unorm8(c[2]);
+                  output[idx*4+0] = c[0] == 65535 ? 0xff : unorm16_to_unorm8_table[c[0]];
+                  output[idx*4+1] = c[1] == 65535 ? 0xff : unorm16_to_unorm8_table[c[1]];
+                  output[idx*4+2] = c[2] == 65535 ? 0xff : unorm16_to_unorm8_table[c[2]];
                }
-               output[idx*4+3] = c[3] == 65535 ? 0xff : uint16_div_64k_to_half_to_unorm8(c[3]);
+               output[idx*4+3] = c[3] == 65535 ? 0xff : unorm16_to_unorm8_table[c[3]];
             } else {
                /* Store the color as FP16. */
                output[idx*4+0] = c[0] == 65535 ? FP16_ONE : _mesa_uint16_div_64k_to_half(c[0]);
@@ -28,6 +28,9 @@
 #ifndef TEXCOMPRESS_BPTC_TMP_H
 #define TEXCOMPRESS_BPTC_TMP_H
 
+#include <float.h>
+
+#include "util/format/u_format_bc_encode.h"
 #include "util/format_srgb.h"
 #include "util/half_float.h"
 #include "macros.h"
@@ -1188,266 +1191,563 @@ write_bits(struct bit_writer *writer, int n_bits, int value)
    } while (n_bits > 0);
 }
 
+/* Quantized endpoints, p-bits and indices chosen for one subset of a block.
+ * Mode 1 has one p-bit shared by both endpoints, so pbits[0] == pbits[1].
+ */
+struct bc7_subset {
+   uint8_t endpoints[2][4];
+   int pbits[2];
+   uint8_t indices[BLOCK_SIZE * BLOCK_SIZE];
+   unsigned error;
+};
+
 static void
-get_average_luminance_alpha_unorm(int width, int height,
-                                  const uint8_t *src, int src_rowstride,
-                                  int *average_luminance, int *average_alpha)
+get_subset_endpoints_unorm(const uint8_t texels[][4], uint32_t mask,
+                           int n_components, bool fast,
+                           float endpoints[2][4])
 {
-   int luminance_sum = 0, alpha_sum = 0;
-   int y, x;
+   float mean[4] = { 0 }, axis[4], cov[4][4] = { { 0 } };
+   int min[4] = { 255, 255, 255, 255 }, max[4] = { 0, 0, 0, 0 };
+   int count = 0;
+   int texel, i, j;
+
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+      if (!(mask & (1 << texel)))
+         continue;
+      for (i = 0; i < n_components; i++) {
+         mean[i] += texels[texel][i];
+         min[i] = MIN2(min[i], texels[texel][i]);
+         max[i] = MAX2(max[i], texels[texel][i]);
+      }
+      count++;
+   }
 
-   for (y = 0; y < height; y++) {
-      for (x = 0; x < width; x++) {
-         luminance_sum += src[0] + src[1] + src[2];
-         alpha_sum += src[3];
-         src += 4;
+   for (i = 0; i < n_components; i++)
+      mean[i] /= count;
+
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+      if (!(mask & (1 << texel)))
+         continue;
+      for (i = 0; i < n_components; i++) {
+         for (j = 0; j < n_components; j++) {
+            cov[i][j] += (texels[texel][i] - mean[i]) *
+                         (texels[texel][j] - mean[j]);
+         }
       }
-      src += src_rowstride - width * 4;
    }
 
-   *average_luminance = luminance_sum / (width * height);
-   *average_alpha = alpha_sum / (width * height);
+   if (fast) {
+      /* Diagonal of the bounding box, following the correlation of each
+       * component with the widest one.
+       */
+      int widest = 0;
+
+      for (i = 1; i < n_components; i++) {
+         if (max[i] - min[i] > max[widest] - min[widest])
+            widest = i;
+      }
+
+      for (i = 0; i < n_components; i++) {
+         bool flip = cov[widest][i] < 0;
+
+         endpoints[0][i] = flip ? max[i] : min[i];
+         endpoints[1][i] = flip ? min[i] : max[i];
+      }
+   } else {
+      /* Principal axis by power iteration, then the extent of the texels
+       * along it.
+       */
+      float lo = FLT_MAX, hi = -FLT_MAX, len2 = 0;
+      int iter;
+
+      for (i = 0; i < n_components; i++)
+         axis[i] = max[i] - min[i];
+
+      for (iter = 0; iter < 4; iter++) {
+         float next[4] = { 0 }, m = 0;
+
+         for (i = 0; i < n_components; i++) {
+            for (j = 0; j < n_components; j++)
+               next[i] += cov[i][j] * axis[j];
+            m = MAX2(m, fabsf(next[i]));
+         }
+
+         if (m < FLT_EPSILON)
+            break;
+
+         for (i = 0; i < n_components; i++)
+            axis[i] = next[i] / m;
+      }
+
+      for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+         float d = 0;
+
+         if (!(mask & (1 << texel)))
+            continue;
+         for (i = 0; i < n_components; i++)
+            d += (texels[texel][i] - mean[i]) * axis[i];
+         lo = MIN2(lo, d);
+         hi = MAX2(hi, d);
+      }
+
+      for (i = 0; i < n_components; i++)
+         len2 += axis[i] * axis[i];
+
+      for (i = 0; i < n_components; i++) {
+         if (len2 < FLT_EPSILON) {
+            endpoints[0][i] = endpoints[1][i] = mean[i];
+         } else {
+            endpoints[0][i] = mean[i] + axis[i] * lo / len2;
+            endpoints[1][i] = mean[i] + axis[i] * hi / len2;
+         }
+      }
+   }
+
+   for (i = n_components; i < 4; i++)
+      endpoints[0][i] = endpoints[1][i] = 255;
 }
 
+/* Quantizes the endpoints for the mode and returns the values the decoder
+ * expands them to.
+ */
 static void
-get_rgba_endpoints_unorm(int width, int height,
-                         const uint8_t *src, int src_rowstride,
-                         int average_luminance, int average_alpha,
-                         uint8_t endpoints[][4])
+quantize_subset_endpoints_unorm(int mode_num, int n_components,
+                                float endpoints[2][4],
+                                struct bc7_subset *subset,
+                                uint8_t expanded[2][4])
 {
-   int endpoint_luminances[2];
-   int midpoint;
-   int sums[2][4];
-   int endpoint;
-   int luminance;
-   uint8_t temp[3];
-   const uint8_t *p = src;
-   int rgb_left_endpoint_count = 0;
-   int alpha_left_endpoint_count = 0;
-   int y, x, i;
+   int endpoint, component, pbit;
 
-   memset(sums, 0, sizeof sums);
+   if (mode_num == 5) {
+      /* 7 bits per color component or 8 bits of alpha, without p-bits. */
+      const int n_bits = n_components == 1 ? 8 : 7;
+      const int max = (1 << n_bits) - 1;
 
-   for (y = 0; y < height; y++) {
-      for (x = 0; x < width; x++) {
-         luminance = p[0] + p[1] + p[2];
-         if (luminance < average_luminance) {
-            endpoint = 0;
-            rgb_left_endpoint_count++;
-         } else {
-            endpoint = 1;
+      memset(subset->endpoints, 0, sizeof(subset->endpoints));
+      memset(expanded, 0, 2 * 4);
+      subset->pbits[0] = subset->pbits[1] = 0;
+
+      for (endpoint = 0; endpoint < 2; endpoint++) {
+         for (component = 0; component < n_components; component++) {
+            float e = endpoints[endpoint][component];
+            int v = CLAMP((int) (e * max / 255.0f + 0.5f), 0, max);
+
+            subset->endpoints[endpoint][component] = v;
+            expanded[endpoint][component] = expand_component(v, n_bits);
          }
-         for (i = 0; i < 3; i++)
-            sums[endpoint][i] += p[i];
+      }
+   } else if (mode_num == 6) {
+      /* 7 bits per component plus a p-bit per endpoint gives 8 bits. */
+      for (endpoint = 0; endpoint < 2; endpoint++) {
+         float best_error = FLT_MAX;
 
-         if (p[2] < average_alpha) {
-            endpoint = 0;
-            alpha_left_endpoint_count++;
-         } else {
-            endpoint = 1;
+         for (pbit = 0; pbit < 2; pbit++) {
+            uint8_t q[4];
+            float error = 0;
+
+            for (component = 0; component < 4; component++) {
+               float e = endpoints[endpoint][component];
+               int v = CLAMP((int) ((e - pbit) / 2.0f + 0.5f), 0, 127);
+               float d = e - (v << 1 | pbit);
+
+               q[component] = v;
+               error += d * d;
+            }
+
+            if (error < best_error) {
+               best_error = error;
+               memcpy(subset->endpoints[endpoint], q, 4);
+               subset->pbits[endpoint] = pbit;
+            }
          }
-         sums[endpoint][3] += p[3];
 
-         p += 4;
+         for (component = 0; component < 4; component++) {
+            expanded[endpoint][component] =
+               subset->endpoints[endpoint][component] << 1 |
+               subset->pbits[endpoint];
+         }
       }
+   } else {
+      /* 6 bits per component plus a shared p-bit, expanded from 7 bits. */
+      float best_error = FLT_MAX;
 
-      p += src_rowstride - width * 4;
-   }
+      for (pbit = 0; pbit < 2; pbit++) {
+         uint8_t q[2][4];
+         float error = 0;
 
-   if (rgb_left_endpoint_count == 0 ||
-       rgb_left_endpoint_count == width * height) {
-      for (i = 0; i < 3; i++)
-         endpoints[0][i] = endpoints[1][i] =
-            (sums[0][i] + sums[1][i]) / (width * height);
-   } else {
-      for (i = 0; i < 3; i++) {
-         endpoints[0][i] = sums[0][i] / rgb_left_endpoint_count;
-         endpoints[1][i] = (sums[1][i] /
-                            (width * height - rgb_left_endpoint_count));
+         for (endpoint = 0; endpoint < 2; endpoint++) {
+            for (component = 0; component < 3; component++) {
+               float e = endpoints[endpoint][component];
+               int v = CLAMP((int) ((e * 127.0f / 255.0f - pbit) / 2.0f +
+                                    0.5f), 0, 63);
+               float d = e - expand_component(v << 1 | pbit, 7);
+
+               q[endpoint][component] = v;
+               error += d * d;
+            }
+            q[endpoint][3] = 0;
+         }
+
+         if (error < best_error) {
+            best_error = error;
+            memcpy(subset->endpoints, q, sizeof(q));
+            subset->pbits[0] = subset->pbits[1] = pbit;
+         }
+      }
+
+      for (endpoint = 0; endpoint < 2; endpoint++) {
+         for (component = 0; component < 3; component++) {
+            expanded[endpoint][component] =
+               expand_component(subset->endpoints[endpoint][component] << 1 |
+                                subset->pbits[endpoint], 7);
+         }
+         expanded[endpoint][3] = 255;
       }
    }
+}
 
-   if (alpha_left_endpoint_count == 0 ||
-       alpha_left_endpoint_count == width * height) {
-      endpoints[0][3] = endpoints[1][3] =
-         (sums[0][3] + sums[1][3]) / (width * height);
-   } else {
-         endpoints[0][3] = sums[0][3] / alpha_left_endpoint_count;
-         endpoints[1][3] = (sums[1][3] /
-                            (width * height - alpha_left_endpoint_count));
+static unsigned
+select_subset_indices_unorm(const uint8_t texels[][4], uint32_t mask,
+                            int n_components, int index_bits,
+                            uint8_t expanded[2][4], uint8_t *indices)
+{
+   int palette[16][4];
+   int n_indices = 1 << index_bits;
+   unsigned error = 0;
+   int texel, index, component;
+
+   for (index = 0; index < n_indices; index++) {
+      for (component = 0; component < 4; component++) {
+         palette[index][component] = interpolate(expanded[0][component],
+                                                 expanded[1][component],
+                                                 index, index_bits);
+      }
    }
 
-   /* We may need to swap the endpoints to ensure the most-significant bit of
-    * the first index is zero */
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+      unsigned best_dist = UINT_MAX;
 
-   for (endpoint = 0; endpoint < 2; endpoint++) {
-      endpoint_luminances[endpoint] =
-         endpoints[endpoint][0] +
-         endpoints[endpoint][1] +
-         endpoints[endpoint][2];
-   }
-   midpoint = (endpoint_luminances[0] + endpoint_luminances[1]) / 2;
+      if (!(mask & (1 << texel)))
+         continue;
 
-   if ((src[0] + src[1] + src[2] <= midpoint) !=
-       (endpoint_luminances[0] <= midpoint)) {
-      memcpy(temp, endpoints[0], 3);
-      memcpy(endpoints[0], endpoints[1], 3);
-      memcpy(endpoints[1], temp, 3);
+      for (index = 0; index < n_indices; index++) {
+         unsigned dist = 0;
+
+         for (component = 0; component < n_components; component++) {
+            int d = texels[texel][component] - palette[index][component];
+            dist += d * d;
+         }
+
+         if (dist < best_dist) {
+            best_dist = dist;
+            indices[texel] = index;
+         }
+      }
+
+      error += best_dist;
    }
 
-   /* Same for the alpha endpoints */
+   return error;
+}
+
+/* Least-squares endpoints for the indices chosen in a previous pass.
+ * Returns false if all of the texels use the same weight.
+ */
+static bool
+refine_subset_endpoints_unorm(const uint8_t texels[][4], uint32_t mask,
+                              int n_components, int index_bits,
+                              const uint8_t *indices, float endpoints[2][4])
+{
+   static const uint8_t weights3[] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+   static const uint8_t weights4[] =
+      { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+   const uint8_t *weights = index_bits == 4 ? weights4 : weights3;
+   float aa = 0, bb = 0, ab = 0, ax[4] = { 0 }, bx[4] = { 0 };
+   float det;
+   int texel, component;
+
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+      float b, a;
+
+      if (!(mask & (1 << texel)))
+         continue;
+
+      b = weights[indices[texel]] / 64.0f;
+      a = 1.0f - b;
+      aa += a * a;
+      bb += b * b;
+      ab += a * b;
+      for (component = 0; component < n_components; component++) {
+         ax[component] += a * texels[texel][component];
+         bx[component] += b * texels[texel][component];
+      }
+   }
 
-   midpoint = (endpoints[0][3] + endpoints[1][3]) / 2;
+   det = aa * bb - ab * ab;
+   if (fabsf(det) < FLT_EPSILON)
+      return false;
 
-   if ((src[3] <= midpoint) != (endpoints[0][3] <= midpoint)) {
-      temp[0] = endpoints[0][3];
-      endpoints[0][3] = endpoints[1][3];
-      endpoints[1][3] = temp[0];
+   for (component = 0; component < n_components; component++) {
+      endpoints[0][component] = (ax[component] * bb - bx[component] * ab) / det;
+      endpoints[1][component] = (bx[component] * aa - ax[component] * ab) / det;
    }
+
+   return true;
 }
 
 static void
-write_rgb_indices_unorm(struct bit_writer *writer,
-                        int src_width, int src_height,
-                        const uint8_t *src, int src_rowstride,
-                        uint8_t endpoints[][4])
+fit_subset_unorm(int mode_num, int n_components,
+                 const uint8_t texels[][4], uint32_t mask,
+                 enum util_format_compress_quality quality,
+                 struct bc7_subset *subset)
 {
-   int luminance;
-   int endpoint_luminances[2];
-   int endpoint;
-   int index;
-   int y, x;
-
-   for (endpoint = 0; endpoint < 2; endpoint++) {
-      endpoint_luminances[endpoint] =
-         endpoints[endpoint][0] +
-         endpoints[endpoint][1] +
-         endpoints[endpoint][2];
+   const int index_bits = bptc_unorm_modes[mode_num].n_index_bits;
+   float endpoints[2][4];
+   uint8_t expanded[2][4];
+
+   get_subset_endpoints_unorm(texels, mask, n_components,
+                              quality == UTIL_FORMAT_COMPRESS_FAST,
+                              endpoints);
+   quantize_subset_endpoints_unorm(mode_num, n_components, endpoints, subset,
+                                   expanded);
+   subset->error = select_subset_indices_unorm(texels, mask, n_components,
+                                               index_bits, expanded,
+                                               subset->indices);
+
+   if (quality != UTIL_FORMAT_COMPRESS_FAST && subset->error &&
+       refine_subset_endpoints_unorm(texels, mask, n_components, index_bits,
+                                     subset->indices, endpoints)) {
+      struct bc7_subset refined;
+
+      quantize_subset_endpoints_unorm(mode_num, n_components, endpoints,
+                                      &refined, expanded);
+      refined.error = select_subset_indices_unorm(texels, mask, n_components,
+                                                  index_bits, expanded,
+                                                  refined.indices);
+      if (refined.error < subset->error) {
+         memcpy(subset->endpoints, refined.endpoints,
+                sizeof(refined.endpoints));
+         memcpy(subset->pbits, refined.pbits, sizeof(refined.pbits));
+         for (int texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+            if (mask & (1 << texel))
+               subset->indices[texel] = refined.indices[texel];
+         }
+         subset->error = refined.error;
+      }
    }
+}
 
-   /* If the endpoints have the same luminance then we'll just use index 0 for
-    * all of the texels */
-   if (endpoint_luminances[0] == endpoint_luminances[1]) {
-      write_bits(writer, BLOCK_SIZE * BLOCK_SIZE * 2 - 1, 0);
+/* The most-significant bit of the index of the anchor texel of each subset
+ * is implicitly zero, so swap the endpoints if needed.
+ */
+static void
+fix_subset_anchor_unorm(struct bc7_subset *subset, uint32_t mask,
+                        int anchor, int index_bits)
+{
+   const int max_index = (1 << index_bits) - 1;
+   uint8_t temp[4];
+   int pbit, texel;
+
+   if (subset->indices[anchor] <= max_index / 2)
       return;
-   }
 
-   for (y = 0; y < src_height; y++) {
-      for (x = 0; x < src_width; x++) {
-         luminance = src[0] + src[1] + src[2];
+   memcpy(temp, subset->endpoints[0], 4);
+   memcpy(subset->endpoints[0], subset->endpoints[1], 4);
+   memcpy(subset->endpoints[1], temp, 4);
+   pbit = subset->pbits[0];
+   subset->pbits[0] = subset->pbits[1];
+   subset->pbits[1] = pbit;
 
-         index = ((luminance - endpoint_luminances[0]) * 3 /
-                  (endpoint_luminances[1] - endpoint_luminances[0]));
-         if (index < 0)
-            index = 0;
-         else if (index > 3)
-            index = 3;
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+      if (mask & (1 << texel))
+         subset->indices[texel] = max_index - subset->indices[texel];
+   }
+}
 
-         assert(x != 0 || y != 0 || index < 2);
+static void
+write_mode6_block_unorm(uint8_t *dst, struct bc7_subset *subset)
+{
+   struct bit_writer writer = { .dst = dst };
+   int component, endpoint, texel;
 
-         write_bits(writer, (x == 0 && y == 0) ? 1 : 2, index);
+   fix_subset_anchor_unorm(subset, 0xffff, 0, 4);
 
-         src += 4;
-      }
+   write_bits(&writer, 7, 1 << 6); /* mode 6 */
 
-      /* Pad the indices out to the block size */
-      if (src_width < BLOCK_SIZE)
-         write_bits(writer, 2 * (BLOCK_SIZE - src_width), 0);
+   for (component = 0; component < 4; component++)
+      for (endpoint = 0; endpoint < 2; endpoint++)
+         write_bits(&writer, 7, subset->endpoints[endpoint][component]);
 
-      src += src_rowstride - src_width * 4;
-   }
+   for (endpoint = 0; endpoint < 2; endpoint++)
+      write_bits(&writer, 1, subset->pbits[endpoint]);
 
-   /* Pad the indices out to the block size */
-   if (src_height < BLOCK_SIZE)
-      write_bits(writer, 2 * BLOCK_SIZE * (BLOCK_SIZE - src_height), 0);
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++)
+      write_bits(&writer, texel == 0 ? 3 : 4, subset->indices[texel]);
 }
 
 static void
-write_alpha_indices_unorm(struct bit_writer *writer,
-                          int src_width, int src_height,
-                          const uint8_t *src, int src_rowstride,
-                          uint8_t endpoints[][4])
+write_mode1_block_unorm(uint8_t *dst, int partition_num,
+                        struct bc7_subset subsets[2])
 {
-   int index;
-   int y, x;
+   struct bit_writer writer = { .dst = dst };
+   uint32_t masks[2] = { 0, 0 };
+   int anchor = anchor_indices[0][partition_num];
+   int component, subset, endpoint, texel;
 
-   /* If the endpoints have the same alpha then we'll just use index 0 for
-    * all of the texels */
-   if (endpoints[0][3] == endpoints[1][3]) {
-      write_bits(writer, BLOCK_SIZE * BLOCK_SIZE * 3 - 1, 0);
-      return;
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++)
+      masks[(partition_table1[partition_num] >> (texel * 2)) & 3] |= 1 << texel;
+
+   fix_subset_anchor_unorm(&subsets[0], masks[0], 0, 3);
+   fix_subset_anchor_unorm(&subsets[1], masks[1], anchor, 3);
+
+   write_bits(&writer, 2, 1 << 1); /* mode 1 */
+   write_bits(&writer, 6, partition_num);
+
+   for (component = 0; component < 3; component++)
+      for (subset = 0; subset < 2; subset++)
+         for (endpoint = 0; endpoint < 2; endpoint++)
+            write_bits(&writer, 6,
+                       subsets[subset].endpoints[endpoint][component]);
+
+   for (subset = 0; subset < 2; subset++)
+      write_bits(&writer, 1, subsets[subset].pbits[0]);
+
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+      subset = (masks[1] >> texel) & 1;
+      write_bits(&writer, texel == 0 || texel == anchor ? 2 : 3,
+                 subsets[subset].indices[texel]);
    }
+}
 
-   for (y = 0; y < src_height; y++) {
-      for (x = 0; x < src_width; x++) {
-         index = (((int) src[3] - (int) endpoints[0][3]) * 7 /
-                  ((int) endpoints[1][3] - endpoints[0][3]));
-         if (index < 0)
-            index = 0;
-         else if (index > 7)
-            index = 7;
+static void
+write_mode5_block_unorm(uint8_t *dst, int rotation,
+                        struct bc7_subset *color, struct bc7_subset *alpha)
+{
+   struct bit_writer writer = { .dst = dst };
+   int component, endpoint, texel;
 
-         assert(x != 0 || y != 0 || index < 4);
+   fix_subset_anchor_unorm(color, 0xffff, 0, 2);
+   fix_subset_anchor_unorm(alpha, 0xffff, 0, 2);
 
-         /* The first index has one less bit */
-         write_bits(writer, (x == 0 && y == 0) ? 2 : 3, index);
+   write_bits(&writer, 6, 1 << 5); /* mode 5 */
+   write_bits(&writer, 2, rotation);
 
-         src += 4;
-      }
+   for (component = 0; component < 3; component++)
+      for (endpoint = 0; endpoint < 2; endpoint++)
+         write_bits(&writer, 7, color->endpoints[endpoint][component]);
 
-      /* Pad the indices out to the block size */
-      if (src_width < BLOCK_SIZE)
-         write_bits(writer, 3 * (BLOCK_SIZE - src_width), 0);
+   for (endpoint = 0; endpoint < 2; endpoint++)
+      write_bits(&writer, 8, alpha->endpoints[endpoint][0]);
 
-      src += src_rowstride - src_width * 4;
-   }
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++)
+      write_bits(&writer, texel == 0 ? 1 : 2, color->indices[texel]);
 
-   /* Pad the indices out to the block size */
-   if (src_height < BLOCK_SIZE)
-      write_bits(writer, 3 * BLOCK_SIZE * (BLOCK_SIZE - src_height), 0);
+   for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++)
+      write_bits(&writer, texel == 0 ? 1 : 2, alpha->indices[texel]);
 }
 
+/* Every block is encoded with mode 6 (one subset of RGBA with 4-bit
+ * indices).  Unless the quality is UTIL_FORMAT_COMPRESS_FAST, mode 5
+ * (separate indices for alpha) and, for opaque blocks, mode 1 (two subsets
+ * of RGB) are also tried and the encoding with the least error is kept.
+ */
 static void
 compress_rgba_unorm_block(int src_width, int src_height,
                           const uint8_t *src, int src_rowstride,
-                          uint8_t *dst)
+                          uint8_t *dst,
+                          enum util_format_compress_quality quality)
 {
-   int average_luminance, average_alpha;
-   uint8_t endpoints[2][4];
-   struct bit_writer writer;
-   int component, endpoint;
+   uint8_t texels[BLOCK_SIZE * BLOCK_SIZE][4];
+   struct bc7_subset mode6;
+   unsigned best_error;
+   bool opaque = true;
+   int x, y, texel;
+
+   /* Replicate the edge texels of partial blocks. */
+   for (y = 0; y < BLOCK_SIZE; y++) {
+      for (x = 0; x < BLOCK_SIZE; x++) {
+         const uint8_t *p = src + MIN2(y, src_height - 1) * src_rowstride +
+                            MIN2(x, src_width - 1) * 4;
+
+         memcpy(texels[y * BLOCK_SIZE + x], p, 4);
+         opaque &= p[3] == 255;
+      }
+   }
 
-   get_average_luminance_alpha_unorm(src_width, src_height, src, src_rowstride,
-                                     &average_luminance, &average_alpha);
-   get_rgba_endpoints_unorm(src_width, src_height, src, src_rowstride,
-                            average_luminance, average_alpha,
-                            endpoints);
+   fit_subset_unorm(6, 4, texels, 0xffff, quality, &mode6);
+   best_error = mode6.error;
 
-   writer.dst = dst;
-   writer.pos = 0;
-   writer.buf = 0;
+   if (quality == UTIL_FORMAT_COMPRESS_FAST || best_error == 0) {
+      write_mode6_block_unorm(dst, &mode6);
+      return;
+   }
 
-   write_bits(&writer, 5, 0x10); /* mode 4 */
-   write_bits(&writer, 2, 0); /* rotation 0 */
-   write_bits(&writer, 1, 0); /* index selection bit */
+   /* Mode 5, also with the rotations which swap alpha and one of the color
+    * components, so that the component least correlated with the others
+    * gets its own indices.
+    */
+   struct bc7_subset color, alpha, best_color, best_alpha;
+   int best_rotation = -1;
+   int rotation;
 
-   /* Write the color endpoints */
-   for (component = 0; component < 3; component++)
-      for (endpoint = 0; endpoint < 2; endpoint++)
-         write_bits(&writer, 5, endpoints[endpoint][component] >> 3);
+   for (rotation = 0; rotation < 4; rotation++) {
+      uint8_t rotated[BLOCK_SIZE * BLOCK_SIZE][4];
+      uint8_t alphas[BLOCK_SIZE * BLOCK_SIZE][4];
 
-   /* Write the alpha endpoints */
-   for (endpoint = 0; endpoint < 2; endpoint++)
-      write_bits(&writer, 6, endpoints[endpoint][3] >> 2);
+      memcpy(rotated, texels, sizeof(texels));
+      for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+         apply_rotation(rotation, rotated[texel]);
+         alphas[texel][0] = rotated[texel][3];
+      }
 
-   write_rgb_indices_unorm(&writer,
-                           src_width, src_height,
-                           src, src_rowstride,
-                           endpoints);
-   write_alpha_indices_unorm(&writer,
-                             src_width, src_height,
-                             src, src_rowstride,
-                             endpoints);
+      fit_subset_unorm(5, 3, rotated, 0xffff, quality, &color);
+      if (color.error >= best_error)
+         continue;
+      fit_subset_unorm(5, 1, alphas, 0xffff, quality, &alpha);
+
+      if (color.error + alpha.error < best_error) {
+         best_error = color.error + alpha.error;
+         best_rotation = rotation;
+         best_color = color;
+         best_alpha = alpha;
+      }
+   }
+
+   /* Mode 1, trying only the first partitions at normal quality, which are
+    * the simple splits of the block in two halves.
+    */
+   struct bc7_subset best[2], subsets[2];
+   int n_partitions = quality == UTIL_FORMAT_COMPRESS_BEST ? N_PARTITIONS : 16;
+   int best_partition = -1;
+   int partition_num;
+
+   for (partition_num = 0; opaque && partition_num < n_partitions;
+        partition_num++) {
+      uint32_t masks[2] = { 0, 0 };
+
+      for (texel = 0; texel < BLOCK_SIZE * BLOCK_SIZE; texel++) {
+         int subset = (partition_table1[partition_num] >> (texel * 2)) & 3;
+         masks[subset] |= 1 << texel;
+      }
+
+      fit_subset_unorm(1, 3, texels, masks[0], quality, &subsets[0]);
+      if (subsets[0].error >= best_error)
+         continue;
+      fit_subset_unorm(1, 3, texels, masks[1], quality, &subsets[1]);
+
+      if (subsets[0].error + subsets[1].error < best_error) {
+         best_error = subsets[0].error + subsets[1].error;
+         best_partition = partition_num;
+         memcpy(best, subsets, sizeof(best));
+      }
+   }
+
+   if (best_partition >= 0)
+      write_mode1_block_unorm(dst, best_partition, best);
+   else if (best_rotation >= 0)
+      write_mode5_block_unorm(dst, best_rotation, &best_color, &best_alpha);
+   else
+      write_mode6_block_unorm(dst, &mode6);
 }
 
 static void
@@ -1455,6 +1755,8 @@ compress_rgba_unorm(int width, int height,
                     const uint8_t *src, int src_rowstride,
                     uint8_t *dst, int dst_rowstride)
 {
+   enum util_format_compress_quality quality =
+      util_format_get_compress_quality();
    int dst_row_diff;
    int y, x;
 
@@ -1469,7 +1771,7 @@ compress_rgba_unorm(int width, int height,
                                    MIN2(height - y, BLOCK_SIZE),
                                    src + x * 4 + y * src_rowstride,
                                    src_rowstride,
-                                   dst);
+                                   dst, quality);
          dst += BLOCK_BYTES;
       }
       dst += dst_row_diff;
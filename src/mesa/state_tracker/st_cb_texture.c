@@ -66,6 +66,7 @@
 
 #include "pipe/p_context.h"
 #include "pipe/p_defines.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_inlines.h"
 #include "util/u_upload_mgr.h"
 #include "pipe/p_shader_tokens.h"
@@ -532,6 +533,28 @@ st_MapTextureImage(struct gl_context *ctx,
 }
 
 
+/**
+ * Return the queue used to decompress and transcode fallback formats on
+ * upload, or NULL to do it on the calling thread.
+ */
+static struct util_queue *
+get_decompress_queue(struct st_context *st)
+{
+   if (!util_queue_is_initialized(&st->decompress_queue)) {
+      unsigned num_threads = util_get_cpu_caps()->nr_cpus;
+
+      if (num_threads <= 1 ||
+          !util_queue_init(&st->decompress_queue, "stdecomp", 64,
+                           num_threads - 1,
+                           UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                           UTIL_QUEUE_INIT_SHARED_THREADS, NULL))
+         return NULL;
+   }
+
+   return &st->decompress_queue;
+}
+
+
 void
 st_UnmapTextureImage(struct gl_context *ctx,
                      struct gl_texture_image *texImage,
@@ -549,6 +572,9 @@ st_UnmapTextureImage(struct gl_context *ctx,
       assert(z == transfer->box.z);
 
       if (transfer->usage & PIPE_MAP_WRITE) {
+         struct util_queue *queue = get_decompress_queue(st);
+         bool bgra = texImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB;
+
          if (util_format_is_compressed(texImage->pt->format)) {
             /* Transcode into a different compressed format. */
             unsigned size =
@@ -558,69 +584,28 @@ st_UnmapTextureImage(struct gl_context *ctx,
             void *tmp = malloc(size);
 
             /* Decompress to tmp. */
-            if (texImage->TexFormat == MESA_FORMAT_ETC1_RGB8) {
-               _mesa_etc1_unpack_rgba8888(tmp, transfer->box.width * 4,
+            _mesa_unpack_compressed_image(queue, texImage->TexFormat, bgra,
+                                          tmp, transfer->box.width * 4,
                                           itransfer->temp_data,
                                           itransfer->temp_stride,
                                           transfer->box.width,
                                           transfer->box.height);
-            } else if (_mesa_is_format_etc2(texImage->TexFormat)) {
-               bool bgra = texImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB;
-
-               _mesa_unpack_etc2_format(tmp, transfer->box.width * 4,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width,
-                                        transfer->box.height,
-                                        texImage->TexFormat,
-                                        bgra);
-            } else if (_mesa_is_format_astc_2d(texImage->TexFormat)) {
-               _mesa_unpack_astc_2d_ldr(tmp, transfer->box.width * 4,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width,
-                                        transfer->box.height,
-                                        texImage->TexFormat);
-            } else {
-               unreachable("unexpected format for a compressed format fallback");
-            }
 
             /* Compress it to the target format. */
-            struct gl_pixelstore_attrib pack = {0};
-            pack.Alignment = 4;
-
-            _mesa_texstore(ctx, 2, GL_RGBA, texImage->pt->format,
-                           transfer->stride, &itransfer->map,
-                           transfer->box.width,
-                           transfer->box.height, 1, GL_RGBA,
-                           GL_UNSIGNED_BYTE, tmp, &pack);
+            _mesa_compress_rgba8_image(queue, texImage->pt->format,
+                                       itransfer->map, transfer->stride,
+                                       tmp, transfer->box.width * 4,
+                                       transfer->box.width,
+                                       transfer->box.height);
             free(tmp);
          } else {
             /* Decompress into an uncompressed format. */
-            if (texImage->TexFormat == MESA_FORMAT_ETC1_RGB8) {
-               _mesa_etc1_unpack_rgba8888(itransfer->map, transfer->stride,
+            _mesa_unpack_compressed_image(queue, texImage->TexFormat, bgra,
+                                          itransfer->map, transfer->stride,
                                           itransfer->temp_data,
                                           itransfer->temp_stride,
                                           transfer->box.width,
                                           transfer->box.height);
-            } else if (_mesa_is_format_etc2(texImage->TexFormat)) {
-               bool bgra = texImage->pt->format == PIPE_FORMAT_B8G8R8A8_SRGB;
-
-               _mesa_unpack_etc2_format(itransfer->map, transfer->stride,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width, transfer->box.height,
-                                        texImage->TexFormat,
-                                        bgra);
-            } else if (_mesa_is_format_astc_2d(texImage->TexFormat)) {
-               _mesa_unpack_astc_2d_ldr(itransfer->map, transfer->stride,
-                                        itransfer->temp_data,
-                                        itransfer->temp_stride,
-                                        transfer->box.width, transfer->box.height,
-                                        texImage->TexFormat);
-            } else {
-               unreachable("unexpected format for a compressed format fallback");
-            }
          }
       }
 
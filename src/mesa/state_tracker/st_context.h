@@ -35,6 +35,7 @@
 #include "state_tracker/st_atom.h"
 #include "util/u_helpers.h"
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "util/list.h"
 #include "vbo/vbo.h"
 #include "util/list.h"
@@ -373,6 +374,11 @@ struct st_context
     */
    struct util_throttle throttle;
 
+   /* Worker threads decompressing ETC and ASTC images on upload when the
+    * driver doesn't support them, initialized on first use.
+    */
+   struct util_queue decompress_queue;
+
    struct {
       struct st_zombie_sampler_view_node list;
       simple_mtx_t mutex;
@@ -24,6 +24,8 @@
 #ifdef HAVE_COMPRESSION
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 /* Ensure that zlib uses 'const' in 'z_const' declarations. */
 #ifndef ZLIB_CONST
@@ -36,6 +38,7 @@
 
 #ifdef HAVE_ZSTD
 #include "zstd.h"
+#include "zdict.h"
 #endif
 
 #include "util/compress.h"
@@ -44,6 +47,16 @@
 /* 3 is the recomended level, with 22 as the absolute maximum */
 #define ZSTD_COMPRESSION_LEVEL 3
 
+struct util_compress_dict {
+   void *data;
+   size_t size;
+#ifdef HAVE_ZSTD
+   unsigned id;
+   ZSTD_CDict *cdict;
+   ZSTD_DDict *ddict;
+#endif
+};
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size)
 {
@@ -69,14 +82,111 @@ util_compress_max_compressed_len(size_t in_data_size)
 #endif
 }
 
-/* Compress data and return the size of the compressed data */
+/* Build a dictionary from samples of the data that is going to be
+ * compressed. zstd trains a proper dictionary, with zlib the dictionary is
+ * just the tail of the samples as zlib favours strings at the end of it.
+ *
+ * The samples are stored back to back in samples. Returns the size of the
+ * dictionary written to dict, or 0 on failure.
+ */
 size_t
-util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
-                      uint8_t *out_data, size_t out_buff_size)
+util_compress_train_dict(void *dict, size_t dict_capacity,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples)
+{
+#ifdef HAVE_ZSTD
+   size_t ret = ZDICT_trainFromBuffer(dict, dict_capacity, samples,
+                                      sample_sizes, num_samples);
+   if (ZDICT_isError(ret))
+      return 0;
+
+   return ret;
+#elif defined(HAVE_ZLIB)
+   /* Only the last 32KB of a dictionary are ever used by deflate. */
+   size_t total_size = 0;
+   for (unsigned i = 0; i < num_samples; i++)
+      total_size += sample_sizes[i];
+
+   size_t size = MIN3(dict_capacity, total_size, 32 * 1024);
+   memcpy(dict, (const uint8_t *)samples + total_size - size, size);
+   return size;
+#else
+   STATIC_ASSERT(false);
+#endif
+}
+
+struct util_compress_dict *
+util_compress_dict_create(const void *data, size_t size)
 {
+   struct util_compress_dict *dict = calloc(1, sizeof(*dict));
+   if (!dict)
+      return NULL;
+
+   dict->data = malloc(size);
+   if (!dict->data)
+      goto fail;
+
+   memcpy(dict->data, data, size);
+   dict->size = size;
+
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
-                              ZSTD_COMPRESSION_LEVEL);
+   /* Frames refer to their dictionary by id, a raw content dictionary has
+    * none and couldn't be told apart from not using a dictionary at all.
+    */
+   dict->id = ZSTD_getDictID_fromDict(data, size);
+   if (dict->id == 0)
+      goto fail;
+
+   dict->cdict = ZSTD_createCDict(dict->data, dict->size,
+                                  ZSTD_COMPRESSION_LEVEL);
+   dict->ddict = ZSTD_createDDict(dict->data, dict->size);
+   if (!dict->cdict || !dict->ddict)
+      goto fail;
+#endif
+
+   return dict;
+
+fail:
+   util_compress_dict_destroy(dict);
+   return NULL;
+}
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict)
+{
+   if (!dict)
+      return;
+
+#ifdef HAVE_ZSTD
+   ZSTD_freeCDict(dict->cdict);
+   ZSTD_freeDDict(dict->ddict);
+#endif
+   free(dict->data);
+   free(dict);
+}
+
+/* Compress data with an optional dictionary and return the size of the
+ * compressed data
+ */
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size)
+{
+#ifdef HAVE_ZSTD
+   size_t ret;
+   if (dict) {
+      ZSTD_CCtx *cctx = ZSTD_createCCtx();
+      if (!cctx)
+         return 0;
+
+      ret = ZSTD_compress_usingCDict(cctx, out_data, out_buff_size,
+                                     in_data, in_data_size, dict->cdict);
+      ZSTD_freeCCtx(cctx);
+   } else {
+      ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
+                          ZSTD_COMPRESSION_LEVEL);
+   }
    if (ZSTD_isError(ret))
       return 0;
 
@@ -100,6 +210,12 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
        return 0;
    }
 
+   if (dict &&
+       deflateSetDictionary(&strm, dict->data, dict->size) != Z_OK) {
+       (void) deflateEnd(&strm);
+       return 0;
+   }
+
    /* compress until end of in_data */
    ret = deflate(&strm, Z_FINISH);
 
@@ -117,15 +233,43 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
 # endif
 }
 
+/* Compress data and return the size of the compressed data */
+size_t
+util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
+                      uint8_t *out_data, size_t out_buff_size)
+{
+   return util_compress_deflate_dict(NULL, in_data, in_data_size,
+                                     out_data, out_buff_size);
+}
+
 /**
- * Decompresses data, returns true if successful.
+ * Decompresses data, returns true if successful. Data that was compressed
+ * with a dictionary can only be decompressed with that same dictionary.
  */
 bool
-util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
-                      uint8_t *out_data, size_t out_data_size)
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size)
 {
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_decompress(out_data, out_data_size, in_data, in_data_size);
+   unsigned dict_id = ZSTD_getDictID_fromFrame(in_data, in_data_size);
+   if (dict_id == 0) {
+      size_t ret = ZSTD_decompress(out_data, out_data_size,
+                                   in_data, in_data_size);
+      return !ZSTD_isError(ret);
+   }
+
+   if (!dict || dict_id != dict->id)
+      return false;
+
+   ZSTD_DCtx *dctx = ZSTD_createDCtx();
+   if (!dctx)
+      return false;
+
+   size_t ret = ZSTD_decompress_usingDDict(dctx, out_data, out_data_size,
+                                           in_data, in_data_size,
+                                           dict->ddict);
+   ZSTD_freeDCtx(dctx);
    return !ZSTD_isError(ret);
 #elif defined(HAVE_ZLIB)
    z_stream strm;
@@ -144,6 +288,19 @@ util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
       return false;
 
    ret = inflate(&strm, Z_NO_FLUSH);
+
+   /* The stream header records the adler32 of the dictionary it needs,
+    * inflateSetDictionary() fails if ours doesn't match.
+    */
+   if (ret == Z_NEED_DICT) {
+      if (!dict ||
+          inflateSetDictionary(&strm, dict->data, dict->size) != Z_OK) {
+         (void)inflateEnd(&strm);
+         return false;
+      }
+
+      ret = inflate(&strm, Z_NO_FLUSH);
+   }
    assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
 
    /* Unless there was an error we should have decompressed everything in one
@@ -163,4 +320,15 @@ util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
 #endif
 }
 
+/**
+ * Decompresses data, returns true if successful.
+ */
+bool
+util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
+                      uint8_t *out_data, size_t out_data_size)
+{
+   return util_compress_inflate_dict(NULL, in_data, in_data_size,
+                                     out_data, out_data_size);
+}
+
 #endif
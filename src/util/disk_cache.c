@@ -37,6 +37,7 @@
 #include <dirent.h>
 #include <inttypes.h>
 
+#include "util/compress.h"
 #include "util/crc32.h"
 #include "util/debug.h"
 #include "util/rand_xor.h"
@@ -95,6 +96,13 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    /* Assume failure. */
    cache->path_init_failed = true;
 
+   simple_mtx_init(&cache->lru_mtx, mtx_plain);
+   simple_mtx_init(&cache->foz_batch_mtx, mtx_plain);
+   simple_mtx_init(&cache->dict_mtx, mtx_plain);
+   util_dynarray_init(&cache->foz_batch, NULL);
+   util_dynarray_init(&cache->dict_samples, NULL);
+   util_dynarray_init(&cache->dict_sample_sizes, NULL);
+
 #ifdef ANDROID
    /* Android needs the "disk cache" to be enabled for
     * EGL_ANDROID_blob_cache's callbacks to be called, but it doesn't actually
@@ -103,6 +111,9 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    goto path_fail;
 #endif
 
+   /* This doesn't depend on the user's cache directory being usable. */
+   disk_cache_load_read_only_layer(local, cache, gpu_name, driver_id);
+
    char *path = disk_cache_generate_cache_dir(local, gpu_name, driver_id);
    if (!path)
       goto path_fail;
@@ -119,6 +130,15 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    if (!disk_cache_mmap_cache_index(local, cache, path))
       goto path_fail;
 
+   /* Eviction falls back to scanning the cache directories without it. */
+   if (!env_var_as_boolean("MESA_DISK_CACHE_SINGLE_FILE", false))
+      disk_cache_mmap_lru_index(local, cache);
+
+   /* Train a dictionary from the items we store if there is none yet. */
+   if (!disk_cache_load_dictionary(cache))
+      cache->dict_training =
+         env_var_as_boolean("MESA_DISK_CACHE_DICTIONARY", false);
+
    max_size = 0;
 
    max_size_str = getenv("MESA_GLSL_CACHE_MAX_SIZE");
@@ -175,7 +195,8 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
                         UTIL_QUEUE_INIT_SCALE_THREADS |
                         UTIL_QUEUE_INIT_RESIZE_IF_FULL |
                         UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY |
-                        UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY, NULL))
+                        UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY |
+                        UTIL_QUEUE_INIT_SHARED_THREADS, NULL))
       goto fail;
 
    cache->path_init_failed = false;
@@ -220,8 +241,11 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    return cache;
 
  fail:
-   if (cache)
+   if (cache) {
+      if (cache->ro_layer)
+         foz_destroy(&cache->ro_layer_db);
       ralloc_free(cache);
+   }
    ralloc_free(local);
 
    return NULL;
@@ -240,6 +264,19 @@ disk_cache_destroy(struct disk_cache *cache)
       disk_cache_destroy_mmap(cache);
    }
 
+   if (cache) {
+      if (cache->ro_layer)
+         foz_destroy(&cache->ro_layer_db);
+
+      util_compress_dict_destroy(cache->dict);
+      util_dynarray_fini(&cache->dict_samples);
+      util_dynarray_fini(&cache->dict_sample_sizes);
+      util_dynarray_fini(&cache->foz_batch);
+      simple_mtx_destroy(&cache->dict_mtx);
+      simple_mtx_destroy(&cache->foz_batch_mtx);
+      simple_mtx_destroy(&cache->lru_mtx);
+   }
+
    ralloc_free(cache);
 }
 
@@ -257,6 +294,7 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
       return;
    }
 
+   disk_cache_lru_remove(cache, key);
    disk_cache_evict_item(cache, filename);
 }
 
@@ -435,6 +473,12 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
+   if (cache->ro_layer) {
+      void *data = disk_cache_load_item_read_only_layer(cache, key, size);
+      if (data)
+         return data;
+   }
+
    if (env_var_as_boolean("MESA_DISK_CACHE_SINGLE_FILE", false)) {
       return disk_cache_load_item_foz(cache, key, size);
    } else {
@@ -442,7 +486,11 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       if (filename == NULL)
          return NULL;
 
-      return disk_cache_load_item(cache, filename, size);
+      void *data = disk_cache_load_item(cache, filename, size);
+      if (data)
+         disk_cache_lru_touch(cache, key);
+
+      return data;
    }
 }
 
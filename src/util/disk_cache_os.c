@@ -41,6 +41,15 @@ struct cache_entry_file_data {
    uint32_t uncompressed_size;
 };
 
+/* Size of the compression dictionary trained from cache items. */
+#define DISK_CACHE_DICT_SIZE (32 * 1024)
+
+/* Amount of item data to collect before training the dictionary, and the
+ * maximum taken from a single item.
+ */
+#define DISK_CACHE_DICT_SAMPLES_SIZE (1024 * 1024)
+#define DISK_CACHE_DICT_MAX_SAMPLE_SIZE (16 * 1024)
+
 #if DETECT_OS_WINDOWS
 /* TODO: implement disk cache support on windows */
 
@@ -58,6 +67,7 @@ struct cache_entry_file_data {
 #include <unistd.h>
 
 #include "util/blob.h"
+#include "util/compiler.h"
 #include "util/crc32.h"
 #include "util/debug.h"
 #include "util/disk_cache.h"
@@ -388,12 +398,182 @@ write_all(int fd, const void *buf, size_t count)
    return done;
 }
 
+/* Returns the size of the deleted file, (or 0 on any error). */
+static size_t
+evict_cache_file(struct disk_cache *cache, char *filename)
+{
+   struct stat sb;
+   if (stat(filename, &sb) == -1) {
+      free(filename);
+      return 0;
+   }
+
+   unlink(filename);
+   free(filename);
+
+   if (sb.st_blocks)
+      p_atomic_add(cache->size, - (uint64_t)sb.st_blocks * 512);
+
+   return sb.st_blocks * 512;
+}
+
+static struct disk_cache_lru_entry *
+get_lru_set(struct disk_cache *cache, const cache_key key)
+{
+   uint32_t key_chunk;
+   memcpy(&key_chunk, key, sizeof(key_chunk));
+
+   unsigned set = CPU_TO_LE32(key_chunk) & ((1 << CACHE_LRU_SET_BITS) - 1);
+   return &cache->lru_index->entries[set * CACHE_LRU_WAYS];
+}
+
+/* Record an access of the cache file for key. If the key isn't in the LRU
+ * index yet it takes over the least recently used entry of its set, the file
+ * of that entry is then only found by the directory scan in
+ * disk_cache_evict_lru_item().
+ */
+void
+disk_cache_lru_touch(struct disk_cache *cache, const cache_key key)
+{
+   if (!cache->lru_index)
+      return;
+
+   struct disk_cache_lru_entry *set = get_lru_set(cache, key);
+   struct disk_cache_lru_entry *victim = &set[0];
+   uint64_t now = p_atomic_inc_return(&cache->lru_index->clock);
+
+   for (unsigned i = 0; i < CACHE_LRU_WAYS; i++) {
+      if (memcmp(set[i].key, key, CACHE_KEY_SIZE) == 0) {
+         set[i].last_access = now;
+         return;
+      }
+
+      if (set[i].last_access < victim->last_access)
+         victim = &set[i];
+   }
+
+   memcpy(victim->key, key, CACHE_KEY_SIZE);
+   victim->last_access = now;
+}
+
+void
+disk_cache_lru_remove(struct disk_cache *cache, const cache_key key)
+{
+   if (!cache->lru_index)
+      return;
+
+   struct disk_cache_lru_entry *set = get_lru_set(cache, key);
+   for (unsigned i = 0; i < CACHE_LRU_WAYS; i++) {
+      if (memcmp(set[i].key, key, CACHE_KEY_SIZE) == 0)
+         memset(&set[i], 0, sizeof(set[i]));
+   }
+}
+
+/* Scan the LRU index for the CACHE_LRU_BATCH least recently used entries.
+ * Must be called with lru_mtx held.
+ */
+static void
+gather_lru_candidates(struct disk_cache *cache)
+{
+   struct disk_cache_lru_candidate *candidates = cache->lru_candidates;
+   unsigned num_candidates = 0;
+
+   for (uint32_t i = 0; i < CACHE_LRU_MAX_ENTRIES; i++) {
+      uint64_t last_access = cache->lru_index->entries[i].last_access;
+      if (last_access == 0)
+         continue;
+
+      /* The list is kept sorted from newest to oldest, so the first entry
+       * is replaced once the list is full.
+       */
+      unsigned pos;
+      if (num_candidates < CACHE_LRU_BATCH) {
+         pos = num_candidates++;
+      } else if (last_access < candidates[0].last_access) {
+         pos = 0;
+         while (pos + 1 < num_candidates &&
+                candidates[pos + 1].last_access > last_access) {
+            candidates[pos] = candidates[pos + 1];
+            pos++;
+         }
+         candidates[pos].index = i;
+         candidates[pos].last_access = last_access;
+         continue;
+      } else {
+         continue;
+      }
+
+      while (pos > 0 && candidates[pos - 1].last_access < last_access) {
+         candidates[pos] = candidates[pos - 1];
+         pos--;
+      }
+      candidates[pos].index = i;
+      candidates[pos].last_access = last_access;
+   }
+
+   cache->num_lru_candidates = num_candidates;
+}
+
+/* Evict the least recently used cache file known to the LRU index. The index
+ * is only scanned once per CACHE_LRU_BATCH evictions, candidates that were
+ * used since are skipped.
+ *
+ * Returns the size of the deleted file, (or 0 if there was nothing to evict).
+ */
+static size_t
+evict_lru_index_item(struct disk_cache *cache)
+{
+   simple_mtx_lock(&cache->lru_mtx);
+
+   while (true) {
+      if (cache->num_lru_candidates == 0) {
+         gather_lru_candidates(cache);
+         if (cache->num_lru_candidates == 0)
+            break;
+      }
+
+      struct disk_cache_lru_candidate *candidate =
+         &cache->lru_candidates[--cache->num_lru_candidates];
+      struct disk_cache_lru_entry *entry =
+         &cache->lru_index->entries[candidate->index];
+      if (entry->last_access != candidate->last_access)
+         continue;
+
+      cache_key key;
+      memcpy(key, entry->key, CACHE_KEY_SIZE);
+      memset(entry, 0, sizeof(*entry));
+
+      char *filename = disk_cache_get_cache_filename(cache, key);
+      if (!filename)
+         break;
+
+      /* The file may already have been evicted by another process. */
+      size_t size = evict_cache_file(cache, filename);
+      if (size) {
+         simple_mtx_unlock(&cache->lru_mtx);
+         return size;
+      }
+   }
+
+   simple_mtx_unlock(&cache->lru_mtx);
+   return 0;
+}
+
 /* Evict least recently used cache item */
 void
 disk_cache_evict_lru_item(struct disk_cache *cache)
 {
    char *dir_path;
 
+   /* Files not in the LRU index, (written by older versions or displaced
+    * from a full set), are only reclaimed by scanning the cache directories,
+    * so every 16th eviction still does that.
+    */
+   if (cache->lru_index &&
+       p_atomic_inc_return(&cache->num_lru_evictions) % 16 != 0 &&
+       evict_lru_index_item(cache))
+      return;
+
    /* With a reasonably-sized, full cache, (and with keys generated
     * from a cryptographic hash), we can choose two random hex digits
     * and reasonably expect the directory to exist with a file in it.
@@ -441,21 +621,133 @@ disk_cache_evict_lru_item(struct disk_cache *cache)
 void
 disk_cache_evict_item(struct disk_cache *cache, char *filename)
 {
+   evict_cache_file(cache, filename);
+}
+
+/* Must be called with dict_mtx held. */
+static void
+load_dictionary_locked(struct disk_cache *cache)
+{
+   char *filename;
+   uint8_t *data = NULL;
+
+   if (cache->dict || !cache->path)
+      return;
+
+   if (asprintf(&filename, "%s/dictionary", cache->path) == -1)
+      return;
+
+   int fd = open(filename, O_RDONLY | O_CLOEXEC);
+   free(filename);
+   if (fd == -1)
+      return;
+
    struct stat sb;
-   if (stat(filename, &sb) == -1) {
-      free(filename);
+   if (fstat(fd, &sb) == -1 || sb.st_size == 0)
+      goto done;
+
+   data = malloc(sb.st_size);
+   if (data == NULL || read_all(fd, data, sb.st_size) == -1)
+      goto done;
+
+   p_atomic_set(&cache->dict, util_compress_dict_create(data, sb.st_size));
+
+ done:
+   free(data);
+   close(fd);
+}
+
+/* Load the compression dictionary of the cache directory, if there is one.
+ * Items compressed with it can't be read without it.
+ */
+struct util_compress_dict *
+disk_cache_load_dictionary(struct disk_cache *cache)
+{
+   simple_mtx_lock(&cache->dict_mtx);
+   load_dictionary_locked(cache);
+   simple_mtx_unlock(&cache->dict_mtx);
+
+   return cache->dict;
+}
+
+/* Publish a newly trained dictionary. If another process got there first
+ * its dictionary is kept, the link() makes sure only one ever exists.
+ */
+static void
+store_dictionary(struct disk_cache *cache, const void *data, size_t size)
+{
+   char *filename = NULL, *filename_tmp = NULL;
+
+   if (asprintf(&filename, "%s/dictionary", cache->path) == -1)
       return;
-   }
 
-   unlink(filename);
+   if (asprintf(&filename_tmp, "%s.%d.tmp", filename, (int)getpid()) == -1)
+      goto done;
+
+   int fd = open(filename_tmp, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC,
+                 0644);
+   if (fd == -1)
+      goto done;
+
+   if (write_all(fd, data, size) != -1)
+      link(filename_tmp, filename);
+
+   close(fd);
+   unlink(filename_tmp);
+
+ done:
+   free(filename_tmp);
    free(filename);
+}
 
-   if (sb.st_blocks)
-      p_atomic_add(cache->size, - (uint64_t)sb.st_blocks * 512);
+/* Collect the start of items compressed without a dictionary until there is
+ * enough data to train one.
+ */
+static void
+add_dictionary_sample(struct disk_cache *cache, const void *data,
+                      size_t size)
+{
+   simple_mtx_lock(&cache->dict_mtx);
+
+   if (!cache->dict_training || cache->dict) {
+      simple_mtx_unlock(&cache->dict_mtx);
+      return;
+   }
+
+   size = MIN2(size, DISK_CACHE_DICT_MAX_SAMPLE_SIZE);
+   void *sample = util_dynarray_grow_bytes(&cache->dict_samples, 1, size);
+   if (sample) {
+      memcpy(sample, data, size);
+      util_dynarray_append(&cache->dict_sample_sizes, size_t, size);
+   }
+
+   if (cache->dict_samples.size >= DISK_CACHE_DICT_SAMPLES_SIZE) {
+      p_atomic_set(&cache->dict_training, false);
+
+      void *dict = malloc(DISK_CACHE_DICT_SIZE);
+      size_t dict_size = 0;
+      if (dict) {
+         dict_size = util_compress_train_dict(
+            dict, DISK_CACHE_DICT_SIZE, cache->dict_samples.data,
+            cache->dict_sample_sizes.data,
+            util_dynarray_num_elements(&cache->dict_sample_sizes, size_t));
+      }
+
+      if (dict_size) {
+         store_dictionary(cache, dict, dict_size);
+         load_dictionary_locked(cache);
+      }
+
+      free(dict);
+      util_dynarray_fini(&cache->dict_samples);
+      util_dynarray_fini(&cache->dict_sample_sizes);
+   }
+
+   simple_mtx_unlock(&cache->dict_mtx);
 }
 
 static void *
-parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
+parse_and_validate_cache_item(struct disk_cache *cache, const void *cache_item,
                               size_t cache_item_size, size_t *size)
 {
    uint8_t *uncompressed_data = NULL;
@@ -511,9 +803,19 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
 
    /* Uncompress the cache data */
    uncompressed_data = malloc(cf_data->uncompressed_size);
-   if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                              cf_data->uncompressed_size))
-      goto fail;
+   struct util_compress_dict *dict = p_atomic_read(&cache->dict);
+   if (!util_compress_inflate_dict(dict, data, cache_data_size,
+                                   uncompressed_data,
+                                   cf_data->uncompressed_size)) {
+      /* The item may have been compressed with a dictionary another
+       * process trained after we looked for one.
+       */
+      if (dict || !(dict = disk_cache_load_dictionary(cache)) ||
+          !util_compress_inflate_dict(dict, data, cache_data_size,
+                                      uncompressed_data,
+                                      cf_data->uncompressed_size))
+         goto fail;
+   }
 
    if (size)
       *size = cf_data->uncompressed_size;
@@ -603,12 +905,16 @@ create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
    if (compressed_data == NULL)
       return false;
 
+   struct util_compress_dict *dict = p_atomic_read(&dc_job->cache->dict);
    size_t compressed_size =
-      util_compress_deflate(dc_job->data, dc_job->size,
-                            compressed_data, max_buf);
+      util_compress_deflate_dict(dict, dc_job->data, dc_job->size,
+                                 compressed_data, max_buf);
    if (compressed_size == 0)
       goto fail;
 
+   if (!dict && p_atomic_read(&dc_job->cache->dict_training))
+      add_dictionary_sample(dc_job->cache, dc_job->data, dc_job->size);
+
    /* Copy the driver_keys_blob, this can be used find information about the
     * mesa version that produced the entry or deal with hash collisions,
     * should that ever become a real problem.
@@ -752,6 +1058,8 @@ disk_cache_write_item_to_disk(struct disk_cache_put_job *dc_job,
 
    p_atomic_add(dc_job->cache->size, sb.st_blocks * 512);
 
+   disk_cache_lru_touch(dc_job->cache, dc_job->key);
+
  done:
    if (fd_final != -1)
       close(fd_final);
@@ -868,12 +1176,20 @@ disk_cache_enabled()
    return true;
 }
 
-void *
-disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
-                         size_t *size)
+static void *
+load_item_from_foz_db(struct disk_cache *cache, struct foz_db *foz_db,
+                      const cache_key key, size_t *size)
 {
    size_t cache_tem_size = 0;
-   void *cache_item = foz_read_entry(&cache->foz_db, key, &cache_tem_size);
+
+   /* Items from the mapped read-only dbs can be parsed in place. */
+   const void *mapped_item =
+      foz_read_entry_mapped(foz_db, key, &cache_tem_size);
+   if (mapped_item)
+      return parse_and_validate_cache_item(cache, mapped_item, cache_tem_size,
+                                           size);
+
+   void *cache_item = foz_read_entry(foz_db, key, &cache_tem_size);
    if (!cache_item)
       return NULL;
 
@@ -884,19 +1200,122 @@ disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
    return uncompressed_data;
 }
 
+void *
+disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
+                         size_t *size)
+{
+   return load_item_from_foz_db(cache, &cache->foz_db, key, size);
+}
+
+/* Open the read-only layer set with MESA_DISK_CACHE_READ_ONLY_LAYER. It has
+ * the layout of a single file cache directory, so one warmed up with
+ * MESA_DISK_CACHE_SINGLE_FILE can be distributed as is.
+ */
+bool
+disk_cache_load_read_only_layer(void *mem_ctx, struct disk_cache *cache,
+                                const char *gpu_name, const char *driver_id)
+{
+   const char *layer = getenv("MESA_DISK_CACHE_READ_ONLY_LAYER");
+   if (!layer || !*layer)
+      return false;
+
+   char *path = ralloc_asprintf(mem_ctx, "%s/%s/%s", layer, driver_id,
+                                gpu_name);
+   if (!path)
+      return false;
+
+   cache->ro_layer = foz_prepare_read_only(&cache->ro_layer_db, path);
+   return cache->ro_layer;
+}
+
+void *
+disk_cache_load_item_read_only_layer(struct disk_cache *cache,
+                                     const cache_key key, size_t *size)
+{
+   return load_item_from_foz_db(cache, &cache->ro_layer_db, key, size);
+}
+
+static bool
+write_foz_batch(struct disk_cache *cache, struct util_dynarray *batch)
+{
+   unsigned num_items =
+      util_dynarray_num_elements(batch, struct disk_cache_foz_item);
+   struct foz_entry_data *entries = malloc(num_items * sizeof(*entries));
+   bool r = false;
+
+   if (entries) {
+      unsigned i = 0;
+      util_dynarray_foreach(batch, struct disk_cache_foz_item, item) {
+         entries[i].key = item->key;
+         entries[i].blob = item->data;
+         entries[i].size = item->size;
+         i++;
+      }
+
+      r = foz_write_entries(&cache->foz_db, entries, num_items);
+      free(entries);
+   }
+
+   util_dynarray_foreach(batch, struct disk_cache_foz_item, item)
+      free(item->data);
+
+   /* The single file cache only ever grows, rewrite it once it gets too
+    * large.
+    */
+   if (r)
+      foz_compact(&cache->foz_db, cache->max_size);
+
+   return r;
+}
+
+/* Items are compressed in parallel by the cache threads but written in
+ * batches: the thread that finds no flush in progress writes everything that
+ * is pending, including items queued while it was writing, so the db is
+ * locked and flushed once per batch rather than once per item.
+ */
 bool
 disk_cache_write_item_to_disk_foz(struct disk_cache_put_job *dc_job)
 {
+   struct disk_cache *cache = dc_job->cache;
    struct blob cache_blob;
    blob_init(&cache_blob);
 
-   if (!create_cache_item_header_and_blob(dc_job, &cache_blob))
+   if (!create_cache_item_header_and_blob(dc_job, &cache_blob)) {
+      blob_finish(&cache_blob);
       return false;
+   }
 
-   bool r = foz_write_entry(&dc_job->cache->foz_db, dc_job->key,
-                            cache_blob.data, cache_blob.size);
+   struct disk_cache_foz_item item;
+   memcpy(item.key, dc_job->key, sizeof(cache_key));
+   item.data = cache_blob.data;
+   item.size = cache_blob.size;
+
+   simple_mtx_lock(&cache->foz_batch_mtx);
+
+   util_dynarray_append(&cache->foz_batch, struct disk_cache_foz_item, item);
+   if (cache->foz_batch_flushing) {
+      simple_mtx_unlock(&cache->foz_batch_mtx);
+      return true;
+   }
+
+   cache->foz_batch_flushing = true;
+
+   bool r = true;
+   while (cache->foz_batch.size) {
+      struct util_dynarray batch = cache->foz_batch;
+      util_dynarray_init(&cache->foz_batch, NULL);
+
+      simple_mtx_unlock(&cache->foz_batch_mtx);
+
+      r &= write_foz_batch(cache, &batch);
+      util_dynarray_fini(&batch);
+
+      simple_mtx_lock(&cache->foz_batch_mtx);
+   }
+
+   cache->foz_batch_flushing = false;
+   simple_mtx_unlock(&cache->foz_batch_mtx);
 
-   blob_finish(&cache_blob);
    return r;
 }
 
@@ -965,10 +1384,98 @@ path_fail:
    return mapped;
 }
 
+/* Create the LRU index with a valid header under a temporary name and
+ * publish it with link(), so that processes racing to create it never see a
+ * partial header and an index that is already mapped is never replaced.
+ */
+static void
+create_lru_index(const char *path)
+{
+   const struct disk_cache_lru_index header = {
+      .magic = CACHE_LRU_MAGIC,
+      .version = CACHE_LRU_VERSION,
+      .size = sizeof(struct disk_cache_lru_index),
+   };
+   char *path_tmp = NULL;
+
+   if (asprintf(&path_tmp, "%s.%d.tmp", path, (int)getpid()) == -1)
+      return;
+
+   int fd = open(path_tmp, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1)
+      goto done;
+
+   if (ftruncate(fd, sizeof(struct disk_cache_lru_index)) == 0 &&
+       write_all(fd, &header, offsetof(struct disk_cache_lru_index, clock)) != -1)
+      link(path_tmp, path);
+
+   close(fd);
+   unlink(path_tmp);
+
+ done:
+   free(path_tmp);
+}
+
+/* Map the LRU index, which records the order in which cache files were last
+ * used so that eviction doesn't need to scan the cache directories.
+ *
+ * The index is never truncated, other processes may have it mapped. If it
+ * was written by a build with another layout it is left alone and eviction
+ * falls back to the directory scan.
+ */
+bool
+disk_cache_mmap_lru_index(void *mem_ctx, struct disk_cache *cache)
+{
+   bool mapped = false;
+
+   char *path = ralloc_asprintf(mem_ctx, "%s/lru_index", cache->path);
+   if (path == NULL)
+      return false;
+
+   int fd = open(path, O_RDWR | O_CLOEXEC);
+   if (fd == -1 && errno == ENOENT) {
+      create_lru_index(path);
+      fd = open(path, O_RDWR | O_CLOEXEC);
+   }
+   if (fd == -1)
+      return false;
+
+   struct stat sb;
+   if (fstat(fd, &sb) == -1)
+      goto fail;
+
+   size_t size = sizeof(struct disk_cache_lru_index);
+   if (sb.st_size != size)
+      goto fail;
+
+   /* Like the index this is mapped shared and updated without locking, a
+    * torn entry at worst results in a file being evicted early or late.
+    */
+   struct disk_cache_lru_index *map =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (map == MAP_FAILED)
+      goto fail;
+
+   if (map->magic != CACHE_LRU_MAGIC || map->version != CACHE_LRU_VERSION ||
+       map->size != size) {
+      munmap(map, size);
+      goto fail;
+   }
+
+   cache->lru_index = map;
+   mapped = true;
+
+fail:
+   close(fd);
+   return mapped;
+}
+
 void
 disk_cache_destroy_mmap(struct disk_cache *cache)
 {
    munmap(cache->index_mmap, cache->index_mmap_size);
+   if (cache->lru_index)
+      munmap(cache->lru_index, sizeof(struct disk_cache_lru_index));
 }
 #endif
 
@@ -43,6 +43,57 @@
 /* The number of keys that can be stored in the index. */
 #define CACHE_INDEX_MAX_KEYS (1 << CACHE_INDEX_KEY_BITS)
 
+/* Number of bits of a cache key used to pick a set in the LRU index. */
+#define CACHE_LRU_SET_BITS 14
+
+/* Number of entries in each set of the LRU index. */
+#define CACHE_LRU_WAYS 4
+
+/* The number of cache files that can be tracked by the LRU index. */
+#define CACHE_LRU_MAX_ENTRIES ((1 << CACHE_LRU_SET_BITS) * CACHE_LRU_WAYS)
+
+/* Number of eviction candidates gathered per scan of the LRU index. */
+#define CACHE_LRU_BATCH 64
+
+/* Entry of the LRU index, an empty entry has last_access == 0. */
+struct disk_cache_lru_entry {
+   uint64_t last_access;
+   uint8_t key[CACHE_KEY_SIZE];
+};
+
+/* Identifies the LRU index file, bump the version when its layout changes. */
+#define CACHE_LRU_MAGIC 0x4d4c5255 /* "URLM" */
+#define CACHE_LRU_VERSION 1
+
+/* The LRU index file, shared between all processes using the cache. */
+struct disk_cache_lru_index {
+   /* Written before the file is published and never changed after, a
+    * mismatch means the index belongs to another Mesa build.
+    */
+   uint32_t magic;
+   uint32_t version;
+   uint64_t size;
+
+   /* Incremented on every access, gives the order of last_access. */
+   uint64_t clock;
+
+   struct disk_cache_lru_entry entries[CACHE_LRU_MAX_ENTRIES];
+};
+
+struct disk_cache_lru_candidate {
+   uint32_t index;
+   uint64_t last_access;
+};
+
+/* A compressed cache item waiting to be written to the single file cache. */
+struct disk_cache_foz_item {
+   cache_key key;
+   void *data;
+   size_t size;
+};
+
+struct util_compress_dict;
+
 struct disk_cache {
    /* The path to the cache directory. */
    char *path;
@@ -53,6 +104,12 @@ struct disk_cache {
 
    struct foz_db foz_db;
 
+   /* Prebuilt read-only cache shared by all users, looked up before the
+    * cache above.
+    */
+   struct foz_db ro_layer_db;
+   bool ro_layer;
+
    /* Seed for rand, which is used to pick a random directory */
    uint64_t seed_xorshift128plus[2];
 
@@ -66,6 +123,33 @@ struct disk_cache {
    /* Pointer to stored keys, (within index_mmap). */
    uint8_t *stored_keys;
 
+   /* A pointer to the mmapped LRU index within the cache directory, NULL if
+    * it couldn't be mapped.
+    */
+   struct disk_cache_lru_index *lru_index;
+
+   /* Eviction candidates from the LRU index, oldest last. */
+   simple_mtx_t lru_mtx;
+   struct disk_cache_lru_candidate lru_candidates[CACHE_LRU_BATCH];
+   unsigned num_lru_candidates;
+   unsigned num_lru_evictions;
+
+   /* Items waiting to be written to the single file cache, written in
+    * batches by whichever cache thread gets to flush them.
+    */
+   simple_mtx_t foz_batch_mtx;
+   struct util_dynarray foz_batch;
+   bool foz_batch_flushing;
+
+   /* Compression dictionary shared through the cache directory, and the
+    * samples it is trained from when MESA_DISK_CACHE_DICTIONARY is set.
+    */
+   simple_mtx_t dict_mtx;
+   struct util_compress_dict *dict;
+   bool dict_training;
+   struct util_dynarray dict_samples;
+   struct util_dynarray dict_sample_sizes;
+
    /* Maximum size of all cached objects (in bytes). */
    uint64_t max_size;
 
@@ -103,6 +187,20 @@ disk_cache_evict_lru_item(struct disk_cache *cache);
 void
 disk_cache_evict_item(struct disk_cache *cache, char *filename);
 
+void
+disk_cache_lru_touch(struct disk_cache *cache, const cache_key key);
+
+void
+disk_cache_lru_remove(struct disk_cache *cache, const cache_key key);
+
+bool
+disk_cache_load_read_only_layer(void *mem_ctx, struct disk_cache *cache,
+                                const char *gpu_name, const char *driver_id);
+
+void *
+disk_cache_load_item_read_only_layer(struct disk_cache *cache,
+                                     const cache_key key, size_t *size);
+
 void *
 disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
                          size_t *size);
@@ -130,6 +228,12 @@ bool
 disk_cache_mmap_cache_index(void *mem_ctx, struct disk_cache *cache,
                             char *path);
 
+bool
+disk_cache_mmap_lru_index(void *mem_ctx, struct disk_cache *cache);
+
+struct util_compress_dict *
+disk_cache_load_dictionary(struct disk_cache *cache);
+
 void
 disk_cache_destroy_mmap(struct disk_cache *cache);
 
@@ -1132,21 +1132,66 @@ util_format_rgb_to_bgr(enum pipe_format format)
    }
 }
 
+static const struct util_format_pack_description *util_format_pack_table[PIPE_FORMAT_COUNT];
 static const struct util_format_unpack_description *util_format_unpack_table[PIPE_FORMAT_COUNT];
 
+static void
+util_format_pack_table_init(void)
+{
+#if defined(HAVE_FORMAT_AVX2) || defined(HAVE_FORMAT_AVX512)
+   util_cpu_detect();
+#endif
+
+   for (enum pipe_format format = PIPE_FORMAT_NONE; format < PIPE_FORMAT_COUNT; format++) {
+      const struct util_format_pack_description *pack = NULL;
+
+#ifdef HAVE_FORMAT_AVX512
+      pack = util_format_pack_description_avx512(format);
+#endif
+#ifdef HAVE_FORMAT_AVX2
+      if (!pack)
+         pack = util_format_pack_description_avx2(format);
+#endif
+
+      util_format_pack_table[format] = pack ? pack : util_format_pack_description_generic(format);
+   }
+}
+
+const struct util_format_pack_description *
+util_format_pack_description(enum pipe_format format)
+{
+   static once_flag flag = ONCE_FLAG_INIT;
+   call_once(&flag, util_format_pack_table_init);
+
+   if (format >= PIPE_FORMAT_COUNT)
+      return NULL;
+
+   return util_format_pack_table[format];
+}
+
 static void
 util_format_unpack_table_init(void)
 {
+#if defined(HAVE_FORMAT_AVX2) || defined(HAVE_FORMAT_AVX512)
+   util_cpu_detect();
+#endif
+
    for (enum pipe_format format = PIPE_FORMAT_NONE; format < PIPE_FORMAT_COUNT; format++) {
+      const struct util_format_unpack_description *unpack = NULL;
+
 #if (defined(PIPE_ARCH_AARCH64) || defined(PIPE_ARCH_ARM)) && !defined(NO_FORMAT_ASM) && !defined(__SOFTFP__)
-      const struct util_format_unpack_description *unpack = util_format_unpack_description_neon(format);
-      if (unpack) {
-         util_format_unpack_table[format] = unpack;
-         continue;
-      }
+      unpack = util_format_unpack_description_neon(format);
+#endif
+#ifdef HAVE_FORMAT_AVX512
+      if (!unpack)
+         unpack = util_format_unpack_description_avx512(format);
+#endif
+#ifdef HAVE_FORMAT_AVX2
+      if (!unpack)
+         unpack = util_format_unpack_description_avx2(format);
 #endif
 
-      util_format_unpack_table[format] = util_format_unpack_description_generic(format);
+      util_format_unpack_table[format] = unpack ? unpack : util_format_unpack_description_generic(format);
    }
 }
 
@@ -412,20 +412,38 @@ typedef void (*util_format_fetch_rgba_func_ptr)(void *restrict dst, const uint8_
 const struct util_format_description *
 util_format_description(enum pipe_format format) ATTRIBUTE_CONST;
 
+/* Lookups with CPU detection for choosing optimized paths. */
 const struct util_format_pack_description *
 util_format_pack_description(enum pipe_format format) ATTRIBUTE_CONST;
 
-/* Lookup with CPU detection for choosing optimized paths. */
 const struct util_format_unpack_description *
 util_format_unpack_description(enum pipe_format format) ATTRIBUTE_CONST;
 
-/* Codegenned table of CPU-agnostic unpack code. */
+/* Codegenned tables of CPU-agnostic pack and unpack code. */
+const struct util_format_pack_description *
+util_format_pack_description_generic(enum pipe_format format) ATTRIBUTE_CONST;
+
 const struct util_format_unpack_description *
 util_format_unpack_description_generic(enum pipe_format format) ATTRIBUTE_CONST;
 
 const struct util_format_unpack_description *
 util_format_unpack_description_neon(enum pipe_format format) ATTRIBUTE_CONST;
 
+/* Codegenned row kernels for x86 vector extensions, NULL for formats
+ * without them or when the CPU lacks the extension.
+ */
+const struct util_format_pack_description *
+util_format_pack_description_avx2(enum pipe_format format) ATTRIBUTE_CONST;
+
+const struct util_format_unpack_description *
+util_format_unpack_description_avx2(enum pipe_format format) ATTRIBUTE_CONST;
+
+const struct util_format_pack_description *
+util_format_pack_description_avx512(enum pipe_format format) ATTRIBUTE_CONST;
+
+const struct util_format_unpack_description *
+util_format_unpack_description_avx512(enum pipe_format format) ATTRIBUTE_CONST;
+
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
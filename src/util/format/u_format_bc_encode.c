@@ -0,0 +1,776 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * The encoders work on whole 4x4 blocks with fixed trip count loops over the
+ * 16 texels so that the compiler can vectorize them.  Palettes are computed
+ * exactly like the decoders in mesa/main do, so the errors used to pick
+ * between candidate encodings are the real ones.
+ */
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c11/threads.h"
+#include "util/format/u_format_bc_encode.h"
+#include "util/macros.h"
+#include "util/u_atomic.h"
+#include "util/u_debug.h"
+
+static int compress_quality = -1;
+
+enum util_format_compress_quality
+util_format_get_compress_quality(void)
+{
+   int quality = p_atomic_read(&compress_quality);
+
+   if (unlikely(quality < 0)) {
+      const char *str = debug_get_option("MESA_TEXCOMPRESS_QUALITY", "normal");
+
+      if (!strcmp(str, "fast"))
+         quality = UTIL_FORMAT_COMPRESS_FAST;
+      else if (!strcmp(str, "best"))
+         quality = UTIL_FORMAT_COMPRESS_BEST;
+      else
+         quality = UTIL_FORMAT_COMPRESS_NORMAL;
+
+      p_atomic_set(&compress_quality, quality);
+   }
+
+   return quality;
+}
+
+void
+util_format_set_compress_quality(enum util_format_compress_quality quality)
+{
+   p_atomic_set(&compress_quality, quality);
+}
+
+
+/*
+ * BC1 color blocks.
+ */
+
+struct bc1_block {
+   uint16_t c0, c1;
+   uint32_t indices;
+   unsigned error;
+};
+
+/* Endpoint pairs whose 2/3 interpolant is closest to each 8-bit value, for
+ * encoding single color blocks without the error of plain quantization.
+ */
+static uint8_t bc1_match5[256][2];
+static uint8_t bc1_match6[256][2];
+static once_flag bc1_match_once = ONCE_FLAG_INIT;
+
+static inline int
+expand5(int v)
+{
+   return (v << 3) | (v >> 2);
+}
+
+static inline int
+expand6(int v)
+{
+   return (v << 2) | (v >> 4);
+}
+
+static void
+bc1_init_match_table(uint8_t table[256][2], int bits)
+{
+   const int max = (1 << bits) - 1;
+
+   for (int v = 0; v < 256; v++) {
+      int best_error = INT_MAX;
+
+      for (int a = 0; a <= max; a++) {
+         for (int b = 0; b <= max; b++) {
+            int ea = bits == 5 ? expand5(a) : expand6(a);
+            int eb = bits == 5 ? expand5(b) : expand6(b);
+            /* Prefer close endpoints on ties, hardware interpolates those
+             * more consistently.
+             */
+            int error = abs((ea * 2 + eb) / 3 - v) * 64 + abs(a - b);
+
+            if (error < best_error) {
+               best_error = error;
+               table[v][0] = a;
+               table[v][1] = b;
+            }
+         }
+      }
+   }
+}
+
+static void
+bc1_init_match_tables(void)
+{
+   bc1_init_match_table(bc1_match5, 5);
+   bc1_init_match_table(bc1_match6, 6);
+}
+
+static inline uint16_t
+rgb565_quantize(const float c[3])
+{
+   int r = CLAMP((int)(c[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+   int g = CLAMP((int)(c[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+   int b = CLAMP((int)(c[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+
+   return (r << 11) | (g << 5) | b;
+}
+
+static inline void
+rgb565_expand(uint16_t c, int rgb[3])
+{
+   rgb[0] = expand5(c >> 11);
+   rgb[1] = expand6((c >> 5) & 0x3f);
+   rgb[2] = expand5(c & 0x1f);
+}
+
+static void
+bc1_palette(uint16_t c0, uint16_t c1, bool four_colors, int palette[4][3])
+{
+   rgb565_expand(c0, palette[0]);
+   rgb565_expand(c1, palette[1]);
+
+   for (unsigned c = 0; c < 3; c++) {
+      if (four_colors) {
+         palette[2][c] = (palette[0][c] * 2 + palette[1][c]) / 3;
+         palette[3][c] = (palette[0][c] + palette[1][c] * 2) / 3;
+      } else {
+         palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+         palette[3][c] = 0;
+      }
+   }
+}
+
+/**
+ * Pick the palette entry closest to each texel.  Transparent texels get
+ * index 3, which is transparent black in three color mode.
+ */
+static unsigned
+bc1_select_nearest(const uint8_t rgba[16][4], unsigned transparent,
+                   const int palette[4][3], unsigned num_colors,
+                   uint32_t *indices)
+{
+   unsigned dist[16][4];
+   unsigned error = 0;
+   uint32_t bits = 0;
+
+   for (unsigned p = 0; p < 4; p++) {
+      for (unsigned i = 0; i < 16; i++) {
+         int dr = rgba[i][0] - palette[p][0];
+         int dg = rgba[i][1] - palette[p][1];
+         int db = rgba[i][2] - palette[p][2];
+
+         dist[i][p] = dr * dr + dg * dg + db * db;
+      }
+   }
+
+   for (unsigned i = 0; i < 16; i++) {
+      unsigned best = 0;
+
+      if (transparent & (1 << i)) {
+         bits |= 3u << (2 * i);
+         continue;
+      }
+
+      for (unsigned p = 1; p < num_colors; p++) {
+         if (dist[i][p] < dist[i][best])
+            best = p;
+      }
+
+      bits |= best << (2 * i);
+      error += dist[i][best];
+   }
+
+   *indices = bits;
+   return error;
+}
+
+/**
+ * Pick indices by projecting the texels on the line between the endpoints,
+ * which is cheaper than measuring the distance to every palette entry.
+ */
+static void
+bc1_select_projected(const uint8_t rgba[16][4], unsigned transparent,
+                     const int palette[4][3], unsigned num_colors,
+                     uint32_t *indices)
+{
+   static const uint8_t map4[4] = { 0, 2, 3, 1 };
+   static const uint8_t map3[3] = { 0, 2, 1 };
+   const int steps = num_colors - 1;
+   int dir[3], len2 = 0;
+   uint32_t bits = 0;
+
+   for (unsigned c = 0; c < 3; c++) {
+      dir[c] = palette[1][c] - palette[0][c];
+      len2 += dir[c] * dir[c];
+   }
+
+   for (unsigned i = 0; i < 16; i++) {
+      int dot = 0, t = 0;
+
+      for (unsigned c = 0; c < 3; c++)
+         dot += (rgba[i][c] - palette[0][c]) * dir[c];
+
+      if (len2)
+         t = CLAMP((dot * steps * 2 + len2) / (len2 * 2), 0, steps);
+
+      if (transparent & (1 << i))
+         bits |= 3u << (2 * i);
+      else
+         bits |= (uint32_t)(num_colors == 4 ? map4[t] : map3[t]) << (2 * i);
+   }
+
+   *indices = bits;
+}
+
+/**
+ * Quantize a pair of endpoints and choose the indices for them.
+ */
+static void
+bc1_fit(const uint8_t rgba[16][4], unsigned transparent, bool three_colors,
+        const float e0[3], const float e1[3],
+        enum util_format_compress_quality quality, struct bc1_block *block)
+{
+   uint16_t c0 = rgb565_quantize(e0);
+   uint16_t c1 = rgb565_quantize(e1);
+   int palette[4][3];
+
+   /* c0 > c1 selects four colors, c0 <= c1 three colors and transparent. */
+   if (three_colors ? c0 > c1 : c0 < c1) {
+      uint16_t tmp = c0;
+      c0 = c1;
+      c1 = tmp;
+   }
+
+   block->c0 = c0;
+   block->c1 = c1;
+
+   if (c0 == c1 && !three_colors) {
+      /* Would decode as three colors; use only the first endpoint. */
+      bc1_palette(c0, c1, true, palette);
+      block->error = bc1_select_nearest(rgba, 0, palette, 1, &block->indices);
+      return;
+   }
+
+   bc1_palette(c0, c1, !three_colors, palette);
+
+   if (quality == UTIL_FORMAT_COMPRESS_FAST) {
+      bc1_select_projected(rgba, transparent, palette, three_colors ? 3 : 4,
+                           &block->indices);
+      block->error = 0;
+   } else {
+      block->error = bc1_select_nearest(rgba, transparent, palette,
+                                        three_colors ? 3 : 4, &block->indices);
+   }
+}
+
+/**
+ * Solve for the endpoints which minimize the squared error of the texels
+ * for the given indices.  Returns false if the system is singular, i.e.
+ * all texels use the same weights.
+ */
+static bool
+bc1_refine(const uint8_t rgba[16][4], unsigned transparent, bool three_colors,
+           uint32_t indices, float e0[3], float e1[3])
+{
+   /* Weight of c0 for each index, scaled by the number of steps. */
+   static const float weights4[4] = { 3, 0, 2, 1 };
+   static const float weights3[4] = { 2, 0, 1, 0 };
+   const float *weights = three_colors ? weights3 : weights4;
+   const float scale = three_colors ? 2 : 3;
+   float aa = 0, bb = 0, ab = 0;
+   float ax[3] = { 0 }, bx[3] = { 0 };
+
+   for (unsigned i = 0; i < 16; i++) {
+      if (transparent & (1 << i))
+         continue;
+
+      float a = weights[(indices >> (2 * i)) & 3];
+      float b = scale - a;
+
+      aa += a * a;
+      bb += b * b;
+      ab += a * b;
+      for (unsigned c = 0; c < 3; c++) {
+         ax[c] += a * rgba[i][c];
+         bx[c] += b * rgba[i][c];
+      }
+   }
+
+   float det = aa * bb - ab * ab;
+   if (fabsf(det) < FLT_EPSILON)
+      return false;
+
+   float f = scale / det;
+   for (unsigned c = 0; c < 3; c++) {
+      e0[c] = (ax[c] * bb - bx[c] * ab) * f;
+      e1[c] = (bx[c] * aa - ax[c] * ab) * f;
+   }
+
+   return true;
+}
+
+static void
+bc1_solid(const uint8_t rgb[3], unsigned transparent, bool three_colors,
+          struct bc1_block *block)
+{
+   if (three_colors) {
+      /* Can't use the interpolants here since 3 is transparent. */
+      const float color[3] = { rgb[0], rgb[1], rgb[2] };
+
+      block->c0 = block->c1 = rgb565_quantize(color);
+      block->indices = 0;
+      for (unsigned i = 0; i < 16; i++) {
+         if (transparent & (1 << i))
+            block->indices |= 3u << (2 * i);
+      }
+      return;
+   }
+
+   call_once(&bc1_match_once, bc1_init_match_tables);
+
+   uint16_t c0 = (bc1_match5[rgb[0]][0] << 11) |
+                 (bc1_match6[rgb[1]][0] << 5) |
+                 bc1_match5[rgb[2]][0];
+   uint16_t c1 = (bc1_match5[rgb[0]][1] << 11) |
+                 (bc1_match6[rgb[1]][1] << 5) |
+                 bc1_match5[rgb[2]][1];
+
+   if (c0 > c1) {
+      block->c0 = c0;
+      block->c1 = c1;
+      block->indices = 0xaaaaaaaa;
+   } else if (c0 < c1) {
+      /* Index 3 is the same interpolant with the endpoints swapped. */
+      block->c0 = c1;
+      block->c1 = c0;
+      block->indices = 0xffffffff;
+   } else {
+      block->c0 = block->c1 = c0;
+      block->indices = 0;
+   }
+}
+
+static void
+bc1_encode_colors(uint8_t *dst, const uint8_t rgba[16][4],
+                  unsigned transparent, bool three_colors,
+                  enum util_format_compress_quality quality)
+{
+   struct bc1_block block;
+   int min[3] = { 255, 255, 255 }, max[3] = { 0, 0, 0 };
+   float mean[3] = { 0 }, cov[6] = { 0 };
+   unsigned count = 0;
+
+   if (transparent == 0xffff) {
+      block.c0 = block.c1 = 0;
+      block.indices = 0xffffffff;
+      goto write;
+   }
+
+   for (unsigned i = 0; i < 16; i++) {
+      if (transparent & (1 << i))
+         continue;
+
+      for (unsigned c = 0; c < 3; c++) {
+         min[c] = MIN2(min[c], rgba[i][c]);
+         max[c] = MAX2(max[c], rgba[i][c]);
+         mean[c] += rgba[i][c];
+      }
+      count++;
+   }
+
+   if (min[0] == max[0] && min[1] == max[1] && min[2] == max[2]) {
+      const uint8_t rgb[3] = { min[0], min[1], min[2] };
+
+      bc1_solid(rgb, transparent, three_colors, &block);
+      goto write;
+   }
+
+   for (unsigned c = 0; c < 3; c++)
+      mean[c] /= count;
+
+   for (unsigned i = 0; i < 16; i++) {
+      if (transparent & (1 << i))
+         continue;
+
+      float r = rgba[i][0] - mean[0];
+      float g = rgba[i][1] - mean[1];
+      float b = rgba[i][2] - mean[2];
+
+      cov[0] += r * r;
+      cov[1] += r * g;
+      cov[2] += r * b;
+      cov[3] += g * g;
+      cov[4] += g * b;
+      cov[5] += b * b;
+   }
+
+   float e0[3], e1[3];
+
+   if (quality == UTIL_FORMAT_COMPRESS_FAST) {
+      /* Diagonal of the bounding box, flipped to follow the correlation of
+       * the channels with the widest one, inset to reduce the error of the
+       * extremes.
+       */
+      const float cov_with[3][3] = {
+         { cov[0], cov[1], cov[2] },
+         { cov[1], cov[3], cov[4] },
+         { cov[2], cov[4], cov[5] },
+      };
+      unsigned widest = 0;
+
+      for (unsigned c = 1; c < 3; c++) {
+         if (max[c] - min[c] > max[widest] - min[widest])
+            widest = c;
+      }
+
+      for (unsigned c = 0; c < 3; c++) {
+         float inset = (max[c] - min[c]) / 16.0f;
+
+         e0[c] = max[c] - inset;
+         e1[c] = min[c] + inset;
+         if (cov_with[widest][c] < 0) {
+            float tmp = e0[c];
+            e0[c] = e1[c];
+            e1[c] = tmp;
+         }
+      }
+   } else {
+      /* Principal axis by power iteration, starting from the diagonal. */
+      float axis[3] = {
+         max[0] - min[0], max[1] - min[1], max[2] - min[2],
+      };
+
+      for (unsigned iter = 0; iter < 4; iter++) {
+         float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+         float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+         float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+         float m = MAX3(fabsf(x), fabsf(y), fabsf(z));
+
+         if (m < FLT_EPSILON)
+            break;
+
+         axis[0] = x / m;
+         axis[1] = y / m;
+         axis[2] = z / m;
+      }
+
+      float lo = FLT_MAX, hi = -FLT_MAX;
+      for (unsigned i = 0; i < 16; i++) {
+         if (transparent & (1 << i))
+            continue;
+
+         float d = (rgba[i][0] - mean[0]) * axis[0] +
+                   (rgba[i][1] - mean[1]) * axis[1] +
+                   (rgba[i][2] - mean[2]) * axis[2];
+         lo = MIN2(lo, d);
+         hi = MAX2(hi, d);
+      }
+
+      float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+      for (unsigned c = 0; c < 3; c++) {
+         e0[c] = mean[c] + axis[c] * hi / len2;
+         e1[c] = mean[c] + axis[c] * lo / len2;
+      }
+   }
+
+   bc1_fit(rgba, transparent, three_colors, e0, e1, quality, &block);
+
+   /* Refine the endpoints for the indices while it helps, once at normal
+    * quality.
+    */
+   const unsigned iterations = quality == UTIL_FORMAT_COMPRESS_BEST ? 8 :
+                               quality == UTIL_FORMAT_COMPRESS_NORMAL ? 1 : 0;
+
+   for (unsigned iter = 0; iter < iterations && block.error; iter++) {
+      struct bc1_block refined;
+
+      if (!bc1_refine(rgba, transparent, three_colors, block.indices, e0, e1))
+         break;
+
+      bc1_fit(rgba, transparent, three_colors, e0, e1, quality, &refined);
+      if (refined.error >= block.error)
+         break;
+      block = refined;
+   }
+
+write:
+   dst[0] = block.c0 & 0xff;
+   dst[1] = block.c0 >> 8;
+   dst[2] = block.c1 & 0xff;
+   dst[3] = block.c1 >> 8;
+   dst[4] = block.indices & 0xff;
+   dst[5] = (block.indices >> 8) & 0xff;
+   dst[6] = (block.indices >> 16) & 0xff;
+   dst[7] = block.indices >> 24;
+}
+
+void
+util_format_bc1_encode_block(uint8_t *dst, const uint8_t rgba[16][4],
+                             bool punchthrough,
+                             enum util_format_compress_quality quality)
+{
+   unsigned transparent = 0;
+
+   if (punchthrough) {
+      for (unsigned i = 0; i < 16; i++) {
+         if (rgba[i][3] < 128)
+            transparent |= 1 << i;
+      }
+   }
+
+   bc1_encode_colors(dst, rgba, transparent, transparent != 0, quality);
+}
+
+void
+util_format_bc2_encode_block(uint8_t *dst, const uint8_t rgba[16][4],
+                             enum util_format_compress_quality quality)
+{
+   for (unsigned i = 0; i < 8; i++) {
+      unsigned a0 = (rgba[i * 2 + 0][3] * 15 + 127) / 255;
+      unsigned a1 = (rgba[i * 2 + 1][3] * 15 + 127) / 255;
+
+      dst[i] = a0 | (a1 << 4);
+   }
+
+   bc1_encode_colors(dst + 8, rgba, 0, false, quality);
+}
+
+void
+util_format_bc3_encode_block(uint8_t *dst, const uint8_t rgba[16][4],
+                             enum util_format_compress_quality quality)
+{
+   uint8_t alpha[16];
+
+   for (unsigned i = 0; i < 16; i++)
+      alpha[i] = rgba[i][3];
+
+   util_format_bc4_encode_block(dst, alpha, quality);
+   bc1_encode_colors(dst + 8, rgba, 0, false, quality);
+}
+
+
+/*
+ * BC4 blocks, also used for the alpha of BC3.
+ */
+
+static void
+bc4_palette(unsigned a0, unsigned a1, int palette[8])
+{
+   palette[0] = a0;
+   palette[1] = a1;
+
+   if (a0 > a1) {
+      for (unsigned code = 2; code < 8; code++)
+         palette[code] = (a0 * (8 - code) + a1 * (code - 1)) / 7;
+   } else {
+      for (unsigned code = 2; code < 6; code++)
+         palette[code] = (a0 * (6 - code) + a1 * (code - 1)) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+   }
+}
+
+static unsigned
+bc4_select_nearest(const uint8_t values[16], const int palette[8],
+                   uint8_t indices[16])
+{
+   unsigned error = 0;
+
+   for (unsigned i = 0; i < 16; i++) {
+      unsigned best = 0, best_dist = UINT_MAX;
+
+      for (unsigned code = 0; code < 8; code++) {
+         int d = values[i] - palette[code];
+         unsigned dist = d * d;
+
+         if (dist < best_dist) {
+            best_dist = dist;
+            best = code;
+         }
+      }
+
+      indices[i] = best;
+      error += best_dist;
+   }
+
+   return error;
+}
+
+static void
+bc4_write(uint8_t *dst, unsigned a0, unsigned a1, const uint8_t indices[16])
+{
+   uint64_t bits = 0;
+
+   for (unsigned i = 0; i < 16; i++)
+      bits |= (uint64_t)indices[i] << (3 * i);
+
+   dst[0] = a0;
+   dst[1] = a1;
+   for (unsigned i = 0; i < 6; i++)
+      dst[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+void
+util_format_bc4_encode_block(uint8_t *dst, const uint8_t values[16],
+                             enum util_format_compress_quality quality)
+{
+   uint8_t indices[16];
+   unsigned min = 255, max = 0;
+
+   for (unsigned i = 0; i < 16; i++) {
+      min = MIN2(min, values[i]);
+      max = MAX2(max, values[i]);
+   }
+
+   if (min == max) {
+      memset(indices, 0, sizeof(indices));
+      bc4_write(dst, max, max, indices);
+      return;
+   }
+
+   if (quality == UTIL_FORMAT_COMPRESS_FAST) {
+      /* Eight values from max to min; snap each value to the nearest step.
+       * Step t from the minimum is code 1 for t == 0, code 0 for t == 7 and
+       * code 8 - t in between.
+       */
+      const unsigned range = max - min;
+
+      for (unsigned i = 0; i < 16; i++) {
+         unsigned t = ((values[i] - min) * 7 + range / 2) / range;
+
+         indices[i] = t == 0 ? 1 : t == 7 ? 0 : 8 - t;
+      }
+      bc4_write(dst, max, min, indices);
+      return;
+   }
+
+   /* Six interpolated values plus exact 0 and 255 are better when the
+    * block has a few texels at the extremes.
+    */
+   unsigned min6 = 255, max6 = 0;
+   for (unsigned i = 0; i < 16; i++) {
+      if (values[i] != 0 && values[i] != 255) {
+         min6 = MIN2(min6, values[i]);
+         max6 = MAX2(max6, values[i]);
+      }
+   }
+
+   /* Try the extremes of the block with eight values and the extremes
+    * without 0 and 255 with six values.  The best quality also searches
+    * endpoints a few steps inside of those.
+    */
+   const int search = quality == UTIL_FORMAT_COMPRESS_BEST ? 4 : 1;
+   unsigned best_error = UINT_MAX;
+   unsigned best_a0 = max, best_a1 = min;
+
+   for (unsigned mode = 0; mode < 2; mode++) {
+      if (mode == 1 && min6 > max6)
+         break;
+
+      for (int d0 = 0; d0 < search; d0++) {
+         for (int d1 = 0; d1 < search; d1++) {
+            int a0 = mode == 0 ? (int)max - d0 : (int)min6 + d0;
+            int a1 = mode == 0 ? (int)min + d1 : (int)max6 - d1;
+            uint8_t candidate[16];
+            int palette[8];
+
+            /* a0 > a1 selects eight values. */
+            if (mode == 0 ? a0 <= a1 : a0 > a1)
+               continue;
+
+            bc4_palette(a0, a1, palette);
+            unsigned error = bc4_select_nearest(values, palette, candidate);
+            if (error < best_error) {
+               best_error = error;
+               best_a0 = a0;
+               best_a1 = a1;
+               memcpy(indices, candidate, sizeof(candidate));
+            }
+         }
+      }
+   }
+
+   bc4_write(dst, best_a0, best_a1, indices);
+}
+
+void
+util_format_bc4_encode_ubyte(uint8_t *blkaddr, uint8_t srccolors[4][4],
+                             int numxpixels, int numypixels)
+{
+   uint8_t values[16];
+
+   /* Replicate the edge texels of partial blocks. */
+   for (unsigned j = 0; j < 4; j++) {
+      for (unsigned i = 0; i < 4; i++)
+         values[j * 4 + i] = srccolors[MIN2(j, numypixels - 1)]
+                                      [MIN2(i, numxpixels - 1)];
+   }
+
+   util_format_bc4_encode_block(blkaddr, values,
+                                util_format_get_compress_quality());
+}
+
+
+void
+util_format_dxtn_encode(int src_comps, int width, int height,
+                        const uint8_t *src, enum util_format_dxtn dst_format,
+                        uint8_t *dst, int dst_stride,
+                        enum util_format_compress_quality quality)
+{
+   const unsigned block_size = dst_format == UTIL_FORMAT_DXT1_RGB ||
+                               dst_format == UTIL_FORMAT_DXT1_RGBA ? 8 : 16;
+   const unsigned row_size = DIV_ROUND_UP(width, 4) * block_size;
+
+   /* Like the legacy compressor, a stride smaller than a row means packed. */
+   if (dst_stride < (int)row_size)
+      dst_stride = row_size;
+
+   for (int y = 0; y < height; y += 4) {
+      uint8_t *block = dst;
+
+      for (int x = 0; x < width; x += 4) {
+         uint8_t rgba[16][4];
+
+         /* Replicate the edge texels of partial blocks. */
+         for (unsigned j = 0; j < 4; j++) {
+            const uint8_t *row =
+               src + (size_t)MIN2(y + j, height - 1) * width * src_comps;
+
+            for (unsigned i = 0; i < 4; i++) {
+               const uint8_t *texel = row + MIN2(x + i, width - 1) * src_comps;
+
+               rgba[j * 4 + i][0] = texel[0];
+               rgba[j * 4 + i][1] = texel[1];
+               rgba[j * 4 + i][2] = texel[2];
+               rgba[j * 4 + i][3] = src_comps == 4 ? texel[3] : 255;
+            }
+         }
+
+         switch (dst_format) {
+         case UTIL_FORMAT_DXT1_RGB:
+            util_format_bc1_encode_block(block, rgba, false, quality);
+            break;
+         case UTIL_FORMAT_DXT1_RGBA:
+            util_format_bc1_encode_block(block, rgba, true, quality);
+            break;
+         case UTIL_FORMAT_DXT3_RGBA:
+            util_format_bc2_encode_block(block, rgba, quality);
+            break;
+         case UTIL_FORMAT_DXT5_RGBA:
+            util_format_bc3_encode_block(block, rgba, quality);
+            break;
+         }
+         block += block_size;
+      }
+      dst += dst_stride;
+   }
+}
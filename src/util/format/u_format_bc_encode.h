@@ -0,0 +1,91 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Block encoders for BC1-BC5 (S3TC and RGTC) used when textures are
+ * compressed by the CPU, e.g. on upload of an uncompressed image into a
+ * compressed internal format or when transcoding ETC/ASTC.
+ */
+
+#ifndef U_FORMAT_BC_ENCODE_H_
+#define U_FORMAT_BC_ENCODE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "util/format/u_format_s3tc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Trade-off between speed and quality of the CPU texture compressors,
+ * selected with MESA_TEXCOMPRESS_QUALITY=fast|normal|best.
+ *
+ * FAST fits the endpoints to the bounding box of the block.  NORMAL fits
+ * them to its principal axis, refines them by least squares and also tries
+ * the other BC7 modes.  BEST iterates the refinement, searches around the
+ * BC4 endpoints and tries all of the BC7 partitions.
+ */
+enum util_format_compress_quality {
+   UTIL_FORMAT_COMPRESS_FAST,
+   UTIL_FORMAT_COMPRESS_NORMAL,
+   UTIL_FORMAT_COMPRESS_BEST,
+};
+
+enum util_format_compress_quality
+util_format_get_compress_quality(void);
+
+void
+util_format_set_compress_quality(enum util_format_compress_quality quality);
+
+/**
+ * Encode a 4x4 block of RGBA8 texels, in row-major order, as a BC1 color
+ * block.  If \p punchthrough is set, texels with alpha below 128 are
+ * encoded as transparent black.
+ */
+void
+util_format_bc1_encode_block(uint8_t *dst, const uint8_t rgba[16][4],
+                             bool punchthrough,
+                             enum util_format_compress_quality quality);
+
+void
+util_format_bc2_encode_block(uint8_t *dst, const uint8_t rgba[16][4],
+                             enum util_format_compress_quality quality);
+
+void
+util_format_bc3_encode_block(uint8_t *dst, const uint8_t rgba[16][4],
+                             enum util_format_compress_quality quality);
+
+/** Encode 16 values as a BC4 block or the alpha half of a BC3 block. */
+void
+util_format_bc4_encode_block(uint8_t *dst, const uint8_t values[16],
+                             enum util_format_compress_quality quality);
+
+/**
+ * Encode a tightly packed image of \p src_comps (3 or 4) channels, with the
+ * interface of the DXTn compressor from libtxc_dxtn.  \p dst_stride is the
+ * size of a row of blocks, or 0 if they are packed.
+ */
+void
+util_format_dxtn_encode(int src_comps, int width, int height,
+                        const uint8_t *src, enum util_format_dxtn dst_format,
+                        uint8_t *dst, int dst_stride,
+                        enum util_format_compress_quality quality);
+
+/**
+ * Replacement for util_format_unsigned_encode_rgtc_ubyte() which honors the
+ * quality setting.
+ */
+void
+util_format_bc4_encode_ubyte(uint8_t *blkaddr, uint8_t srccolors[4][4],
+                             int numxpixels, int numypixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* U_FORMAT_BC_ENCODE_H_ */
@@ -750,3 +750,325 @@ def generate(formats):
 
                 generate_format_unpack(format, channel, native_type, suffix)
                 generate_format_pack(format, channel, native_type, suffix)
+
+
+def is_format_simd(format):
+    '''Whether generate_simd() has row kernels for the format: plain RGB
+    formats with four 8-bit UNORM (or padding) channels.'''
+
+    if format.layout != PLAIN or format.colorspace != RGB:
+        return False
+    if format.block_size() != 32 or format.nr_channels() == 0:
+        return False
+    for channel in format.le_channels:
+        if channel.size != 8:
+            return False
+        if channel.type != VOID and (channel.type != UNSIGNED or not channel.norm or channel.pure):
+            return False
+    return True
+
+
+def simd_shuffles(format):
+    '''Return the per-pixel pshufb masks of the unpack and pack directions,
+    the bytes to OR into unpacked 8unorm pixels and the indices of the
+    channels forced to one.'''
+
+    channels = format.le_channels
+    swizzles = format.le_swizzles
+
+    unpack = []
+    ones = []
+    for i in range(4):
+        swizzle = swizzles[i]
+        if swizzle < 4 and channels[swizzle].type != VOID:
+            unpack.append(channels[swizzle].shift // 8)
+        else:
+            unpack.append(0x80)
+            if swizzle == SWIZZLE_1:
+                ones.append(i)
+
+    inv_swizzle = inv_swizzles(swizzles)
+    pack = [0x80] * 4
+    for i in range(4):
+        if channels[i].type != VOID and inv_swizzle[i] is not None:
+            pack[channels[i].shift // 8] = inv_swizzle[i]
+
+    unpack_or = [0xff if i in ones else 0 for i in range(4)]
+
+    return unpack, pack, unpack_or, ones
+
+
+def print_simd_bytes(name, values, is_shuffle=True):
+    '''Print a 16-byte constant repeating a per-pixel pattern for 4 pixels.'''
+    values = [v + 4 * p if is_shuffle and v != 0x80 else v
+              for p in range(4) for v in values]
+    print('   static const uint8_t %s_bytes[16] = {' % name)
+    print('      %s,' % ', '.join('0x%02x' % v for v in values[0:8]))
+    print('      %s,' % ', '.join('0x%02x' % v for v in values[8:16]))
+    print('   };')
+
+
+simd_isas = {
+    'avx2': {
+        'vec': '__m256i',
+        'vecf': '__m256',
+        'prefix': '_mm256',
+        'bits': 256,
+        'broadcast': '_mm256_broadcastsi128_si256',
+    },
+    'avx512': {
+        'vec': '__m512i',
+        'vecf': '__m512',
+        'prefix': '_mm512',
+        'bits': 512,
+        'broadcast': '_mm512_broadcast_i32x4',
+    },
+}
+
+
+def generate_simd_helpers(isa):
+    '''Generate the vector equivalent of float_to_ubyte(): NaN and values
+    not above zero give 0, values of at least one give 255, and everything
+    in between goes through the same exact float math.'''
+
+    print('static inline %s' % ('__m256i' if isa == 'avx2' else '__m512i'))
+    if isa == 'avx2':
+        print('float_to_ubyte_avx2(__m256 f)')
+        print('{')
+        print('   __m256i bits = _mm256_castps_si256(')
+        print('      _mm256_add_ps(_mm256_mul_ps(f, _mm256_set1_ps(255.0f / 256.0f)),')
+        print('                    _mm256_set1_ps(32768.0f)));')
+        print('   __m256i ge_one = _mm256_castps_si256(')
+        print('      _mm256_cmp_ps(f, _mm256_set1_ps(1.0f), _CMP_GE_OQ));')
+        print('   __m256i gt_zero = _mm256_castps_si256(')
+        print('      _mm256_cmp_ps(f, _mm256_setzero_ps(), _CMP_GT_OQ));')
+        print()
+        print('   bits = _mm256_and_si256(_mm256_or_si256(bits, ge_one),')
+        print('                           _mm256_set1_epi32(0xff));')
+        print('   return _mm256_and_si256(bits, gt_zero);')
+    else:
+        print('float_to_ubyte_avx512(__m512 f)')
+        print('{')
+        print('   __m512i bits = _mm512_castps_si512(')
+        print('      _mm512_add_ps(_mm512_mul_ps(f, _mm512_set1_ps(255.0f / 256.0f)),')
+        print('                    _mm512_set1_ps(32768.0f)));')
+        print('   __mmask16 ge_one = _mm512_cmp_ps_mask(f, _mm512_set1_ps(1.0f), _CMP_GE_OQ);')
+        print('   __mmask16 gt_zero = _mm512_cmp_ps_mask(f, _mm512_setzero_ps(), _CMP_GT_OQ);')
+        print()
+        print('   bits = _mm512_and_si512(bits, _mm512_set1_epi32(0xff));')
+        print('   bits = _mm512_mask_mov_epi32(bits, ge_one, _mm512_set1_epi32(0xff));')
+        print('   return _mm512_maskz_mov_epi32(gt_zero, bits);')
+    print('}')
+    print()
+
+
+def generate_simd_unpack_8unorm(format, isa):
+    name = format.short_name()
+    v = simd_isas[isa]
+    pixels = v['bits'] // 32
+    unpack, pack, unpack_or, ones = simd_shuffles(format)
+    identity = unpack == [0, 1, 2, 3]
+
+    print('static void')
+    print('util_format_%s_unpack_rgba_8unorm_%s(uint8_t *restrict dst, const uint8_t *restrict src, unsigned width)' % (name, isa))
+    print('{')
+    if not identity:
+        print_simd_bytes('shuffle', unpack)
+    if ones:
+        print_simd_bytes('ones', unpack_or, False)
+    if not identity:
+        print('   const %s shuffle = %s(_mm_loadu_si128((const __m128i *)shuffle_bytes));' % (v['vec'], v['broadcast']))
+    if ones:
+        print('   const %s ones = %s(_mm_loadu_si128((const __m128i *)ones_bytes));' % (v['vec'], v['broadcast']))
+    print()
+    print('   while (width >= %u) {' % pixels)
+    print('      %s pixels = %s_loadu_si%u((const void *)src);' % (v['vec'], v['prefix'], v['bits']))
+    if not identity:
+        print('      pixels = %s_shuffle_epi8(pixels, shuffle);' % v['prefix'])
+    if ones:
+        print('      pixels = %s_or_si%u(pixels, ones);' % (v['prefix'], v['bits']))
+    print('      %s_storeu_si%u((void *)dst, pixels);' % (v['prefix'], v['bits']))
+    print('      width -= %u;' % pixels)
+    print('      src += %u;' % (pixels * 4))
+    print('      dst += %u;' % (pixels * 4))
+    print('   }')
+    print('   if (width)')
+    print('      util_format_%s_unpack_rgba_8unorm(dst, src, width);' % name)
+    print('}')
+    print()
+
+
+def generate_simd_unpack_float(format, isa):
+    name = format.short_name()
+    unpack, pack, unpack_or, ones = simd_shuffles(format)
+
+    print('static void')
+    print('util_format_%s_unpack_rgba_float_%s(void *restrict dst_row, const uint8_t *restrict src, unsigned width)' % (name, isa))
+    print('{')
+    print('   float *dst = dst_row;')
+    print_simd_bytes('shuffle', unpack)
+    print('   const __m128i shuffle = _mm_loadu_si128((const __m128i *)shuffle_bytes);')
+    if isa == 'avx2':
+        mask = sum(1 << (i + 4 * p) for i in ones for p in range(2))
+        print('   const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);')
+        if ones:
+            print('   const __m256 one = _mm256_set1_ps(1.0f);')
+        print()
+        print('   while (width >= 4) {')
+        print('      __m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);')
+        print('      __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(pixels));')
+        print('      __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(pixels, 8)));')
+        print('      lo = _mm256_mul_ps(lo, scale);')
+        print('      hi = _mm256_mul_ps(hi, scale);')
+        if ones:
+            print('      lo = _mm256_blend_ps(lo, one, 0x%02x);' % mask)
+            print('      hi = _mm256_blend_ps(hi, one, 0x%02x);' % mask)
+        print('      _mm256_storeu_ps(dst, lo);')
+        print('      _mm256_storeu_ps(dst + 8, hi);')
+    else:
+        mask = sum(1 << (i + 4 * p) for i in ones for p in range(4))
+        print('   const __m512 scale = _mm512_set1_ps(1.0f / 255.0f);')
+        if ones:
+            print('   const __m512 one = _mm512_set1_ps(1.0f);')
+        print()
+        print('   while (width >= 4) {')
+        print('      __m128i pixels = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);')
+        print('      __m512 rgba = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(pixels));')
+        print('      rgba = _mm512_mul_ps(rgba, scale);')
+        if ones:
+            print('      rgba = _mm512_mask_blend_ps(0x%04x, rgba, one);' % mask)
+        print('      _mm512_storeu_ps(dst, rgba);')
+    print('      width -= 4;')
+    print('      src += 16;')
+    print('      dst += 16;')
+    print('   }')
+    print('   if (width)')
+    print('      util_format_%s_unpack_rgba_float(dst, src, width);' % name)
+    print('}')
+    print()
+
+
+def generate_simd_pack_8unorm(format, isa):
+    name = format.short_name()
+    v = simd_isas[isa]
+    pixels = v['bits'] // 32
+    unpack, pack, unpack_or, ones = simd_shuffles(format)
+
+    print('static void')
+    print('util_format_%s_pack_rgba_8unorm_%s(uint8_t *restrict dst_row, unsigned dst_stride, const uint8_t *restrict src_row, unsigned src_stride, unsigned width, unsigned height)' % (name, isa))
+    print('{')
+    print_simd_bytes('shuffle', pack)
+    print('   const %s shuffle = %s(_mm_loadu_si128((const __m128i *)shuffle_bytes));' % (v['vec'], v['broadcast']))
+    print()
+    print('   for (unsigned y = 0; y < height; y++) {')
+    print('      const uint8_t *src = src_row;')
+    print('      uint8_t *dst = dst_row;')
+    print('      unsigned x;')
+    print()
+    print('      for (x = 0; x + %u <= width; x += %u) {' % (pixels, pixels))
+    print('         %s pixels = %s_loadu_si%u((const void *)src);' % (v['vec'], v['prefix'], v['bits']))
+    print('         %s_storeu_si%u((void *)dst, %s_shuffle_epi8(pixels, shuffle));' % (v['prefix'], v['bits'], v['prefix']))
+    print('         src += %u;' % (pixels * 4))
+    print('         dst += %u;' % (pixels * 4))
+    print('      }')
+    print('      if (x < width)')
+    print('         util_format_%s_pack_rgba_8unorm(dst, 0, src, 0, width - x, 1);' % name)
+    print('      dst_row += dst_stride;')
+    print('      src_row += src_stride;')
+    print('   }')
+    print('}')
+    print()
+
+
+def generate_simd_pack_float(format, isa):
+    name = format.short_name()
+    unpack, pack, unpack_or, ones = simd_shuffles(format)
+
+    print('static void')
+    print('util_format_%s_pack_rgba_float_%s(uint8_t *restrict dst_row, unsigned dst_stride, const float *restrict src_row, unsigned src_stride, unsigned width, unsigned height)' % (name, isa))
+    print('{')
+    print_simd_bytes('shuffle', pack)
+    print('   const __m128i shuffle = _mm_loadu_si128((const __m128i *)shuffle_bytes);')
+    print()
+    print('   for (unsigned y = 0; y < height; y++) {')
+    print('      const float *src = src_row;')
+    print('      uint8_t *dst = dst_row;')
+    print('      unsigned x;')
+    print()
+    print('      for (x = 0; x + 4 <= width; x += 4) {')
+    if isa == 'avx2':
+        print('         __m256i lo = float_to_ubyte_avx2(_mm256_loadu_ps(src));')
+        print('         __m256i hi = float_to_ubyte_avx2(_mm256_loadu_ps(src + 8));')
+        print('         /* packus works within 128-bit lanes, put the halves back in order. */')
+        print('         __m256i words = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xd8);')
+        print('         __m256i bytes = _mm256_packus_epi16(words, words);')
+        print('         __m128i rgba = _mm_unpacklo_epi64(_mm256_castsi256_si128(bytes),')
+        print('                                           _mm256_extracti128_si256(bytes, 1));')
+    else:
+        print('         __m128i rgba = _mm512_cvtepi32_epi8(float_to_ubyte_avx512(_mm512_loadu_ps(src)));')
+    print('         _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(rgba, shuffle));')
+    print('         src += 16;')
+    print('         dst += 16;')
+    print('      }')
+    print('      if (x < width)')
+    print('         util_format_%s_pack_rgba_float(dst, 0, src, 0, width - x, 1);' % name)
+    print('      dst_row += dst_stride;')
+    print('      src_row += src_stride / sizeof(*src_row);')
+    print('   }')
+    print('}')
+    print()
+
+
+def generate_simd(formats, isa):
+    '''Generate the row kernels and description tables of an x86 vector
+    extension.  Pixels left over at the end of a row go through the generic
+    functions, and the results are bit-exact with them.'''
+
+    simd_formats = [format for format in formats if is_format_simd(format)]
+    cap = {'avx2': 'has_avx2', 'avx512': 'has_avx512bw'}[isa]
+
+    print()
+    print('#include <immintrin.h>')
+    print()
+    print('#include "util/u_cpu_detect.h"')
+    print('#include "u_format_pack.h"')
+    print()
+
+    if simd_formats:
+        generate_simd_helpers(isa)
+
+    for format in simd_formats:
+        generate_simd_unpack_8unorm(format, isa)
+        generate_simd_unpack_float(format, isa)
+        generate_simd_pack_8unorm(format, isa)
+        generate_simd_pack_float(format, isa)
+
+    for type in ('unpack', 'pack'):
+        print('static const struct util_format_%s_description util_format_%s_descriptions_%s[] = {' % (type, type, isa))
+        for format in simd_formats:
+            sn = format.short_name()
+            print('   [%s] = {' % format.name)
+            print('      .%s_rgba_8unorm = &util_format_%s_%s_rgba_8unorm_%s,' % (type, sn, type, isa))
+            if type == 'unpack':
+                print('      .unpack_rgba = &util_format_%s_unpack_rgba_float_%s,' % (sn, isa))
+            else:
+                print('      .pack_rgba_float = &util_format_%s_pack_rgba_float_%s,' % (sn, isa))
+            print('   },')
+        print('};')
+        print()
+
+        print('const struct util_format_%s_description *' % type)
+        print('util_format_%s_description_%s(enum pipe_format format)' % (type, isa))
+        print('{')
+        print('   if (!util_get_cpu_caps()->%s)' % cap)
+        print('      return NULL;')
+        print()
+        print('   if (format >= ARRAY_SIZE(util_format_%s_descriptions_%s))' % (type, isa))
+        print('      return NULL;')
+        print()
+        print('   if (!util_format_%s_descriptions_%s[format].%s_rgba_8unorm)' % (type, isa, type))
+        print('      return NULL;')
+        print()
+        print('   return &util_format_%s_descriptions_%s[format];' % (type, isa))
+        print('}')
+        print()
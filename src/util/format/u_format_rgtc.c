@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include "util/format/u_format.h"
+#include "util/format/u_format_bc_encode.h"
 #include "util/format/u_format_rgtc.h"
 #include "util/u_math.h"
 #include "util/rgtc.h"
@@ -78,7 +79,7 @@ util_format_rgtc1_unorm_pack_rgba_8unorm(uint8_t *restrict dst_row, unsigned dst
 	       tmp[j][i] = src_row[(y + j)*src_stride/sizeof(*src_row) + (x + i)*4];
             }
          }
-         util_format_unsigned_encode_rgtc_ubyte(dst, tmp, 4, 4);
+         util_format_bc4_encode_ubyte(dst, tmp, 4, 4);
          dst += bytes_per_block;
       }
       dst_row += dst_stride / sizeof(*dst_row);
@@ -125,7 +126,7 @@ util_format_rgtc1_unorm_pack_rgba_float(uint8_t *restrict dst_row, unsigned dst_
 	       tmp[j][i] = float_to_ubyte(src_row[(y + j)*src_stride/sizeof(*src_row) + (x + i)*4]);
             }
          }
-         util_format_unsigned_encode_rgtc_ubyte(dst, tmp, 4, 4);
+         util_format_bc4_encode_ubyte(dst, tmp, 4, 4);
          dst += bytes_per_block;
       }
       dst_row += dst_stride / sizeof(*dst_row);
@@ -278,8 +279,8 @@ util_format_rgtc2_unorm_pack_rgba_8unorm(uint8_t *restrict dst_row, unsigned dst
 	       tmp_g[j][i] = src_row[((y + j)*src_stride/sizeof(*src_row) + (x + i)*4) + 1];
             }
          }
-         util_format_unsigned_encode_rgtc_ubyte(dst, tmp_r, 4, 4);
-         util_format_unsigned_encode_rgtc_ubyte(dst + 8, tmp_g, 4, 4);
+         util_format_bc4_encode_ubyte(dst, tmp_r, 4, 4);
+         util_format_bc4_encode_ubyte(dst + 8, tmp_g, 4, 4);
          dst += bytes_per_block;
       }
       dst_row += dst_stride / sizeof(*dst_row);
@@ -303,8 +304,8 @@ util_format_rxtc2_unorm_pack_rgba_float(uint8_t *restrict dst_row, unsigned dst_
                tmp_g[j][i] = float_to_ubyte(src_row[(y + j)*src_stride/sizeof(*src_row) + (x + i)*4 + chan2off]);
             }
          }
-         util_format_unsigned_encode_rgtc_ubyte(dst, tmp_r, 4, 4);
-         util_format_unsigned_encode_rgtc_ubyte(dst + 8, tmp_g, 4, 4);
+         util_format_bc4_encode_ubyte(dst, tmp_r, 4, 4);
+         util_format_bc4_encode_ubyte(dst + 8, tmp_g, 4, 4);
          dst += bytes_per_block;
       }
       dst_row += dst_stride / sizeof(*dst_row);
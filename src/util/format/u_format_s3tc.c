@@ -298,10 +298,13 @@ util_format_dxtn_pack_rgba_8unorm(uint8_t *restrict dst_row, unsigned dst_stride
       for(x = 0; x < width; x += bw) {
          uint8_t tmp[4][4][4];  /* [bh][bw][comps] */
          for(j = 0; j < bh; ++j) {
+            /* replicate the edge texels of partial blocks */
+            const uint8_t *src_row = src + MIN2(y + j, height - 1)*src_stride/sizeof(*src);
             for(i = 0; i < bw; ++i) {
+               const uint8_t *src_texel = src_row + MIN2(x + i, width - 1)*comps;
                uint8_t src_tmp;
                for(k = 0; k < 3; ++k) {
-                  src_tmp = src[(y + j)*src_stride/sizeof(*src) + (x+i)*comps + k];
+                  src_tmp = src_texel[k];
                   if (srgb) {
                      tmp[j][i][k] = util_format_linear_to_srgb_8unorm(src_tmp);
                   }
@@ -310,7 +313,7 @@ util_format_dxtn_pack_rgba_8unorm(uint8_t *restrict dst_row, unsigned dst_stride
                   }
                }
                /* for sake of simplicity there's an unneeded 4th component for dxt1_rgb */
-               tmp[j][i][3] = src[(y + j)*src_stride/sizeof(*src) + (x+i)*comps + 3];
+               tmp[j][i][3] = src_texel[3];
             }
          }
          /* even for dxt1_rgb have 4 src comps */
@@ -375,10 +378,13 @@ util_format_dxtn_pack_rgba_float(uint8_t *restrict dst_row, unsigned dst_stride,
       for(x = 0; x < width; x += 4) {
          uint8_t tmp[4][4][4];
          for(j = 0; j < 4; ++j) {
+            /* replicate the edge texels of partial blocks */
+            const float *src_row = src + MIN2(y + j, height - 1)*src_stride/sizeof(*src);
             for(i = 0; i < 4; ++i) {
+               const float *src_texel = src_row + MIN2(x + i, width - 1)*4;
                float src_tmp;
                for(k = 0; k < 3; ++k) {
-                  src_tmp = src[(y + j)*src_stride/sizeof(*src) + (x+i)*4 + k];
+                  src_tmp = src_texel[k];
                   if (srgb) {
                      tmp[j][i][k] = util_format_linear_float_to_srgb_8unorm(src_tmp);
                   }
@@ -387,7 +393,7 @@ util_format_dxtn_pack_rgba_float(uint8_t *restrict dst_row, unsigned dst_stride,
                   }
                }
                /* for sake of simplicity there's an unneeded 4th component for dxt1_rgb */
-               src_tmp = src[(y + j)*src_stride/sizeof(*src) + (x+i)*4 + 3];
+               src_tmp = src_texel[3];
                tmp[j][i][3] = float_to_ubyte(src_tmp);
             }
          }
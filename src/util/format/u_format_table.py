@@ -174,7 +174,7 @@ def write_format_table(formats):
 
     def generate_table_getter(type):
         suffix = ""
-        if type == "unpack_":
+        if type in ("pack_", "unpack_"):
             suffix = "_generic"
         print("const struct util_format_%sdescription *" % type)
         print("util_format_%sdescription%s(enum pipe_format format)" % (type, suffix))
@@ -307,8 +307,13 @@ def write_format_table(formats):
 
     generate_function_getter("fetch_rgba")
 
+def write_format_simd(formats, isa):
+    write_format_table_header(sys.stdout)
+    u_format_pack.generate_simd(formats, isa)
+
 def main():
     formats = []
+    simd = None
 
     sys.stdout2 = open(os.devnull, "w")
 
@@ -317,10 +322,16 @@ def main():
             sys.stdout2 = sys.stdout
             sys.stdout = open(os.devnull, "w")
             continue
+        if arg.startswith('--simd='):
+            simd = arg[len('--simd='):]
+            continue
 
         formats.extend(parse(arg))
 
-    write_format_table(formats)
+    if simd:
+        write_format_simd(formats, simd)
+    else:
+        write_format_table(formats)
 
 if __name__ == '__main__':
     main()
@@ -37,6 +37,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -44,6 +46,7 @@
 #include "hash_table.h"
 #include "mesa-sha1.h"
 #include "ralloc.h"
+#include "u_atomic.h"
 
 #define FOZ_REF_MAGIC_SIZE 16
 
@@ -169,8 +172,15 @@ update_foz_index(struct foz_db *foz_db, FILE *db_idx, unsigned file_idx)
       uint64_t key = strtoull(hash_str, NULL, 16);
 
       entry->offset = cache_offset;
+      entry->crc_checked = false;
+      entry->last_access = 0;
 
-      _mesa_hash_table_u64_insert(foz_db->index_db, key, entry);
+      /* Entries of the read-only dbs go to their own table, which is never
+       * modified after foz_prepare() and can thus be searched without mtx.
+       */
+      _mesa_hash_table_u64_insert(file_idx == 0 ? foz_db->index_db :
+                                                  foz_db->ro_index_db,
+                                  key, entry);
    }
 
 
@@ -195,6 +205,84 @@ static int lock_file_with_timeout(FILE *f, int64_t timeout)
    return err;
 }
 
+static uint64_t
+get_file_size(FILE *file)
+{
+   struct stat st;
+   if (fstat(fileno(file), &st) != 0)
+      return 0;
+
+   return st.st_size;
+}
+
+/* Returns true if the default db on disk is no longer the one we have open,
+ * which happens when another process compacted it.
+ */
+static bool
+default_db_replaced(struct foz_db *foz_db)
+{
+   struct stat path_st, fd_st;
+   if (stat(foz_db->filename, &path_st) != 0 ||
+       fstat(fileno(foz_db->file[0]), &fd_st) != 0)
+      return false;
+
+   return path_st.st_dev != fd_st.st_dev || path_st.st_ino != fd_st.st_ino;
+}
+
+/* Switch to new default db files and reload the index from them. Must be
+ * called with mtx held.
+ */
+static void
+swap_default_db(struct foz_db *foz_db, FILE *file, FILE *db_idx)
+{
+   util_dynarray_append(&foz_db->retired_files, FILE *, foz_db->file[0]);
+   fclose(foz_db->db_idx);
+
+   foz_db->file[0] = file;
+   foz_db->db_idx = db_idx;
+   p_atomic_set(&foz_db->size, get_file_size(file));
+
+   _mesa_hash_table_u64_clear(foz_db->index_db);
+   fseek(db_idx, FOZ_REF_MAGIC_SIZE, SEEK_SET);
+   update_foz_index(foz_db, db_idx, 0);
+}
+
+/* Take the flock on the default db, first switching over to the files on
+ * disk if they were replaced since we opened them. Must be called with
+ * flock_mtx held.
+ */
+static bool
+lock_default_db(struct foz_db *foz_db, int64_t timeout)
+{
+   while (true) {
+      FILE *file = foz_db->file[0];
+      if (lock_file_with_timeout(file, timeout) == -1)
+         return false;
+
+      if (!default_db_replaced(foz_db))
+         return true;
+
+      FILE *new_file = fopen(foz_db->filename, "a+b");
+      FILE *new_idx = fopen(foz_db->idx_filename, "a+b");
+      if (!check_files_opened_successfully(new_file, new_idx))
+         return true;
+
+      /* Not initialized yet, keep using the files we have. */
+      if (get_file_size(new_file) < FOZ_REF_MAGIC_SIZE ||
+          get_file_size(new_idx) < FOZ_REF_MAGIC_SIZE) {
+         fclose(new_file);
+         fclose(new_idx);
+         return true;
+      }
+
+      simple_mtx_lock(&foz_db->mtx);
+      swap_default_db(foz_db, new_file, new_idx);
+      simple_mtx_unlock(&foz_db->mtx);
+
+      flock(fileno(file), LOCK_UN);
+   }
+}
+
 static bool
 load_foz_dbs(struct foz_db *foz_db, FILE *db_idx, uint8_t file_idx,
              bool read_only)
@@ -261,6 +349,37 @@ fail:
    return false;
 }
 
+/* Map a read-only foz db into memory so entries can be returned without
+ * copying. If mapping fails we fall back to pread() on the file.
+ */
+static void
+map_foz_db(struct foz_db *foz_db, unsigned file_idx)
+{
+   int fd = fileno(foz_db->file[file_idx]);
+   struct stat st;
+
+   if (fstat(fd, &st) != 0 || st.st_size <= 0)
+      return;
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (map == MAP_FAILED)
+      return;
+
+   foz_db->map[file_idx] = map;
+   foz_db->map_size[file_idx] = st.st_size;
+}
+
+static void
+init_foz_db(struct foz_db *foz_db)
+{
+   simple_mtx_init(&foz_db->mtx, mtx_plain);
+   simple_mtx_init(&foz_db->flock_mtx, mtx_plain);
+   foz_db->mem_ctx = ralloc_context(NULL);
+   foz_db->index_db = _mesa_hash_table_u64_create(NULL);
+   foz_db->ro_index_db = _mesa_hash_table_u64_create(NULL);
+   util_dynarray_init(&foz_db->retired_files, foz_db->mem_ctx);
+}
+
 /* Here we open mesa cache foz dbs files. If the files exist we load the index
  * db into a hash table. The index db contains the offsets needed to later
  * read cache entries from the foz db containing the actual cache entries.
@@ -279,20 +398,24 @@ foz_prepare(struct foz_db *foz_db, char *cache_path)
    foz_db->file[0] = fopen(filename, "a+b");
    foz_db->db_idx = fopen(idx_filename, "a+b");
 
-   free(filename);
-   free(idx_filename);
-
-   if (!check_files_opened_successfully(foz_db->file[0], foz_db->db_idx))
+   if (!check_files_opened_successfully(foz_db->file[0], foz_db->db_idx)) {
+      free(filename);
+      free(idx_filename);
       return false;
+   }
 
-   simple_mtx_init(&foz_db->mtx, mtx_plain);
-   simple_mtx_init(&foz_db->flock_mtx, mtx_plain);
-   foz_db->mem_ctx = ralloc_context(NULL);
-   foz_db->index_db = _mesa_hash_table_u64_create(NULL);
+   init_foz_db(foz_db);
+   foz_db->filename = ralloc_strdup(foz_db->mem_ctx, filename);
+   foz_db->idx_filename = ralloc_strdup(foz_db->mem_ctx, idx_filename);
+
+   free(filename);
+   free(idx_filename);
 
    if (!load_foz_dbs(foz_db, foz_db->db_idx, 0, false))
       return false;
 
+   foz_db->size = get_file_size(foz_db->file[0]);
+
    uint8_t file_idx = 1;
    char *foz_dbs = getenv("MESA_DISK_CACHE_READ_ONLY_FOZ_DBS");
    if (!foz_dbs)
@@ -331,6 +454,7 @@ foz_prepare(struct foz_db *foz_db, char *cache_path)
       }
 
       fclose(db_idx);
+      map_foz_db(foz_db, file_idx);
       file_idx++;
 
       if (file_idx >= FOZ_MAX_DBS)
@@ -340,106 +464,293 @@ foz_prepare(struct foz_db *foz_db, char *cache_path)
    return true;
 }
 
+/* Open the single file cache in cache_path as a read-only db without a
+ * writable default db, for caches that are prebuilt and shared rather than
+ * written by us. Only the read functions may be used on it.
+ */
+bool
+foz_prepare_read_only(struct foz_db *foz_db, char *cache_path)
+{
+   char *filename = NULL;
+   char *idx_filename = NULL;
+   if (!create_foz_db_filenames(cache_path, "foz_cache", &filename, &idx_filename))
+      return false;
+
+   FILE *file = fopen(filename, "rb");
+   FILE *db_idx = fopen(idx_filename, "rb");
+
+   free(filename);
+   free(idx_filename);
+
+   if (!check_files_opened_successfully(file, db_idx))
+      return false;
+
+   init_foz_db(foz_db);
+   foz_db->file[1] = file;
+
+   /* On failure this has already destroyed the db. */
+   if (!load_foz_dbs(foz_db, db_idx, 1, true)) {
+      fclose(db_idx);
+      return false;
+   }
+
+   fclose(db_idx);
+   map_foz_db(foz_db, 1);
+
+   return true;
+}
+
 void
 foz_destroy(struct foz_db *foz_db)
 {
    if (foz_db->db_idx)
       fclose(foz_db->db_idx);
    for (unsigned i = 0; i < FOZ_MAX_DBS; i++) {
+      if (foz_db->map[i])
+         munmap((void *)foz_db->map[i], foz_db->map_size[i]);
       if (foz_db->file[i])
          fclose(foz_db->file[i]);
    }
 
    if (foz_db->mem_ctx) {
+      util_dynarray_foreach(&foz_db->retired_files, FILE *, file)
+         fclose(*file);
+
       _mesa_hash_table_u64_destroy(foz_db->index_db);
+      _mesa_hash_table_u64_destroy(foz_db->ro_index_db);
       ralloc_free(foz_db->mem_ctx);
       simple_mtx_destroy(&foz_db->flock_mtx);
       simple_mtx_destroy(&foz_db->mtx);
    }
 }
 
+/* Look up an entry of the read-only dbs. Their index never changes after
+ * foz_prepare() so no locking is required. The full 160bit key is checked
+ * for increased assurance against potential collisions.
+ */
+static struct foz_db_entry *
+lookup_ro_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit)
+{
+   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
+
+   struct foz_db_entry *entry =
+      _mesa_hash_table_u64_search(foz_db->ro_index_db, hash);
+   if (!entry || memcmp(entry->key, cache_key_160bit, sizeof(entry->key)))
+      return NULL;
+
+   return entry;
+}
+
+/* Return a pointer to the payload of an entry inside a mapped read-only db,
+ * or NULL if the db isn't mapped or the entry is invalid. The checksum is
+ * only verified the first time an entry is read.
+ */
+static const void *
+get_mapped_payload(struct foz_db *foz_db, struct foz_db_entry *entry,
+                   size_t *size)
+{
+   const uint8_t *map = foz_db->map[entry->file_idx];
+   size_t map_size = foz_db->map_size[entry->file_idx];
+   struct foz_payload_header header;
+
+   if (!map || entry->offset > map_size ||
+       map_size - entry->offset < sizeof(header))
+      return NULL;
+
+   memcpy(&header, map + entry->offset, sizeof(header));
+   if (header.payload_size > map_size - entry->offset - sizeof(header))
+      return NULL;
+
+   const void *data = map + entry->offset + sizeof(header);
+   if (!p_atomic_read(&entry->crc_checked)) {
+      if (header.crc != 0 &&
+          util_hash_crc32(data, header.payload_size) != header.crc)
+         return NULL;
+      p_atomic_set(&entry->crc_checked, true);
+   }
+
+   *size = header.payload_size;
+   return data;
+}
+
+/* Read an entry with pread() so that neither the FILE position nor mtx are
+ * involved, allowing any number of readers to run concurrently. The hash
+ * stored in front of the payload is checked as well, so an index that
+ * doesn't match the db file only results in a miss.
+ */
+static void *
+read_entry_from_file(FILE *file, uint64_t offset,
+                     const uint8_t *cache_key_160bit, size_t *size)
+{
+   int fd = fileno(file);
+   char bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(struct foz_payload_header)];
+   char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1];
+   struct foz_payload_header header;
+
+   if (offset < FOSSILIZE_BLOB_HASH_LENGTH ||
+       pread(fd, bytes_to_read, sizeof(bytes_to_read),
+             offset - FOSSILIZE_BLOB_HASH_LENGTH) != sizeof(bytes_to_read))
+      return NULL;
+
+   _mesa_sha1_format(hash_str, cache_key_160bit);
+   if (memcmp(hash_str, bytes_to_read, FOSSILIZE_BLOB_HASH_LENGTH))
+      return NULL;
+
+   memcpy(&header, &bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH], sizeof(header));
+
+   uint32_t data_sz = header.payload_size;
+   void *data = malloc(data_sz);
+   if (!data)
+      return NULL;
+
+   if (pread(fd, data, data_sz, offset + sizeof(header)) != data_sz)
+      goto fail;
+
+   /* verify checksum */
+   if (header.crc != 0) {
+      if (util_hash_crc32(data, data_sz) != header.crc)
+         goto fail;
+   }
+
+   *size = data_sz;
+   return data;
+
+fail:
+   free(data);
+   return NULL;
+}
+
 /* Here we lookup a cache entry in the index hash table. If an entry is found
  * we use the retrieved offset to read the cache entry from disk.
+ *
+ * The read-only dbs are searched first and without locking. For the default
+ * db mtx is only held for the index lookup, the payload is read outside it.
  */
 void *
 foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                size_t *size)
 {
    uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
-
+   size_t data_sz = 0;
    void *data = NULL;
 
    if (!foz_db->alive)
       return NULL;
 
-   simple_mtx_lock(&foz_db->mtx);
+   struct foz_db_entry *entry = lookup_ro_entry(foz_db, cache_key_160bit);
+   if (entry) {
+      if (foz_db->map[entry->file_idx]) {
+         const void *payload = get_mapped_payload(foz_db, entry, &data_sz);
+         if (!payload)
+            return NULL;
+
+         data = malloc(data_sz);
+         if (!data)
+            return NULL;
+         memcpy(data, payload, data_sz);
+      } else {
+         data = read_entry_from_file(foz_db->file[entry->file_idx],
+                                     entry->offset, cache_key_160bit,
+                                     &data_sz);
+      }
+   } else {
+      /* Dbs from foz_prepare_read_only() have no default db. */
+      if (!foz_db->db_idx)
+         return NULL;
+
+      simple_mtx_lock(&foz_db->mtx);
 
-   struct foz_db_entry *entry =
-      _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   if (!entry) {
-      update_foz_index(foz_db, foz_db->db_idx, 0);
       entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   }
-   if (!entry) {
-      simple_mtx_unlock(&foz_db->mtx);
-      return NULL;
-   }
+      if (!entry) {
+         update_foz_index(foz_db, foz_db->db_idx, 0);
+         entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
+      }
 
-   uint8_t file_idx = entry->file_idx;
-   if (fseek(foz_db->file[file_idx], entry->offset, SEEK_SET) < 0)
-      goto fail;
+      /* A compaction may replace file[0] once we drop the lock, but the old
+       * file is kept open until foz_destroy() so the offset remains valid.
+       */
+      FILE *file = foz_db->file[0];
+      uint64_t offset = entry ? entry->offset : 0;
+      bool match = entry && !memcmp(entry->key, cache_key_160bit,
+                                    sizeof(entry->key));
+      if (match)
+         entry->last_access = ++foz_db->access_counter;
 
-   uint32_t header_size = sizeof(struct foz_payload_header);
-   if (fread(&entry->header, 1, header_size, foz_db->file[file_idx]) !=
-       header_size)
-      goto fail;
+      simple_mtx_unlock(&foz_db->mtx);
 
-   /* Check for collision using full 160bit hash for increased assurance
-    * against potential collisions.
-    */
-   for (int i = 0; i < 20; i++) {
-      if (cache_key_160bit[i] != entry->key[i])
-         goto fail;
+      if (!match)
+         return NULL;
+
+      data = read_entry_from_file(file, offset, cache_key_160bit, &data_sz);
    }
 
-   uint32_t data_sz = entry->header.payload_size;
-   data = malloc(data_sz);
-   if (fread(data, 1, data_sz, foz_db->file[file_idx]) != data_sz)
-      goto fail;
+   if (data && size)
+      *size = data_sz;
 
-   /* verify checksum */
-   if (entry->header.crc != 0) {
-      if (util_hash_crc32(data, data_sz) != entry->header.crc)
-         goto fail;
-   }
+   return data;
+}
 
-   simple_mtx_unlock(&foz_db->mtx);
+/* Like foz_read_entry() but returns a pointer directly into a mapped
+ * read-only db instead of a copy. The pointer remains valid until
+ * foz_destroy(). Returns NULL if the entry isn't in a mapped db, in which
+ * case callers should fall back to foz_read_entry().
+ */
+const void *
+foz_read_entry_mapped(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                      size_t *size)
+{
+   if (!foz_db->alive)
+      return NULL;
 
-   if (size)
+   struct foz_db_entry *entry = lookup_ro_entry(foz_db, cache_key_160bit);
+   if (!entry)
+      return NULL;
+
+   size_t data_sz;
+   const void *data = get_mapped_payload(foz_db, entry, &data_sz);
+   if (data && size)
       *size = data_sz;
 
    return data;
+}
 
-fail:
-   free(data);
+/* Returns true if the entry is already in one of the dbs, or earlier in the
+ * batch being written. Must be called with mtx held.
+ */
+static bool
+is_entry_written(struct foz_db *foz_db, const struct foz_entry_data *entries,
+                 unsigned idx)
+{
+   uint64_t hash = truncate_hash_to_64bits(entries[idx].key);
 
-   /* reading db entry failed. reset the file offset */
-   simple_mtx_unlock(&foz_db->mtx);
+   if (_mesa_hash_table_u64_search(foz_db->index_db, hash) ||
+       _mesa_hash_table_u64_search(foz_db->ro_index_db, hash))
+      return true;
 
-   return NULL;
+   for (unsigned i = 0; i < idx; i++) {
+      if (!memcmp(entries[i].key, entries[idx].key, 20))
+         return true;
+   }
+
+   return false;
 }
 
-/* Here we write the cache entry to disk and store its offset in the index db.
+/* Here we write a batch of cache entries to disk and store their offsets in
+ * the index db. All entries are written under a single flock and the db and
+ * index are each flushed only once, after the entries of the batch have been
+ * written to them.
  */
 bool
-foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
-                const void *blob, size_t blob_size)
+foz_write_entries(struct foz_db *foz_db, const struct foz_entry_data *entries,
+                  unsigned num_entries)
 {
-   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
-
    if (!foz_db->alive)
       return false;
 
+   uint64_t *offsets = calloc(num_entries, sizeof(uint64_t));
+   if (!offsets)
+      return false;
+
    /* The flock is per-fd, not per thread, we do it outside of the main mutex to avoid having to
     * wait in the mutex potentially blocking reads. We use the secondary flock_mtx to stop race
     * conditions between the write threads sharing the same file descriptor. */
@@ -447,80 +758,107 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
 
    /* Wait for 1 second. This is done outside of the main mutex as I believe there is more potential
     * for file contention than mtx contention of significant length. */
-   int err = lock_file_with_timeout(foz_db->file[0], 1000000000);
-   if (err == -1)
+   if (!lock_default_db(foz_db, 1000000000))
       goto fail_file;
 
    simple_mtx_lock(&foz_db->mtx);
 
    update_foz_index(foz_db, foz_db->db_idx, 0);
 
-   struct foz_db_entry *entry =
-      _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   if (entry) {
-      simple_mtx_unlock(&foz_db->mtx);
-      flock(fileno(foz_db->file[0]), LOCK_UN);
-      simple_mtx_unlock(&foz_db->flock_mtx);
-      return NULL;
-   }
+   fseek(foz_db->file[0], 0, SEEK_END);
 
-   /* Prepare db entry header and blob ready for writing */
-   struct foz_payload_header header;
-   header.uncompressed_size = blob_size;
-   header.format = FOSSILIZE_COMPRESSION_NONE;
-   header.payload_size = blob_size;
-   header.crc = util_hash_crc32(blob, blob_size);
+   unsigned num_written = 0;
+   for (unsigned i = 0; i < num_entries; i++) {
+      const struct foz_entry_data *e = &entries[i];
+
+      if (is_entry_written(foz_db, entries, i))
+         continue;
+
+      /* Prepare db entry header and blob ready for writing */
+      struct foz_payload_header header;
+      header.uncompressed_size = e->size;
+      header.format = FOSSILIZE_COMPRESSION_NONE;
+      header.payload_size = e->size;
+      header.crc = util_hash_crc32(e->blob, e->size);
+
+      /* Write hash header to db */
+      char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; /* 40 digits + null */
+      _mesa_sha1_format(hash_str, e->key);
+      if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->file[0]) !=
+          FOSSILIZE_BLOB_HASH_LENGTH)
+         goto fail;
 
-   fseek(foz_db->file[0], 0, SEEK_END);
+      offsets[i] = ftell(foz_db->file[0]);
 
-   /* Write hash header to db */
-   char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; /* 40 digits + null */
-   _mesa_sha1_format(hash_str, cache_key_160bit);
-   if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->file[0]) !=
-       FOSSILIZE_BLOB_HASH_LENGTH)
-      goto fail;
+      /* Write db entry header */
+      if (fwrite(&header, 1, sizeof(header), foz_db->file[0]) != sizeof(header))
+         goto fail;
 
-   off_t offset = ftell(foz_db->file[0]);
+      /* Now write the db entry blob */
+      if (fwrite(e->blob, 1, e->size, foz_db->file[0]) != e->size)
+         goto fail;
 
-   /* Write db entry header */
-   if (fwrite(&header, 1, sizeof(header), foz_db->file[0]) != sizeof(header))
-      goto fail;
+      num_written++;
+   }
 
-   /* Now write the db entry blob */
-   if (fwrite(blob, 1, blob_size, foz_db->file[0]) != blob_size)
-      goto fail;
+   if (!num_written) {
+      free(offsets);
+      simple_mtx_unlock(&foz_db->mtx);
+      flock(fileno(foz_db->file[0]), LOCK_UN);
+      simple_mtx_unlock(&foz_db->flock_mtx);
+      return false;
+   }
 
    /* Flush everything to file to reduce chance of cache corruption */
    fflush(foz_db->file[0]);
+   p_atomic_set(&foz_db->size, ftell(foz_db->file[0]));
 
-   /* Write hash header to index db */
-   if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->db_idx) !=
-       FOSSILIZE_BLOB_HASH_LENGTH)
-      goto fail;
-
+   struct foz_payload_header header;
    header.uncompressed_size = sizeof(uint64_t);
    header.format = FOSSILIZE_COMPRESSION_NONE;
    header.payload_size = sizeof(uint64_t);
    header.crc = 0;
 
-   if (fwrite(&header, 1, sizeof(header), foz_db->db_idx) !=
-       sizeof(header))
-      goto fail;
+   for (unsigned i = 0; i < num_entries; i++) {
+      if (!offsets[i])
+         continue;
 
-   if (fwrite(&offset, 1, sizeof(uint64_t), foz_db->db_idx) !=
-       sizeof(uint64_t))
-      goto fail;
+      /* Write hash header to index db */
+      char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; /* 40 digits + null */
+      _mesa_sha1_format(hash_str, entries[i].key);
+      if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->db_idx) !=
+          FOSSILIZE_BLOB_HASH_LENGTH)
+         goto fail;
+
+      if (fwrite(&header, 1, sizeof(header), foz_db->db_idx) !=
+          sizeof(header))
+         goto fail;
+
+      if (fwrite(&offsets[i], 1, sizeof(uint64_t), foz_db->db_idx) !=
+          sizeof(uint64_t))
+         goto fail;
+   }
 
    /* Flush everything to file to reduce chance of cache corruption */
    fflush(foz_db->db_idx);
 
-   entry = ralloc(foz_db->mem_ctx, struct foz_db_entry);
-   entry->header = header;
-   entry->offset = offset;
-   entry->file_idx = 0;
-   _mesa_sha1_hex_to_sha1(entry->key, hash_str);
-   _mesa_hash_table_u64_insert(foz_db->index_db, hash, entry);
+   for (unsigned i = 0; i < num_entries; i++) {
+      if (!offsets[i])
+         continue;
+
+      struct foz_db_entry *entry = ralloc(foz_db->mem_ctx, struct foz_db_entry);
+      entry->header = header;
+      entry->offset = offsets[i];
+      entry->file_idx = 0;
+      entry->crc_checked = false;
+      entry->last_access = ++foz_db->access_counter;
+      memcpy(entry->key, entries[i].key, sizeof(entry->key));
+      _mesa_hash_table_u64_insert(foz_db->index_db,
+                                  truncate_hash_to_64bits(entries[i].key),
+                                  entry);
+   }
 
+   free(offsets);
    simple_mtx_unlock(&foz_db->mtx);
    flock(fileno(foz_db->file[0]), LOCK_UN);
    simple_mtx_unlock(&foz_db->flock_mtx);
@@ -530,10 +868,270 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
 fail:
    simple_mtx_unlock(&foz_db->mtx);
 fail_file:
+   free(offsets);
    flock(fileno(foz_db->file[0]), LOCK_UN);
    simple_mtx_unlock(&foz_db->flock_mtx);
    return false;
 }
+
+/* Here we write the cache entry to disk and store its offset in the index db.
+ */
+bool
+foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                const void *blob, size_t blob_size)
+{
+   struct foz_entry_data entry = {
+      .key = cache_key_160bit,
+      .blob = blob,
+      .size = blob_size,
+   };
+
+   return foz_write_entries(foz_db, &entry, 1);
+}
+
+struct foz_compact_entry {
+   uint8_t key[20];
+   uint64_t offset;
+   uint64_t last_access;
+   uint64_t size;                    /* hash + header + payload */
+};
+
+/* Most recently used first, then most recently written. */
+static int
+compare_by_recency(const void *a, const void *b)
+{
+   const struct foz_compact_entry *ea = a, *eb = b;
+
+   if (ea->last_access != eb->last_access)
+      return ea->last_access < eb->last_access ? 1 : -1;
+   if (ea->offset != eb->offset)
+      return ea->offset < eb->offset ? 1 : -1;
+   return 0;
+}
+
+static int
+compare_by_offset(const void *a, const void *b)
+{
+   const struct foz_compact_entry *ea = a, *eb = b;
+
+   if (ea->offset != eb->offset)
+      return ea->offset < eb->offset ? -1 : 1;
+   return 0;
+}
+
+static void
+add_compact_entry(struct foz_compact_entry *entries, unsigned *num_entries,
+                  struct foz_db_entry *entry)
+{
+   if (!entry)
+      return;
+
+   struct foz_compact_entry *e = &entries[(*num_entries)++];
+   memcpy(e->key, entry->key, sizeof(e->key));
+   e->offset = entry->offset;
+   e->last_access = entry->last_access;
+   e->size = 0;
+}
+
+/* Write the given entries of the default db into new db files. */
+static bool
+write_compacted_db(FILE *file, FILE *new_file, FILE *new_idx,
+                   struct foz_compact_entry *entries, unsigned num_entries)
+{
+   uint8_t *buf = NULL;
+   size_t buf_size = 0;
+
+   if (fwrite(stream_reference_magic_and_version, 1,
+              sizeof(stream_reference_magic_and_version), new_file) !=
+       sizeof(stream_reference_magic_and_version))
+      return false;
+
+   if (fwrite(stream_reference_magic_and_version, 1,
+              sizeof(stream_reference_magic_and_version), new_idx) !=
+       sizeof(stream_reference_magic_and_version))
+      return false;
+
+   uint64_t new_offset = sizeof(stream_reference_magic_and_version);
+   for (unsigned i = 0; i < num_entries; i++) {
+      struct foz_compact_entry *e = &entries[i];
+
+      if (e->size > buf_size) {
+         uint8_t *new_buf = realloc(buf, e->size);
+         if (!new_buf)
+            goto fail;
+         buf = new_buf;
+         buf_size = e->size;
+      }
+
+      /* Copy hash, header and payload in one go. */
+      if (pread(fileno(file), buf, e->size,
+                e->offset - FOSSILIZE_BLOB_HASH_LENGTH) != e->size)
+         goto fail;
+
+      if (fwrite(buf, 1, e->size, new_file) != e->size)
+         goto fail;
+
+      struct foz_payload_header header;
+      header.uncompressed_size = sizeof(uint64_t);
+      header.format = FOSSILIZE_COMPRESSION_NONE;
+      header.payload_size = sizeof(uint64_t);
+      header.crc = 0;
+
+      uint64_t offset = new_offset + FOSSILIZE_BLOB_HASH_LENGTH;
+      if (fwrite(buf, 1, FOSSILIZE_BLOB_HASH_LENGTH, new_idx) !=
+          FOSSILIZE_BLOB_HASH_LENGTH ||
+          fwrite(&header, 1, sizeof(header), new_idx) != sizeof(header) ||
+          fwrite(&offset, 1, sizeof(offset), new_idx) != sizeof(offset))
+         goto fail;
+
+      new_offset += e->size;
+   }
+
+   free(buf);
+   return fflush(new_file) == 0 && fflush(new_idx) == 0;
+
+fail:
+   free(buf);
+   return false;
+}
+
+/* Rewrite the default foz db keeping only the most recently used entries
+ * once it grows beyond max_size. Entries used by this process are ranked by
+ * their last access, all others by how recently they were written. The db is
+ * shrunk to half of max_size so that compactions stay infrequent.
+ *
+ * The new files are written next to the old ones and renamed over them while
+ * the flock of the old db is held. Other processes switch over to the new
+ * files the next time they take the flock for a write.
+ */
+void
+foz_compact(struct foz_db *foz_db, uint64_t max_size)
+{
+   struct foz_compact_entry *entries = NULL;
+   char *tmp_filename = NULL, *tmp_idx_filename = NULL;
+   FILE *new_file = NULL, *new_idx = NULL;
+
+   if (!foz_db->alive || p_atomic_read(&foz_db->size) <= max_size)
+      return;
+
+   simple_mtx_lock(&foz_db->flock_mtx);
+
+   if (!lock_default_db(foz_db, 1000000000)) {
+      simple_mtx_unlock(&foz_db->flock_mtx);
+      return;
+   }
+
+   /* Writers are now excluded, both in this and other processes, so the db
+    * can't change under us.
+    */
+   FILE *file = foz_db->file[0];
+   if (get_file_size(file) <= max_size)
+      goto out;
+
+   /* Only hold mtx while gathering the entries so readers aren't blocked
+    * while the db is rewritten.
+    */
+   simple_mtx_lock(&foz_db->mtx);
+   update_foz_index(foz_db, foz_db->db_idx, 0);
+
+   struct hash_table_u64 *index_db = foz_db->index_db;
+   unsigned num_entries = 0;
+   entries = malloc((_mesa_hash_table_num_entries(index_db->table) + 2) *
+                    sizeof(*entries));
+   if (!entries) {
+      simple_mtx_unlock(&foz_db->mtx);
+      goto out;
+   }
+
+   hash_table_foreach(index_db->table, he)
+      add_compact_entry(entries, &num_entries, he->data);
+   add_compact_entry(entries, &num_entries, index_db->freed_key_data);
+   add_compact_entry(entries, &num_entries, index_db->deleted_key_data);
+
+   simple_mtx_unlock(&foz_db->mtx);
+
+   for (unsigned i = 0; i < num_entries; i++) {
+      struct foz_payload_header header;
+      if (pread(fileno(file), &header, sizeof(header), entries[i].offset) ==
+          sizeof(header))
+         entries[i].size = FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header) +
+                           header.payload_size;
+   }
+
+   qsort(entries, num_entries, sizeof(*entries), compare_by_recency);
+
+   uint64_t kept_size = sizeof(stream_reference_magic_and_version);
+   unsigned num_kept = 0;
+   for (unsigned i = 0; i < num_entries; i++) {
+      if (!entries[i].size || kept_size + entries[i].size > max_size / 2)
+         continue;
+
+      kept_size += entries[i].size;
+      entries[num_kept++] = entries[i];
+   }
+
+   /* Keep the entries in write order, as that is all other processes can
+    * rank them by.
+    */
+   qsort(entries, num_kept, sizeof(*entries), compare_by_offset);
+
+   tmp_filename = ralloc_asprintf(NULL, "%s.tmp", foz_db->filename);
+   tmp_idx_filename = ralloc_asprintf(NULL, "%s.tmp", foz_db->idx_filename);
+
+   new_file = fopen(tmp_filename, "wb");
+   new_idx = fopen(tmp_idx_filename, "wb");
+   if (!check_files_opened_successfully(new_file, new_idx)) {
+      new_file = new_idx = NULL;
+      goto fail;
+   }
+
+   bool written = write_compacted_db(file, new_file, new_idx, entries,
+                                     num_kept);
+   fclose(new_file);
+   fclose(new_idx);
+   if (!written)
+      goto fail;
+
+   /* Rename the index first, readers verify the hash in the db file so a
+    * mismatched pair only results in misses.
+    */
+   if (rename(tmp_idx_filename, foz_db->idx_filename) != 0 ||
+       rename(tmp_filename, foz_db->filename) != 0)
+      goto fail;
+
+   new_file = fopen(foz_db->filename, "a+b");
+   new_idx = fopen(foz_db->idx_filename, "a+b");
+   if (!check_files_opened_successfully(new_file, new_idx))
+      goto out;
+
+   simple_mtx_lock(&foz_db->mtx);
+
+   swap_default_db(foz_db, new_file, new_idx);
+
+   /* Carry over the access order of the entries we kept. */
+   for (unsigned i = 0; i < num_kept; i++) {
+      struct foz_db_entry *entry =
+         _mesa_hash_table_u64_search(foz_db->index_db,
+                                     truncate_hash_to_64bits(entries[i].key));
+      if (entry)
+         entry->last_access = entries[i].last_access;
+   }
+
+   simple_mtx_unlock(&foz_db->mtx);
+
+out:
+   ralloc_free(tmp_filename);
+   ralloc_free(tmp_idx_filename);
+   free(entries);
+   flock(fileno(file), LOCK_UN);
+   simple_mtx_unlock(&foz_db->flock_mtx);
+   return;
+
+fail:
+   unlink(tmp_filename);
+   unlink(tmp_idx_filename);
+   goto out;
+}
 #else
 
 bool
@@ -545,6 +1143,12 @@ foz_prepare(struct foz_db *foz_db, char *filename)
    return false;
 }
 
+bool
+foz_prepare_read_only(struct foz_db *foz_db, char *cache_path)
+{
+   return false;
+}
+
 void
 foz_destroy(struct foz_db *foz_db)
 {
@@ -557,6 +1161,13 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    return false;
 }
 
+const void *
+foz_read_entry_mapped(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                      size_t *size)
+{
+   return NULL;
+}
+
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size)
@@ -564,4 +1175,16 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    return false;
 }
 
+bool
+foz_write_entries(struct foz_db *foz_db, const struct foz_entry_data *entries,
+                  unsigned num_entries)
+{
+   return false;
+}
+
+void
+foz_compact(struct foz_db *foz_db, uint64_t max_size)
+{
+}
+
 #endif
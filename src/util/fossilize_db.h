@@ -42,6 +42,7 @@
 #include <stdio.h>
 
 #include "simple_mtx.h"
+#include "u_dynarray.h"
 
 /* Max number of DBs our implementation can read from at once */
 #define FOZ_MAX_DBS 9 /* Default DB + 8 Read only DBs */
@@ -68,23 +69,52 @@ struct foz_payload_header {
 struct foz_db_entry {
    uint8_t file_idx;
    uint8_t key[20];
+   bool crc_checked;                 /* Payload crc verified, read-only dbs */
    uint64_t offset;
+   uint64_t last_access;             /* Access counter value, default db */
    struct foz_payload_header header;
 };
 
+/* A cache entry to be written by foz_write_entries(). */
+struct foz_entry_data {
+   const uint8_t *key;               /* 160bit cache key */
+   const void *blob;
+   size_t size;
+};
+
 struct foz_db {
    FILE *file[FOZ_MAX_DBS];          /* An array of all foz dbs */
    FILE *db_idx;                     /* The default writable foz db idx */
-   simple_mtx_t mtx;                 /* Mutex for file/hash table read/writes */
+   simple_mtx_t mtx;                 /* Mutex for default db hash table read/writes */
    simple_mtx_t flock_mtx;           /* Mutex for flocking the file for writes */
    void *mem_ctx;
-   struct hash_table_u64 *index_db;  /* Hash table of all foz db entries */
+   struct hash_table_u64 *index_db;  /* Hash table of default foz db entries */
+   char *filename;                   /* Path of the default foz db */
+   char *idx_filename;               /* Path of the default foz db idx */
+   uint64_t size;                    /* Size of the default foz db */
+   uint64_t access_counter;          /* Orders default db entries by use */
+
+   /* Default db files replaced by a compaction. They are kept open until
+    * foz_destroy() as readers may still be using them outside of mtx.
+    */
+   struct util_dynarray retired_files;
+
+   /* The read-only dbs never change once loaded, so their entries live in a
+    * separate hash table that is looked up without taking mtx, and their
+    * files are mapped into memory when possible.
+    */
+   struct hash_table_u64 *ro_index_db;
+   const uint8_t *map[FOZ_MAX_DBS];
+   size_t map_size[FOZ_MAX_DBS];
    bool alive;
 };
 
 bool
 foz_prepare(struct foz_db *foz_db, char *cache_path);
 
+bool
+foz_prepare_read_only(struct foz_db *foz_db, char *cache_path);
+
 void
 foz_destroy(struct foz_db *foz_db);
 
@@ -92,8 +122,19 @@ void *
 foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                size_t *size);
 
+const void *
+foz_read_entry_mapped(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+                      size_t *size);
+
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size);
 
+bool
+foz_write_entries(struct foz_db *foz_db, const struct foz_entry_data *entries,
+                  unsigned num_entries);
+
+void
+foz_compact(struct foz_db *foz_db, uint64_t max_size);
+
 #endif /* FOSSILIZE_DB_H */
@@ -33,7 +33,8 @@
  */
 
 /**
- * Implements an open-addressing, linear-reprobing hash table.
+ * Implements an open-addressing hash table, probing groups of entries with
+ * the control bytes described in hash_table_probe.h.
  *
  * For more information, see:
  *
@@ -45,6 +46,7 @@
 #include <assert.h>
 
 #include "hash_table.h"
+#include "hash_table_probe.h"
 #include "ralloc.h"
 #include "macros.h"
 #include "u_memory.h"
@@ -127,12 +129,6 @@ key_pointer_is_reserved(const struct hash_table *ht, const void *key)
    return key == NULL || key == ht->deleted_key;
 }
 
-static int
-entry_is_free(const struct hash_entry *entry)
-{
-   return entry->key == NULL;
-}
-
 static int
 entry_is_deleted(const struct hash_table *ht, struct hash_entry *entry)
 {
@@ -145,6 +141,20 @@ entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
    return entry->key != NULL && entry->key != ht->deleted_key;
 }
 
+static inline uint8_t *
+hash_table_ctrl(const struct hash_table *ht)
+{
+   return (uint8_t *)(ht->table + ht->size);
+}
+
+static struct hash_entry *
+hash_table_alloc_entries(void *mem_ctx, uint32_t size)
+{
+   return (struct hash_entry *)
+      rzalloc_size(mem_ctx,
+                   hash_probe_table_size(size, sizeof(struct hash_entry)));
+}
+
 bool
 _mesa_hash_table_init(struct hash_table *ht,
                       void *mem_ctx,
@@ -160,7 +170,7 @@ _mesa_hash_table_init(struct hash_table *ht,
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
+   ht->table = hash_table_alloc_entries(mem_ctx, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
    ht->deleted_key = &deleted_key_value;
@@ -222,13 +232,15 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+   size_t table_size = hash_probe_table_size(ht->size,
+                                             sizeof(struct hash_entry));
+   ht->table = (struct hash_entry *)ralloc_size(ht, table_size);
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table, table_size);
 
    return ht;
 }
@@ -257,7 +269,8 @@ _mesa_hash_table_destroy(struct hash_table *ht,
 static void
 hash_table_clear_fast(struct hash_table *ht)
 {
-   memset(ht->table, 0, sizeof(struct hash_entry) * hash_sizes[ht->size_index].size);
+   memset(ht->table, 0, hash_probe_table_size(ht->size,
+                                              sizeof(struct hash_entry)));
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -283,6 +296,7 @@ _mesa_hash_table_clear(struct hash_table *ht,
 
          entry->key = NULL;
       }
+      hash_ctrl_clear(hash_table_ctrl(ht), ht->size);
       ht->entries = 0;
       ht->deleted_entries = 0;
    } else
@@ -311,26 +325,27 @@ hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
    assert(!key_pointer_is_reserved(ht, key));
 
    uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
+   const uint8_t *ctrl = hash_table_ctrl(ht);
+   uint32_t mixed_hash = hash_probe_mix(hash);
+   uint8_t tag = hash_ctrl_tag(mixed_hash);
+   uint32_t pos = util_fast_urem32(mixed_hash, size, ht->size_magic);
 
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
+   for (uint32_t n = hash_probe_num_groups(size); n; n--) {
+      uint64_t match = hash_probe_match(ctrl + pos, tag);
 
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(ht, entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+      while (match) {
+         unsigned i = hash_probe_mask_next(&match);
+         struct hash_entry *entry = ht->table + hash_probe_index(pos, i, size);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
             return entry;
-         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_hash_address);
+      if (hash_probe_match(ctrl + pos, HASH_CTRL_FREE))
+         return NULL;
+
+      pos = hash_probe_next_group(pos, size);
+   }
 
    return NULL;
 }
@@ -365,24 +380,27 @@ hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
                          const void *key, void *data)
 {
    uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-
-      if (likely(entry->key == NULL)) {
+   uint8_t *ctrl = hash_table_ctrl(ht);
+   uint32_t mixed_hash = hash_probe_mix(hash);
+   uint32_t pos = util_fast_urem32(mixed_hash, size, ht->size_magic);
+
+   while (true) {
+      uint64_t match = hash_probe_match(ctrl + pos, HASH_CTRL_FREE);
+
+      if (likely(match)) {
+         uint32_t index =
+            hash_probe_index(pos, hash_probe_mask_next(&match), size);
+         struct hash_entry *entry = ht->table + index;
+
          entry->hash = hash;
          entry->key = key;
          entry->data = data;
+         hash_ctrl_set(ctrl, size, index, hash_ctrl_tag(mixed_hash));
          return;
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (true);
+      pos = hash_probe_next_group(pos, size);
+   }
 }
 
 static void
@@ -400,8 +418,8 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    if (new_size_index >= ARRAY_SIZE(hash_sizes))
       return;
 
-   table = rzalloc_array(ralloc_parent(ht->table), struct hash_entry,
-                         hash_sizes[new_size_index].size);
+   table = hash_table_alloc_entries(ralloc_parent(ht->table),
+                                    hash_sizes[new_size_index].size);
    if (table == NULL)
       return;
 
@@ -441,44 +459,53 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
    }
 
    uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-
-      if (!entry_is_present(ht, entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
+   uint8_t *ctrl = hash_table_ctrl(ht);
+   uint32_t mixed_hash = hash_probe_mix(hash);
+   uint8_t tag = hash_ctrl_tag(mixed_hash);
+   uint32_t pos = util_fast_urem32(mixed_hash, size, ht->size_magic);
+
+   for (uint32_t n = hash_probe_num_groups(size); n; n--) {
+      uint64_t match = hash_probe_match(ctrl + pos, tag);
+
+      while (match) {
+         unsigned i = hash_probe_mask_next(&match);
+         struct hash_entry *entry = ht->table + hash_probe_index(pos, i, size);
+
+         /* Implement replacement when another insert happens
+          * with a matching key.  This is a relatively common
+          * feature of hash tables, with the alternative
+          * generally being "insert the new value as well, and
+          * return it first when the key is searched for".
+          *
+          * Note that the hash table doesn't have a delete
+          * callback.  If freeing of old data pointers is
+          * required to avoid memory leaks, perform a search
+          * before inserting.
+          */
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key)) {
+            entry->key = key;
+            entry->data = data;
+            return entry;
+         }
       }
 
-      /* Implement replacement when another insert happens
-       * with a matching key.  This is a relatively common
-       * feature of hash tables, with the alternative
-       * generally being "insert the new value as well, and
-       * return it first when the key is searched for".
-       *
-       * Note that the hash table doesn't have a delete
-       * callback.  If freeing of old data pointers is
-       * required to avoid memory leaks, perform a search
-       * before inserting.
-       */
-      if (!entry_is_deleted(ht, entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         entry->key = key;
-         entry->data = data;
-         return entry;
+      uint64_t free_match = hash_probe_match(ctrl + pos, HASH_CTRL_FREE);
+
+      /* Stash the first available entry we find */
+      if (available_entry == NULL) {
+         uint64_t available = free_match |
+                              hash_probe_match(ctrl + pos, HASH_CTRL_DELETED);
+         if (available) {
+            unsigned i = hash_probe_mask_next(&available);
+            available_entry = ht->table + hash_probe_index(pos, i, size);
+         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_hash_address);
+      if (free_match)
+         break;
+
+      pos = hash_probe_next_group(pos, size);
+   }
 
    if (available_entry) {
       if (entry_is_deleted(ht, available_entry))
@@ -486,6 +513,7 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
       available_entry->hash = hash;
       available_entry->key = key;
       available_entry->data = data;
+      hash_ctrl_set(ctrl, size, available_entry - ht->table, tag);
       ht->entries++;
       return available_entry;
    }
@@ -531,6 +559,8 @@ _mesa_hash_table_remove(struct hash_table *ht,
       return;
 
    entry->key = ht->deleted_key;
+   hash_ctrl_set(hash_table_ctrl(ht), ht->size, entry - ht->table,
+                 HASH_CTRL_DELETED);
    ht->entries--;
    ht->deleted_entries++;
 }
@@ -553,6 +583,12 @@ struct hash_entry *
 _mesa_hash_table_next_entry_unsafe(const struct hash_table *ht, struct hash_entry *entry)
 {
    assert(!ht->deleted_entries);
+
+   /* hash_table_foreach_remove() clears the entries it has visited. */
+   if (entry && !entry->key)
+      hash_ctrl_set(hash_table_ctrl(ht), ht->size, entry - ht->table,
+                    HASH_CTRL_FREE);
+
    if (!ht->entries)
       return NULL;
    if (entry == NULL)
@@ -0,0 +1,160 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Control bytes of struct hash_table and struct set.
+ *
+ * Every entry of a table has a control byte, which is 0 for a free entry, 1
+ * for a deleted one, and the top 7 bits of the (scrambled) hash with the top
+ * bit set for an entry in use.  They are stored in an array following the
+ * entries, so that a probe can compare the control bytes of a group of 16
+ * consecutive entries at once (with SSE2 or NEON if available) and only
+ * looks at the entries whose hash may match.
+ *
+ * Entries are probed a group at a time, starting at the entry selected by
+ * the hash and moving on by one group size.  Table sizes are odd primes, so
+ * this visits every entry.  A probe ends at the first group with a free
+ * entry.  Deleted entries are only made free again when the table is
+ * rehashed or cleared.
+ *
+ * The control bytes of the first 15 entries are repeated after the last one
+ * (several times for tables smaller than a group), so that a group can start
+ * at any entry.
+ */
+
+#ifndef HASH_TABLE_PROBE_H
+#define HASH_TABLE_PROBE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bitscan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HASH_PROBE_SSE2 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HASH_PROBE_NEON 1
+#endif
+
+#define HASH_PROBE_GROUP_SIZE 16
+
+#define HASH_CTRL_FREE     0
+#define HASH_CTRL_DELETED  1
+
+/* log2 of the number of mask bits per entry of a group. */
+#ifdef HASH_PROBE_NEON
+#define HASH_PROBE_MASK_SHIFT 2
+#else
+#define HASH_PROBE_MASK_SHIFT 0
+#endif
+
+/**
+ * Scrambles a key hash before it is used to pick the first group and the
+ * control byte.  Hash functions like _mesa_hash_pointer() return close values
+ * for close keys with the same top bits, which would otherwise fill runs of
+ * consecutive entries with the same control byte.
+ */
+static inline uint32_t
+hash_probe_mix(uint32_t hash)
+{
+   return hash * 0x9e3779b1u;
+}
+
+static inline uint8_t
+hash_ctrl_tag(uint32_t mixed_hash)
+{
+   return 0x80 | (mixed_hash >> 25);
+}
+
+/**
+ * Size of the allocation holding the entries and control bytes of a table.
+ */
+static inline size_t
+hash_probe_table_size(uint32_t size, size_t entry_size)
+{
+   return size * entry_size + size + HASH_PROBE_GROUP_SIZE - 1;
+}
+
+static inline void
+hash_ctrl_set(uint8_t *ctrl, uint32_t size, uint32_t index, uint8_t value)
+{
+   ctrl[index] = value;
+   for (index += size; index < size + HASH_PROBE_GROUP_SIZE - 1; index += size)
+      ctrl[index] = value;
+}
+
+static inline void
+hash_ctrl_clear(uint8_t *ctrl, uint32_t size)
+{
+   memset(ctrl, HASH_CTRL_FREE, size + HASH_PROBE_GROUP_SIZE - 1);
+}
+
+/**
+ * Returns a mask of the entries of the group starting at ctrl whose control
+ * byte is value.  Walk it with hash_probe_mask_next().
+ */
+static inline uint64_t
+hash_probe_match(const uint8_t *ctrl, uint8_t value)
+{
+#if defined(HASH_PROBE_SSE2)
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group,
+                                                     _mm_set1_epi8(value)));
+#elif defined(HASH_PROBE_NEON)
+   uint8x16_t eq = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(value));
+   /* Narrow every byte to a nibble and keep one bit of it. */
+   uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+   return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) &
+          0x8888888888888888ull;
+#else
+   uint64_t mask = 0;
+   for (unsigned i = 0; i < HASH_PROBE_GROUP_SIZE; i++)
+      mask |= (uint64_t)(ctrl[i] == value) << i;
+   return mask;
+#endif
+}
+
+/**
+ * Returns the index in the group of the lowest entry of a non-zero mask and
+ * removes it from the mask.
+ */
+static inline unsigned
+hash_probe_mask_next(uint64_t *mask)
+{
+   unsigned i = (ffsll(*mask) - 1) >> HASH_PROBE_MASK_SHIFT;
+   *mask &= *mask - 1;
+   return i;
+}
+
+/**
+ * Index of the entry at offset i of the group starting at entry pos.
+ */
+static inline uint32_t
+hash_probe_index(uint32_t pos, unsigned i, uint32_t size)
+{
+   uint32_t index = pos + i;
+   while (index >= size)
+      index -= size;
+   return index;
+}
+
+static inline uint32_t
+hash_probe_next_group(uint32_t pos, uint32_t size)
+{
+   return hash_probe_index(pos, HASH_PROBE_GROUP_SIZE, size);
+}
+
+/**
+ * Number of groups after which a probe has seen every entry.
+ */
+static inline uint32_t
+hash_probe_num_groups(uint32_t size)
+{
+   return (size + HASH_PROBE_GROUP_SIZE - 1) / HASH_PROBE_GROUP_SIZE;
+}
+
+#endif /* HASH_TABLE_PROBE_H */
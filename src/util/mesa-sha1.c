@@ -25,9 +25,106 @@
  */
 
 #include "sha1/sha1.h"
+#include "sha1/sha1_accel.h"
 #include "mesa-sha1.h"
+#include "c11/threads.h"
+#include "macros.h"
+#include "u_cpu_detect.h"
 #include <string.h>
 
+typedef void (*sha1_transform_func)(uint32_t state[5], const uint8_t *data,
+                                    size_t num_blocks);
+
+static void
+sha1_transform_c(uint32_t state[5], const uint8_t *data, size_t num_blocks)
+{
+   for (; num_blocks; num_blocks--, data += SHA1_BLOCK_LENGTH)
+      SHA1Transform(state, data);
+}
+
+static sha1_transform_func sha1_transform = sha1_transform_c;
+static once_flag sha1_once_flag = ONCE_FLAG_INIT;
+
+static void
+sha1_select_transform(void)
+{
+   util_cpu_detect();
+
+#if defined(HAVE_SHA1_NI)
+   if (util_get_cpu_caps()->has_sha && util_get_cpu_caps()->has_sse4_1)
+      sha1_transform = _mesa_sha1_transform_ni;
+#elif defined(HAVE_SHA1_ARMV8)
+   if (util_get_cpu_caps()->has_sha)
+      sha1_transform = _mesa_sha1_transform_armv8;
+#endif
+}
+
+void
+_mesa_sha1_init(struct mesa_sha1 *ctx)
+{
+   call_once(&sha1_once_flag, sha1_select_transform);
+   SHA1Init(ctx);
+}
+
+/* Same as SHA1Update(), with the fastest block function. */
+void
+_mesa_sha1_update(struct mesa_sha1 *ctx, const void *data, size_t size)
+{
+   const uint8_t *bytes = (const uint8_t *)data;
+   size_t used = (ctx->count >> 3) & (SHA1_BLOCK_LENGTH - 1);
+
+   ctx->count += (uint64_t)size << 3;
+
+   if (used) {
+      size_t n = MIN2(size, SHA1_BLOCK_LENGTH - used);
+
+      memcpy(&ctx->buffer[used], bytes, n);
+      bytes += n;
+      size -= n;
+      used += n;
+
+      if (used < SHA1_BLOCK_LENGTH)
+         return;
+
+      sha1_transform(ctx->state, ctx->buffer, 1);
+   }
+
+   if (size >= SHA1_BLOCK_LENGTH) {
+      size_t num_blocks = size / SHA1_BLOCK_LENGTH;
+
+      sha1_transform(ctx->state, bytes, num_blocks);
+      bytes += num_blocks * SHA1_BLOCK_LENGTH;
+      size -= num_blocks * SHA1_BLOCK_LENGTH;
+   }
+
+   memcpy(ctx->buffer, bytes, size);
+}
+
+/* Same as SHA1Final(). */
+void
+_mesa_sha1_final(struct mesa_sha1 *ctx, unsigned char result[20])
+{
+   size_t used = (ctx->count >> 3) & (SHA1_BLOCK_LENGTH - 1);
+
+   ctx->buffer[used++] = 0x80;
+
+   if (used > SHA1_BLOCK_LENGTH - 8) {
+      memset(&ctx->buffer[used], 0, SHA1_BLOCK_LENGTH - used);
+      sha1_transform(ctx->state, ctx->buffer, 1);
+      used = 0;
+   }
+
+   memset(&ctx->buffer[used], 0, SHA1_BLOCK_LENGTH - 8 - used);
+   for (unsigned i = 0; i < 8; i++)
+      ctx->buffer[SHA1_BLOCK_LENGTH - 8 + i] = ctx->count >> ((7 - i) * 8);
+   sha1_transform(ctx->state, ctx->buffer, 1);
+
+   for (unsigned i = 0; i < SHA1_DIGEST_LENGTH; i++)
+      result[i] = ctx->state[i >> 2] >> ((3 - (i & 3)) * 8);
+
+   memset(ctx, 0, sizeof(*ctx));
+}
+
 void
 _mesa_sha1_compute(const void *data, size_t size, unsigned char result[20])
 {
@@ -57,9 +57,14 @@ __declspec(align(16))
 {
 #ifndef NDEBUG
    /* A canary value used to determine whether a pointer is ralloc'd. */
-   unsigned canary;
+   unsigned canary : 24;
 #endif
 
+   /* How the node was allocated, see ralloc_arena_context().  This fits in
+    * the padding required by the alignment of the header.
+    */
+   unsigned type : 2;
+
    struct ralloc_header *parent;
 
    /* The first child (head of a linked list) */
@@ -72,6 +77,12 @@ __declspec(align(16))
    void (*destructor)(void *);
 };
 
+enum {
+   RALLOC_TYPE_MALLOC,     /* a block of its own */
+   RALLOC_TYPE_ARENA_ROOT, /* an arena context, allocated with the arena */
+   RALLOC_TYPE_ARENA_NODE, /* carved out of an arena chunk */
+};
+
 typedef struct ralloc_header ralloc_header;
 
 static void unlink_block(ralloc_header *info);
@@ -101,6 +112,256 @@ add_child(ralloc_header *parent, ralloc_header *info)
    }
 }
 
+/***************************************************************************
+ * Arena contexts.
+ ***************************************************************************
+ *
+ * The children of an arena context and of its arena nodes are arena nodes,
+ * which are carved out of large chunks owned by the arena instead of being
+ * malloc'd one at a time.  They are regular ralloc nodes, except that each
+ * one is preceded by its arena, which it keeps when it is moved to another
+ * parent, and its size so that it can be resized.  The memory of an arena
+ * node is only returned when the whole arena is freed.
+ *
+ * As long as no arena node has a destructor or was moved out of the tree of
+ * its arena context, and no other node was moved into it, freeing the arena
+ * context simply frees the chunks.  Otherwise, the tree is walked to call the
+ * destructors and to free the other nodes, and the chunks are kept until the
+ * context and all the arena nodes moved out of its tree are freed.
+ */
+
+#define ARENA_MIN_CHUNK_SIZE (8 * 1024)
+#define ARENA_MAX_CHUNK_SIZE (1024 * 1024)
+
+struct arena_node_prefix
+{
+   struct ralloc_arena *arena;
+   size_t size;
+};
+
+/* Offset of the header of an arena node from the start of its block, which
+ * is no more than the alignment of the header on common ABIs.
+ */
+#define ARENA_NODE_OFFSET \
+   align64(sizeof(struct arena_node_prefix), alignof(ralloc_header))
+
+/* Offset of the header of an arena context from its arena. */
+#define ARENA_ROOT_OFFSET \
+   align64(sizeof(struct ralloc_arena), alignof(ralloc_header))
+
+/* Offset of the first block of a chunk, the chunk starts with a pointer to
+ * the next one.
+ */
+#define ARENA_CHUNK_OFFSET align64(sizeof(void *), alignof(ralloc_header))
+
+struct ralloc_arena
+{
+   /* The arena context, allocated with the arena. */
+   ralloc_header *root;
+
+   /* Singly-linked list of chunks. */
+   void *chunks;
+
+   /* Free space of the current chunk. */
+   char *next;
+   char *end;
+
+   size_t chunk_size;
+
+   /* Number of arena nodes which weren't freed, not counting the root. */
+   size_t num_nodes;
+
+   bool root_freed;
+
+   /* Whether the tree of the root must be walked to free it. */
+   bool needs_walk;
+};
+
+static struct arena_node_prefix *
+get_arena_node_prefix(const ralloc_header *info)
+{
+   assert(info->type == RALLOC_TYPE_ARENA_NODE);
+   return (struct arena_node_prefix *) (((char *) info) - ARENA_NODE_OFFSET);
+}
+
+/* Returns the arena whose memory holds the node, if any. */
+static struct ralloc_arena *
+get_arena(const ralloc_header *info)
+{
+   switch (info->type) {
+   case RALLOC_TYPE_ARENA_ROOT:
+      return (struct ralloc_arena *) (((char *) info) - ARENA_ROOT_OFFSET);
+   case RALLOC_TYPE_ARENA_NODE:
+      return get_arena_node_prefix(info)->arena;
+   default:
+      return NULL;
+   }
+}
+
+static size_t
+arena_block_size(size_t size)
+{
+   return align64(ARENA_NODE_OFFSET + sizeof(ralloc_header) + size,
+                  alignof(ralloc_header));
+}
+
+static char *
+arena_alloc_chunk(struct ralloc_arena *arena, size_t block_size)
+{
+   /* Large blocks get a chunk of their own rather than wasting what is left
+    * of the current one.
+    */
+   bool dedicated = block_size > ARENA_MAX_CHUNK_SIZE / 8;
+   size_t size = dedicated ? block_size : MAX2(arena->chunk_size, block_size);
+   char *chunk = malloc(ARENA_CHUNK_OFFSET + size);
+
+   if (unlikely(chunk == NULL))
+      return NULL;
+
+   *(void **) chunk = arena->chunks;
+   arena->chunks = chunk;
+
+   if (!dedicated) {
+      arena->next = chunk + ARENA_CHUNK_OFFSET + block_size;
+      arena->end = chunk + ARENA_CHUNK_OFFSET + size;
+      arena->chunk_size = MIN2(arena->chunk_size * 2, ARENA_MAX_CHUNK_SIZE);
+   }
+
+   return chunk + ARENA_CHUNK_OFFSET;
+}
+
+static ralloc_header *
+arena_alloc(struct ralloc_arena *arena, size_t size)
+{
+   size_t block_size = arena_block_size(size);
+   char *block;
+
+   if (likely(block_size <= (size_t) (arena->end - arena->next))) {
+      block = arena->next;
+      arena->next += block_size;
+   } else {
+      block = arena_alloc_chunk(arena, block_size);
+      if (unlikely(block == NULL))
+         return NULL;
+   }
+
+   ((struct arena_node_prefix *) block)->arena = arena;
+   ((struct arena_node_prefix *) block)->size = size;
+   arena->num_nodes++;
+
+   return (ralloc_header *) (block + ARENA_NODE_OFFSET);
+}
+
+static ralloc_header *
+arena_resize(ralloc_header *old, size_t size)
+{
+   struct arena_node_prefix *prefix = get_arena_node_prefix(old);
+   struct ralloc_arena *arena = prefix->arena;
+   char *block = (char *) prefix;
+   size_t old_size = prefix->size;
+   size_t old_block_size = arena_block_size(old_size);
+   size_t block_size = arena_block_size(size);
+   ralloc_header *info;
+
+   /* The last block of the current chunk can grow in place, which is the
+    * common case of strings and arrays being appended to.
+    */
+   if (block + old_block_size == arena->next &&
+       block_size <= (size_t) (arena->end - block)) {
+      arena->next = block + block_size;
+      prefix->size = size;
+      return old;
+   }
+
+   if (block_size <= old_block_size) {
+      prefix->size = size;
+      return old;
+   }
+
+   info = arena_alloc(arena, size);
+   if (unlikely(info == NULL))
+      return NULL;
+
+   /* The old block is simply abandoned. */
+   arena->num_nodes--;
+   memcpy(info, old, sizeof(ralloc_header) + old_size);
+   return info;
+}
+
+static void
+arena_destroy(struct ralloc_arena *arena)
+{
+   void *chunk = arena->chunks;
+
+   while (chunk != NULL) {
+      void *next = *(void **) chunk;
+      free(chunk);
+      chunk = next;
+   }
+
+   /* This also frees the root. */
+   free(arena);
+}
+
+/* Called when info is moved from its parent to parent. */
+static void
+arena_move(ralloc_header *info, ralloc_header *parent)
+{
+   struct ralloc_arena *from = info->type == RALLOC_TYPE_ARENA_NODE ?
+                               get_arena(info) : NULL;
+   struct ralloc_arena *to = parent != NULL ? get_arena(parent) : NULL;
+
+   if (from != to) {
+      if (from != NULL)
+         from->needs_walk = true;
+      if (to != NULL)
+         to->needs_walk = true;
+   }
+}
+
+void *
+ralloc_arena_context(const void *ctx)
+{
+   struct ralloc_arena *arena =
+      malloc(align64(ARENA_ROOT_OFFSET + sizeof(ralloc_header),
+                     alignof(ralloc_header)));
+   ralloc_header *info, *parent;
+
+   if (unlikely(arena == NULL))
+      return NULL;
+
+   info = (ralloc_header *) (((char *) arena) + ARENA_ROOT_OFFSET);
+   info->type = RALLOC_TYPE_ARENA_ROOT;
+   info->parent = NULL;
+   info->child = NULL;
+   info->prev = NULL;
+   info->next = NULL;
+   info->destructor = NULL;
+
+   arena->root = info;
+   arena->chunks = NULL;
+   arena->next = NULL;
+   arena->end = NULL;
+   arena->chunk_size = ARENA_MIN_CHUNK_SIZE;
+   arena->num_nodes = 0;
+   arena->root_freed = false;
+   arena->needs_walk = false;
+
+   parent = ctx != NULL ? get_header(ctx) : NULL;
+
+   /* A nested arena must be freed with its parent arena. */
+   if (parent != NULL && parent->type != RALLOC_TYPE_MALLOC)
+      get_arena(parent)->needs_walk = true;
+
+   add_child(parent, info);
+
+#ifndef NDEBUG
+   info->canary = CANARY;
+#endif
+
+   return PTR_FROM_HEADER(info);
+}
+
 void *
 ralloc_context(const void *ctx)
 {
@@ -110,22 +371,36 @@ ralloc_context(const void *ctx)
 void *
 ralloc_size(const void *ctx, size_t size)
 {
-   /* Some malloc allocation doesn't always align to 16 bytes even on 64 bits
-    * system, from Android bionic/tests/malloc_test.cpp:
-    *  - Allocations of a size that rounds up to a multiple of 16 bytes
-    *    must have at least 16 byte alignment.
-    *  - Allocations of a size that rounds up to a multiple of 8 bytes and
-    *    not 16 bytes, are only required to have at least 8 byte alignment.
-    */
-   void *block = malloc(align64(size + sizeof(ralloc_header),
-                                alignof(ralloc_header)));
    ralloc_header *info;
    ralloc_header *parent;
 
-   if (unlikely(block == NULL))
-      return NULL;
+   parent = ctx != NULL ? get_header(ctx) : NULL;
+
+   if (parent != NULL && parent->type != RALLOC_TYPE_MALLOC) {
+      info = arena_alloc(get_arena(parent), size);
+      if (unlikely(info == NULL))
+         return NULL;
+
+      info->type = RALLOC_TYPE_ARENA_NODE;
+   } else {
+      /* Some malloc allocation doesn't always align to 16 bytes even on 64
+       * bits system, from Android bionic/tests/malloc_test.cpp:
+       *  - Allocations of a size that rounds up to a multiple of 16 bytes
+       *    must have at least 16 byte alignment.
+       *  - Allocations of a size that rounds up to a multiple of 8 bytes and
+       *    not 16 bytes, are only required to have at least 8 byte
+       *    alignment.
+       */
+      void *block = malloc(align64(size + sizeof(ralloc_header),
+                                   alignof(ralloc_header)));
+
+      if (unlikely(block == NULL))
+         return NULL;
+
+      info = (ralloc_header *) block;
+      info->type = RALLOC_TYPE_MALLOC;
+   }
 
-   info = (ralloc_header *) block;
    /* measurements have shown that calloc is slower (because of
     * the multiplication overflow checking?), so clear things
     * manually
@@ -136,8 +411,6 @@ ralloc_size(const void *ctx, size_t size)
    info->next = NULL;
    info->destructor = NULL;
 
-   parent = ctx != NULL ? get_header(ctx) : NULL;
-
    add_child(parent, info);
 
 #ifndef NDEBUG
@@ -165,8 +438,15 @@ resize(void *ptr, size_t size)
    ralloc_header *child, *old, *info;
 
    old = get_header(ptr);
-   info = realloc(old, align64(size + sizeof(ralloc_header),
-                               alignof(ralloc_header)));
+
+   /* The root of an arena is allocated with the arena. */
+   assert(old->type != RALLOC_TYPE_ARENA_ROOT);
+
+   if (old->type == RALLOC_TYPE_ARENA_NODE)
+      info = arena_resize(old, size);
+   else
+      info = realloc(old, align64(size + sizeof(ralloc_header),
+                                  alignof(ralloc_header)));
 
    if (info == NULL)
       return NULL;
@@ -287,8 +567,21 @@ unlink_block(ralloc_header *info)
 static void
 unsafe_free(ralloc_header *info)
 {
-   /* Recursively free any children...don't waste time unlinking them. */
+   struct ralloc_arena *arena = get_arena(info);
    ralloc_header *temp;
+
+   /* The whole tree of the arena context is made of arena nodes, which
+    * don't need to be visited.
+    */
+   if (arena != NULL && info == arena->root && !arena->needs_walk) {
+      if (info->destructor != NULL)
+         info->destructor(PTR_FROM_HEADER(info));
+
+      arena_destroy(arena);
+      return;
+   }
+
+   /* Recursively free any children...don't waste time unlinking them. */
    while (info->child != NULL) {
       temp = info->child;
       info->child = temp->next;
@@ -299,7 +592,18 @@ unsafe_free(ralloc_header *info)
    if (info->destructor != NULL)
       info->destructor(PTR_FROM_HEADER(info));
 
-   free(info);
+   if (arena == NULL) {
+      free(info);
+      return;
+   }
+
+   if (info == arena->root)
+      arena->root_freed = true;
+   else
+      arena->num_nodes--;
+
+   if (arena->root_freed && arena->num_nodes == 0)
+      arena_destroy(arena);
 }
 
 void
@@ -315,6 +619,7 @@ ralloc_steal(const void *new_ctx, void *ptr)
 
    unlink_block(info);
 
+   arena_move(info, parent);
    add_child(parent, info);
 }
 
@@ -335,8 +640,10 @@ ralloc_adopt(const void *new_ctx, void *old_ctx)
 
    /* Set all the children's parent to new_ctx; get a pointer to the last child. */
    for (child = old_info->child; child->next != NULL; child = child->next) {
+      arena_move(child, new_info);
       child->parent = new_info;
    }
+   arena_move(child, new_info);
    child->parent = new_info;
 
    /* Connect the two lists together; parent them to new_ctx; make old_ctx empty. */
@@ -363,6 +670,10 @@ void
 ralloc_set_destructor(const void *ptr, void(*destructor)(void *))
 {
    ralloc_header *info = get_header(ptr);
+
+   if (destructor != NULL && info->type == RALLOC_TYPE_ARENA_NODE)
+      get_arena(info)->needs_walk = true;
+
    info->destructor = destructor;
 }
 
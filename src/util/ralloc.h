@@ -91,6 +91,23 @@ extern "C" {
  */
 void *ralloc_context(const void *ctx);
 
+/**
+ * Allocate a new arena context.
+ *
+ * Allocations chained off of an arena context, directly or through other
+ * such allocations, are carved out of large chunks owned by the arena.  This
+ * makes them cheaper, and freeing the arena context frees them all at once
+ * without visiting each of them, unless destructors were set on them or
+ * allocations were stolen into or out of the arena.
+ *
+ * The memory of an allocation of the arena is only returned to the system
+ * with the arena.  This is meant for trees which are freed as a whole, not
+ * for long-lived contexts which accumulate garbage.
+ *
+ * An arena context cannot be resized.
+ */
+void *ralloc_arena_context(const void *ctx);
+
 /**
  * Allocate memory chained off of the given context.
  *
@@ -37,6 +37,7 @@
 #include <string.h>
 
 #include "hash_table.h"
+#include "hash_table_probe.h"
 #include "macros.h"
 #include "ralloc.h"
 #include "set.h"
@@ -98,12 +99,6 @@ key_pointer_is_reserved(const void *key)
    return key == NULL || key == deleted_key;
 }
 
-static int
-entry_is_free(struct set_entry *entry)
-{
-   return entry->key == NULL;
-}
-
 static int
 entry_is_deleted(struct set_entry *entry)
 {
@@ -116,6 +111,20 @@ entry_is_present(struct set_entry *entry)
    return entry->key != NULL && entry->key != deleted_key;
 }
 
+static inline uint8_t *
+set_ctrl(const struct set *ht)
+{
+   return (uint8_t *)(ht->table + ht->size);
+}
+
+static struct set_entry *
+set_alloc_entries(void *mem_ctx, uint32_t size)
+{
+   return (struct set_entry *)
+      rzalloc_size(mem_ctx, hash_probe_table_size(size,
+                                                  sizeof(struct set_entry)));
+}
+
 bool
 _mesa_set_init(struct set *ht, void *mem_ctx,
                  uint32_t (*key_hash_function)(const void *key),
@@ -130,7 +139,7 @@ _mesa_set_init(struct set *ht, void *mem_ctx,
    ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct set_entry, ht->size);
+   ht->table = set_alloc_entries(mem_ctx, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
 
@@ -188,13 +197,15 @@ _mesa_set_clone(struct set *set, void *dst_mem_ctx)
 
    memcpy(clone, set, sizeof(struct set));
 
-   clone->table = ralloc_array(clone, struct set_entry, clone->size);
+   size_t table_size = hash_probe_table_size(clone->size,
+                                             sizeof(struct set_entry));
+   clone->table = (struct set_entry *)ralloc_size(clone, table_size);
    if (clone->table == NULL) {
       ralloc_free(clone);
       return NULL;
    }
 
-   memcpy(clone->table, set->table, clone->size * sizeof(struct set_entry));
+   memcpy(clone->table, set->table, table_size);
 
    return clone;
 }
@@ -224,7 +235,8 @@ _mesa_set_destroy(struct set *ht, void (*delete_function)(struct set_entry *entr
 static void
 set_clear_fast(struct set *ht)
 {
-   memset(ht->table, 0, sizeof(struct set_entry) * hash_sizes[ht->size_index].size);
+   memset(ht->table, 0, hash_probe_table_size(ht->size,
+                                              sizeof(struct set_entry)));
    ht->entries = ht->deleted_entries = 0;
 }
 
@@ -249,6 +261,7 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
 
          entry->key = NULL;
       }
+      hash_ctrl_clear(set_ctrl(set), set->size);
       set->entries = 0;
       set->deleted_entries = 0;
    } else
@@ -266,25 +279,27 @@ set_search(const struct set *ht, uint32_t hash, const void *key)
    assert(!key_pointer_is_reserved(key));
 
    uint32_t size = ht->size;
-   uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
-                                           ht->rehash_magic) + 1;
-   uint32_t hash_address = start_address;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+   const uint8_t *ctrl = set_ctrl(ht);
+   uint32_t mixed_hash = hash_probe_mix(hash);
+   uint8_t tag = hash_ctrl_tag(mixed_hash);
+   uint32_t pos = util_fast_urem32(mixed_hash, size, ht->size_magic);
+
+   for (uint32_t n = hash_probe_num_groups(size); n; n--) {
+      uint64_t match = hash_probe_match(ctrl + pos, tag);
+
+      while (match) {
+         unsigned i = hash_probe_mask_next(&match);
+         struct set_entry *entry = ht->table + hash_probe_index(pos, i, size);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
             return entry;
-         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_address);
+      if (hash_probe_match(ctrl + pos, HASH_CTRL_FREE))
+         return NULL;
+
+      pos = hash_probe_next_group(pos, size);
+   }
 
    return NULL;
 }
@@ -309,22 +324,26 @@ static void
 set_add_rehash(struct set *ht, uint32_t hash, const void *key)
 {
    uint32_t size = ht->size;
-   uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
-                                           ht->rehash_magic) + 1;
-   uint32_t hash_address = start_address;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-      if (likely(entry->key == NULL)) {
+   uint8_t *ctrl = set_ctrl(ht);
+   uint32_t mixed_hash = hash_probe_mix(hash);
+   uint32_t pos = util_fast_urem32(mixed_hash, size, ht->size_magic);
+
+   while (true) {
+      uint64_t match = hash_probe_match(ctrl + pos, HASH_CTRL_FREE);
+
+      if (likely(match)) {
+         uint32_t index =
+            hash_probe_index(pos, hash_probe_mask_next(&match), size);
+         struct set_entry *entry = ht->table + index;
+
          entry->hash = hash;
          entry->key = key;
+         hash_ctrl_set(ctrl, size, index, hash_ctrl_tag(mixed_hash));
          return;
       }
 
-      hash_address = hash_address + double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (true);
+      pos = hash_probe_next_group(pos, size);
+   }
 }
 
 static void
@@ -342,8 +361,8 @@ set_rehash(struct set *ht, unsigned new_size_index)
    if (new_size_index >= ARRAY_SIZE(hash_sizes))
       return;
 
-   table = rzalloc_array(ralloc_parent(ht->table), struct set_entry,
-                         hash_sizes[new_size_index].size);
+   table = set_alloc_entries(ralloc_parent(ht->table),
+                             hash_sizes[new_size_index].size);
    if (table == NULL)
       return;
 
@@ -403,33 +422,42 @@ set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
    }
 
    uint32_t size = ht->size;
-   uint32_t start_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = util_fast_urem32(hash, ht->rehash,
-                                           ht->rehash_magic) + 1;
-   uint32_t hash_address = start_address;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-
-      if (!entry_is_present(entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
+   uint8_t *ctrl = set_ctrl(ht);
+   uint32_t mixed_hash = hash_probe_mix(hash);
+   uint8_t tag = hash_ctrl_tag(mixed_hash);
+   uint32_t pos = util_fast_urem32(mixed_hash, size, ht->size_magic);
+
+   for (uint32_t n = hash_probe_num_groups(size); n; n--) {
+      uint64_t match = hash_probe_match(ctrl + pos, tag);
+
+      while (match) {
+         unsigned i = hash_probe_mask_next(&match);
+         struct set_entry *entry = ht->table + hash_probe_index(pos, i, size);
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key)) {
+            if (found)
+               *found = true;
+            return entry;
+         }
       }
 
-      if (!entry_is_deleted(entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         if (found)
-            *found = true;
-         return entry;
+      uint64_t free_match = hash_probe_match(ctrl + pos, HASH_CTRL_FREE);
+
+      /* Stash the first available entry we find */
+      if (available_entry == NULL) {
+         uint64_t available = free_match |
+                              hash_probe_match(ctrl + pos, HASH_CTRL_DELETED);
+         if (available) {
+            unsigned i = hash_probe_mask_next(&available);
+            available_entry = ht->table + hash_probe_index(pos, i, size);
+         }
       }
 
-      hash_address = hash_address + double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_address);
+      if (free_match)
+         break;
+
+      pos = hash_probe_next_group(pos, size);
+   }
 
    if (available_entry) {
       /* There is no matching entry, create it. */
@@ -437,6 +465,7 @@ set_search_or_add(struct set *ht, uint32_t hash, const void *key, bool *found)
          ht->deleted_entries--;
       available_entry->hash = hash;
       available_entry->key = key;
+      hash_ctrl_set(ctrl, size, available_entry - ht->table, tag);
       ht->entries++;
       if (found)
          *found = false;
@@ -547,6 +576,7 @@ _mesa_set_remove(struct set *ht, struct set_entry *entry)
       return;
 
    entry->key = deleted_key;
+   hash_ctrl_set(set_ctrl(ht), ht->size, entry - ht->table, HASH_CTRL_DELETED);
    ht->entries--;
    ht->deleted_entries++;
 }
@@ -569,6 +599,11 @@ struct set_entry *
 _mesa_set_next_entry_unsafe(const struct set *ht, struct set_entry *entry)
 {
    assert(!ht->deleted_entries);
+
+   /* set_foreach_remove() clears the entries it has visited. */
+   if (entry && !entry->key)
+      hash_ctrl_set(set_ctrl(ht), ht->size, entry - ht->table, HASH_CTRL_FREE);
+
    if (!ht->entries)
       return NULL;
    if (entry == NULL)
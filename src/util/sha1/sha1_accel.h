@@ -0,0 +1,35 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * SHA-1 block functions using the SHA instructions of x86 and ARMv8.
+ *
+ * They process num_blocks consecutive blocks of SHA1_BLOCK_LENGTH bytes,
+ * like calling SHA1Transform() on each of them, and may only be called when
+ * util_cpu_caps reports the instructions.
+ */
+
+#ifndef SHA1_ACCEL_H
+#define SHA1_ACCEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+_mesa_sha1_transform_ni(uint32_t state[5], const uint8_t *data,
+                        size_t num_blocks);
+
+void
+_mesa_sha1_transform_armv8(uint32_t state[5], const uint8_t *data,
+                           size_t num_blocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHA1_ACCEL_H */
@@ -0,0 +1,83 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with -march=armv8-a+crypto, see sha1_accel.h. */
+
+#include <arm_neon.h>
+
+#include "sha1_accel.h"
+
+/* Four rounds using the message words of tmp_cur, computing the words of two
+ * groups later into tmp_cur.  m0-m3 are the message words of this group and
+ * the next three ones: m0 receives the first step of the words of four
+ * groups later and m3, holding those of the previous group, the last one of
+ * the words of three groups later.
+ */
+#define ROUNDS4(op, e_cur, e_next, tmp_cur, k_next, m0, m1, m2, m3)   \
+   e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));                      \
+   abcd = op(abcd, e_cur, tmp_cur);                                   \
+   tmp_cur = vaddq_u32(m2, k_next);                                   \
+   m3 = vsha1su1q_u32(m3, m2);                                        \
+   m0 = vsha1su0q_u32(m0, m1, m2)
+
+void
+_mesa_sha1_transform_armv8(uint32_t state[5], const uint8_t *data,
+                           size_t num_blocks)
+{
+   const uint32x4_t k0 = vdupq_n_u32(0x5a827999);
+   const uint32x4_t k1 = vdupq_n_u32(0x6ed9eba1);
+   const uint32x4_t k2 = vdupq_n_u32(0x8f1bbcdc);
+   const uint32x4_t k3 = vdupq_n_u32(0xca62c1d6);
+   uint32x4_t abcd = vld1q_u32(state);
+   uint32_t e0 = state[4], e1;
+
+   for (; num_blocks; num_blocks--, data += 64) {
+      const uint32x4_t abcd_save = abcd;
+      const uint32_t e_save = e0;
+      uint32x4_t msg0, msg1, msg2, msg3, tmp0, tmp1;
+
+      msg0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data)));
+      msg1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+      msg2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+      msg3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+      tmp0 = vaddq_u32(msg0, k0);
+      tmp1 = vaddq_u32(msg1, k0);
+
+      /* Rounds 0-3, before the first words of the schedule are complete. */
+      e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+      abcd = vsha1cq_u32(abcd, e0, tmp0);
+      tmp0 = vaddq_u32(msg2, k0);
+      msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+
+      /* Rounds 4-79.  The schedule updates of the last groups are dead. */
+      ROUNDS4(vsha1cq_u32, e1, e0, tmp1, k0, msg1, msg2, msg3, msg0);
+      ROUNDS4(vsha1cq_u32, e0, e1, tmp0, k0, msg2, msg3, msg0, msg1);
+      ROUNDS4(vsha1cq_u32, e1, e0, tmp1, k1, msg3, msg0, msg1, msg2);
+      ROUNDS4(vsha1cq_u32, e0, e1, tmp0, k1, msg0, msg1, msg2, msg3);
+      ROUNDS4(vsha1pq_u32, e1, e0, tmp1, k1, msg1, msg2, msg3, msg0);
+      ROUNDS4(vsha1pq_u32, e0, e1, tmp0, k1, msg2, msg3, msg0, msg1);
+      ROUNDS4(vsha1pq_u32, e1, e0, tmp1, k1, msg3, msg0, msg1, msg2);
+      ROUNDS4(vsha1pq_u32, e0, e1, tmp0, k2, msg0, msg1, msg2, msg3);
+      ROUNDS4(vsha1pq_u32, e1, e0, tmp1, k2, msg1, msg2, msg3, msg0);
+      ROUNDS4(vsha1mq_u32, e0, e1, tmp0, k2, msg2, msg3, msg0, msg1);
+      ROUNDS4(vsha1mq_u32, e1, e0, tmp1, k2, msg3, msg0, msg1, msg2);
+      ROUNDS4(vsha1mq_u32, e0, e1, tmp0, k2, msg0, msg1, msg2, msg3);
+      ROUNDS4(vsha1mq_u32, e1, e0, tmp1, k3, msg1, msg2, msg3, msg0);
+      ROUNDS4(vsha1mq_u32, e0, e1, tmp0, k3, msg2, msg3, msg0, msg1);
+      ROUNDS4(vsha1pq_u32, e1, e0, tmp1, k3, msg3, msg0, msg1, msg2);
+      ROUNDS4(vsha1pq_u32, e0, e1, tmp0, k3, msg0, msg1, msg2, msg3);
+      ROUNDS4(vsha1pq_u32, e1, e0, tmp1, k3, msg1, msg2, msg3, msg0);
+      ROUNDS4(vsha1pq_u32, e0, e1, tmp0, k3, msg2, msg3, msg0, msg1);
+
+      e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+      abcd = vsha1pq_u32(abcd, e1, tmp1);
+
+      e0 += e_save;
+      abcd = vaddq_u32(abcd, abcd_save);
+   }
+
+   vst1q_u32(state, abcd);
+   state[4] = e0;
+}
@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with -msse4.1 -msha, see sha1_accel.h. */
+
+#include <immintrin.h>
+
+#include "sha1_accel.h"
+
+/* Four rounds with the message words in m0, also advancing the message
+ * schedule: m1 receives the last step of the words of four rounds later, m3
+ * the first one and m2 the middle one.
+ */
+#define ROUNDS4(f, e_cur, e_next, m0, m1, m2, m3)            \
+   e_cur = _mm_sha1nexte_epu32(e_cur, m0);                   \
+   e_next = abcd;                                            \
+   m1 = _mm_sha1msg2_epu32(m1, m0);                          \
+   abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f);               \
+   m3 = _mm_sha1msg1_epu32(m3, m0);                          \
+   m2 = _mm_xor_si128(m2, m0)
+
+void
+_mesa_sha1_transform_ni(uint32_t state[5], const uint8_t *data,
+                        size_t num_blocks)
+{
+   const __m128i bswap = _mm_set_epi64x(0x0001020304050607ull,
+                                        0x08090a0b0c0d0e0full);
+   __m128i abcd, e0, e1, msg0, msg1, msg2, msg3;
+
+   /* The instructions want a in the highest lane. */
+   abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+   e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+   for (; num_blocks; num_blocks--, data += 64) {
+      const __m128i abcd_save = abcd;
+      const __m128i e_save = e0;
+
+      msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), bswap);
+      msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)),
+                              bswap);
+      msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)),
+                              bswap);
+      msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)),
+                              bswap);
+
+      /* Rounds 0-11, before the message schedule is in full swing. */
+      e0 = _mm_add_epi32(e0, msg0);
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+      e1 = _mm_sha1nexte_epu32(e1, msg1);
+      e0 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+      msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+      e0 = _mm_sha1nexte_epu32(e0, msg2);
+      e1 = abcd;
+      abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+      msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+      msg0 = _mm_xor_si128(msg0, msg2);
+
+      /* Rounds 12-79.  The schedule updates of the last groups are dead. */
+      ROUNDS4(0, e1, e0, msg3, msg0, msg1, msg2);
+      ROUNDS4(0, e0, e1, msg0, msg1, msg2, msg3);
+      ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0);
+      ROUNDS4(1, e0, e1, msg2, msg3, msg0, msg1);
+      ROUNDS4(1, e1, e0, msg3, msg0, msg1, msg2);
+      ROUNDS4(1, e0, e1, msg0, msg1, msg2, msg3);
+      ROUNDS4(1, e1, e0, msg1, msg2, msg3, msg0);
+      ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1);
+      ROUNDS4(2, e1, e0, msg3, msg0, msg1, msg2);
+      ROUNDS4(2, e0, e1, msg0, msg1, msg2, msg3);
+      ROUNDS4(2, e1, e0, msg1, msg2, msg3, msg0);
+      ROUNDS4(2, e0, e1, msg2, msg3, msg0, msg1);
+      ROUNDS4(3, e1, e0, msg3, msg0, msg1, msg2);
+      ROUNDS4(3, e0, e1, msg0, msg1, msg2, msg3);
+      ROUNDS4(3, e1, e0, msg1, msg2, msg3, msg0);
+      ROUNDS4(3, e0, e1, msg2, msg3, msg0, msg1);
+      ROUNDS4(3, e1, e0, msg3, msg0, msg1, msg2);
+
+      e0 = _mm_sha1nexte_epu32(e0, e_save);
+      abcd = _mm_add_epi32(abcd, abcd_save);
+   }
+
+   _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+   state[4] = _mm_extract_epi32(e0, 3);
+}
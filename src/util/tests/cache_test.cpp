@@ -36,9 +36,11 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
+#include "util/disk_cache_os.h"
 #include "util/ralloc.h"
 
 #ifdef ENABLE_SHADER_CACHE
@@ -457,6 +459,184 @@ test_put_key_and_get_key(void)
    disk_cache_destroy(cache);
 }
 
+/* Check that eviction picks the least recently used item rather than just
+ * the oldest one.
+ */
+static void
+test_put_and_get_lru()
+{
+   const size_t item_size = 300 * 1024;
+   uint8_t keys[4][20];
+   uint64_t state = 0x9e3779b97f4a7c15ull;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+   struct disk_cache *cache = disk_cache_create("test_lru", "make_check", 0);
+
+   uint8_t *data = (uint8_t *) malloc(item_size);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++) {
+      /* Use incompressible data so the cache fills up after three items. */
+      for (unsigned j = 0; j < item_size; j++) {
+         state ^= state << 13;
+         state ^= state >> 7;
+         state ^= state << 17;
+         data[j] = state;
+      }
+
+      disk_cache_compute_key(cache, data, item_size, keys[i]);
+      disk_cache_put(cache, keys[i], data, item_size, NULL);
+      disk_cache_wait_for_idle(cache);
+
+      /* Use the first item so that the second becomes the least recently
+       * used one.
+       */
+      if (i == 2) {
+         EXPECT_TRUE(does_cache_contain(cache, keys[0]))
+            << "disk_cache_get before eviction";
+      }
+   }
+   free(data);
+
+   EXPECT_TRUE(does_cache_contain(cache, keys[0]))
+      << "recently used item not evicted";
+   EXPECT_FALSE(does_cache_contain(cache, keys[1]))
+      << "least recently used item evicted";
+   EXPECT_TRUE(does_cache_contain(cache, keys[2]))
+      << "3rd item not evicted";
+   EXPECT_TRUE(does_cache_contain(cache, keys[3]))
+      << "newest item not evicted";
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+}
+
+/* An LRU index written by a build with another layout must be left as it is,
+ * other processes may have it mapped. Eviction falls back to scanning the
+ * cache directories.
+ */
+static void
+test_lru_index_other_layout()
+{
+   const char *path =
+      CACHE_TEST_TMP "/mesa-glsl-cache-dir/" CACHE_DIR_NAME "/lru_index";
+   const size_t item_size = 300 * 1024;
+   uint8_t foreign[4096];
+   uint8_t keys[4][20];
+   struct stat sb;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   /* The index created by the previous tests has a valid header. */
+   struct {
+      uint32_t magic;
+      uint32_t version;
+      uint64_t size;
+   } header;
+   static_assert(sizeof(header) == offsetof(struct disk_cache_lru_index, clock),
+                 "LRU index header layout");
+   FILE *f = fopen(path, "rb");
+   ASSERT_NE(f, nullptr) << "LRU index created";
+   EXPECT_EQ(fread(&header, sizeof(header), 1, f), 1);
+   fclose(f);
+   EXPECT_EQ(header.magic, CACHE_LRU_MAGIC);
+   EXPECT_EQ(header.version, CACHE_LRU_VERSION);
+   EXPECT_EQ(header.size, sizeof(struct disk_cache_lru_index));
+
+   memset(foreign, 0xa5, sizeof(foreign));
+   unlink(path);
+   f = fopen(path, "wb");
+   ASSERT_NE(f, nullptr) << "creating a foreign LRU index";
+   fwrite(foreign, 1, sizeof(foreign), f);
+   fclose(f);
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+   struct disk_cache *cache = disk_cache_create("test_lru", "make_check", 0);
+
+   uint8_t *data = (uint8_t *) malloc(item_size);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++) {
+      memset(data, i + 1, item_size);
+      data[0] = 0xff;
+      disk_cache_compute_key(cache, data, item_size, keys[i]);
+      disk_cache_put(cache, keys[i], data, item_size, NULL);
+      disk_cache_wait_for_idle(cache);
+   }
+   free(data);
+
+   EXPECT_TRUE(does_cache_contain(cache, keys[3]))
+      << "newest item with a foreign LRU index";
+
+   disk_cache_destroy(cache);
+
+   EXPECT_EQ(stat(path, &sb), 0);
+   EXPECT_EQ(sb.st_size, sizeof(foreign)) << "foreign LRU index not resized";
+
+   uint8_t contents[sizeof(foreign)];
+   f = fopen(path, "rb");
+   ASSERT_NE(f, nullptr);
+   EXPECT_EQ(fread(contents, 1, sizeof(contents), f), sizeof(contents));
+   fclose(f);
+   EXPECT_EQ(memcmp(contents, foreign, sizeof(foreign)), 0)
+      << "foreign LRU index not modified";
+
+   unlink(path);
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+}
+
+/* Build a single file cache in one directory and make sure a multi file
+ * cache in another directory can read it as its read-only layer.
+ */
+static void
+test_put_and_get_read_only_layer()
+{
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char *result;
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/layer-build", 1);
+   setenv("MESA_DISK_CACHE_SINGLE_FILE", "true", 1);
+
+   struct disk_cache *cache = disk_cache_create("test_layer", "make_check", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_destroy(cache);
+
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/layer-user", 1);
+   setenv("MESA_DISK_CACHE_SINGLE_FILE", "false", 1);
+
+   cache = disk_cache_create("test_layer", "make_check", 0);
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_EQ(result, nullptr) << "disk_cache_get without a read-only layer";
+   disk_cache_destroy(cache);
+
+   setenv("MESA_DISK_CACHE_READ_ONLY_LAYER",
+          CACHE_TEST_TMP "/layer-build/" CACHE_DIR_NAME_SF, 1);
+
+   cache = disk_cache_create("test_layer", "make_check", 0);
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(result, blob) << "disk_cache_get from the read-only layer";
+   EXPECT_EQ(size, sizeof(blob));
+   free(result);
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_DISK_CACHE_READ_ONLY_LAYER");
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/mesa-glsl-cache-dir", 1);
+}
+
 /* To make sure we are not just using the inmemory cache index for the single
  * file cache we test adding and retriving cache items between two different
  * cache instances.
@@ -519,6 +699,242 @@ test_put_and_get_between_instances()
    disk_cache_destroy(cache1);
    disk_cache_destroy(cache2);
 }
+
+static char foz_cache_dir[PATH_MAX];
+static const char *foz_cache_gpu_name;
+
+/* Callback for nftw used to locate the directory holding the single file
+ * cache of foz_cache_gpu_name.
+ */
+static int
+find_foz_cache(const char *path,
+               const struct stat *sb,
+               int typeflag,
+               struct FTW *ftwbuf)
+{
+   if (typeflag != FTW_F || strcmp(path + ftwbuf->base, "foz_cache.foz"))
+      return 0;
+
+   size_t len = strlen(foz_cache_gpu_name);
+   if ((size_t)ftwbuf->base < len + 1 ||
+       strncmp(path + ftwbuf->base - len - 1, foz_cache_gpu_name, len))
+      return 0;
+
+   snprintf(foz_cache_dir, sizeof(foz_cache_dir), "%.*s",
+            ftwbuf->base - 1, path);
+   return 1;
+}
+
+static bool
+find_foz_cache_dir(const char *gpu_name)
+{
+   foz_cache_dir[0] = '\0';
+   foz_cache_gpu_name = gpu_name;
+   nftw(CACHE_TEST_TMP, find_foz_cache, 64, FTW_PHYS);
+
+   return foz_cache_dir[0] != '\0';
+}
+
+/* Turn the default single file cache into a read-only db and make sure items
+ * can still be retrieved from it.
+ */
+static void
+test_put_and_get_read_only_db()
+{
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char string[] = "While this string has thirty-four";
+   uint8_t string_key[20];
+   char *result;
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   struct disk_cache *cache = disk_cache_create("test_read_only_db",
+                                                "make_check", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_compute_key(cache, string, sizeof(string), string_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+   disk_cache_wait_for_idle(cache);
+   disk_cache_destroy(cache);
+
+   ASSERT_TRUE(find_foz_cache_dir("test_read_only_db"))
+      << "foz_cache.foz not found";
+
+   char src[PATH_MAX + 32], dst[PATH_MAX + 32];
+   snprintf(src, sizeof(src), "%s/foz_cache.foz", foz_cache_dir);
+   snprintf(dst, sizeof(dst), "%s/ro.foz", foz_cache_dir);
+   ASSERT_EQ(rename(src, dst), 0);
+   snprintf(src, sizeof(src), "%s/foz_cache_idx.foz", foz_cache_dir);
+   snprintf(dst, sizeof(dst), "%s/ro_idx.foz", foz_cache_dir);
+   ASSERT_EQ(rename(src, dst), 0);
+
+   setenv("MESA_DISK_CACHE_READ_ONLY_FOZ_DBS", "ro", 1);
+
+   cache = disk_cache_create("test_read_only_db", "make_check", 0);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(blob, result) << "disk_cache_get of read-only db item (pointer)";
+   EXPECT_EQ(size, sizeof(blob)) << "disk_cache_get of read-only db item (size)";
+   free(result);
+
+   result = (char *) disk_cache_get(cache, string_key, &size);
+   EXPECT_STREQ(string, result) << "2nd disk_cache_get of read-only db item (pointer)";
+   EXPECT_EQ(size, sizeof(string)) << "2nd disk_cache_get of read-only db item (size)";
+   free(result);
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_DISK_CACHE_READ_ONLY_FOZ_DBS");
+}
+
+/* Fill the single file cache well past MESA_GLSL_CACHE_MAX_SIZE and make sure
+ * it gets compacted, keeping the newest and the most recently used items.
+ */
+static void
+test_single_file_size_limit()
+{
+   uint8_t keys[16][20];
+   uint8_t data[1024];
+   uint64_t state = 0x9e3779b97f4a7c15ull;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "8K", 1);
+   struct disk_cache *cache = disk_cache_create("test_size_limit",
+                                                "make_check", 0);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++) {
+      /* Use incompressible data so each item takes up about 1KB. */
+      for (unsigned j = 0; j < sizeof(data); j++) {
+         state ^= state << 13;
+         state ^= state >> 7;
+         state ^= state << 17;
+         data[j] = state;
+      }
+
+      disk_cache_compute_key(cache, data, sizeof(data), keys[i]);
+      disk_cache_put(cache, keys[i], data, sizeof(data), NULL);
+      disk_cache_wait_for_idle(cache);
+
+      /* Keep the first item in use. */
+      EXPECT_TRUE(does_cache_contain(cache, keys[0]))
+         << "recently used item kept by compaction";
+   }
+
+   EXPECT_TRUE(does_cache_contain(cache, keys[ARRAY_SIZE(keys) - 1]))
+      << "newest item kept by compaction";
+   EXPECT_FALSE(does_cache_contain(cache, keys[1]))
+      << "least recently used item evicted by compaction";
+
+   ASSERT_TRUE(find_foz_cache_dir("test_size_limit"))
+      << "foz_cache.foz not found";
+
+   char filename[PATH_MAX + 32];
+   struct stat sb;
+   snprintf(filename, sizeof(filename), "%s/foz_cache.foz", foz_cache_dir);
+   ASSERT_EQ(stat(filename, &sb), 0);
+   EXPECT_LE(sb.st_size, 8 * 1024) << "single file cache size limit";
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_MAX_SIZE");
+}
+
+static off_t
+get_foz_cache_size(const char *gpu_name)
+{
+   char path[PATH_MAX + 16];
+   struct stat sb;
+
+   if (!find_foz_cache_dir(gpu_name))
+      return 0;
+
+   snprintf(path, sizeof(path), "%s/foz_cache.foz", foz_cache_dir);
+   return stat(path, &sb) == 0 ? sb.st_size : 0;
+}
+
+/* Fill the cache with items that only compress well against each other and
+ * make sure a dictionary gets trained from them and used for new items.
+ */
+static void
+test_put_and_get_dictionary()
+{
+   const size_t item_size = 16 * 1024;
+   const unsigned num_items = 80;
+   uint64_t state = 0x9e3779b97f4a7c15ull;
+   uint8_t key[20];
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_DISK_CACHE_DICTIONARY", "true", 1);
+   struct disk_cache *cache = disk_cache_create("test_dict", "make_check", 0);
+
+   /* Random data shared by all the items, with a few bytes changed per
+    * item.
+    */
+   uint8_t *base = (uint8_t *) malloc(item_size);
+   for (unsigned j = 0; j < item_size; j++) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      base[j] = state;
+   }
+
+   uint8_t *data = (uint8_t *) malloc(item_size);
+   for (unsigned i = 0; i <= num_items; i++) {
+      memcpy(data, base, item_size);
+      for (unsigned j = 0; j < 8; j++)
+         data[(i * 1031 + j * 2053) % item_size] ^= i + 1;
+
+      off_t foz_size = get_foz_cache_size("test_dict");
+
+      disk_cache_compute_key(cache, data, item_size, key);
+      disk_cache_put(cache, key, data, item_size, NULL);
+      disk_cache_wait_for_idle(cache);
+
+      /* The dictionary is in place by the time the last item is written. */
+      if (i == num_items) {
+         EXPECT_LT(get_foz_cache_size("test_dict") - foz_size,
+                   (off_t) item_size / 2)
+            << "item compressed with the dictionary";
+      }
+   }
+
+   disk_cache_destroy(cache);
+
+   char path[PATH_MAX + 16];
+   ASSERT_TRUE(find_foz_cache_dir("test_dict"));
+   snprintf(path, sizeof(path), "%s/dictionary", foz_cache_dir);
+   EXPECT_EQ(access(path, F_OK), 0) << "dictionary trained";
+
+   /* A new instance has to load the dictionary to read the item back. */
+   cache = disk_cache_create("test_dict", "make_check", 0);
+
+   uint8_t *result = (uint8_t *) disk_cache_get(cache, key, &size);
+   EXPECT_NE(result, nullptr) << "disk_cache_get with dictionary";
+   if (result) {
+      EXPECT_EQ(size, item_size);
+      EXPECT_EQ(memcmp(result, data, item_size), 0);
+   }
+
+   free(result);
+   free(data);
+   free(base);
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_DISK_CACHE_DICTIONARY");
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 class Cache : public ::testing::Test {
@@ -544,6 +960,12 @@ TEST_F(Cache, MultiFile)
 
    test_put_key_and_get_key();
 
+   test_put_and_get_lru();
+
+   test_lru_index_other_layout();
+
+   test_put_and_get_read_only_layer();
+
    int err = rmrf_local(CACHE_TEST_TMP);
    EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
 #endif
@@ -558,8 +980,8 @@ TEST_F(Cache, SingleFile)
 
    test_disk_cache_create(mem_ctx, CACHE_DIR_NAME_SF);
 
-   /* We skip testing cache size limit as the single file cache currently
-    * doesn't have any functionality to enforce cache size limits.
+   /* The size limit part of this test relies on individual files being
+    * evicted, the single file cache limit is tested separately below.
     */
    test_put_and_get(false);
 
@@ -567,6 +989,12 @@ TEST_F(Cache, SingleFile)
 
    test_put_and_get_between_instances();
 
+   test_put_and_get_read_only_db();
+
+   test_single_file_size_limit();
+
+   test_put_and_get_dictionary();
+
    setenv("MESA_DISK_CACHE_SINGLE_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
@@ -0,0 +1,233 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Benchmark of the pack and unpack functions of every format with test
+ * cases in u_format_tests.c, converting whole images the way texture uploads
+ * and readbacks do.  Prints nanoseconds per pixel of the functions picked
+ * for this CPU, followed by those of the generic code when they differ.
+ *
+ * Usage: u_format_bench [scale]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "util/format/u_format.h"
+#include "util/format/u_format_tests.h"
+
+#define WIDTH 480
+#define HEIGHT 48
+
+enum bench_op {
+   UNPACK_8UNORM,
+   UNPACK_FLOAT,
+   PACK_8UNORM,
+   PACK_FLOAT,
+   NUM_OPS,
+};
+
+static const char *op_names[NUM_OPS] = {
+   "unpack_8unorm", "unpack_float", "pack_8unorm", "pack_float",
+};
+
+static uint8_t packed[WIDTH * HEIGHT * UTIL_FORMAT_MAX_PACKED_BYTES];
+static uint8_t rgba8[WIDTH * HEIGHT * 4];
+static float rgbaf[WIDTH * HEIGHT * 4];
+static unsigned scale = 1;
+
+static bool
+has_op(const struct util_format_pack_description *pack,
+       const struct util_format_unpack_description *unpack,
+       enum bench_op op)
+{
+   switch (op) {
+   case UNPACK_8UNORM:
+      return unpack->unpack_rgba_8unorm || unpack->unpack_rgba_8unorm_rect;
+   case UNPACK_FLOAT:
+      return unpack->unpack_rgba || unpack->unpack_rgba_rect;
+   case PACK_8UNORM:
+      return pack->pack_rgba_8unorm;
+   case PACK_FLOAT:
+      return pack->pack_rgba_float;
+   default:
+      return false;
+   }
+}
+
+static bool
+same_op(const struct util_format_pack_description *pack_a,
+        const struct util_format_unpack_description *unpack_a,
+        const struct util_format_pack_description *pack_b,
+        const struct util_format_unpack_description *unpack_b,
+        enum bench_op op)
+{
+   switch (op) {
+   case UNPACK_8UNORM:
+      return unpack_a->unpack_rgba_8unorm == unpack_b->unpack_rgba_8unorm &&
+             unpack_a->unpack_rgba_8unorm_rect == unpack_b->unpack_rgba_8unorm_rect;
+   case UNPACK_FLOAT:
+      return unpack_a->unpack_rgba == unpack_b->unpack_rgba &&
+             unpack_a->unpack_rgba_rect == unpack_b->unpack_rgba_rect;
+   case PACK_8UNORM:
+      return pack_a->pack_rgba_8unorm == pack_b->pack_rgba_8unorm;
+   case PACK_FLOAT:
+      return pack_a->pack_rgba_float == pack_b->pack_rgba_float;
+   default:
+      return true;
+   }
+}
+
+static void
+run_op(const struct util_format_description *desc,
+       const struct util_format_pack_description *pack,
+       const struct util_format_unpack_description *unpack,
+       enum bench_op op)
+{
+   const unsigned packed_stride =
+      WIDTH / desc->block.width * desc->block.bits / 8;
+   const unsigned num_block_rows = HEIGHT / desc->block.height;
+
+   switch (op) {
+   case UNPACK_8UNORM:
+      if (unpack->unpack_rgba_8unorm_rect) {
+         unpack->unpack_rgba_8unorm_rect(rgba8, WIDTH * 4, packed, packed_stride,
+                                         WIDTH, HEIGHT);
+      } else {
+         for (unsigned y = 0; y < num_block_rows; y++) {
+            unpack->unpack_rgba_8unorm(rgba8 + y * WIDTH * 4,
+                                       packed + y * packed_stride, WIDTH);
+         }
+      }
+      break;
+   case UNPACK_FLOAT:
+      if (unpack->unpack_rgba_rect) {
+         unpack->unpack_rgba_rect(rgbaf, WIDTH * 16, packed, packed_stride,
+                                  WIDTH, HEIGHT);
+      } else {
+         for (unsigned y = 0; y < num_block_rows; y++) {
+            unpack->unpack_rgba(rgbaf + y * WIDTH * 4,
+                                packed + y * packed_stride, WIDTH);
+         }
+      }
+      break;
+   case PACK_8UNORM:
+      pack->pack_rgba_8unorm(packed, packed_stride, rgba8, WIDTH * 4,
+                             WIDTH, HEIGHT);
+      break;
+   case PACK_FLOAT:
+      pack->pack_rgba_float(packed, packed_stride, rgbaf, WIDTH * 16,
+                            WIDTH, HEIGHT);
+      break;
+   default:
+      break;
+   }
+}
+
+static double
+time_op(const struct util_format_description *desc,
+        const struct util_format_pack_description *pack,
+        const struct util_format_unpack_description *unpack,
+        enum bench_op op)
+{
+   const unsigned iterations = 20 * scale;
+
+   /* Warm up the caches. */
+   run_op(desc, pack, unpack, op);
+
+   int64_t start = os_time_get_nano();
+   for (unsigned i = 0; i < iterations; i++)
+      run_op(desc, pack, unpack, op);
+
+   return (double)(os_time_get_nano() - start) /
+          ((double)iterations * WIDTH * HEIGHT);
+}
+
+static void
+fill_sources(const struct util_format_description *desc,
+             const struct util_format_test_case *test)
+{
+   const unsigned block_size = desc->block.bits / 8;
+
+   /* Tile the test case, so that compressed formats decode valid blocks. */
+   for (unsigned i = 0; i + block_size <= sizeof(packed); i += block_size)
+      memcpy(packed + i, test->packed, block_size);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(rgbaf); i++) {
+      rgbaf[i] = (float)(i % 257) / 256.0f;
+      rgba8[i] = i * 7;
+   }
+}
+
+static void
+bench_format(const struct util_format_test_case *test)
+{
+   const struct util_format_description *desc =
+      util_format_description(test->format);
+   const struct util_format_pack_description *pack =
+      util_format_pack_description(test->format);
+   const struct util_format_pack_description *pack_generic =
+      util_format_pack_description_generic(test->format);
+   const struct util_format_unpack_description *unpack =
+      util_format_unpack_description(test->format);
+   const struct util_format_unpack_description *unpack_generic =
+      util_format_unpack_description_generic(test->format);
+
+   if (WIDTH % desc->block.width || HEIGHT % desc->block.height ||
+       desc->block.depth != 1)
+      return;
+
+   fill_sources(desc, test);
+
+   printf("%-40s", desc->short_name);
+   for (unsigned op = 0; op < NUM_OPS; op++) {
+      if (!has_op(pack, unpack, op)) {
+         printf(" %22s", "-");
+         continue;
+      }
+
+      double ns = time_op(desc, pack, unpack, op);
+      if (same_op(pack, unpack, pack_generic, unpack_generic, op)) {
+         printf(" %8.2f %13s", ns, "");
+      } else {
+         double generic_ns = time_op(desc, pack_generic, unpack_generic, op);
+         printf(" %8.2f (generic %5.2f)", ns, generic_ns);
+      }
+   }
+   printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+   if (argc > 1)
+      scale = MAX2(atoi(argv[1]), 1);
+
+   util_cpu_detect();
+
+   printf("%-40s", "ns/pixel");
+   for (unsigned op = 0; op < NUM_OPS; op++)
+      printf(" %-22s", op_names[op]);
+   printf("\n");
+
+   for (unsigned i = 0; i < util_format_nr_test_cases; i++) {
+      const struct util_format_test_case *test = &util_format_test_cases[i];
+      bool seen = false;
+
+      /* Formats have several test cases, only the first one is used. */
+      for (unsigned j = 0; j < i; j++) {
+         if (util_format_test_cases[j].format == test->format)
+            seen = true;
+      }
+
+      if (!seen)
+         bench_format(test);
+   }
+
+   return 0;
+}
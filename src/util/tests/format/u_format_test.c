@@ -34,6 +34,7 @@
 #include "util/u_math.h"
 #include "util/format/u_format.h"
 #include "util/format/u_format_tests.h"
+#include "util/format/u_format_bc_encode.h"
 #include "util/format/u_format_s3tc.h"
 
 
@@ -731,6 +732,303 @@ test_format_norm_flags(const struct util_format_description *format_desc)
    return success;
 }
 
+/* Wide enough for the vector kernels, and not a multiple of their width so
+ * that the generic code also handles the end of every row.
+ */
+#define DISPATCH_ROW_WIDTH 37
+#define DISPATCH_ROWS 3
+
+static uint32_t
+dispatch_rand(uint32_t *state)
+{
+   *state = *state * 1664525 + 1013904223;
+   return *state >> 8;
+}
+
+static float
+dispatch_rand_float(uint32_t *state)
+{
+   static const float special[] = {
+      0.0f, -0.0f, 1.0f, -1.0f, 2.0f, 1e-30f, -1e-30f, 1e30f, 0.5f / 255.0f,
+      254.5f / 255.0f, 1.0f - FLT_EPSILON, INFINITY, -INFINITY, NAN,
+   };
+   uint32_t r = dispatch_rand(state);
+
+   if (r % 4 == 0)
+      return special[(r / 4) % ARRAY_SIZE(special)];
+   return (float)(r % 100000) / 99999.0f;
+}
+
+/**
+ * Check that pack and unpack functions give the same results as the generic
+ * ones on whole rows.
+ */
+static boolean
+test_dispatch_rows(const struct util_format_description *format_desc,
+                   const struct util_format_pack_description *pack,
+                   const struct util_format_unpack_description *unpack)
+{
+   const struct util_format_pack_description *pack_generic =
+      util_format_pack_description_generic(format_desc->format);
+   const struct util_format_unpack_description *unpack_generic =
+      util_format_unpack_description_generic(format_desc->format);
+   static uint8_t packed[2][DISPATCH_ROWS][DISPATCH_ROW_WIDTH * UTIL_FORMAT_MAX_PACKED_BYTES];
+   static uint8_t rgba8[2][DISPATCH_ROWS][DISPATCH_ROW_WIDTH * 4];
+   static float rgbaf[2][DISPATCH_ROWS][DISPATCH_ROW_WIDTH * 4];
+   uint32_t seed = format_desc->format;
+   unsigned i, y;
+   boolean success = TRUE;
+
+   for (i = 0; i < sizeof packed[0]; ++i)
+      (&packed[0][0][0])[i] = dispatch_rand(&seed);
+   for (i = 0; i < sizeof rgba8[0]; ++i)
+      (&rgba8[0][0][0])[i] = dispatch_rand(&seed);
+   for (i = 0; i < ARRAY_SIZE(rgbaf[0]) * ARRAY_SIZE(rgbaf[0][0]); ++i)
+      (&rgbaf[0][0][0])[i] = dispatch_rand_float(&seed);
+
+   if (unpack->unpack_rgba_8unorm != unpack_generic->unpack_rgba_8unorm) {
+      for (y = 0; y < DISPATCH_ROWS; ++y) {
+         unpack->unpack_rgba_8unorm(rgba8[1][y], packed[0][y], DISPATCH_ROW_WIDTH);
+         unpack_generic->unpack_rgba_8unorm(rgba8[0][y], packed[0][y], DISPATCH_ROW_WIDTH);
+      }
+      if (memcmp(rgba8[0], rgba8[1], sizeof rgba8[0]) != 0) {
+         printf("FAILED: unpack_rgba_8unorm differs from the generic code\n");
+         success = FALSE;
+      }
+   }
+
+   if (unpack->unpack_rgba != unpack_generic->unpack_rgba) {
+      for (y = 0; y < DISPATCH_ROWS; ++y) {
+         unpack->unpack_rgba(rgbaf[1][y], packed[0][y], DISPATCH_ROW_WIDTH);
+         unpack_generic->unpack_rgba(rgbaf[0][y], packed[0][y], DISPATCH_ROW_WIDTH);
+      }
+      if (memcmp(rgbaf[0], rgbaf[1], sizeof rgbaf[0]) != 0) {
+         printf("FAILED: unpack_rgba differs from the generic code\n");
+         success = FALSE;
+      }
+   }
+
+   /* The unpacking above overwrote the first copy of the sources. */
+   for (i = 0; i < sizeof rgba8[0]; ++i)
+      (&rgba8[0][0][0])[i] = dispatch_rand(&seed);
+   for (i = 0; i < ARRAY_SIZE(rgbaf[0]) * ARRAY_SIZE(rgbaf[0][0]); ++i)
+      (&rgbaf[0][0][0])[i] = dispatch_rand_float(&seed);
+
+   if (pack->pack_rgba_8unorm != pack_generic->pack_rgba_8unorm) {
+      memset(packed, 0, sizeof packed);
+      pack->pack_rgba_8unorm(packed[1][0], sizeof packed[1][0],
+                             rgba8[0][0], sizeof rgba8[0][0],
+                             DISPATCH_ROW_WIDTH, DISPATCH_ROWS);
+      pack_generic->pack_rgba_8unorm(packed[0][0], sizeof packed[0][0],
+                                     rgba8[0][0], sizeof rgba8[0][0],
+                                     DISPATCH_ROW_WIDTH, DISPATCH_ROWS);
+      if (memcmp(packed[0], packed[1], sizeof packed[0]) != 0) {
+         printf("FAILED: pack_rgba_8unorm differs from the generic code\n");
+         success = FALSE;
+      }
+   }
+
+   if (pack->pack_rgba_float != pack_generic->pack_rgba_float) {
+      memset(packed, 0, sizeof packed);
+      pack->pack_rgba_float(packed[1][0], sizeof packed[1][0],
+                            rgbaf[0][0], sizeof rgbaf[0][0],
+                            DISPATCH_ROW_WIDTH, DISPATCH_ROWS);
+      pack_generic->pack_rgba_float(packed[0][0], sizeof packed[0][0],
+                                    rgbaf[0][0], sizeof rgbaf[0][0],
+                                    DISPATCH_ROW_WIDTH, DISPATCH_ROWS);
+      if (memcmp(packed[0], packed[1], sizeof packed[0]) != 0) {
+         printf("FAILED: pack_rgba_float differs from the generic code\n");
+         success = FALSE;
+      }
+   }
+
+   return success;
+}
+
+static boolean
+test_format_dispatch_rows(const struct util_format_description *format_desc)
+{
+   enum pipe_format format = format_desc->format;
+   boolean success = TRUE;
+
+   if (!test_dispatch_rows(format_desc, util_format_pack_description(format),
+                           util_format_unpack_description(format)))
+      success = FALSE;
+
+   /* Also cover the kernels of the extensions not picked for this CPU. */
+#ifdef HAVE_FORMAT_AVX2
+   if (util_format_pack_description_avx2(format) &&
+       !test_dispatch_rows(format_desc, util_format_pack_description_avx2(format),
+                           util_format_unpack_description_avx2(format)))
+      success = FALSE;
+#endif
+#ifdef HAVE_FORMAT_AVX512
+   if (util_format_pack_description_avx512(format) &&
+       !test_dispatch_rows(format_desc, util_format_pack_description_avx512(format),
+                           util_format_unpack_description_avx512(format)))
+      success = FALSE;
+#endif
+
+   return success;
+}
+
+/* Image for the round trip tests: smooth gradients with some noise and a
+ * few sharp edges, not a multiple of the block size.
+ */
+#define COMPRESS_WIDTH 37
+#define COMPRESS_HEIGHT 23
+
+/**
+ * Compress an image with each encoder quality, decompress it and check the
+ * PSNR of the result, which mustn't get worse with higher qualities.
+ *
+ * With \p opaque the image has no alpha, which the BPTC encoder handles
+ * with two-subset mode 1 blocks except at the fast quality.
+ */
+static boolean
+test_format_compress_pass(const struct util_format_description *format_desc,
+                          bool opaque)
+{
+   static uint8_t src[COMPRESS_HEIGHT][COMPRESS_WIDTH][4];
+   /* The decoders write whole blocks. */
+   static uint8_t dst[ALIGN_POT(COMPRESS_HEIGHT, 4)][ALIGN_POT(COMPRESS_WIDTH, 4)][4];
+   static uint8_t packed[COMPRESS_HEIGHT * COMPRESS_WIDTH * 4];
+   static const char *names[] = { "fast", "normal", "best" };
+   enum pipe_format format = format_desc->format;
+   const struct util_format_pack_description *pack =
+      util_format_pack_description(format);
+   unsigned nr_channels = 0;
+   bool punchthrough = format == PIPE_FORMAT_DXT1_RGBA;
+   double min_psnr, last_psnr = 0.0;
+   uint32_t seed = format;
+   boolean success = TRUE;
+
+   switch (format) {
+   case PIPE_FORMAT_DXT1_RGB:
+   case PIPE_FORMAT_DXT1_RGBA:
+   case PIPE_FORMAT_DXT3_RGBA:
+   case PIPE_FORMAT_DXT5_RGBA:
+      min_psnr = 30.0;
+      break;
+   case PIPE_FORMAT_RGTC1_UNORM:
+   case PIPE_FORMAT_RGTC2_UNORM:
+      min_psnr = 36.0;
+      break;
+   case PIPE_FORMAT_BPTC_RGBA_UNORM:
+      min_psnr = 30.0;
+      break;
+   default:
+      return TRUE;
+   }
+
+   unsigned stride = util_format_get_stride(format, COMPRESS_WIDTH);
+
+   /* Compressed formats have a single channel covering the whole block, so
+    * count the ones that the swizzle reads instead.
+    */
+   for (unsigned c = 0; c < 4; ++c) {
+      if (format_desc->swizzle[c] <= PIPE_SWIZZLE_W)
+         nr_channels++;
+   }
+
+   for (unsigned y = 0; y < COMPRESS_HEIGHT; ++y) {
+      for (unsigned x = 0; x < COMPRESS_WIDTH; ++x) {
+         int noise = dispatch_rand(&seed) % 9 - 4;
+         bool edge = (x / 8 + y / 8) % 3 == 0;
+
+         src[y][x][0] = CLAMP((int)x * 6 + noise, 0, 255);
+         src[y][x][1] = CLAMP((int)y * 10 - noise + (edge ? 40 : 0), 0, 255);
+         src[y][x][2] = CLAMP(200 - (int)(x + y) * 3 + noise, 0, 255);
+         src[y][x][3] = opaque ? 255 : CLAMP(255 - (int)x * 3 + noise, 0, 255);
+
+         /* Transparent texels decode as black. */
+         if (punchthrough) {
+            src[y][x][3] = edge ? 0 : 255;
+            if (edge)
+               memset(src[y][x], 0, 3);
+         }
+      }
+   }
+
+   for (unsigned q = 0; q < ARRAY_SIZE(names); ++q) {
+      double error = 0.0;
+
+      util_format_set_compress_quality(q);
+
+      pack->pack_rgba_8unorm(packed, stride, &src[0][0][0], sizeof src[0],
+                             COMPRESS_WIDTH, COMPRESS_HEIGHT);
+      util_format_unpack_rgba_8unorm_rect(format, &dst[0][0][0], sizeof dst[0],
+                                          packed, stride,
+                                          COMPRESS_WIDTH, COMPRESS_HEIGHT);
+
+      for (unsigned y = 0; y < COMPRESS_HEIGHT; ++y) {
+         for (unsigned x = 0; x < COMPRESS_WIDTH; ++x) {
+            for (unsigned c = 0; c < 4; ++c) {
+               if (format_desc->swizzle[c] > PIPE_SWIZZLE_W)
+                  continue;
+               int d = src[y][x][c] - dst[y][x][c];
+               error += d * d;
+            }
+         }
+      }
+
+      error /= COMPRESS_WIDTH * COMPRESS_HEIGHT * nr_channels;
+      double psnr = error ? 10.0 * log10(255.0 * 255.0 / error) : 99.0;
+
+      if (psnr < min_psnr) {
+         printf("FAILED: %s %s%s quality PSNR %.2f dB, expected at least %.2f dB\n",
+                format_desc->short_name, opaque ? "opaque " : "", names[q],
+                psnr, min_psnr);
+         success = FALSE;
+      }
+      if (psnr < last_psnr - 0.05) {
+         printf("FAILED: %s %s%s quality PSNR %.2f dB, lower than %.2f dB\n",
+                format_desc->short_name, opaque ? "opaque " : "", names[q],
+                psnr, last_psnr);
+         success = FALSE;
+      }
+      last_psnr = psnr;
+
+      /* The BPTC mode is encoded in unary in the low bits of the first
+       * byte, so mode 1 blocks start with 0b10.
+       */
+      if (format == PIPE_FORMAT_BPTC_RGBA_UNORM && opaque &&
+          q != UTIL_FORMAT_COMPRESS_FAST) {
+         unsigned nr_blocks = DIV_ROUND_UP(COMPRESS_WIDTH, 4) *
+                              DIV_ROUND_UP(COMPRESS_HEIGHT, 4);
+         unsigned nr_mode1 = 0;
+
+         for (unsigned b = 0; b < nr_blocks; ++b) {
+            if ((packed[b * 16] & 0x3) == 0x2)
+               nr_mode1++;
+         }
+         if (!nr_mode1) {
+            printf("FAILED: %s opaque %s quality used no mode 1 blocks\n",
+                   format_desc->short_name, names[q]);
+            success = FALSE;
+         }
+      }
+   }
+
+   util_format_set_compress_quality(UTIL_FORMAT_COMPRESS_NORMAL);
+
+   return success;
+}
+
+static boolean
+test_format_compress_quality(const struct util_format_description *format_desc)
+{
+   boolean success = test_format_compress_pass(format_desc, false);
+
+   /* Opaque blocks take a different BPTC mode. */
+   if (format_desc->format == PIPE_FORMAT_BPTC_RGBA_UNORM &&
+       !test_format_compress_pass(format_desc, true))
+      success = FALSE;
+
+   return success;
+}
+
+
 typedef boolean
 (*test_func_t)(const struct util_format_description *format_desc,
                const struct util_format_test_case *test);
@@ -857,6 +1155,17 @@ test_all(void)
 
       TEST_FORMAT_METADATA(norm_flags);
 
+      if (format_desc->block.width == 1 && format_desc->block.height == 1 &&
+          (util_format_pack_description(format) !=
+           util_format_pack_description_generic(format) ||
+           util_format_unpack_description(format) !=
+           util_format_unpack_description_generic(format))) {
+         TEST_FORMAT_METADATA(dispatch_rows);
+      }
+
+      if (!test_format_compress_quality(format_desc))
+         success = FALSE;
+
 #     undef TEST_ONE_FUNC
 #     undef TEST_ONE_FORMAT
    }
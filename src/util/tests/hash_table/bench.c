@@ -0,0 +1,174 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Benchmarks of struct hash_table and struct set, modelled on the way the
+ * compilers use them:
+ *
+ *  - small pointer sets created and destroyed per block or pass,
+ *  - a CSE-style pointer set doing search-or-add with removals,
+ *  - large pointer maps (e.g. remap tables of a whole program),
+ *  - string-keyed symbol tables.
+ *
+ * Usage: hash_table_bench [scale]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "hash_table.h"
+#include "set.h"
+#include "os_time.h"
+
+#define NUM_POINTERS (1 << 20)
+
+static char *pointers;
+static unsigned scale = 1;
+static volatile uintptr_t sink;
+
+static const void *
+pointer_key(unsigned i)
+{
+   /* Spread like heap-allocated 32-byte instructions. */
+   return pointers + (size_t)(i % NUM_POINTERS) * 32;
+}
+
+static uint32_t
+rand_next(uint32_t *state)
+{
+   *state = *state * 1664525 + 1013904223;
+   return *state >> 8;
+}
+
+static void
+report(const char *name, int64_t start, uint64_t num_ops)
+{
+   double ns = (double)(os_time_get_nano() - start) / num_ops;
+   printf("%-32s %8.2f ns/op\n", name, ns);
+}
+
+static void
+bench_small_sets(void)
+{
+   const unsigned rounds = 20000 * scale;
+   uint32_t seed = 1;
+   uint64_t ops = 0;
+   int64_t start = os_time_get_nano();
+
+   for (unsigned r = 0; r < rounds; r++) {
+      struct set *set = _mesa_pointer_set_create(NULL);
+      unsigned base = rand_next(&seed);
+      unsigned n = 8 + r % 56;
+
+      for (unsigned i = 0; i < n; i++)
+         _mesa_set_add(set, pointer_key(base + i * 7));
+      for (unsigned i = 0; i < 2 * n; i++)
+         sink += (uintptr_t)_mesa_set_search(set, pointer_key(base + i * 7));
+
+      ops += 3 * n;
+      _mesa_set_destroy(set, NULL);
+   }
+
+   report("set: small pointer sets", start, ops);
+}
+
+static void
+bench_cse_set(void)
+{
+   const unsigned num_ops = 2000000 * scale;
+   struct set *set = _mesa_pointer_set_create(NULL);
+   uint32_t seed = 2;
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_ops; i++) {
+      const void *key = pointer_key(rand_next(&seed) % 65536);
+      bool found;
+      struct set_entry *entry = _mesa_set_search_or_add(set, key, &found);
+
+      /* Instructions get removed again when they are rewritten. */
+      if (found && (i & 7) == 0)
+         _mesa_set_remove(set, entry);
+   }
+
+   report("set: cse search_or_add/remove", start, num_ops);
+   _mesa_set_destroy(set, NULL);
+}
+
+static void
+bench_large_table(void)
+{
+   const unsigned num_keys = 500000;
+   const unsigned num_lookups = 4000000 * scale;
+   struct hash_table *ht = _mesa_pointer_hash_table_create(NULL);
+   uint32_t seed = 3;
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_keys; i++)
+      _mesa_hash_table_insert(ht, pointer_key(i), (void *)(uintptr_t)i);
+   report("hash_table: insert", start, num_keys);
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < num_lookups; i++) {
+      struct hash_entry *entry =
+         _mesa_hash_table_search(ht, pointer_key(rand_next(&seed) % num_keys));
+      sink += (uintptr_t)entry->data;
+   }
+   report("hash_table: search hit", start, num_lookups);
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < num_lookups; i++) {
+      unsigned k = num_keys + rand_next(&seed) % (NUM_POINTERS - num_keys);
+      sink += (uintptr_t)_mesa_hash_table_search(ht, pointer_key(k));
+   }
+   report("hash_table: search miss", start, num_lookups);
+
+   _mesa_hash_table_destroy(ht, NULL);
+}
+
+static void
+bench_string_table(void)
+{
+   const unsigned num_keys = 20000;
+   const unsigned num_lookups = 2000000 * scale;
+   char (*names)[24] = malloc(num_keys * 2 * sizeof(*names));
+   struct hash_table *ht =
+      _mesa_hash_table_create(NULL, _mesa_hash_string, _mesa_key_string_equal);
+   uint32_t seed = 4;
+
+   for (unsigned i = 0; i < num_keys * 2; i++)
+      snprintf(names[i], sizeof(names[i]), "gl_var_%u", i);
+
+   for (unsigned i = 0; i < num_keys; i++)
+      _mesa_hash_table_insert(ht, names[i], NULL);
+
+   int64_t start = os_time_get_nano();
+   for (unsigned i = 0; i < num_lookups; i++) {
+      unsigned k = rand_next(&seed) % (num_keys * 2);
+      sink += (uintptr_t)_mesa_hash_table_search(ht, names[k]);
+   }
+   report("hash_table: string search", start, num_lookups);
+
+   _mesa_hash_table_destroy(ht, NULL);
+   free(names);
+}
+
+int
+main(int argc, char **argv)
+{
+   if (argc > 1)
+      scale = MAX2(atoi(argv[1]), 1);
+
+   pointers = malloc((size_t)NUM_POINTERS * 32);
+   if (!pointers)
+      return 1;
+
+   bench_small_sets();
+   bench_cse_set();
+   bench_large_table();
+   bench_string_table();
+
+   free(pointers);
+   return 0;
+}
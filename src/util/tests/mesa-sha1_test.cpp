@@ -57,3 +57,49 @@ TEST_P(MesaSHA1TestFixture, Match)
       << "\t  Actual: " << buf << "\n"
       << "\tExpected: " << p.expected_sha1 << "\n";
 }
+
+TEST(MesaSHA1Test, MillionA)
+{
+   static const char expected[] = "34aa973cd4c4daa4f61eeb2bdbad27316534016f";
+   char *data = (char *)malloc(1000000);
+   unsigned char sha1[20];
+   char buf[41];
+
+   memset(data, 'a', 1000000);
+   _mesa_sha1_compute(data, 1000000, sha1);
+   _mesa_sha1_format(buf, sha1);
+   EXPECT_STREQ(buf, expected);
+
+   free(data);
+}
+
+TEST(MesaSHA1Test, MatchesPortable)
+{
+   uint8_t data[1000];
+
+   for (unsigned i = 0; i < sizeof(data); i++)
+      data[i] = i * 7 + (i >> 5);
+
+   /* Cover all the paddings and buffered updates of various sizes. */
+   for (unsigned size = 0; size <= 300; size++) {
+      for (unsigned split = 0; split < size; split += 37) {
+         struct mesa_sha1 ctx;
+         SHA1_CTX ref;
+         unsigned char sha1[20], expected[20];
+
+         _mesa_sha1_init(&ctx);
+         _mesa_sha1_update(&ctx, data, split);
+         _mesa_sha1_update(&ctx, data + split, size - split);
+         _mesa_sha1_update(&ctx, data + 300, size);
+         _mesa_sha1_final(&ctx, sha1);
+
+         SHA1Init(&ref);
+         SHA1Update(&ref, data, size);
+         SHA1Update(&ref, data + 300, size);
+         SHA1Final(expected, &ref);
+
+         ASSERT_EQ(memcmp(sha1, expected, sizeof(sha1)), 0)
+            << "size " << size << ", split " << split;
+      }
+   }
+}
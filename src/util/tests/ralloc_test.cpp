@@ -0,0 +1,137 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include "util/ralloc.h"
+
+static int num_destroyed;
+
+static void
+count_destructor(void *ptr)
+{
+   num_destroyed++;
+}
+
+TEST(ralloc, arena_alloc)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *ctx = ralloc_context(arena);
+   uint64_t *ptrs[1000];
+
+   for (unsigned i = 0; i < 1000; i++) {
+      /* Mix small and chunk-sized allocations. */
+      ptrs[i] = (uint64_t *)ralloc_size(i & 1 ? arena : ctx,
+                                        i % 100 == 0 ? 300000 : 8 * (i % 7 + 1));
+      EXPECT_EQ((uintptr_t)ptrs[i] % 8, 0u);
+      ptrs[i][0] = i;
+   }
+
+   for (unsigned i = 0; i < 1000; i++) {
+      EXPECT_EQ(ptrs[i][0], i);
+      EXPECT_EQ(ralloc_parent(ptrs[i]), i & 1 ? arena : ctx);
+   }
+
+   ralloc_free(ptrs[3]);
+   ralloc_free(ctx);
+   ralloc_free(arena);
+}
+
+TEST(ralloc, arena_resize)
+{
+   void *arena = ralloc_arena_context(NULL);
+   char *str = ralloc_strdup(arena, "a");
+   char *other = ralloc_strdup(arena, "b");
+   int *array = NULL;
+
+   for (unsigned i = 0; i < 1000; i++) {
+      ralloc_asprintf_append(&str, "%u", i % 10);
+      ralloc_asprintf_append(&other, "%u", i % 10);
+   }
+   EXPECT_EQ(strlen(str), 1001u);
+   EXPECT_EQ(strncmp(str, "a0123456789", 11), 0);
+   EXPECT_EQ(strncmp(other, "b0123456789", 11), 0);
+
+   for (unsigned i = 0; i < 100; i++) {
+      array = reralloc(arena, array, int, i + 1);
+      array[i] = i;
+   }
+   for (unsigned i = 0; i < 100; i++)
+      EXPECT_EQ(array[i], (int)i);
+
+   /* Children of a moved node are still attached to it. */
+   char *child = ralloc_strdup(array, "child");
+   array = reralloc(arena, array, int, 100000);
+   EXPECT_EQ(array[99], 99);
+   EXPECT_EQ(ralloc_parent(child), array);
+   EXPECT_EQ(ralloc_parent(array), arena);
+
+   ralloc_free(arena);
+}
+
+TEST(ralloc, arena_destructor)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *ctx = ralloc_context(arena);
+
+   num_destroyed = 0;
+   ralloc_set_destructor(ralloc_context(ctx), count_destructor);
+   ralloc_set_destructor(arena, count_destructor);
+
+   ralloc_free(arena);
+   EXPECT_EQ(num_destroyed, 2);
+}
+
+TEST(ralloc, arena_steal_in)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *ctx = ralloc_context(arena);
+   void *foreign = ralloc_context(NULL);
+
+   /* A node stolen into the arena is freed with it. */
+   num_destroyed = 0;
+   ralloc_set_destructor(foreign, count_destructor);
+   ralloc_steal(ctx, foreign);
+
+   ralloc_free(arena);
+   EXPECT_EQ(num_destroyed, 1);
+}
+
+TEST(ralloc, arena_steal)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *outside = ralloc_context(NULL);
+   char *str = ralloc_strdup(arena, "stolen");
+   char *child = ralloc_strdup(str, "child");
+   void *adopted = ralloc_context(arena);
+
+   ralloc_steal(outside, str);
+   ralloc_adopt(outside, arena);
+   EXPECT_EQ(ralloc_parent(adopted), outside);
+
+   /* The arena is kept alive by the nodes moved out of it. */
+   ralloc_free(arena);
+   EXPECT_STREQ(str, "stolen");
+   EXPECT_STREQ(child, "child");
+
+   num_destroyed = 0;
+   ralloc_set_destructor(child, count_destructor);
+   ralloc_free(str);
+   EXPECT_EQ(num_destroyed, 1);
+
+   ralloc_free(outside);
+}
+
+TEST(ralloc, arena_nested)
+{
+   void *arena = ralloc_arena_context(NULL);
+   void *nested = ralloc_arena_context(arena);
+
+   num_destroyed = 0;
+   ralloc_set_destructor(ralloc_context(nested), count_destructor);
+   ralloc_strdup(nested, "nested");
+
+   ralloc_free(arena);
+   EXPECT_EQ(num_destroyed, 1);
+}
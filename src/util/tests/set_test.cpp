@@ -75,6 +75,30 @@ TEST(set, basic)
    _mesa_set_destroy(s, NULL);
 }
 
+TEST(set, reuse_after_foreach_remove)
+{
+   struct set *s = _mesa_set_create_u32_keys(NULL);
+
+   for (uintptr_t i = 2; i < 102; i++)
+      _mesa_set_add(s, (const void *)i);
+
+   set_foreach_remove(s, he) {
+   }
+   EXPECT_EQ(s->entries, 0);
+
+   /* The set must not see the removed entries as used anymore. */
+   for (uintptr_t i = 1000; i < 1100; i++)
+      ASSERT_NE(_mesa_set_add(s, (const void *)i), nullptr);
+
+   EXPECT_EQ(s->entries, 100);
+   for (uintptr_t i = 2; i < 102; i++)
+      EXPECT_EQ(_mesa_set_search(s, (const void *)i), nullptr);
+   for (uintptr_t i = 1000; i < 1100; i++)
+      EXPECT_NE(_mesa_set_search(s, (const void *)i), nullptr);
+
+   _mesa_set_destroy(s, NULL);
+}
+
 TEST(set, clone)
 {
    struct set *s = _mesa_set_create(NULL, _mesa_hash_pointer,
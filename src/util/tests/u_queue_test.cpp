@@ -0,0 +1,260 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_queue.h"
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define NUM_THREADS 3
+
+struct shared_queue_data {
+   int busy[NUM_THREADS];
+   int num_executed;
+   bool overlap;
+   struct util_queue *nested_queue;
+};
+
+static void
+count_execute(void *job, void *gdata, int thread_index)
+{
+   struct shared_queue_data *data = (struct shared_queue_data *)gdata;
+
+   /* No other running job of the queue may have the same thread index. */
+   if (thread_index < 0 || thread_index >= NUM_THREADS ||
+       p_atomic_xchg(&data->busy[thread_index], 1)) {
+      data->overlap = true;
+      return;
+   }
+
+   os_time_sleep(100);
+   p_atomic_inc(&data->num_executed);
+   p_atomic_set(&data->busy[thread_index], 0);
+}
+
+TEST(u_queue, shared_finish)
+{
+   struct shared_queue_data data = {};
+   struct util_queue queue;
+
+   ASSERT_TRUE(util_queue_init(&queue, "test", 8, NUM_THREADS,
+                               UTIL_QUEUE_INIT_SHARED_THREADS, &data));
+
+   /* The queue isn't resizable, so this also waits for free slots. */
+   for (unsigned i = 0; i < 100; i++)
+      util_queue_add_job(&queue, &data, NULL, count_execute, NULL, 0);
+
+   util_queue_finish(&queue);
+   EXPECT_EQ(p_atomic_read(&data.num_executed), 100);
+   EXPECT_FALSE(data.overlap);
+
+   util_queue_destroy(&queue);
+}
+
+static void
+nested_execute(void *job, void *gdata, int thread_index)
+{
+   struct shared_queue_data *data = (struct shared_queue_data *)gdata;
+   struct util_queue_fence fence;
+
+   /* Wait for a job of another queue from within a job.  With more outer
+    * jobs than CPUs, all workers end up waiting, so the inner jobs can only
+    * run on the spare threads started for the parked workers.
+    */
+   util_queue_fence_init(&fence);
+   util_queue_add_job(data->nested_queue, data, &fence, count_execute,
+                      NULL, 0);
+   util_queue_fence_wait(&fence);
+   util_queue_fence_destroy(&fence);
+}
+
+TEST(u_queue, shared_nested_wait)
+{
+   struct shared_queue_data data = {};
+   struct util_queue outer, inner;
+
+   ASSERT_TRUE(util_queue_init(&inner, "inner", 8, NUM_THREADS,
+                               UTIL_QUEUE_INIT_SHARED_THREADS, &data));
+   ASSERT_TRUE(util_queue_init(&outer, "outer", 8, 64,
+                               UTIL_QUEUE_INIT_SHARED_THREADS |
+                               UTIL_QUEUE_INIT_RESIZE_IF_FULL, &data));
+   data.nested_queue = &inner;
+
+   for (unsigned i = 0; i < 64; i++)
+      util_queue_add_job(&outer, &data, NULL, nested_execute, NULL, 0);
+
+   util_queue_finish(&outer);
+   EXPECT_EQ(p_atomic_read(&data.num_executed), 64);
+   EXPECT_FALSE(data.overlap);
+
+   util_queue_destroy(&outer);
+   util_queue_destroy(&inner);
+}
+
+static thread_local bool waiting_for_fence;
+
+static void
+parked_execute(void *job, void *gdata, int thread_index)
+{
+   struct shared_queue_data *data = (struct shared_queue_data *)gdata;
+
+   if (waiting_for_fence)
+      data->overlap = true;
+}
+
+static void
+parked_wait_execute(void *job, void *gdata, int thread_index)
+{
+   struct shared_queue_data *data = (struct shared_queue_data *)gdata;
+   struct util_queue_fence fence;
+
+   if (waiting_for_fence)
+      data->overlap = true;
+
+   util_queue_fence_init(&fence);
+   util_queue_add_job(data->nested_queue, data, &fence, parked_execute,
+                      NULL, 0);
+
+   /* No other job may run on this thread until the wait is over, as it
+    * could take locks held by this one.
+    */
+   waiting_for_fence = true;
+   util_queue_fence_wait(&fence);
+   waiting_for_fence = false;
+
+   util_queue_fence_destroy(&fence);
+   p_atomic_inc(&data->num_executed);
+}
+
+TEST(u_queue, shared_wait_parks)
+{
+   struct shared_queue_data data = {};
+   struct util_queue outer, inner;
+
+   ASSERT_TRUE(util_queue_init(&inner, "inner", 8, NUM_THREADS,
+                               UTIL_QUEUE_INIT_SHARED_THREADS, &data));
+   ASSERT_TRUE(util_queue_init(&outer, "outer", 8, 64,
+                               UTIL_QUEUE_INIT_SHARED_THREADS |
+                               UTIL_QUEUE_INIT_RESIZE_IF_FULL, &data));
+   data.nested_queue = &inner;
+
+   for (unsigned i = 0; i < 64; i++)
+      util_queue_add_job(&outer, &data, NULL, parked_wait_execute, NULL, 0);
+
+   util_queue_finish(&outer);
+   EXPECT_EQ(p_atomic_read(&data.num_executed), 64);
+   EXPECT_FALSE(data.overlap);
+
+   util_queue_destroy(&outer);
+   util_queue_destroy(&inner);
+}
+
+static void
+finish_execute(void *job, void *gdata, int thread_index)
+{
+   struct shared_queue_data *data = (struct shared_queue_data *)gdata;
+
+   for (unsigned i = 0; i < 4; i++)
+      util_queue_add_job(data->nested_queue, data, NULL, count_execute,
+                         NULL, 0);
+
+   /* Like a fence wait, this parks the worker. */
+   util_queue_finish(data->nested_queue);
+}
+
+TEST(u_queue, shared_finish_from_job)
+{
+   struct shared_queue_data data = {};
+   struct util_queue outer, inner;
+
+   ASSERT_TRUE(util_queue_init(&inner, "inner", 8, NUM_THREADS,
+                               UTIL_QUEUE_INIT_SHARED_THREADS |
+                               UTIL_QUEUE_INIT_RESIZE_IF_FULL, &data));
+   ASSERT_TRUE(util_queue_init(&outer, "outer", 8, 64,
+                               UTIL_QUEUE_INIT_SHARED_THREADS |
+                               UTIL_QUEUE_INIT_RESIZE_IF_FULL, &data));
+   data.nested_queue = &inner;
+
+   for (unsigned i = 0; i < 16; i++)
+      util_queue_add_job(&outer, &data, NULL, finish_execute, NULL, 0);
+
+   util_queue_finish(&outer);
+   EXPECT_EQ(p_atomic_read(&data.num_executed), 64);
+   EXPECT_FALSE(data.overlap);
+
+   util_queue_destroy(&outer);
+   util_queue_destroy(&inner);
+}
+
+#if defined(__linux__)
+static void
+priority_execute(void *job, void *gdata, int thread_index)
+{
+   *(int *)job = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+}
+
+TEST(u_queue, shared_minimum_priority)
+{
+   struct util_queue low, normal;
+   int low_prio = 0, normal_prio = 0;
+
+   ASSERT_TRUE(util_queue_init(&low, "low", 8, 1,
+                               UTIL_QUEUE_INIT_SHARED_THREADS |
+                               UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL));
+   ASSERT_TRUE(util_queue_init(&normal, "normal", 8, 1,
+                               UTIL_QUEUE_INIT_SHARED_THREADS, NULL));
+
+   util_queue_add_job(&low, &low_prio, NULL, priority_execute, NULL, 0);
+   util_queue_add_job(&normal, &normal_prio, NULL, priority_execute, NULL, 0);
+   util_queue_finish(&low);
+   util_queue_finish(&normal);
+
+   /* Minimum priority queues have their own pool with lowered priority. */
+   EXPECT_EQ(low_prio, 19);
+   EXPECT_EQ(normal_prio, getpriority(PRIO_PROCESS, 0));
+
+   util_queue_destroy(&low);
+   util_queue_destroy(&normal);
+}
+#endif
+
+static void
+block_execute(void *job, void *gdata, int thread_index)
+{
+   util_queue_fence_wait((struct util_queue_fence *)job);
+}
+
+TEST(u_queue, shared_drop_job)
+{
+   struct shared_queue_data data = {};
+   struct util_queue_fence block, fence;
+   struct util_queue queue;
+
+   ASSERT_TRUE(util_queue_init(&queue, "test", 8, 1,
+                               UTIL_QUEUE_INIT_SHARED_THREADS, &data));
+
+   util_queue_fence_init(&block);
+   util_queue_fence_init(&fence);
+   util_queue_fence_reset(&block);
+
+   /* With a single thread, the second job can't start before the first. */
+   util_queue_add_job(&queue, &block, NULL, block_execute, NULL, 0);
+   util_queue_add_job(&queue, &data, &fence, count_execute, NULL, 0);
+   util_queue_drop_job(&queue, &fence);
+   EXPECT_TRUE(util_queue_fence_is_signalled(&fence));
+
+   util_queue_fence_signal(&block);
+   util_queue_finish(&queue);
+   EXPECT_EQ(p_atomic_read(&data.num_executed), 0);
+
+   util_queue_fence_destroy(&fence);
+   util_queue_fence_destroy(&block);
+   util_queue_destroy(&queue);
+}
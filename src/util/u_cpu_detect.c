@@ -431,6 +431,25 @@ static void
 check_os_arm_support(void)
 {
     util_cpu_caps.has_neon = true;
+
+#if defined(PIPE_OS_LINUX)
+    Elf64_auxv_t aux;
+    int fd;
+
+    fd = open("/proc/self/auxv", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+       while (read(fd, &aux, sizeof(Elf64_auxv_t)) == sizeof(Elf64_auxv_t)) {
+          if (aux.a_type == AT_HWCAP) {
+             uint64_t hwcap = aux.a_un.a_val;
+
+             /* HWCAP_SHA1 */
+             util_cpu_caps.has_sha = (hwcap >> 5) & 1;
+             break;
+          }
+       }
+       close (fd);
+    }
+#endif /* PIPE_OS_LINUX */
 }
 #endif /* PIPE_ARCH_ARM || PIPE_ARCH_AARCH64 */
 
@@ -746,6 +765,12 @@ util_cpu_detect_once(void)
          util_cpu_caps.has_avx2 = (regs7[1] >> 5) & 1;
       }
 
+      if (regs[0] >= 0x00000007) {
+         uint32_t regs7[4];
+         cpuid_count(0x00000007, 0x00000000, regs7);
+         util_cpu_caps.has_sha = (regs7[1] >> 29) & 1;
+      }
+
       // check for avx512
       if (((regs2[2] >> 27) & 1) && // OSXSAVE
           (xgetbv() & (0x7 << 5)) && // OPMASK: upper-256 enabled by OS
@@ -846,6 +871,7 @@ util_cpu_detect_once(void)
       printf("util_cpu_caps.has_neon = %u\n", util_cpu_caps.has_neon);
       printf("util_cpu_caps.has_msa = %u\n", util_cpu_caps.has_msa);
       printf("util_cpu_caps.has_daz = %u\n", util_cpu_caps.has_daz);
+      printf("util_cpu_caps.has_sha = %u\n", util_cpu_caps.has_sha);
       printf("util_cpu_caps.has_avx512f = %u\n", util_cpu_caps.has_avx512f);
       printf("util_cpu_caps.has_avx512dq = %u\n", util_cpu_caps.has_avx512dq);
       printf("util_cpu_caps.has_avx512ifma = %u\n", util_cpu_caps.has_avx512ifma);
@@ -106,6 +106,10 @@ struct util_cpu_caps_t {
    unsigned has_daz:1;
    unsigned has_neon:1;
    unsigned has_msa:1;
+   /* SHA extensions on x86, SHA-1 instructions of the crypto extension on
+    * ARMv8.
+    */
+   unsigned has_sha:1;
 
    unsigned has_avx512f:1;
    unsigned has_avx512dq:1;
@@ -27,6 +27,7 @@
 #include "u_queue.h"
 
 #include "c11/threads.h"
+#include "util/bitscan.h"
 #include "util/u_cpu_detect.h"
 #include "util/os_time.h"
 #include "util/u_string.h"
@@ -46,6 +47,12 @@
 static void
 util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
                         bool finish_locked);
+static bool
+util_queue_pool_park(void);
+static void
+util_queue_pool_unpark(void);
+static void
+util_queue_pool_exit(void);
 
 /****************************************************************************
  * Wait for all queues to assert idle when exit() is called.
@@ -69,6 +76,8 @@ atexit_handler(void)
       util_queue_kill_threads(iter, 0, false);
    }
    mtx_unlock(&exit_mutex);
+
+   util_queue_pool_exit();
 }
 
 static void
@@ -139,7 +148,12 @@ do_futex_fence_wait(struct util_queue_fence *fence,
 void
 _util_queue_fence_wait(struct util_queue_fence *fence)
 {
+   bool parked = util_queue_pool_park();
+
    do_futex_fence_wait(fence, false, 0);
+
+   if (parked)
+      util_queue_pool_unpark();
 }
 
 bool
@@ -164,10 +178,15 @@ util_queue_fence_signal(struct util_queue_fence *fence)
 void
 _util_queue_fence_wait(struct util_queue_fence *fence)
 {
+   bool parked = util_queue_pool_park();
+
    mtx_lock(&fence->mutex);
    while (!fence->signalled)
       cnd_wait(&fence->cond, &fence->mutex);
    mtx_unlock(&fence->mutex);
+
+   if (parked)
+      util_queue_pool_unpark();
 }
 
 bool
@@ -238,6 +257,531 @@ util_queue_fence_destroy(struct util_queue_fence *fence)
 }
 #endif
 
+/****************************************************************************
+ * Shared worker pools
+ *
+ * Queues created with UTIL_QUEUE_INIT_SHARED_THREADS don't have threads of
+ * their own.  Instead, a queue with pending jobs hands "tickets" to a pool
+ * of one worker per CPU, which is shared by all such queues of the process
+ * with the same priority.  A worker holding a ticket executes one job of the
+ * queue and then gives the ticket back, so that the queues take turns.
+ * A queue never has more tickets than threads, which bounds the number of
+ * its jobs running in parallel and lets every running job have its own
+ * thread index.
+ *
+ * There is one pool per priority.  The threads of the low priority pool
+ * run with the lowest OS priority, like the threads of queues created with
+ * UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, because Linux doesn't allow
+ * restoring the priority of a thread once it has been lowered.
+ *
+ * Every worker has a deque of tickets.  The tickets of jobs added by a
+ * worker of the same pool go to its own deque, the others to a global one.
+ * Workers take tickets from the back of their own deque and steal them
+ * from the front of the other ones.
+ *
+ * A worker waiting for a fence is parked, and its pool starts a spare
+ * thread if fewer than one thread per CPU are left to take tickets, because
+ * the job it waits for may need a thread to run.  Running other jobs on the
+ * waiting thread instead would deadlock on the locks the waiting job holds.
+ * Spare threads exit once the parked workers are back.
+ */
+
+#define UTIL_QUEUE_PRIORITY_LOW     0
+#define UTIL_QUEUE_PRIORITY_NORMAL  1
+#define UTIL_QUEUE_NUM_PRIORITIES   2
+
+/* The thread indices of running jobs are tracked in a 64-bit mask. */
+#define UTIL_QUEUE_MAX_SHARED_THREADS  64
+
+struct util_queue_deque {
+   simple_mtx_t lock;
+   struct util_queue **tickets; /* ring buffer */
+   unsigned head, count, size;
+};
+
+struct util_queue_worker {
+   thrd_t thread;
+   unsigned index;
+   struct util_queue_pool *pool;
+   struct util_queue_deque deque;
+
+   /* Spare threads use the global deque and are kept in a list, so that
+    * they can be joined once they have exited.
+    */
+   bool spare, exited;
+   struct util_queue_worker *next_spare;
+};
+
+struct util_queue_pool {
+   mtx_t lock;
+   cnd_t has_tickets_cond;
+   unsigned num_tickets; /* tickets in the deques not claimed by a worker */
+   bool shutdown;
+   unsigned priority;
+
+   unsigned num_workers;
+   unsigned num_threads; /* started workers */
+   /* num_workers + 1 entries, the last one only holds the global deque */
+   struct util_queue_worker *workers;
+
+   unsigned num_spares; /* running spare threads */
+   unsigned num_parked; /* threads waiting for a fence */
+   struct util_queue_worker *spares;
+
+   unsigned num_queues; /* protected by pool_mutex */
+};
+
+static struct util_queue_pool pools[UTIL_QUEUE_NUM_PRIORITIES];
+
+static mtx_t pool_mutex = _MTX_INITIALIZER_NP;
+static bool pool_exited;
+static once_flag pool_once_flag = ONCE_FLAG_INIT;
+static tss_t pool_worker_key;
+
+static void
+pool_global_init(void)
+{
+   tss_create(&pool_worker_key, NULL);
+}
+
+static struct util_queue_worker *
+pool_current_worker(void)
+{
+   call_once(&pool_once_flag, pool_global_init);
+   return (struct util_queue_worker *)tss_get(pool_worker_key);
+}
+
+static void
+deque_push_back(struct util_queue_deque *deque, struct util_queue *queue)
+{
+   simple_mtx_lock(&deque->lock);
+   if (deque->count == deque->size) {
+      unsigned new_size = MAX2(deque->size * 2, 16);
+      struct util_queue **tickets =
+         (struct util_queue **)malloc(new_size * sizeof(*tickets));
+      assert(tickets);
+
+      for (unsigned i = 0; i < deque->count; i++)
+         tickets[i] = deque->tickets[(deque->head + i) % deque->size];
+
+      free(deque->tickets);
+      deque->tickets = tickets;
+      deque->head = 0;
+      deque->size = new_size;
+   }
+
+   deque->tickets[(deque->head + deque->count) % deque->size] = queue;
+   deque->count++;
+   simple_mtx_unlock(&deque->lock);
+}
+
+static struct util_queue *
+deque_pop(struct util_queue_deque *deque, bool back)
+{
+   struct util_queue *queue = NULL;
+
+   simple_mtx_lock(&deque->lock);
+   if (deque->count) {
+      if (back) {
+         queue = deque->tickets[(deque->head + deque->count - 1) % deque->size];
+      } else {
+         queue = deque->tickets[deque->head];
+         deque->head = (deque->head + 1) % deque->size;
+      }
+      deque->count--;
+   }
+   simple_mtx_unlock(&deque->lock);
+
+   return queue;
+}
+
+static void
+pool_push_ticket(struct util_queue *queue)
+{
+   struct util_queue_pool *pool = &pools[queue->priority];
+   struct util_queue_worker *worker = pool_current_worker();
+
+   if (!worker || worker->spare || worker->pool != pool)
+      worker = &pool->workers[pool->num_workers];
+
+   deque_push_back(&worker->deque, queue);
+
+   mtx_lock(&pool->lock);
+   pool->num_tickets++;
+   cnd_signal(&pool->has_tickets_cond);
+   mtx_unlock(&pool->lock);
+}
+
+/* The caller must have claimed a ticket by decrementing num_tickets, which
+ * guarantees that one can be found.
+ */
+static struct util_queue *
+pool_take_ticket(struct util_queue_worker *self)
+{
+   struct util_queue_pool *pool = self->pool;
+   struct util_queue_worker *global = &pool->workers[pool->num_workers];
+   /* Spare threads have no deques and steal from every worker. */
+   struct util_queue_worker *own = self->spare ? global : self;
+   unsigned first_victim = self->spare ? 0 : 1;
+
+   while (1) {
+      struct util_queue *queue = deque_pop(&own->deque, true);
+
+      if (!queue && own != global)
+         queue = deque_pop(&global->deque, false);
+
+      for (unsigned i = first_victim; !queue && i < pool->num_workers; i++) {
+         struct util_queue_worker *victim =
+            &pool->workers[(self->index + i) % pool->num_workers];
+         queue = deque_pop(&victim->deque, false);
+      }
+
+      if (queue)
+         return queue;
+   }
+}
+
+static bool
+shared_queue_is_idle(struct util_queue *queue, uint64_t num_jobs)
+{
+   if (queue->num_started_jobs < num_jobs)
+      return false;
+
+   u_foreach_bit64(i, queue->busy_thread_mask) {
+      if (queue->running_job_idx[i] < num_jobs)
+         return false;
+   }
+   return true;
+}
+
+static void
+pool_run_ticket(struct util_queue *queue)
+{
+   struct util_queue_job job;
+   unsigned thread_index;
+
+   mtx_lock(&queue->lock);
+   if (!queue->num_threads || !queue->num_queued) {
+      queue->num_active--;
+      cnd_broadcast(&queue->idle_cond);
+      mtx_unlock(&queue->lock);
+      return;
+   }
+
+   job = queue->jobs[queue->read_idx];
+   memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
+   queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
+
+   queue->num_queued--;
+   cnd_signal(&queue->has_space_cond);
+   if (job.job)
+      queue->total_jobs_size -= job.job_size;
+
+   /* There are never more active tickets than threads. */
+   thread_index = ffsll(~queue->busy_thread_mask) - 1;
+   assert(thread_index < queue->max_threads);
+   queue->busy_thread_mask |= BITFIELD64_BIT(thread_index);
+   queue->running_job_idx[thread_index] = queue->num_started_jobs++;
+   mtx_unlock(&queue->lock);
+
+   if (job.job) {
+      job.execute(job.job, job.global_data, thread_index);
+      if (job.fence)
+         util_queue_fence_signal(job.fence);
+      if (job.cleanup)
+         job.cleanup(job.job, job.global_data, thread_index);
+   }
+
+   mtx_lock(&queue->lock);
+   queue->busy_thread_mask &= ~BITFIELD64_BIT(thread_index);
+
+   /* Give the ticket back, unless there is nothing left to do or the queue
+    * has been shrunk.
+    */
+   bool keep = queue->num_queued &&
+               queue->num_active <= queue->num_threads;
+   if (!keep)
+      queue->num_active--;
+   cnd_broadcast(&queue->idle_cond);
+   mtx_unlock(&queue->lock);
+
+   if (keep)
+      pool_push_ticket(queue);
+}
+
+/* Spare threads exit when there are more threads taking tickets than
+ * CPUs.  Must be called with the pool lock held.
+ */
+static bool
+pool_has_excess_threads(struct util_queue_pool *pool)
+{
+   return pool->num_threads + pool->num_spares - pool->num_parked >
+          pool->num_workers;
+}
+
+static int
+pool_worker_func(void *input);
+
+/* Must be called with the pool lock held. */
+static void
+pool_start_spare(struct util_queue_pool *pool)
+{
+   struct util_queue_worker *spare, **link;
+
+   /* Join the spare threads which have exited. */
+   for (link = &pool->spares; *link;) {
+      spare = *link;
+      if (spare->exited) {
+         thrd_join(spare->thread, NULL);
+         *link = spare->next_spare;
+         free(spare);
+      } else {
+         link = &spare->next_spare;
+      }
+   }
+
+   spare = (struct util_queue_worker *)calloc(1, sizeof(*spare));
+   if (!spare)
+      return;
+
+   spare->index = pool->num_workers;
+   spare->pool = pool;
+   spare->spare = true;
+   pool->num_spares++;
+
+   spare->thread = u_thread_create(pool_worker_func, spare);
+   if (!spare->thread) {
+      pool->num_spares--;
+      free(spare);
+      return;
+   }
+
+   spare->next_spare = pool->spares;
+   pool->spares = spare;
+}
+
+/* Called by every thread before it waits for a fence. */
+static bool
+util_queue_pool_park(void)
+{
+   struct util_queue_worker *worker = pool_current_worker();
+
+   if (!worker)
+      return false;
+
+   struct util_queue_pool *pool = worker->pool;
+
+   mtx_lock(&pool->lock);
+   pool->num_parked++;
+   if (pool->num_threads + pool->num_spares - pool->num_parked <
+       pool->num_workers)
+      pool_start_spare(pool);
+   mtx_unlock(&pool->lock);
+   return true;
+}
+
+static void
+util_queue_pool_unpark(void)
+{
+   struct util_queue_pool *pool = pool_current_worker()->pool;
+
+   mtx_lock(&pool->lock);
+   pool->num_parked--;
+   /* Let idle spare threads exit. */
+   if (pool->num_spares)
+      cnd_broadcast(&pool->has_tickets_cond);
+   mtx_unlock(&pool->lock);
+}
+
+static int
+pool_worker_func(void *input)
+{
+   struct util_queue_worker *worker = (struct util_queue_worker *)input;
+   struct util_queue_pool *pool = worker->pool;
+   bool low = pool->priority == UTIL_QUEUE_PRIORITY_LOW;
+   uint32_t mask[UTIL_MAX_CPUS / 32];
+   char name[16];
+
+   tss_set(pool_worker_key, worker);
+
+   /* Don't inherit the thread affinity of the thread creating the pool. */
+   memset(mask, 0xff, sizeof(mask));
+   util_set_current_thread_affinity(mask, NULL,
+                                    util_get_cpu_caps()->num_cpu_mask_bits);
+
+#if defined(__linux__)
+   if (low) {
+      /* Same as for the threads of UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY
+       * queues, see util_queue_create_thread.
+       */
+      setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#if defined(SCHED_BATCH)
+      struct sched_param sched_param = {0};
+      pthread_setschedparam(pthread_self(), SCHED_BATCH, &sched_param);
+#endif
+   }
+#endif
+
+   if (worker->spare)
+      snprintf(name, sizeof(name), low ? "mesa:lowspare" : "mesa:spare");
+   else
+      snprintf(name, sizeof(name), low ? "mesa:lowpool%u" : "mesa:pool%u",
+               worker->index);
+   u_thread_setname(name);
+
+   while (1) {
+      mtx_lock(&pool->lock);
+      while (!pool->num_tickets && !pool->shutdown &&
+             !(worker->spare && pool_has_excess_threads(pool)))
+         cnd_wait(&pool->has_tickets_cond, &pool->lock);
+
+      if (pool->shutdown ||
+          (worker->spare && pool_has_excess_threads(pool))) {
+         if (worker->spare) {
+            pool->num_spares--;
+            worker->exited = true;
+            /* Pass on a wakeup meant for a thread taking tickets. */
+            if (pool->num_tickets)
+               cnd_signal(&pool->has_tickets_cond);
+         }
+         mtx_unlock(&pool->lock);
+         break;
+      }
+      pool->num_tickets--;
+      mtx_unlock(&pool->lock);
+
+      pool_run_ticket(pool_take_ticket(worker));
+   }
+   return 0;
+}
+
+static void
+pool_stop(struct util_queue_pool *pool)
+{
+   if (!pool->workers)
+      return;
+
+   mtx_lock(&pool->lock);
+   pool->shutdown = true;
+   cnd_broadcast(&pool->has_tickets_cond);
+   mtx_unlock(&pool->lock);
+
+   for (unsigned i = 0; i < pool->num_threads; i++)
+      thrd_join(pool->workers[i].thread, NULL);
+
+   while (pool->spares) {
+      struct util_queue_worker *spare = pool->spares;
+
+      thrd_join(spare->thread, NULL);
+      pool->spares = spare->next_spare;
+      free(spare);
+   }
+   assert(!pool->num_spares && !pool->num_parked);
+
+   for (unsigned i = 0; i <= pool->num_workers; i++) {
+      assert(!pool->workers[i].deque.count);
+      simple_mtx_destroy(&pool->workers[i].deque.lock);
+      free(pool->workers[i].deque.tickets);
+   }
+
+   cnd_destroy(&pool->has_tickets_cond);
+   mtx_destroy(&pool->lock);
+   free(pool->workers);
+   pool->workers = NULL;
+   pool->num_workers = 0;
+   pool->num_threads = 0;
+}
+
+static bool
+pool_start(struct util_queue_pool *pool, unsigned priority)
+{
+   unsigned num_workers;
+
+   util_cpu_detect();
+   num_workers = MAX2(util_get_cpu_caps()->nr_cpus, 1);
+
+   pool->workers = (struct util_queue_worker *)
+      calloc(num_workers + 1, sizeof(struct util_queue_worker));
+   if (!pool->workers)
+      return false;
+
+   for (unsigned i = 0; i <= num_workers; i++) {
+      pool->workers[i].index = i;
+      pool->workers[i].pool = pool;
+      simple_mtx_init(&pool->workers[i].deque.lock, mtx_plain);
+   }
+
+   (void) mtx_init(&pool->lock, mtx_plain);
+   cnd_init(&pool->has_tickets_cond);
+   pool->num_tickets = 0;
+   pool->shutdown = false;
+   pool->priority = priority;
+
+   pool->num_workers = num_workers;
+
+   /* Workers whose thread failed to start just keep empty deques. */
+   for (pool->num_threads = 0; pool->num_threads < num_workers;
+        pool->num_threads++) {
+      struct util_queue_worker *worker = &pool->workers[pool->num_threads];
+
+      worker->thread = u_thread_create(pool_worker_func, worker);
+      if (!worker->thread)
+         break;
+   }
+
+   if (!pool->num_threads) {
+      pool_stop(pool);
+      return false;
+   }
+   return true;
+}
+
+static bool
+pool_ref(unsigned priority)
+{
+   struct util_queue_pool *pool = &pools[priority];
+   bool ret = true;
+   struct util_queue_worker *worker = pool_current_worker();
+   /* Threads inherit the OS priority of their creator, so the normal
+    * priority pool can't be started by a thread of the low priority one.
+    */
+   bool low_creator = worker &&
+                      worker->pool->priority == UTIL_QUEUE_PRIORITY_LOW;
+
+   mtx_lock(&pool_mutex);
+   if (!pool->workers) {
+      ret = !pool_exited &&
+            (priority == UTIL_QUEUE_PRIORITY_LOW || !low_creator) &&
+            pool_start(pool, priority);
+   }
+   if (ret)
+      pool->num_queues++;
+   mtx_unlock(&pool_mutex);
+   return ret;
+}
+
+static void
+pool_unref(unsigned priority)
+{
+   struct util_queue_pool *pool = &pools[priority];
+
+   mtx_lock(&pool_mutex);
+   assert(pool->num_queues);
+   if (--pool->num_queues == 0)
+      pool_stop(pool);
+   mtx_unlock(&pool_mutex);
+}
+
+static void
+util_queue_pool_exit(void)
+{
+   mtx_lock(&pool_mutex);
+   pool_exited = true;
+   for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES; p++)
+      pool_stop(&pools[p]);
+   mtx_unlock(&pool_mutex);
+}
+
 /****************************************************************************
  * util_queue implementation
  */
@@ -382,6 +926,24 @@ util_queue_adjust_num_threads(struct util_queue *queue, unsigned num_threads)
       return;
    }
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS) {
+      unsigned num_tickets = 0;
+
+      mtx_lock(&queue->lock);
+      queue->num_threads = num_threads;
+      while (queue->num_active < MIN2(queue->num_queued, num_threads)) {
+         queue->num_active++;
+         num_tickets++;
+      }
+      mtx_unlock(&queue->lock);
+
+      while (num_tickets--)
+         pool_push_ticket(queue);
+
+      simple_mtx_unlock(&queue->finish_lock);
+      return;
+   }
+
    if (num_threads < old_num_threads) {
       util_queue_kill_threads(queue, num_threads, true);
       simple_mtx_unlock(&queue->finish_lock);
@@ -439,6 +1001,15 @@ util_queue_init(struct util_queue *queue,
       snprintf(queue->name, sizeof(queue->name), "%s", name);
    }
 
+   queue->priority = (flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY) ?
+                     UTIL_QUEUE_PRIORITY_LOW : UTIL_QUEUE_PRIORITY_NORMAL;
+
+   /* Fall back to threads owned by the queue if the pool isn't usable. */
+   if ((flags & UTIL_QUEUE_INIT_SHARED_THREADS) &&
+       (num_threads > UTIL_QUEUE_MAX_SHARED_THREADS ||
+        !pool_ref(queue->priority)))
+      flags &= ~UTIL_QUEUE_INIT_SHARED_THREADS;
+
    queue->flags = flags;
    queue->max_threads = num_threads;
    queue->num_threads = (flags & UTIL_QUEUE_INIT_SCALE_THREADS) ? 1 : num_threads;
@@ -457,6 +1028,18 @@ util_queue_init(struct util_queue *queue,
    if (!queue->jobs)
       goto fail;
 
+   if (flags & UTIL_QUEUE_INIT_SHARED_THREADS) {
+      queue->running_job_idx = (uint64_t*)
+         calloc(queue->max_threads, sizeof(uint64_t));
+      if (!queue->running_job_idx)
+         goto fail;
+
+      cnd_init(&queue->idle_cond);
+
+      add_to_atexit_list(queue);
+      return true;
+   }
+
    queue->threads = (thrd_t*) calloc(queue->max_threads, sizeof(thrd_t));
    if (!queue->threads)
       goto fail;
@@ -481,6 +1064,11 @@ util_queue_init(struct util_queue *queue,
 fail:
    free(queue->threads);
 
+   if (flags & UTIL_QUEUE_INIT_SHARED_THREADS) {
+      free(queue->running_job_idx);
+      pool_unref(queue->priority);
+   }
+
    if (queue->jobs) {
       cnd_destroy(&queue->has_space_cond);
       cnd_destroy(&queue->has_queued_cond);
@@ -507,6 +1095,37 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
       return;
    }
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS) {
+      mtx_lock(&queue->lock);
+      queue->num_threads = keep_num_threads;
+
+      if (!keep_num_threads) {
+         /* Wait for the pool to return all tickets, then signal the
+          * remaining jobs like the last thread of a queue does.
+          */
+         while (queue->num_active)
+            cnd_wait(&queue->idle_cond, &queue->lock);
+
+         for (unsigned i = queue->read_idx; i != queue->write_idx;
+              i = (i + 1) % queue->max_jobs) {
+            if (queue->jobs[i].job) {
+               if (queue->jobs[i].fence)
+                  util_queue_fence_signal(queue->jobs[i].fence);
+               queue->jobs[i].job = NULL;
+            }
+         }
+         queue->read_idx = queue->write_idx;
+         queue->num_queued = 0;
+         cnd_broadcast(&queue->has_space_cond);
+         cnd_broadcast(&queue->idle_cond);
+      }
+      mtx_unlock(&queue->lock);
+
+      if (!finish_locked)
+         simple_mtx_unlock(&queue->finish_lock);
+      return;
+   }
+
    mtx_lock(&queue->lock);
    unsigned old_num_threads = queue->num_threads;
    /* Setting num_threads is what causes the threads to terminate.
@@ -540,6 +1159,12 @@ util_queue_destroy(struct util_queue *queue)
    if (queue->head.next != NULL)
       remove_from_atexit_list(queue);
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS) {
+      cnd_destroy(&queue->idle_cond);
+      free(queue->running_job_idx);
+      pool_unref(queue->priority);
+   }
+
    cnd_destroy(&queue->has_space_cond);
    cnd_destroy(&queue->has_queued_cond);
    simple_mtx_destroy(&queue->finish_lock);
@@ -580,8 +1205,13 @@ util_queue_add_job(struct util_queue *queue,
          util_queue_adjust_num_threads(queue, queue->num_threads + 1);
       }
 
-      if (queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL &&
-          queue->total_jobs_size + job_size < S_256MB) {
+      /* Workers of the pool can't wait for a free slot, because they might
+       * be the ones which have to execute the jobs of the queue.
+       */
+      if ((queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL &&
+           queue->total_jobs_size + job_size < S_256MB) ||
+          ((queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS) &&
+           pool_current_worker())) {
          /* If the queue is full, make it larger to avoid waiting for a free
           * slot.
           */
@@ -627,8 +1257,17 @@ util_queue_add_job(struct util_queue *queue,
    queue->total_jobs_size += ptr->job_size;
 
    queue->num_queued++;
+   queue->num_added_jobs++;
    cnd_signal(&queue->has_queued_cond);
+
+   bool push_ticket = (queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS) &&
+                      queue->num_active < queue->num_threads;
+   if (push_ticket)
+      queue->num_active++;
    mtx_unlock(&queue->lock);
+
+   if (push_ticket)
+      pool_push_ticket(queue);
 }
 
 /**
@@ -679,6 +1318,31 @@ util_queue_finish(struct util_queue *queue)
    util_barrier barrier;
    struct util_queue_fence *fences;
 
+   /* Jobs of shared queues may not all be able to run at the same time, so
+    * wait for the ones started before the last added job instead of using a
+    * barrier.  This doesn't add jobs, so finish_lock isn't needed, and
+    * waiting for it on a pool thread without parking could deadlock.
+    */
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS) {
+      mtx_lock(&queue->lock);
+      uint64_t num_jobs = queue->num_added_jobs;
+      bool parked = false;
+
+      /* Like fence waits, waiting on a pool thread must let the pool start
+       * a spare thread for the jobs waited for.
+       */
+      if (!shared_queue_is_idle(queue, num_jobs))
+         parked = util_queue_pool_park();
+
+      while (queue->num_threads && !shared_queue_is_idle(queue, num_jobs))
+         cnd_wait(&queue->idle_cond, &queue->lock);
+      mtx_unlock(&queue->lock);
+
+      if (parked)
+         util_queue_pool_unpark();
+      return;
+   }
+
    /* If 2 threads were adding jobs for 2 different barries at the same time,
     * a deadlock would happen, because 1 barrier requires that all threads
     * wait for it exclusively.
@@ -713,7 +1377,8 @@ int64_t
 util_queue_get_thread_time_nano(struct util_queue *queue, unsigned thread_index)
 {
    /* Allow some flexibility by not raising an error. */
-   if (thread_index >= queue->num_threads)
+   if (thread_index >= queue->num_threads ||
+       (queue->flags & UTIL_QUEUE_INIT_SHARED_THREADS))
       return 0;
 
    return util_thread_get_time_nano(queue->threads[thread_index]);
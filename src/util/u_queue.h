@@ -51,6 +51,13 @@ extern "C" {
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
 #define UTIL_QUEUE_INIT_SCALE_THREADS             (1 << 3)
+/* Execute the jobs on a process-wide worker pool instead of threads owned
+ * by the queue.  The queue's thread count only limits how many of its jobs
+ * run in parallel, and jobs are not executed in order even with a single
+ * thread.  Queues using UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY share a
+ * separate pool whose threads have the minimum OS priority.
+ */
+#define UTIL_QUEUE_INIT_SHARED_THREADS            (1 << 4)
 
 #if UTIL_FUTEX_SUPPORTED
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -220,6 +227,14 @@ struct util_queue {
    struct util_queue_job *jobs;
    void *global_data;
 
+   /* for UTIL_QUEUE_INIT_SHARED_THREADS, protected by lock */
+   cnd_t idle_cond;
+   unsigned priority;
+   unsigned num_active;       /* tickets held by the worker pool */
+   uint64_t busy_thread_mask; /* thread indices of running jobs */
+   uint64_t *running_job_idx; /* per thread index */
+   uint64_t num_added_jobs, num_started_jobs;
+
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
 };
@@ -258,7 +273,7 @@ int64_t util_queue_get_thread_time_nano(struct util_queue *queue,
 static inline bool
 util_queue_is_initialized(struct util_queue *queue)
 {
-   return queue->threads != NULL;
+   return queue->jobs != NULL;
 }
 
 /* Convenient structure for monitoring the queue externally and passing
@@ -58,9 +58,17 @@ TEMPLATE_H = Template(COPYRIGHT + """\
 extern "C" {
 #endif
 
+struct vk_cmd_queue_chunk;
+
 struct vk_cmd_queue {
    VkAllocationCallbacks *alloc;
    struct list_head cmds;
+
+   /* Arena the commands and all their data are allocated from.  The chunks
+    * are kept across vk_cmd_queue_reset() and only freed by vk_free_queue().
+    */
+   struct list_head chunks;
+   struct vk_cmd_queue_chunk *chunk;
 };
 
 enum vk_cmd_type {
@@ -132,6 +140,12 @@ struct vk_cmd_queue_entry {
 
 % endfor
 
+void vk_cmd_queue_init(struct vk_cmd_queue *queue, VkAllocationCallbacks *alloc);
+
+void *vk_cmd_queue_zalloc(struct vk_cmd_queue *queue, size_t size);
+
+void vk_cmd_queue_reset(struct vk_cmd_queue *queue);
+
 void vk_free_queue(struct vk_cmd_queue *queue);
 
 #ifdef __cplusplus
@@ -148,6 +162,83 @@ TEMPLATE_C = Template(COPYRIGHT + """
 #include <vulkan/vulkan.h>
 
 #include "vk_alloc.h"
+#include "util/macros.h"
+
+/* Size of the first chunk, later ones grow up to VK_CMD_QUEUE_MAX_CHUNK_SIZE */
+#define VK_CMD_QUEUE_MIN_CHUNK_SIZE (4 * 1024)
+#define VK_CMD_QUEUE_MAX_CHUNK_SIZE (1024 * 1024)
+
+struct vk_cmd_queue_chunk {
+   struct list_head link;
+   size_t size;
+   size_t offset;
+   uint64_t data[0];
+};
+
+void
+vk_cmd_queue_init(struct vk_cmd_queue *queue, VkAllocationCallbacks *alloc)
+{
+   queue->alloc = alloc;
+   list_inithead(&queue->cmds);
+   list_inithead(&queue->chunks);
+   queue->chunk = NULL;
+}
+
+/**
+ * Allocate zeroed, 8-byte aligned memory that lives until the queue is
+ * reset or freed.
+ */
+void *
+vk_cmd_queue_zalloc(struct vk_cmd_queue *queue, size_t size)
+{
+   struct vk_cmd_queue_chunk *chunk = queue->chunk;
+
+   size = ALIGN_POT(size, 8);
+
+   if (!chunk || chunk->offset + size > chunk->size) {
+      struct list_head *next = chunk ? chunk->link.next : queue->chunks.next;
+      struct vk_cmd_queue_chunk *next_chunk =
+         LIST_ENTRY(struct vk_cmd_queue_chunk, next, link);
+
+      if (next != &queue->chunks && next_chunk->size >= size) {
+         /* Reuse a chunk kept from before the last reset */
+         chunk = next_chunk;
+      } else {
+         size_t chunk_size = chunk ? MIN2(chunk->size * 2, VK_CMD_QUEUE_MAX_CHUNK_SIZE) :
+                                     VK_CMD_QUEUE_MIN_CHUNK_SIZE;
+         chunk_size = MAX2(chunk_size, size);
+
+         struct vk_cmd_queue_chunk *new_chunk =
+            vk_alloc(queue->alloc, sizeof(*new_chunk) + chunk_size, 8,
+                     VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+         if (!new_chunk)
+            return NULL;
+
+         new_chunk->size = chunk_size;
+         list_add(&new_chunk->link, chunk ? &chunk->link : &queue->chunks);
+         chunk = new_chunk;
+      }
+
+      chunk->offset = 0;
+      queue->chunk = chunk;
+   }
+
+   void *ptr = (char *)chunk->data + chunk->offset;
+   chunk->offset += size;
+   memset(ptr, 0, size);
+
+   return ptr;
+}
+
+/**
+ * Drop all the commands but keep the memory around for recording new ones.
+ */
+void
+vk_cmd_queue_reset(struct vk_cmd_queue *queue)
+{
+   list_inithead(&queue->cmds);
+   queue->chunk = NULL;
+}
 
 const char *vk_cmd_queue_type_names[] = {
 % for c in commands:
@@ -174,9 +265,7 @@ void vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 % endfor
 )
 {
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(queue->alloc,
-                                              sizeof(*cmd), 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(queue, sizeof(*cmd));
    if (!cmd)
       return;
 
@@ -209,30 +298,11 @@ void vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 void
 vk_free_queue(struct vk_cmd_queue *queue)
 {
-   struct vk_cmd_queue_entry *tmp, *cmd;
-   LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &queue->cmds, cmd_link) {
-      switch(cmd->type) {
-% for c in commands:
-% if c.guard is not None:
-#ifdef ${c.guard}
-% endif
-      case ${to_enum_name(c.name)}:
-         vk_free(queue->alloc, cmd->driver_data);
-% for p in c.params[1:]:
-% if p.len:
-         vk_free(queue->alloc, (${remove_suffix(p.decl.replace("const", ""), p.name)})cmd->u.${to_struct_field_name(c.name)}.${to_field_name(p.name)});
-% elif '*' in p.decl:
-         ${get_struct_free(c, p, types)}
-% endif
-% endfor
-         break;
-% if c.guard is not None:
-#endif // ${c.guard}
-% endif
-% endfor
-      }
-      vk_free(queue->alloc, cmd);
-   }
+   list_for_each_entry_safe(struct vk_cmd_queue_chunk, chunk,
+                            &queue->chunks, link)
+      vk_free(queue->alloc, chunk);
+
+   vk_cmd_queue_init(queue, queue->alloc);
 }
 
 """, output_encoding='utf-8')
@@ -276,7 +346,7 @@ def get_array_copy(command, param):
         field_size = "1"
     else:
         field_size = "sizeof(*%s)" % field_name
-    allocation = "%s = vk_zalloc(queue->alloc, %s * %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);" % (field_name, field_size, param.len)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s * %s);" % (field_name, field_size, param.len)
     const_cast = remove_suffix(param.decl.replace("const", ""), param.name)
     copy = "memcpy((%s)%s, %s, %s * %s);" % (const_cast, field_name, param.name, field_size, param.len)
     return "%s\n   %s" % (allocation, copy)
@@ -284,7 +354,7 @@ def get_array_copy(command, param):
 def get_array_member_copy(struct, src_name, member):
     field_name = "%s->%s" % (struct, member.name)
     len_field_name = "%s->%s" % (struct, member.len)
-    allocation = "%s = vk_zalloc(queue->alloc, sizeof(*%s) * %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);" % (field_name, field_name, len_field_name)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, sizeof(*%s) * %s);" % (field_name, field_name, len_field_name)
     const_cast = remove_suffix(member.decl.replace("const", ""), member.name)
     copy = "memcpy((%s)%s, %s->%s, sizeof(*%s) * %s);" % (const_cast, field_name, src_name, member.name, field_name, len_field_name)
     return "%s\n   %s\n" % (allocation, copy)
@@ -314,7 +384,7 @@ def get_struct_copy(dst, src_name, src_type, size, types, level=0):
     global tmp_dst_idx
     global tmp_src_idx
 
-    allocation = "%s = vk_zalloc(queue->alloc, %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);" % (dst, size)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s);" % (dst, size)
     copy = "memcpy((void*)%s, %s, %s);" % (dst, src_name, size)
 
     level += 1
@@ -333,19 +403,6 @@ def get_struct_copy(dst, src_name, src_type, size, types, level=0):
     if_stmt = "if (%s) {" % src_name
     return "%s\n      %s\n      %s\n   %s\n   %s   \n   %s   } else {\n      %s\n   }" % (if_stmt, allocation, copy, tmp_dst, tmp_src, member_copies, null_assignment)
 
-def get_struct_free(command, param, types):
-    field_name = "cmd->u.%s.%s" % (to_struct_field_name(command.name), to_field_name(param.name))
-    const_cast = remove_suffix(param.decl.replace("const", ""), param.name)
-    struct_free = "vk_free(queue->alloc, (%s)%s);" % (const_cast, field_name)
-    member_frees = ""
-    if (param.type in types):
-        for member in types[param.type].members:
-            if member.len and member.len != 'null-terminated':
-                member_name = "cmd->u.%s.%s->%s" % (to_struct_field_name(command.name), to_field_name(param.name), member.name)
-                const_cast = remove_suffix(member.decl.replace("const", ""), member.name)
-                member_frees += "vk_free(queue->alloc, (%s)%s);\n" % (const_cast, member_name)
-    return "%s      %s\n" % (member_frees, struct_free)
-
 EntrypointType = namedtuple('EntrypointType', 'name enum members extended_by')
 
 def get_types(doc):
@@ -419,7 +476,6 @@ def main():
         'to_struct_name': to_struct_name,
         'get_array_copy': get_array_copy,
         'get_struct_copy': get_struct_copy,
-        'get_struct_free': get_struct_free,
         'types': types,
         'manual_commands': MANUAL_COMMANDS,
         'remove_suffix': remove_suffix,